@@ -24,7 +24,9 @@
  * the caller does not care or is not intending to provision any SIM specific
  * settings he can simply pass an empty string.  Provman will
  * then associate any SIM specific settings with the SIM card of the first
- * modem it discovers in the device.
+ * modem it discovers in the device.  Passing "*" starts a multi-SIM session
+ * in which the SIM specific settings of every SIM card are available under
+ * /telephony/sims/\<IMSI\>/.
  *
  * \exception com.intel.provman.Error.Unexpected A call to #Start is
  *   outstanding or has completed and a device management session is already
@@ -464,3 +466,113 @@ array GetAllMeta(string key);
 */
 
 string GetVersion();
+
+/*!
+ * \brief Returns latency statistics for each of provman's D-Bus methods
+ *
+ * This function can be called outside a management session.  Unlike the
+ * other methods it is not queued behind any pending commands, so it can be
+ * used to monitor provman while a long running command is in progress.
+ *
+ * For each method that has been invoked at least once since provman
+ * started, the returned dictionary contains a dictionary of counters
+ * with the following keys: calls, errors, wait-p50, wait-p90, wait-p99,
+ * wait-max, service-p50, service-p90, service-p99 and service-max.  The
+ * wait values measure the time a command spent in provman's queue before
+ * it was executed and the service values the time taken to execute it.
+ * All times are in microseconds and the percentiles are accurate to
+ * within 12.5%.
+ *
+ * The same statistics can be written to syslog by sending provman the
+ * SIGUSR1 signal.
+ *
+ * @return A dictionary of type \a a{sa{st}}, indexed by method name.
+*/
+
+dictionary GetStatistics();
+
+/*!
+ * \brief Switches the recording of a trace of provman's activity on or off
+ *
+ * This function can be called outside a management session and, like
+ * #GetStatistics, is executed straight away.
+ *
+ * While tracing is switched on provman records the time each command
+ * spends queued and executing, the time taken by each plugin to
+ * synchronise its settings and the time taken by each call a plugin makes
+ * to its middleware.  The trace is written in the Chrome trace event
+ * format and can be viewed by loading it into chrome://tracing.  It is
+ * written to the file named by the PROVMAN_TRACE environment variable, if
+ * set, and to trace.json in provman's data directory otherwise, i.e.,
+ * ~/.config/provman for the session daemon and /var/lib/provman for the
+ * system daemon.  The file is only readable by the user provman runs as.
+ * It is complete once tracing has been switched off or provman has
+ * exited.  Switching tracing on again replaces the previous trace.
+ *
+ * Tracing can also be switched on when provman starts by setting the
+ * PROVMAN_TRACE environment variable.  On the system bus only root may
+ * call this method.
+ *
+ * @param enabled TRUE to start tracing, FALSE to stop.
+ *
+ * \exception com.intel.provman.Error.Unknown The trace file could not be
+ *   opened.
+ * \exception com.intel.provman.Error.Denied The caller is not root and
+ *   provman is running on the system bus.
+*/
+
+void SetTracing(boolean enabled);
+
+/*!
+ * \brief Switches the capture of incoming method calls on or off
+ *
+ * This function can be called outside a management session and, like
+ * #GetStatistics, is executed straight away.
+ *
+ * While capture is switched on provman records every method call it
+ * receives, together with its parameters, the client that made it, the
+ * time at which it arrived and the reply that was eventually sent, in a
+ * compact binary file.  The file can be replayed with the provman-replay
+ * tool, against a daemon or against an in-process plugin manager, at the
+ * recorded speed or faster.  Passwords are not recorded: the value of any
+ * key whose last segment is password is replaced, both in the parameters
+ * of Set and SetMultiple and in the replies to Get, GetMultiple and
+ * GetAll.
+ *
+ * The capture is written to the file named by the PROVMAN_CAPTURE
+ * environment variable, if set, and to capture.pmcap in provman's data
+ * directory otherwise.  The file is created afresh, readable only by the
+ * user provman runs as, each time capture is switched on.
+ *
+ * Capture can also be switched on when provman starts by setting the
+ * PROVMAN_CAPTURE environment variable.  On the system bus only root may
+ * call this method.
+ *
+ * @param enabled TRUE to start capturing calls, FALSE to stop.
+ *
+ * \exception com.intel.provman.Error.Unknown The capture file could not
+ *   be opened.
+ * \exception com.intel.provman.Error.Denied The caller is not root and
+ *   provman is running on the system bus.
+*/
+
+void SetCapture(boolean enabled);
+
+/*!
+ * \brief Sets the level of detail written to provman's log file
+ *
+ * This function can be called outside a management session and, like
+ * #GetStatistics, is executed straight away.  It has no effect unless
+ * provman was configured with --enable-logging.
+ *
+ * @param level 0 to disable logging, 1 to log errors only, 2 to also
+ *   log the start and end of sessions and 3 to log everything.
+ *
+ * On the system bus only root may call this method.
+ *
+ * \exception com.intel.provman.Error.BadArgs level is greater than 3.
+ * \exception com.intel.provman.Error.Denied The caller is not root and
+ *   provman is running on the system bus.
+*/
+
+void SetLogLevel(uint32 level);
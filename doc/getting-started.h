@@ -82,6 +82,10 @@
  *
  * It's best to compile with debugging and logging for the time being as there
  * are likely to be lots of bugs.  The log file is stored in /tmp/provman.log.
+ * By default everything is logged.  The amount of detail can be reduced by
+ * setting the PROVMAN_LOG_LEVEL environment variable to error, info or
+ * debug, or none to disable logging, or at runtime using the #SetLogLevel
+ * D-Bus method.
  *
  * @section phonesim Enabling Phonesim modem
  *
@@ -134,5 +138,69 @@
  * \endcode
  * A list of all the manageable system settings should be output to the console.
  *
+ * @section bench Benchmarking
+ *
+ * When provman is configured with --with-test=test a benchmark,
+ * provman-bench, is built along with the daemons.  It drives the plugin
+ * manager directly, without D-Bus, using the test plugin, and reports the
+ * throughput and latency percentiles of each command.  The number of
+ * contexts, keys per context, Gets and iterations can be set on the
+ * command line, e.g.,
+ * \code
+ * ./provman-bench --contexts=1000 --keys=100 --iterations=5
+ * \endcode
+ *
+ * provman can also be configured with --enable-synthetic-plugin.  This
+ * adds a plugin to the session daemon and to provman-bench that simulates a
+ * middleware containing a large number of accounts, registered under up to
+ * four roots, /applications/synthetic0/ to /applications/synthetic3/.  The
+ * number of accounts, properties and roots, and the latency and jitter of
+ * its sync_in and sync_out, are set using environment variables described
+ * in plugins/synthetic.c.  For example,
+ * \code
+ * PROVMAN_SYNTHETIC_ACCOUNTS=1000 PROVMAN_SYNTHETIC_PROPERTIES=100 \
+ * PROVMAN_SYNTHETIC_ROOTS=4 PROVMAN_SYNTHETIC_SYNC_IN_MS=200 \
+ * ./provman-bench --sync-all
+ * \endcode
+ *
+ * A second tool, provman-microbench, is built alongside provman-bench.  It
+ * times the cache, the schema lookups, the plugin routing functions, the
+ * key utilities and the map file in isolation and reports, for each
+ * function, the time and the number of allocations per operation, and the
+ * peak RSS of the process.  It accepts the same --contexts, --keys and
+ * --iterations options as provman-bench.  Allocations are only counted when
+ * provman is built against a version of GLib older than 2.46.
+ *
+ * provman-load measures the daemon itself, including D-Bus and the
+ * scheduling of concurrent clients.  It replays the calls made by the
+ * scripts in testcases/ from many client connections at once.  Unless
+ * --address is given it starts a private dbus-daemon and runs the daemon
+ * named by --daemon on it.  Arguments for a script follow its name,
+ * separated by colons.  For example,
+ * \code
+ * ./provman-load --daemon=./provman-session --clients=20 --sessions=1000 \
+ *     --rate=50 ../testcases/set-multiple ../testcases/get-all-session:/
+ * \endcode
+ * reports session throughput together with the latency percentiles of
+ * whole sessions, the time clients spend queued waiting for Start to
+ * return, and the time from Start to the first reply.
+ *
+ * Sessions seen on a real device can be captured with the #SetCapture
+ * D-Bus method, or by starting provman with PROVMAN_CAPTURE set to the
+ * name of a capture file, and replayed with provman-replay.  By default
+ * the calls are sent to provman on the session bus at the times they were
+ * recorded.  --speed replays them faster, --speed=0 as fast as possible,
+ * and --in-process issues them directly to a plugin manager that contains
+ * the test plugin, e.g.,
+ * \code
+ * ./provman-replay --in-process --speed=0 ~/.config/provman/capture.pmcap
+ * \endcode
+ * The latency of each method is reported alongside the latency recorded in
+ * the capture.
+ *
+ * make check builds and runs provman-store-check, which damages a store
+ * file in the ways a crash would, by truncating its log or corrupting a
+ * batch, and verifies what is recovered when the store is reopened.
+ *
  ******************************************************************************/
 
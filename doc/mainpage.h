@@ -142,7 +142,16 @@
  * planning to access or manipulate any SIM specific settings it can simply
  * pass an empty string to the #Start method.  Provman will then associate
  * any SIM specific settings with the SIM card of the first modem detetected
- * in the device.
+ * in the device.  A client that wishes to provision every SIM card in the
+ * device in a single session can pass "*" to the #Start method instead.
+ * The SIM specific settings of each SIM card then appear under
+ * /telephony/sims/\<IMSI\>/, laid out as they are under /telephony/ in
+ * a session for a single SIM card.  Meta data is shared between the two
+ * kinds of session: meta data associated with
+ * /telephony/sims/\<IMSI\>/contexts/a in a multi-SIM session is the meta
+ * data of /telephony/contexts/a in a session for that SIM card, and vice
+ * versa.  The meta data of the settings that are not SIM specific, such as
+ * /telephony/imsis, is kept separately for multi-SIM sessions.
  *
  * Provman has support for introspection.  The methods #GetTypeInfo and
  * #GetChildrenTypeInfo allow clients to identify the settings that are
@@ -189,6 +198,10 @@
  * <tr><td>#SetMeta</td><td>\copybrief SetMeta</td></tr>
  * <tr><td>#GetAllMeta</td><td>\copybrief GetAllMeta</td></tr>
  * <tr><td>#SetMultipleMeta</td><td>\copybrief SetMultipleMeta</td></tr>
+ * <tr><td>#GetStatistics</td><td>\copybrief GetStatistics</td></tr>
+ * <tr><td>#SetTracing</td><td>\copybrief SetTracing</td></tr>
+ * <tr><td>#SetCapture</td><td>\copybrief SetCapture</td></tr>
+ * <tr><td>#SetLogLevel</td><td>\copybrief SetLogLevel</td></tr>
  * </table>
  *
  * A simple python script demonstrating how these methods can be used is shown
@@ -587,6 +600,12 @@ manager.End()
  *  number listed is the default IMSI number, i.e., the number used if a session
  *  is started by passing an empty string to Start</td>
  *  <td>A comma separated list of imsi numbers</td></tr>
+ * <tr><td colspan="3" align="center"><i>Settings for multi-SIM sessions
+ *   stored under /telephony/sims/\<IMSI\>/</i></td></tr>
+ * <tr><td>contexts, mms</td><td>Only present in sessions started by passing
+ *  "*" to Start.  The 3G and MMS contexts of the SIM card with the given IMSI
+ *  number, with the same settings as /telephony/contexts and
+ *  /telephony/mms</td><td>See above</td></tr>
  * </td></tr>
  * </table>
  *
@@ -38,29 +38,70 @@ extern "C"
 {
 #endif
 
-/* TODO: Not thread safe */
+/*
+ * Messages are formatted by the calling thread into a lock free ring
+ * buffer and written to the log file by a background thread, so the
+ * logging functions may be called from any thread and never block on
+ * I/O.  If the ring buffer fills up new messages are dropped and the
+ * number dropped is recorded in the log.  Each message, including the
+ * file name and line number prefix, is truncated to 511 bytes
+ * (PROVMAN_LOG_MESSAGE_SIZE in log.c, less the terminating NUL).
+ *
+ * Each message has a level.  Messages above the current level are
+ * discarded before they are formatted.  The level defaults to
+ * PROVMAN_LOG_LEVEL_DEBUG, can be set at startup via the
+ * PROVMAN_LOG_LEVEL environment variable, which takes a level name
+ * or number, and can be changed at runtime via provman_log_set_level.
+ * PROVMAN_LOG, PROVMAN_LOGF, PROVMAN_LOGU and PROVMAN_LOGUF log at
+ * PROVMAN_LOG_LEVEL_DEBUG.
+ */
+
+enum provman_log_level_t_ {
+	PROVMAN_LOG_LEVEL_NONE,
+	PROVMAN_LOG_LEVEL_ERROR,
+	PROVMAN_LOG_LEVEL_INFO,
+	PROVMAN_LOG_LEVEL_DEBUG
+};
+typedef enum provman_log_level_t_ provman_log_level_t;
+
+extern int g_provman_log_level;
 
 int provman_log_open(const char *log_file_name);
 void provman_log_printf(unsigned int line_number, const char *file_name,
 				const char *message, ...);
 void provman_logu_printf(const char *message, ...);
+void provman_log_set_level(provman_log_level_t level);
 void provman_log_close(void);
 
 #ifdef PROVMAN_LOGGING
-	#define PROVMAN_LOGF(message, ...) provman_log_printf(__LINE__, \
-			__FILE__, message, __VA_ARGS__)
-	#define PROVMAN_LOG(message) provman_log_printf(__LINE__, __FILE__, \
-			message)
-	#define PROVMAN_LOGUF(message, ...) provman_logu_printf(message, \
-			__VA_ARGS__)
-	#define PROVMAN_LOGU(message) provman_logu_printf(message)
+	#define PROVMAN_LOGLF(level, message, ...) do {			\
+		if (g_provman_log_level >= (level))			\
+			provman_log_printf(__LINE__, __FILE__, message,	\
+					   __VA_ARGS__);		\
+	} while (0)
+	#define PROVMAN_LOGL(level, message) do {			\
+		if (g_provman_log_level >= (level))			\
+			provman_log_printf(__LINE__, __FILE__, message);\
+	} while (0)
+	#define PROVMAN_LOGUF(message, ...) do {			\
+		if (g_provman_log_level >= PROVMAN_LOG_LEVEL_DEBUG)	\
+			provman_logu_printf(message, __VA_ARGS__);	\
+	} while (0)
+	#define PROVMAN_LOGU(message) do {				\
+		if (g_provman_log_level >= PROVMAN_LOG_LEVEL_DEBUG)	\
+			provman_logu_printf(message);			\
+	} while (0)
 #else
-	#define PROVMAN_LOGF(message, ...)
-	#define PROVMAN_LOG(message)
+	#define PROVMAN_LOGLF(level, message, ...)
+	#define PROVMAN_LOGL(level, message)
 	#define PROVMAN_LOGUF(message, ...)
 	#define PROVMAN_LOGU(message)
 #endif
 
+#define PROVMAN_LOGF(message, ...) \
+	PROVMAN_LOGLF(PROVMAN_LOG_LEVEL_DEBUG, message, __VA_ARGS__)
+#define PROVMAN_LOG(message) PROVMAN_LOGL(PROVMAN_LOG_LEVEL_DEBUG, message)
+
 #ifdef __cplusplus
 }
 #endif
@@ -51,8 +51,14 @@
  * defined by the middleware.  This file contains functions that help plugins
  * maintain this mapping.
  *
- * The mapping is stored in a GKeyFile.  Separate mappings are maintained for
- * each imsi number.  An example mapping file is shown below:
+ * Separate mappings are maintained for each imsi number.  The mappings are
+ * kept in the provman store, see store.h, so lookups in either direction
+ * do not require any file to be parsed.  Changes are committed to the
+ * store when provman_map_file_save is called.
+ *
+ * Earlier versions of provman stored the mappings in a GKeyFile.  These
+ * files are migrated to the store the first time they are opened.
+ * An example of such a file is shown below:
  * \code
  * [246813579]
  * context1=/phonesim/context1
@@ -76,7 +82,12 @@ typedef struct provman_map_file_t_ provman_map_file_t;
  * The provman_map_file_t object should be deleted by calling
  * provman_map_file_delete when it is no longer needed.
  *
- * @param fname the path of the mapping file.
+ * @param fname the path of the mapping file, e.g., the path returned by
+ *   provman_utils_make_file_path for "ofono-mapfile.ini".  The mappings are
+ *   stored in the provman store located in the same directory, in a
+ *   namespace named after the file, without its .ini suffix.  If fname
+ *   exists it is assumed to be a map file written by an earlier version of
+ *   provman.  Its contents are migrated to the store and it is deleted.
  * @param map_file returns a pointer to the new map file on exit.
  */
 
@@ -94,6 +105,11 @@ void provman_map_file_new(const char *fname, provman_map_file_t **map_file);
 void provman_map_file_delete(provman_map_file_t *map_file);
 
 /*! @brief Saves the provman_map_file_t object to disk
+ *
+ * This commits all the pending modifications in the provman store,
+ * including those not made through this map file.  The modifications are
+ * written in the background.  This function does not wait for them to
+ * reach the disk.
  *
  * @param map_file pointer to a map_file
  */
@@ -197,11 +213,16 @@ gchar* provman_map_file_find_plugin_id(provman_map_file_t *map_file,
  *   hash table should probably be created as follows,
  *   g_hash_table_new(g_str_hash, g_str_equal)
  *   assuming that the hashtable does not own any of the plugin ids it stores.
+ *
+ * The mappings of the imsi are enumerated once and each stale mapping is
+ * removed directly, so the cost is linear in the number of mappings.
+ *
+ * @return the number of mappings that were removed.
  */
 
-void provman_map_file_remove_unused(provman_map_file_t *map_file,
-				    const gchar *imsi,
-				    GHashTable *used_plugin_ids);
+unsigned int provman_map_file_remove_unused(provman_map_file_t *map_file,
+					    const gchar *imsi,
+					    GHashTable *used_plugin_ids);
 
 #endif
 
@@ -41,6 +41,16 @@
 
 typedef void *provman_plugin_instance;
 
+/*!
+ * @brief Special IMSI value that requests a multi-SIM session.
+ *
+ * When a client passes this value to #Start, plugins that support SIM
+ * specific settings expose the settings of every SIM card in the device
+ * in a single session, each under a subtree named after its IMSI number.
+ */
+
+#define PROVMAN_IMSI_ALL "*"
+
 /*!
  * @brief Typedef for the callback function that plugins invoke when they
  *        want to complete a call to #provman_plugin_sync_in.
@@ -130,7 +140,13 @@ typedef void (*provman_plugin_delete)(provman_plugin_instance instance);
  *        modem.  If this paramater is set to "" and the plugin supports SIM
  *        specific settings it must associate all settings in
  *        the management session with the SIM card of the first modem
- *        discovered in the device.
+ *        discovered in the device.  A value of #PROVMAN_IMSI_ALL requests
+ *        the settings of every SIM card.  Plugins that support it must
+ *        place each SIM's settings under sims/<IMSI>/ beneath their root,
+ *        laid out as they are in a session for that SIM alone, and return
+ *        #PROVMAN_IMSI_ALL from #provman_plugin_sim_id.  Provman keeps the
+ *        meta data of these settings with that of the SIM, so both kinds
+ *        of session share it.
  * @param callback A function pointer that must be invoked by the plugin when
  *        it has completed the #provman_plugin_sync_in task.  If the plugin
  *        returns PROVMAN_ERR_NONE for the call to #provman_plugin_sync_in it
@@ -311,8 +327,27 @@ struct provman_plugin_
 	provman_plugin_sim_id sim_id_fn;
 };
 
+/*! \brief Name of the symbol exported by loadable plugin modules.
+ *
+ * When provman is configured with --enable-plugin-modules, plugins can
+ * also be built as loadable modules.  Such a plugin is described by a
+ * small manifest, a key file with a .plugin extension installed in
+ * $(pkglibdir)/session or $(pkglibdir)/system, containing a [Plugin] group
+ * with the keys Name, Root and Module.  Provman reads the manifests when it
+ * starts but only opens the module the first time a key under Root is
+ * accessed.  The module must export a function with this name, taking no
+ * arguments and returning a pointer to a statically allocated
+ * #provman_plugin structure whose root matches the Root key of the
+ * manifest.
+ */
+#define PROVMAN_PLUGIN_MODULE_SYMBOL "provman_plugin_module_get"
+
 /*! \cond */
 
+int provman_plugin_load_manifests(bool system);
+void provman_plugin_unload_modules();
+bool provman_plugin_is_module(unsigned int i);
+int provman_plugin_load(unsigned int i);
 int provman_plugin_check();
 unsigned int provman_plugin_get_count();
 const provman_plugin *provman_plugin_get(unsigned int i);
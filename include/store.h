@@ -0,0 +1,220 @@
+/*
+ * Provman
+ *
+ * Copyright (C) 2011 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+/*!
+ * @file store.h
+ *
+ * @brief Contains function declarations for the provman store, an embedded
+ *        key value store in which provman and its plugins keep their
+ *        persistent state.
+ *
+ * Each instance of provman, session or system, has a single store file.
+ * The store is divided into namespaces.  Each namespace is a separate
+ * mapping of string keys to string values, identified by a name, e.g.,
+ * \a ofono-mapfile.  Namespaces are created implicitly when the first key is
+ * stored in them.  Plugins that need to persist state should choose a
+ * namespace name that begins with their own name.
+ *
+ * Modifications made by #provman_store_set and #provman_store_remove are
+ * visible immediately but are only written to disk when
+ * #provman_store_commit is called.  All the pending modifications made by
+ * all the users of the store are committed together, atomically.  Commits
+ * are written behind, by a thread owned by the store, so
+ * #provman_store_commit does not block on the disk.  Commits that arrive
+ * while a previous one is being written are coalesced into a single flush.
+ * If provman crashes before a commit has been written, none of the
+ * modifications made since the previous commit will be present when the
+ * store is next opened.  Code that needs to know that its modifications
+ * are on disk, e.g., before it deletes the only other copy of the data,
+ * must call #provman_store_sync.
+ *
+ * The store and the functions that operate on it are not thread safe.
+ * They should only be called from the main thread.
+ *****************************************************************************/
+
+#ifndef PROVMAN_STORE_H
+#define PROVMAN_STORE_H
+
+#include <glib.h>
+#include <stdbool.h>
+
+/*! @brief The name of the store file.
+ *
+ * The store file is located in the same directory as the other files
+ * created by provman_utils_make_file_path.
+ */
+
+#define PROVMAN_STORE_FILE_NAME "provman.store"
+
+/*! @brief Represents an open store.
+ *
+ * The details of this structure are private and are not exposed to the
+ * plugins.
+ */
+
+typedef struct provman_store_t_ provman_store_t;
+
+/*! @brief Prototype of the function called by #provman_store_foreach.
+ *
+ * @param key the key.  The key is owned by the store.
+ * @param value the value of the key.  The value is owned by the store.
+ * @param user_data the user_data passed to #provman_store_foreach.
+ */
+
+typedef void (*provman_store_foreach_cb_t)(const gchar *key,
+					   const gchar *value,
+					   void *user_data);
+
+/*! @brief Opens the store of the current instance of provman.
+ *
+ * Stores are shared.  All the callers that open the store of a given
+ * instance of provman receive a pointer to the same object.  Each call to
+ * provman_store_open must be matched by a call to #provman_store_close.
+ *
+ * @param system indicates whether the function has been called by the
+ * system instance of provman.
+ * @param store a pointer to the store is returned in this parameter.
+ *
+ * @return PROVMAN_ERR_NONE if the store was opened.
+ * @return PROVMAN_ERR_NOT_FOUND if the location of the store cannot be
+ *   determined.
+ */
+
+int provman_store_open(bool system, provman_store_t **store);
+
+/*! @brief Opens the store file located in a given directory.
+ *
+ * This function is identical to #provman_store_open except that the
+ * directory that contains the store is specified explicitly.  A store
+ * that does not yet exist is created when it is first committed.
+ *
+ * @param dir the directory that contains the store file.
+ * @param store a pointer to the store is returned in this parameter.
+ */
+
+void provman_store_open_dir(const gchar *dir, provman_store_t **store);
+
+/*! @brief Releases a reference to a store.
+ *
+ * Any pending modifications are committed when the last reference to the
+ * store is released.
+ *
+ * @param store the store to close.
+ */
+
+void provman_store_close(provman_store_t *store);
+
+/*! @brief Retrieves the value of a key.
+ *
+ * @param store the store.
+ * @param ns the name of the namespace.
+ * @param key the key.
+ *
+ * @return NULL if the key does not exist.
+ * @return the value of the key.  The caller owns this string and must
+ *   delete it with g_free once it has finished with it.
+ */
+
+gchar *provman_store_get(provman_store_t *store, const gchar *ns,
+			 const gchar *key);
+
+/*! @brief Sets the value of a key, creating it if necessary.
+ *
+ * The new value is not written to disk until #provman_store_commit is
+ * called.
+ *
+ * @param store the store.
+ * @param ns the name of the namespace.
+ * @param key the key.
+ * @param value the new value of the key.
+ */
+
+void provman_store_set(provman_store_t *store, const gchar *ns,
+		       const gchar *key, const gchar *value);
+
+/*! @brief Removes a key.
+ *
+ * The removal is not written to disk until #provman_store_commit is
+ * called.
+ *
+ * @param store the store.
+ * @param ns the name of the namespace.
+ * @param key the key to remove.
+ *
+ * @return PROVMAN_ERR_NONE if the key was removed.
+ * @return PROVMAN_ERR_NOT_FOUND if the key does not exist.
+ */
+
+int provman_store_remove(provman_store_t *store, const gchar *ns,
+			 const gchar *key);
+
+/*! @brief Invokes a function for each key in a namespace that begins
+ *         with a given prefix.
+ *
+ * Keys are not visited in any particular order.  The store must not be
+ * modified by func.
+ *
+ * @param store the store.
+ * @param ns the name of the namespace.
+ * @param prefix only the keys that begin with prefix are visited.  Pass
+ *   "" to visit all the keys in the namespace.
+ * @param func the function to invoke.
+ * @param user_data passed to func.
+ */
+
+void provman_store_foreach(provman_store_t *store, const gchar *ns,
+			   const gchar *prefix,
+			   provman_store_foreach_cb_t func, void *user_data);
+
+/*! @brief Queues all pending modifications to be written to disk.
+ *
+ * The function returns without waiting for the modifications to be
+ * written.
+ *
+ * @param store the store.
+ *
+ * @return PROVMAN_ERR_NONE if the modifications were queued or if there
+ *   were no modifications to write.
+ * @return PROVMAN_ERR_WRITE if an earlier commit could not be written.
+ *   The modifications are queued anyway, together with all the
+ *   modifications that were lost, and the store will be rewritten.
+ */
+
+int provman_store_commit(provman_store_t *store);
+
+/*! @brief Commits all pending modifications and waits until they, and
+ *         all earlier commits, are on disk.
+ *
+ * This function blocks the calling thread on the disk and should only be
+ * used where correctness requires it.
+ *
+ * @param store the store.
+ *
+ * @return PROVMAN_ERR_NONE if all the modifications are on disk.
+ * @return PROVMAN_ERR_WRITE if the store could not be written.
+ */
+
+int provman_store_sync(provman_store_t *store);
+
+#endif
@@ -0,0 +1,77 @@
+/*
+ * Provman
+ *
+ * Copyright (C) 2011 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+
+/*!
+ * @file trace.h
+ *
+ * @brief
+ * Macros and functions for recording a timeline of provman's activity
+ *
+ * Spans are written to a file in the Chrome trace event format, which can
+ * be loaded into chrome://tracing.  Tracing is switched on and off at
+ * runtime.  When it is off each macro costs a single test of a global
+ * flag.
+ *
+ ******************************************************************************/
+
+#ifndef PROVMAN_TRACE_H
+#define PROVMAN_TRACE_H
+
+#include <stdbool.h>
+#include <glib.h>
+
+#define PROVMAN_TRACE_CAT_TASK "task"
+#define PROVMAN_TRACE_CAT_PLUGIN "plugin"
+#define PROVMAN_TRACE_CAT_DBUS "dbus"
+
+extern bool g_provman_trace_enabled;
+
+int provman_trace_open(const char *trace_file_name);
+void provman_trace_close(void);
+guint provman_trace_begin(const char *category, const char *name,
+			  const char *detail);
+void provman_trace_end(guint id, int result);
+void provman_trace_instant(const char *category, const char *name);
+
+/* Spans are identified by a non zero id returned by PROVMAN_TRACE_BEGIN.
+   detail may be NULL.  If not, it is recorded in the span's arguments.
+   PROVMAN_TRACE_END takes the variable holding the id, closes the span if
+   the id is non zero and resets the variable to 0. */
+
+#define PROVMAN_TRACE_BEGIN(category, name, detail)			\
+	(g_provman_trace_enabled ?					\
+	 provman_trace_begin(category, name, detail) : 0)
+#define PROVMAN_TRACE_END(id, result) do {		\
+		if (id) {				\
+			provman_trace_end(id, result);	\
+			id = 0;				\
+		}					\
+	} while (0)
+#define PROVMAN_TRACE_INSTANT(category, name) do {		\
+		if (g_provman_trace_enabled)			\
+			provman_trace_instant(category, name);	\
+	} while (0)
+
+#endif
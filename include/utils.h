@@ -34,6 +34,7 @@
 
 #include <glib.h>
 #include <stdbool.h>
+#include <stdio.h>
 
 /*! @brief Checks a given key to ensure that it is syntatically valid.
  *
@@ -49,6 +50,21 @@
 
 int provman_utils_validate_key(const char *key);
 
+/*! @brief Determines whether a key lies within a given subtree.
+ *
+ * A key lies within the subtree identified by root if it is equal to root
+ * or if it is a descendant of root.  Trailing '/'s on root are ignored and
+ * the root '/' contains all keys.  Both parameters are assumed to be valid
+ * keys.
+ *
+ * @param key the key to test
+ * @param root the key that identifies the subtree, e.g., /applications/email
+ *
+ * @return true if key lies within the subtree, false otherwise.
+ */
+
+bool provman_utils_key_in_subtree(const char *key, const char *root);
+
 /*! @brief Convenience function for creating a path of a file owned
  *    by provman.
  *
@@ -68,6 +84,22 @@ int provman_utils_validate_key(const char *key);
 
 int provman_utils_make_file_path(const char* fname, bool system, gchar **path);
 
+/*! @brief Creates a new file that can only be read by its owner.
+ *
+ * Any existing file of the same name is removed first.  The file is
+ * created exclusively, and symbolic links are not followed, so that a
+ * file planted in the same place by another user cannot be overwritten.
+ *
+ * @param path the path of the file to create.
+ * @param file the opened file, which should be closed with fclose, is
+ *  passed to the caller in this parameter.
+ *
+ * @return PROVMAN_ERR_NONE if the file was created successfully.
+ * @return PROVMAN_ERR_OPEN if the file could not be created
+ */
+
+int provman_utils_create_private_file(const char *path, FILE **file);
+
 /*! @brief Extracts a client context identifier from a given key
  *
  * Let's assume that you have a key that identifies a telephony setting, e.g.,
@@ -48,6 +48,10 @@
 #include "eds.h"
 #include "map-file.h"
 
+#ifdef PROVMAN_PLUGIN_MODULES
+#include "src/standard-schemas.h"
+#endif
+
 #define EDS_MAP_FILE_CAT "Default"
 #define EDS_MAP_FILE_NAME "eds-mapfile.ini"
 
@@ -144,6 +148,8 @@ const gchar *g_incoming_auth_type_values[] = {
 };
 
 
+typedef struct eds_plugin_read_t_ eds_plugin_read_t;
+
 typedef struct eds_plugin_t_ eds_plugin_t;
 struct eds_plugin_t_ {
 	GConfClient *gconf;
@@ -156,6 +162,27 @@ struct eds_plugin_t_ {
 	provman_plugin_sync_out_cb sync_out_cb;
 	void *sync_out_user_data;
 	int err;
+	guint completion_source;
+	GThreadPool *reader;
+	eds_plugin_read_t *read;
+	bool busy;
+	bool in_session;
+	bool resync;
+	gulong added_id;
+	gulong changed_id;
+	gulong removed_id;
+};
+
+typedef struct eds_plugin_snapshot_t_ eds_plugin_snapshot_t;
+struct eds_plugin_snapshot_t_ {
+	gchar *account_uid;
+	gchar *xml;
+};
+
+struct eds_plugin_read_t_ {
+	eds_plugin_t *plugin_instance;
+	GPtrArray *snapshots;
+	GHashTable *settings;
 };
 
 typedef struct eds_account_t_ eds_account_t;
@@ -178,6 +205,25 @@ static void prv_eds_account_free(gpointer acc)
 	}
 }
 
+static void prv_snapshot_free(gpointer snapshot)
+{
+	eds_plugin_snapshot_t *snap = snapshot;
+
+	if (snap) {
+		g_free(snap->account_uid);
+		g_free(snap->xml);
+		g_free(snap);
+	}
+}
+
+static void prv_read_delete(eds_plugin_read_t *read)
+{
+	g_ptr_array_unref(read->snapshots);
+	if (read->settings)
+		g_hash_table_unref(read->settings);
+	g_free(read);
+}
+
 static const gchar* prv_find_type(const char *auth_type, const gchar **types,
 				  size_t types_len)
 {
@@ -239,21 +285,44 @@ void eds_plugin_delete(provman_plugin_instance instance)
 
 	if (instance) {
 		plugin_instance = instance;
+		if (plugin_instance->reader)
+			g_thread_pool_free(plugin_instance->reader, FALSE,
+					   TRUE);
+		if (plugin_instance->read) {
+			(void) g_source_remove_by_user_data(
+				plugin_instance->read);
+			prv_read_delete(plugin_instance->read);
+		}
+		if (plugin_instance->completion_source)
+			(void) g_source_remove(
+				plugin_instance->completion_source);
 		if (plugin_instance->cached_accounts)
 			g_hash_table_unref(plugin_instance->cached_accounts);
 		if (plugin_instance->gconf)
 			g_object_unref(plugin_instance->gconf);
 		if (plugin_instance->settings)
 			g_hash_table_unref(plugin_instance->settings);
-		if (plugin_instance->account_list)
+		if (plugin_instance->account_list) {
+			if (plugin_instance->added_id) {
+				g_signal_handler_disconnect(
+					plugin_instance->account_list,
+					plugin_instance->added_id);
+				g_signal_handler_disconnect(
+					plugin_instance->account_list,
+					plugin_instance->changed_id);
+				g_signal_handler_disconnect(
+					plugin_instance->account_list,
+					plugin_instance->removed_id);
+			}
 			g_object_unref(plugin_instance->account_list);
+		}
 		if (plugin_instance->map_file)
 			provman_map_file_delete(plugin_instance->map_file);
 		g_free(instance);
 	}
 }
 
-static void prv_add_param(eds_plugin_t *plugin_instance,
+static void prv_add_param(GHashTable *settings,
 			  const gchar *id, const gchar *type,
 			  const gchar *prop_name, const gchar *value)
 {
@@ -266,11 +335,11 @@ static void prv_add_param(eds_plugin_t *plugin_instance,
 		g_string_append(key, "/");
 	}
 	g_string_append(key, prop_name);
-	g_hash_table_insert(plugin_instance->settings,
+	g_hash_table_insert(settings,
 			    g_string_free(key, FALSE), g_strdup(value));
 }
 
-static void prv_add_use_ssl_type(eds_plugin_t *plugin_instance,
+static void prv_add_use_ssl_type(GHashTable *settings,
 				 const gchar *id, const gchar *type,
 				 CamelURL *uri)
 {
@@ -282,39 +351,39 @@ static void prv_add_use_ssl_type(eds_plugin_t *plugin_instance,
 				      sizeof(g_use_ssl_values) /
 				      sizeof(const gchar *));
 		if (value)
-			prv_add_param(plugin_instance, id, type,
+			prv_add_param(settings, id, type,
 				      LOCAL_PROP_EMAIL_USESSL, value);
 	}
 }
 
-static void prv_add_url_gen_params(eds_plugin_t *plugin_instance,
+static void prv_add_url_gen_params(GHashTable *settings,
 				   const gchar *id, const gchar *type,
 				   CamelURL *uri)
 {
 	char buffer[128];
 
 	if (uri->host)
-		prv_add_param(plugin_instance, id, type, LOCAL_PROP_EMAIL_HOST,
+		prv_add_param(settings, id, type, LOCAL_PROP_EMAIL_HOST,
 			      uri->host);
 
 	if (uri->port != 0) {
 		sprintf(buffer, "%u", uri->port);
-		prv_add_param(plugin_instance, id, type, LOCAL_PROP_EMAIL_PORT,
+		prv_add_param(settings, id, type, LOCAL_PROP_EMAIL_PORT,
 			      buffer);
 	}
 
 	if (uri->user)
-		prv_add_param(plugin_instance, id, type,
+		prv_add_param(settings, id, type,
 			      LOCAL_PROP_EMAIL_USERNAME, uri->user);
 
 	if (uri->passwd)
-		prv_add_param(plugin_instance, id, type,
+		prv_add_param(settings, id, type,
 			      LOCAL_PROP_EMAIL_PASSWORD, uri->passwd);
 
-	prv_add_use_ssl_type(plugin_instance, id, type, uri);
+	prv_add_use_ssl_type(settings, id, type, uri);
 }
 
-static void prv_add_url_incoming_params(eds_plugin_t *plugin_instance,
+static void prv_add_url_incoming_params(GHashTable *settings,
 					const gchar *id, const gchar *url)
 {
 	CamelURL* uri = NULL;
@@ -336,10 +405,10 @@ static void prv_add_url_incoming_params(eds_plugin_t *plugin_instance,
 		goto on_error;
 	}
 
-	prv_add_param(plugin_instance, id, LOCAL_KEY_EMAIL_INCOMING,
+	prv_add_param(settings, id, LOCAL_KEY_EMAIL_INCOMING,
 		      LOCAL_PROP_EMAIL_TYPE, protocol);
 
-	prv_add_url_gen_params(plugin_instance, id, LOCAL_KEY_EMAIL_INCOMING,
+	prv_add_url_gen_params(settings, id, LOCAL_KEY_EMAIL_INCOMING,
 			       uri);
 
 	if (uri->authmech) {
@@ -350,7 +419,7 @@ static void prv_add_url_incoming_params(eds_plugin_t *plugin_instance,
 				      sizeof(const gchar*));
 
 		if (authtype)
-			prv_add_param(plugin_instance, id,
+			prv_add_param(settings, id,
 				      LOCAL_KEY_EMAIL_INCOMING,
 				      LOCAL_PROP_EMAIL_AUTHTYPE, authtype);
 	}
@@ -363,7 +432,7 @@ on_error:
 	return;
 }
 
-static void prv_add_url_outgoing_params(eds_plugin_t *plugin_instance,
+static void prv_add_url_outgoing_params(GHashTable *settings,
 					const gchar *id, const gchar *url)
 {
 	CamelURL* uri = NULL;
@@ -385,10 +454,10 @@ static void prv_add_url_outgoing_params(eds_plugin_t *plugin_instance,
 		goto on_error;
 	}
 
-	prv_add_param(plugin_instance, id, LOCAL_KEY_EMAIL_OUTGOING,
+	prv_add_param(settings, id, LOCAL_KEY_EMAIL_OUTGOING,
 		      LOCAL_PROP_EMAIL_TYPE, protocol);
 
-	prv_add_url_gen_params(plugin_instance, id, LOCAL_KEY_EMAIL_OUTGOING,
+	prv_add_url_gen_params(settings, id, LOCAL_KEY_EMAIL_OUTGOING,
 			       uri);
 
 	if (uri->authmech) {
@@ -399,7 +468,7 @@ static void prv_add_url_outgoing_params(eds_plugin_t *plugin_instance,
 				      sizeof(const gchar*));
 
 		if (authtype)
-			prv_add_param(plugin_instance, id,
+			prv_add_param(settings, id,
 				      LOCAL_KEY_EMAIL_OUTGOING,
 				      LOCAL_PROP_EMAIL_AUTHTYPE, authtype);
 	}
@@ -412,12 +481,60 @@ on_error:
 	return;
 }
 
+/* Returns the client id of the account with the given uid, creating a
+   mapping if the account has not been seen before. */
+
+static gchar *prv_map_account(eds_plugin_t *plugin_instance, const gchar *uid)
+{
+	gchar *mapped_name;
+
+	mapped_name = provman_map_file_find_client_id(plugin_instance->map_file,
+						      EDS_MAP_FILE_CAT, uid);
+	if (!mapped_name) {
+		mapped_name = g_strdup(uid);
+		provman_map_file_store_map(plugin_instance->map_file,
+					   EDS_MAP_FILE_CAT, mapped_name,
+					   mapped_name);
+	}
+
+	return mapped_name;
+}
+
+/* Only reads the account itself, so it can be called from the reader
+   thread. */
+
+static void prv_read_account(GHashTable *settings, const gchar *account_uid,
+			     EAccount *account)
+{
+	gchar *address_with_name;
+
+	if (account->name)
+		prv_add_param(settings, account_uid, NULL,
+			      LOCAL_PROP_EMAIL_NAME, account->name);
+
+	if (account->id && account->id->address) {
+		address_with_name =
+			camel_internet_address_format_address(
+				account->id->name,
+				account->id->address);
+		prv_add_param(settings, account_uid, NULL,
+			      LOCAL_PROP_EMAIL_ADDRESS, address_with_name);
+		g_free(address_with_name);
+	}
+
+	if (account->source && account->source->url)
+		prv_add_url_incoming_params(settings, account_uid,
+					    account->source->url);
+
+	if (account->transport && account->transport->url)
+		prv_add_url_outgoing_params(settings, account_uid,
+					    account->transport->url);
+}
+
 static int prv_get_account(eds_plugin_t *plugin_instance, EAccount *account)
 {
 	int err = PROVMAN_ERR_NONE;
-	const char *account_uid;
 	gchar *mapped_name = NULL;
-	gchar *address_with_name;
 
 	if (!account->uid) {
 		err = PROVMAN_ERR_CORRUPT;
@@ -426,17 +543,7 @@ static int prv_get_account(eds_plugin_t *plugin_instance, EAccount *account)
 
 	PROVMAN_LOGF("Found Account %s", account->uid);
 
-	mapped_name = provman_map_file_find_client_id(plugin_instance->map_file,
-						      EDS_MAP_FILE_CAT,
-						      account->uid);
-	if (mapped_name) {
-		account_uid = mapped_name;
-	} else {
-		account_uid = account->uid;
-		provman_map_file_store_map(plugin_instance->map_file,
-					   EDS_MAP_FILE_CAT, account_uid,
-					   account_uid);
-	}
+	mapped_name = prv_map_account(plugin_instance, account->uid);
 
 	/* Is the account already cached? */
 
@@ -446,31 +553,8 @@ static int prv_get_account(eds_plugin_t *plugin_instance, EAccount *account)
 
 		g_hash_table_insert(plugin_instance->cached_accounts,
 				    g_strdup(account->uid), NULL);
-
-		if (account->name)
-			prv_add_param(plugin_instance, account_uid, NULL,
-				      LOCAL_PROP_EMAIL_NAME, account->name);
-
-		if (account->id && account->id->address) {
-			address_with_name =
-				camel_internet_address_format_address(
-					account->id->name,
-					account->id->address);
-			prv_add_param(plugin_instance, account_uid, NULL,
-				      LOCAL_PROP_EMAIL_ADDRESS,
-				      address_with_name);
-			g_free(address_with_name);
-		}
-
-		if (account->source && account->source->url)
-			prv_add_url_incoming_params(plugin_instance,
-						    account_uid,
-						    account->source->url);
-
-		if (account->transport && account->transport->url)
-			prv_add_url_outgoing_params(plugin_instance,
-						    account_uid,
-						    account->transport->url);
+		prv_read_account(plugin_instance->settings, mapped_name,
+				 account);
 	} else {
 		PROVMAN_LOGF("Account %s already cached", account->uid);
 	}
@@ -483,11 +567,225 @@ on_error:
 	return err;
 }
 
+/* Removes an account's settings so that they can be read again. */
+
+static void prv_forget_account(eds_plugin_t *plugin_instance, const gchar *uid)
+{
+	gchar *local_key;
+
+	(void) g_hash_table_remove(plugin_instance->cached_accounts, uid);
+
+	local_key = provman_map_file_find_client_id(plugin_instance->map_file,
+						    EDS_MAP_FILE_CAT, uid);
+	if (local_key) {
+		PROVMAN_LOGF("Removing Account %s from cache", local_key);
+		provman_utils_remove_account(plugin_instance->settings,
+					     LOCAL_KEY_EMAIL_ROOT, local_key);
+		g_free(local_key);
+	}
+}
+
+/* Reading all the accounts is done in three steps.  The account list
+   and the map file may only be used on the main thread, so
+   prv_read_new assigns the client ids and takes an XML snapshot of
+   each account there.  prv_read_parse turns the snapshots into settings
+   and may run in the reader thread, as it touches nothing but the read
+   itself.  prv_read_apply then installs the new settings on the main
+   thread. */
+
+static eds_plugin_read_t *prv_read_new(eds_plugin_t *plugin_instance)
+{
+	eds_plugin_read_t *read = g_new0(eds_plugin_read_t, 1);
+	eds_plugin_snapshot_t *snap;
+	EIterator *iter;
+	EAccount *account;
+
+	read->plugin_instance = plugin_instance;
+	read->snapshots = g_ptr_array_new_with_free_func(prv_snapshot_free);
+	read->settings = g_hash_table_new_full(g_str_hash, g_str_equal,
+					       g_free, g_free);
+
+	g_hash_table_remove_all(plugin_instance->cached_accounts);
+
+	iter = e_list_get_iterator((EList*) plugin_instance->account_list);
+	if (iter) {
+		while (e_iterator_is_valid(iter)) {
+			account = (EAccount*) e_iterator_get(iter);
+			if (account && account->uid) {
+				PROVMAN_LOGF("Found Account %s", account->uid);
+				snap = g_new0(eds_plugin_snapshot_t, 1);
+				snap->account_uid =
+					prv_map_account(plugin_instance,
+							account->uid);
+				snap->xml = e_account_to_xml(account);
+				g_ptr_array_add(read->snapshots, snap);
+				g_hash_table_insert(
+					plugin_instance->cached_accounts,
+					g_strdup(account->uid), NULL);
+			}
+			(void) e_iterator_next(iter);
+		}
+		g_object_unref(iter);
+	}
+
+	(void) provman_map_file_remove_unused(plugin_instance->map_file,
+					      EDS_MAP_FILE_CAT,
+					      plugin_instance->cached_accounts);
+	provman_map_file_save(plugin_instance->map_file);
+
+	return read;
+}
+
+static void prv_read_parse(eds_plugin_read_t *read)
+{
+	eds_plugin_snapshot_t *snap;
+	EAccount *account;
+	unsigned int i;
+
+	for (i = 0; i < read->snapshots->len; ++i) {
+		snap = g_ptr_array_index(read->snapshots, i);
+		account = snap->xml ? e_account_new_from_xml(snap->xml) : NULL;
+		if (account) {
+			prv_read_account(read->settings, snap->account_uid,
+					 account);
+			g_object_unref(account);
+		}
+	}
+}
+
+static void prv_read_apply(eds_plugin_read_t *read)
+{
+	eds_plugin_t *plugin_instance = read->plugin_instance;
+
+	g_hash_table_unref(plugin_instance->settings);
+	plugin_instance->settings = read->settings;
+	read->settings = NULL;
+}
+
+static void prv_reload_accounts(eds_plugin_t *plugin_instance)
+{
+	eds_plugin_read_t *read = prv_read_new(plugin_instance);
+
+	prv_read_parse(read);
+	prv_read_apply(read);
+	prv_read_delete(read);
+}
+
+/* The account list emits its signals synchronously while sync_out
+   modifies it.  These changes are applied by prv_eds_plugin_analyse
+   itself, so the signals are ignored.  The settings handed over by
+   sync_in must not change before the session ends.  Changes made by
+   other applications during a session are therefore applied once it
+   has ended, by reading all the accounts again. */
+
+static bool prv_can_track(eds_plugin_t *plugin_instance)
+{
+	if (plugin_instance->busy)
+		return false;
+
+	if (plugin_instance->in_session) {
+		plugin_instance->resync = true;
+		return false;
+	}
+
+	return true;
+}
+
+static void prv_account_changed(EAccountList *list, EAccount *account,
+				gpointer user_data)
+{
+	eds_plugin_t *plugin_instance = user_data;
+
+	if (!account->uid || !prv_can_track(plugin_instance))
+		return;
+
+	PROVMAN_LOGF("Account %s added or changed", account->uid);
+
+	prv_forget_account(plugin_instance, account->uid);
+	(void) prv_get_account(plugin_instance, account);
+	provman_map_file_save(plugin_instance->map_file);
+}
+
+static void prv_account_removed(EAccountList *list, EAccount *account,
+				gpointer user_data)
+{
+	eds_plugin_t *plugin_instance = user_data;
+	gchar *local_key;
+
+	if (!account->uid || !prv_can_track(plugin_instance))
+		return;
+
+	PROVMAN_LOGF("Account %s removed", account->uid);
+
+	local_key = provman_map_file_find_client_id(plugin_instance->map_file,
+						    EDS_MAP_FILE_CAT,
+						    account->uid);
+	prv_forget_account(plugin_instance, account->uid);
+	if (local_key) {
+		(void) provman_map_file_delete_map(plugin_instance->map_file,
+						   EDS_MAP_FILE_CAT,
+						   local_key);
+		provman_map_file_save(plugin_instance->map_file);
+		g_free(local_key);
+	}
+}
+
+/* The account list is kept for the lifetime of the plugin.  EDS emits
+   these signals on the main loop whenever the accounts stored in GConf
+   are modified, so the settings are always up to date and sync_in
+   simply hands them over. */
+
+static void prv_watch_accounts(eds_plugin_t *plugin_instance)
+{
+	if (!plugin_instance->account_list || plugin_instance->added_id)
+		return;
+
+	plugin_instance->added_id =
+		g_signal_connect(plugin_instance->account_list,
+				 "account-added",
+				 G_CALLBACK(prv_account_changed),
+				 plugin_instance);
+	plugin_instance->changed_id =
+		g_signal_connect(plugin_instance->account_list,
+				 "account-changed",
+				 G_CALLBACK(prv_account_changed),
+				 plugin_instance);
+	plugin_instance->removed_id =
+		g_signal_connect(plugin_instance->account_list,
+				 "account-removed",
+				 G_CALLBACK(prv_account_removed),
+				 plugin_instance);
+}
+
+static void prv_finish_job(eds_plugin_t *plugin_instance)
+{
+	plugin_instance->completion_source = 0;
+	prv_watch_accounts(plugin_instance);
+}
+
+static void prv_end_session(eds_plugin_t *plugin_instance)
+{
+	plugin_instance->in_session = false;
+
+	if (plugin_instance->resync && plugin_instance->account_list) {
+		PROVMAN_LOG("Accounts modified during session.  Reloading");
+		prv_reload_accounts(plugin_instance);
+	}
+	plugin_instance->resync = false;
+}
+
 static gboolean prv_complete_sync_in(gpointer user_data)
 {
 	eds_plugin_t *plugin_instance = user_data;
 	GHashTable *settings = NULL;
 
+	prv_finish_job(plugin_instance);
+
+	/* No sync_out follows a failed sync_in. */
+
+	if (plugin_instance->err != PROVMAN_ERR_NONE)
+		prv_end_session(plugin_instance);
+
 #ifdef PROVMAN_LOGGING
 	provman_utils_dump_hash_table(plugin_instance->settings);
 #endif
@@ -504,8 +802,8 @@ static gboolean prv_complete_sync_out(gpointer user_data)
 {
 	eds_plugin_t *plugin_instance = user_data;
 
-	g_object_unref(plugin_instance->account_list);
-	plugin_instance->account_list = NULL;
+	prv_finish_job(plugin_instance);
+	prv_end_session(plugin_instance);
 
 	plugin_instance->sync_out_cb(plugin_instance->err,
 				     plugin_instance->sync_out_user_data);
@@ -713,7 +1011,6 @@ static void prv_eds_plugin_analyse(eds_plugin_t *plugin_instance,
 	const gchar *old_value;
 	eds_account_t *acc_cache;
 	gchar *url;
-	gchar *local_key;
 
 	accounts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
 					 prv_eds_account_free);
@@ -770,24 +1067,11 @@ static void prv_eds_plugin_analyse(eds_plugin_t *plugin_instance,
 			g_free(url);
 		}
 
-		/* Remove accounts that have been updated or added.  This forces
-		   plugin to re-read them on the next sync in.  This way we
-		   guarantee that the settings are up to date. */
+		/* Re-read the accounts that have been updated or added so
+		   that the settings reflect what EDS actually stored. */
 
-		(void) g_hash_table_remove(plugin_instance->cached_accounts,
-					   (const gchar*) key);
-
-		local_key = provman_map_file_find_client_id(
-			plugin_instance->map_file, EDS_MAP_FILE_CAT,
-			(const gchar*) key);
-		if (local_key) {
-			PROVMAN_LOGF("Removing Account %s from cache",
-				     local_key);
-			provman_utils_remove_account(plugin_instance->settings,
-						     LOCAL_KEY_EMAIL_ROOT,
-						     (const gchar *) local_key);
-			g_free(local_key);
-		}
+		prv_forget_account(plugin_instance, key);
+		(void) prv_get_account(plugin_instance, acc_cache->account);
 	}
 
 	provman_map_file_save(plugin_instance->map_file);
@@ -797,57 +1081,89 @@ static void prv_eds_plugin_analyse(eds_plugin_t *plugin_instance,
 	g_hash_table_unref(accounts);
 }
 
+static gboolean prv_complete_read(gpointer user_data)
+{
+	eds_plugin_read_t *read = user_data;
+	eds_plugin_t *plugin_instance = read->plugin_instance;
+
+	plugin_instance->read = NULL;
+	prv_read_apply(read);
+	prv_read_delete(read);
+
+	return prv_complete_sync_in(plugin_instance);
+}
+
+static void prv_reader_thread(gpointer data, gpointer user_data)
+{
+	prv_read_parse(data);
+	(void) g_idle_add(prv_complete_read, data);
+}
+
+/* Only the GConf access needed to create the account list and snapshot
+   the accounts is done on the main loop.  Parsing the accounts'
+   CamelURLs into settings happens in the reader thread.  If the thread
+   cannot be created the accounts are parsed synchronously. */
+
+static int prv_read_accounts(eds_plugin_t *plugin_instance)
+{
+	eds_plugin_read_t *read;
+
+	plugin_instance->account_list =
+		e_account_list_new(plugin_instance->gconf);
+	if (!plugin_instance->account_list)
+		return PROVMAN_ERR_SUBSYSTEM;
+
+	read = prv_read_new(plugin_instance);
+
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+#endif
+
+	if (!plugin_instance->reader)
+		plugin_instance->reader =
+			g_thread_pool_new(prv_reader_thread, NULL, 1, FALSE,
+					  NULL);
+
+	if (plugin_instance->reader) {
+		plugin_instance->read = read;
+		g_thread_pool_push(plugin_instance->reader, read, NULL);
+	} else {
+		PROVMAN_LOG("Unable to start EDS reader");
+		prv_read_parse(read);
+		prv_read_apply(read);
+		prv_read_delete(read);
+	}
+
+	return PROVMAN_ERR_NONE;
+}
+
 int eds_plugin_sync_in(provman_plugin_instance instance,
 		       const char* imsi,
 		       provman_plugin_sync_in_cb callback,
 		       void *user_data)
 {
-	int err = PROVMAN_ERR_NONE;
 	eds_plugin_t *plugin_instance = instance;
-	EAccountList *list = NULL;
-	EIterator *iter = NULL;
-	EAccount *account;
 
 	PROVMAN_LOG("EDS Sync In");
 
 	plugin_instance->err = PROVMAN_ERR_NONE;
-
-	list = e_account_list_new(plugin_instance->gconf);
-	if (!list) {
-		err = PROVMAN_ERR_SUBSYSTEM;
-		goto on_error;
-	}
-
-	iter = e_list_get_iterator((EList*) list);
-	if (!iter) {
-		err = PROVMAN_ERR_SUBSYSTEM;
-		goto on_error;
-	}
-
-	while (e_iterator_is_valid(iter)) {
-		account = (EAccount*) e_iterator_get(iter);
-		if (account)
-			(void) prv_get_account(plugin_instance, account);
-		(void) e_iterator_next(iter);
-	}
-	g_object_unref(iter);
-
-	plugin_instance->account_list = list;
-	list = NULL;
-	provman_map_file_remove_unused(plugin_instance->map_file,
-				       EDS_MAP_FILE_CAT,
-				       plugin_instance->cached_accounts);
-	provman_map_file_save(plugin_instance->map_file);
 	plugin_instance->sync_in_cb = callback;
 	plugin_instance->sync_in_user_data = user_data;
-	(void) g_idle_add(prv_complete_sync_in, plugin_instance);
+	plugin_instance->in_session = true;
 
-on_error:
+	/* The accounts only need to be read from GConf the first time.
+	   After that the settings are kept up to date by the account list
+	   signals. */
 
-	if (list)
-		g_object_unref(list);
+	if (!plugin_instance->account_list)
+		plugin_instance->err = prv_read_accounts(plugin_instance);
 
-	return err;
+	if (!plugin_instance->read)
+		plugin_instance->completion_source =
+			g_idle_add(prv_complete_sync_in, plugin_instance);
+
+	return PROVMAN_ERR_NONE;
 }
 
 void eds_plugin_sync_in_cancel(provman_plugin_instance instance)
@@ -870,11 +1186,18 @@ int eds_plugin_sync_out(provman_plugin_instance instance,
 	provman_utils_dump_hash_table(settings);
 #endif
 
-	prv_eds_plugin_analyse(plugin_instance, settings);
+	if (plugin_instance->account_list) {
+		plugin_instance->busy = true;
+		prv_eds_plugin_analyse(plugin_instance, settings);
+		plugin_instance->busy = false;
+	} else {
+		plugin_instance->err = PROVMAN_ERR_SUBSYSTEM;
+	}
 
 	plugin_instance->sync_out_cb = callback;
 	plugin_instance->sync_out_user_data = user_data;
-	(void) g_idle_add(prv_complete_sync_out, plugin_instance);
+	plugin_instance->completion_source =
+		g_idle_add(prv_complete_sync_out, plugin_instance);
 
 	return PROVMAN_ERR_NONE;
 }
@@ -885,3 +1208,26 @@ void eds_plugin_sync_out_cancel(provman_plugin_instance instance)
 
 	plugin_instance->err = PROVMAN_ERR_CANCELLED;
 }
+
+void eds_plugin_abort(provman_plugin_instance instance)
+{
+	prv_end_session(instance);
+}
+
+#ifdef PROVMAN_PLUGIN_MODULES
+
+static const provman_plugin g_eds_plugin = {
+	"eds", LOCAL_KEY_EMAIL_ROOT,
+	g_provman_email_schema,
+	eds_plugin_new, eds_plugin_delete,
+	eds_plugin_sync_in, eds_plugin_sync_in_cancel,
+	eds_plugin_sync_out, eds_plugin_sync_out_cancel,
+	eds_plugin_abort, NULL
+};
+
+const provman_plugin *provman_plugin_module_get(void)
+{
+	return &g_eds_plugin;
+}
+
+#endif
@@ -48,5 +48,11 @@ int eds_plugin_sync_out(provman_plugin_instance instance,
 			void *user_data);
 void eds_plugin_sync_out_cancel(provman_plugin_instance instance);
 
+void eds_plugin_abort(provman_plugin_instance instance);
+
+#ifdef PROVMAN_PLUGIN_MODULES
+const provman_plugin *provman_plugin_module_get(void);
+#endif
+
 #endif
 
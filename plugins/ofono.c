@@ -44,6 +44,9 @@
 #include "plugin.h"
 #include "utils.h"
 #include "map-file.h"
+#include "trace.h"
+
+#include "ofono.h"
 
 #define OFONO_MAP_FILE_NAME "ofono-mapfile.ini"
 
@@ -74,6 +77,10 @@
 #define LOCAL_PROP_MMS_PROXY "proxy"
 #define LOCAL_PROP_MMSC "mmsc"
 #define LOCAL_KEY_IMSIS LOCAL_KEY_TEL_ROOT "imsis"
+#define LOCAL_KEY_SIMS_ROOT LOCAL_KEY_TEL_ROOT "sims/"
+
+#define OFONO_PLUGIN_MAX_IN_FLIGHT 8
+#define OFONO_PLUGIN_NO_BLOCKER -1
 
 enum ofono_plugin_state_t_ {
 	OFONO_PLUGIN_IDLE,
@@ -111,11 +118,16 @@ struct ofono_plugin_t_ {
 	gchar *imsi;
 	GCancellable *cancellable;
 	GPtrArray *cmds;
-	unsigned int current_cmd;
+	unsigned int first_pending;
+	unsigned int in_flight;
 	provman_map_file_t *map_file;
-	GHashTableIter ctx_proxy_iter;
-	gchar *current_ctx_path;
-	GDBusProxy *current_ctx_proxy;
+	guint trace_id;
+	bool multi_sim;
+	ofono_plugin_t *parent;
+	GPtrArray *children;
+	unsigned int children_pending;
+	GHashTable *all_settings;
+	GHashTable *child_settings;
 };
 
 enum ofono_plugin_cmd_type_t_ {
@@ -133,18 +145,44 @@ struct ofono_plugin_spare_context_t_ {
 	GHashTable *settings;
 };
 
+enum ofono_plugin_cmd_state_t_ {
+	OFONO_PLUGIN_CMD_PENDING,
+	OFONO_PLUGIN_CMD_ISSUED,
+	OFONO_PLUGIN_CMD_DONE
+};
+typedef enum ofono_plugin_cmd_state_t_ ofono_plugin_cmd_state_t;
+
+/* blocker is the index of the command that creates the context that this
+   command modifies, or OFONO_PLUGIN_NO_BLOCKER.  The command is not
+   issued until its blocker is done. */
+
 typedef struct ofono_plugin_cmd_t_ ofono_plugin_cmd_t;
 struct ofono_plugin_cmd_t_ {
 	ofono_plugin_cmd_type_t type;
 	gchar *path;
 	gchar *value;
+	ofono_plugin_cmd_state_t state;
+	int blocker;
+};
+
+/* Tracks a single D-Bus call made during sync_out, or a context proxy
+   being created during sync_in.  Several of these may be outstanding at
+   the same time. */
+
+typedef struct ofono_plugin_call_t_ ofono_plugin_call_t;
+struct ofono_plugin_call_t_ {
+	ofono_plugin_t *plugin_instance;
+	unsigned int cmd;
+	gchar *ctx_path;
+	guint trace_id;
 };
 
 static void prv_get_modems_cb(int result, utils_ofono_handle_t handle,
 			      GHashTable *modem_imsi, gchar *default_imsi,
 			      void *user_data);
 static int prv_sync_in_step(ofono_plugin_t *plugin_instance, bool *again);
-static void prv_sync_out_step(ofono_plugin_t *plugin_instance, bool *again);
+static void prv_sync_out_issue(ofono_plugin_t *plugin_instance);
+static void prv_multi_sim_reset(ofono_plugin_t *plugin_instance);
 
 
 static void prv_ofono_plugin_cmd_free(gpointer data)
@@ -157,6 +195,18 @@ static void prv_ofono_plugin_cmd_free(gpointer data)
 	}
 }
 
+static ofono_plugin_cmd_t *prv_ofono_plugin_cmd_new(
+	ofono_plugin_cmd_type_t type)
+{
+	ofono_plugin_cmd_t *cmd = g_new0(ofono_plugin_cmd_t, 1);
+
+	cmd->type = type;
+	cmd->state = OFONO_PLUGIN_CMD_PENDING;
+	cmd->blocker = OFONO_PLUGIN_NO_BLOCKER;
+
+	return cmd;
+}
+
 static void prv_g_object_unref(gpointer object)
 {
 	if (object)
@@ -238,6 +288,7 @@ int ofono_plugin_new(provman_plugin_instance *instance, bool system)
 	retval->state = OFONO_PLUGIN_IDLE;
 	provman_map_file_new(map_file_path, &retval->map_file);
 	g_free(map_file_path);
+	utils_ofono_registry_ref();
 
 	*instance = retval;
 
@@ -252,13 +303,23 @@ void ofono_plugin_delete(provman_plugin_instance instance)
 	if (plugin_instance) {
 		if (plugin_instance->modems)
 			g_hash_table_unref(plugin_instance->modems);
+		prv_multi_sim_reset(plugin_instance);
 		provman_map_file_delete(plugin_instance->map_file);
+		utils_ofono_registry_unref();
 		g_free(plugin_instance->default_imsi);
 		g_free(plugin_instance->imsi);
 		g_free(instance);
 	}
 }
 
+static void prv_begin_call(ofono_plugin_t *plugin_instance,
+			   const gchar *call, const gchar *detail)
+{
+	plugin_instance->cancellable = g_cancellable_new();
+	plugin_instance->trace_id = PROVMAN_TRACE_BEGIN(PROVMAN_TRACE_CAT_DBUS,
+							call, detail);
+}
+
 static int prv_complete_results_call(ofono_plugin_t *plugin_instance,
 				     GDBusProxy *proxy, GAsyncResult *result,
 				     GSourceFunc quit_callback,
@@ -289,6 +350,7 @@ on_error:
 
 	g_object_unref(plugin_instance->cancellable);
 	plugin_instance->cancellable = NULL;
+	PROVMAN_TRACE_END(plugin_instance->trace_id, err);
 
 	if (err == PROVMAN_ERR_CANCELLED) {
 		plugin_instance->cb_err = err;
@@ -329,6 +391,7 @@ on_error:
 
 	g_object_unref(plugin_instance->cancellable);
 	plugin_instance->cancellable = NULL;
+	PROVMAN_TRACE_END(plugin_instance->trace_id, err);
 
 	if (err == PROVMAN_ERR_CANCELLED) {
 		plugin_instance->cb_err = err;
@@ -341,6 +404,44 @@ on_error:
 
 
 
+static ofono_plugin_call_t *prv_begin_cmd_call(
+	ofono_plugin_t *plugin_instance, unsigned int index,
+	const gchar *call_name, const gchar *detail)
+{
+	ofono_plugin_call_t *call = g_new0(ofono_plugin_call_t, 1);
+
+	call->plugin_instance = plugin_instance;
+	call->cmd = index;
+	call->trace_id = PROVMAN_TRACE_BEGIN(PROVMAN_TRACE_CAT_DBUS,
+					     call_name, detail);
+
+	return call;
+}
+
+/* All the calls made during sync_out, and all the context proxies created
+   during sync_in, share the plugin's cancellable.  If it has been
+   cancelled the operation completes with PROVMAN_ERR_CANCELLED once the
+   last outstanding call has returned. */
+
+static int prv_end_cmd_call(ofono_plugin_call_t *call, bool succeeded)
+{
+	int err = PROVMAN_ERR_NONE;
+	ofono_plugin_t *plugin_instance = call->plugin_instance;
+
+	if (g_cancellable_is_cancelled(plugin_instance->cancellable)) {
+		PROVMAN_LOG("Operation Cancelled");
+		err = PROVMAN_ERR_CANCELLED;
+		plugin_instance->cb_err = err;
+	} else if (!succeeded) {
+		PROVMAN_LOG("Operation Failed");
+		err = PROVMAN_ERR_IO;
+	}
+
+	PROVMAN_TRACE_END(call->trace_id, err);
+
+	return err;
+}
+
 static gboolean prv_complete_sync_in(gpointer user_data)
 {
 	ofono_plugin_t *plugin_instance = user_data;
@@ -586,8 +687,9 @@ static void prv_ofono_plugin_update_contexts(ofono_plugin_t *plugin_instance,
 		g_variant_unref(properties);
 		g_variant_unref(tuple);
 	}
-	provman_map_file_remove_unused(plugin_instance->map_file,
-				       plugin_instance->imsi, full_contexts);
+	(void) provman_map_file_remove_unused(plugin_instance->map_file,
+					      plugin_instance->imsi,
+					      full_contexts);
 	provman_map_file_save(plugin_instance->map_file);
 	g_hash_table_unref(full_contexts);
 }
@@ -679,55 +781,80 @@ static void prv_context_proxy_created(GObject *source_object,
 {
 	int err = PROVMAN_ERR_NONE;
 	bool again;
-	ofono_plugin_t *plugin_instance = user_data;
+	ofono_plugin_call_t *call = user_data;
+	ofono_plugin_t *plugin_instance = call->plugin_instance;
 	GDBusProxy *proxy;
 	ofono_plugin_modem_t *modem;
 
-	err = prv_complete_proxy_call(plugin_instance, result,
-				      prv_complete_sync_in,
-				      &proxy);
-	if (err != PROVMAN_ERR_NONE)
-		goto on_error;
+	proxy = g_dbus_proxy_new_finish(result, NULL);
+	err = prv_end_cmd_call(call, proxy != NULL);
+	if (err == PROVMAN_ERR_NONE) {
+		modem = g_hash_table_lookup(plugin_instance->modems,
+					    plugin_instance->imsi);
+		PROVMAN_LOGF("Context Proxy Created for %s", call->ctx_path);
+		g_hash_table_insert(modem->ctxt_proxies, call->ctx_path,
+				    proxy);
+		call->ctx_path = NULL;
+	} else {
+		if (proxy)
+			g_object_unref(proxy);
+		if (plugin_instance->cb_err == PROVMAN_ERR_NONE)
+			plugin_instance->cb_err = err;
+	}
 
-	modem = g_hash_table_lookup(plugin_instance->modems,
-				    plugin_instance->imsi);
+	g_free(call->ctx_path);
+	g_free(call);
 
-	g_hash_table_insert(modem->ctxt_proxies,
-			    g_strdup(plugin_instance->current_ctx_path), proxy);
+	/* The proxies are created concurrently.  sync_in only moves on
+	   once the last of them has been created. */
 
-	PROVMAN_LOGF("Context Proxy Created for %s",
-		plugin_instance->current_ctx_path);
+	if (--plugin_instance->in_flight > 0)
+		return;
 
-	if (!prv_get_context_proxies(plugin_instance, modem))
-		do {
-			err = prv_sync_in_step(plugin_instance, &again);
-			if (err != PROVMAN_ERR_NONE)
-				goto on_error;
-		} while (again);
+	err = plugin_instance->cb_err;
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	do {
+		err = prv_sync_in_step(plugin_instance, &again);
+		if (err != PROVMAN_ERR_NONE)
+			goto on_error;
+	} while (again);
 
 	return;
 
 on_error:
 
-	return;
+	PROVMAN_LOGF("Unable to create oFono context proxies.  Error %d", err);
+
+	plugin_instance->cb_err = err;
+	plugin_instance->completion_source =
+		g_idle_add(prv_complete_sync_in, plugin_instance);
 }
 
 static bool prv_get_context_proxies(ofono_plugin_t *plugin_instance,
 				    ofono_plugin_modem_t *modem)
 {
-	gpointer key = NULL;
+	GHashTableIter iter;
+	gpointer key;
 	gpointer value;
+	ofono_plugin_call_t *call;
 
-	g_hash_table_iter_init(&plugin_instance->ctx_proxy_iter,
-			       modem->ctxt_proxies);
+	plugin_instance->cb_err = PROVMAN_ERR_NONE;
+	plugin_instance->in_flight = 0;
 
-	while (g_hash_table_iter_next(&plugin_instance->ctx_proxy_iter, &key,
-				      &value)  && value)
-		key = NULL;
+	g_hash_table_iter_init(&iter, modem->ctxt_proxies);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		if (value)
+			continue;
+
+		if (!plugin_instance->cancellable)
+			plugin_instance->cancellable = g_cancellable_new();
 
-	if (key) {
-		plugin_instance->current_ctx_path = key;
-		plugin_instance->cancellable = g_cancellable_new();
+		call = prv_begin_cmd_call(plugin_instance, 0,
+					  OFONO_CONTEXT_INTERFACE, key);
+		call->ctx_path = g_strdup(key);
+		++plugin_instance->in_flight;
 		g_dbus_proxy_new_for_bus(
 			G_BUS_TYPE_SYSTEM,
 			G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES,
@@ -737,10 +864,10 @@ static bool prv_get_context_proxies(ofono_plugin_t *plugin_instance,
 			OFONO_CONTEXT_INTERFACE,
 			plugin_instance->cancellable,
 			prv_context_proxy_created,
-			plugin_instance);
+			call);
 	}
 
-	return key != NULL;
+	return plugin_instance->in_flight > 0;
 }
 
 static bool prv_have_imsi(ofono_plugin_t *plugin_instance)
@@ -792,7 +919,8 @@ static int prv_sync_in_step(ofono_plugin_t *plugin_instance, bool *again)
 		else {
 			PROVMAN_LOGF("Creating Proxy for %s", modem->path);
 
-			plugin_instance->cancellable = g_cancellable_new();
+			prv_begin_call(plugin_instance,
+				       OFONO_CONNMAN_INTERFACE, modem->path);
 			g_dbus_proxy_new_for_bus(
 				G_BUS_TYPE_SYSTEM,
 				G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES,
@@ -809,7 +937,8 @@ static int prv_sync_in_step(ofono_plugin_t *plugin_instance, bool *again)
 
 		PROVMAN_LOG("Retrieving Context Settings");
 
-		plugin_instance->cancellable = g_cancellable_new();
+		prv_begin_call(plugin_instance, OFONO_CONNMAN_GET_CONTEXTS,
+			       modem->path);
 		g_dbus_proxy_call(modem->cm_proxy,
 				  OFONO_CONNMAN_GET_CONTEXTS,
 				  NULL, G_DBUS_CALL_FLAGS_NONE,
@@ -837,26 +966,13 @@ on_error:
 	return err;
 }
 
-static void prv_get_modems_cb(int result, utils_ofono_handle_t handle,
-			      GHashTable *modem_imsi, gchar *default_imsi,
-			      void *user_data)
+static void prv_update_modems(ofono_plugin_t *plugin_instance,
+			      GHashTable *modem_imsi)
 {
-	int err = PROVMAN_ERR_NONE;
 	GHashTableIter iter;
 	gpointer key;
 	gpointer value;
-	bool again;
 	ofono_plugin_modem_t *modem;
-	GString *imsis_setting;
-
-	ofono_plugin_t *plugin_instance = user_data;
-
-	plugin_instance->of_handle = NULL;
-
-	if (result != PROVMAN_ERR_NONE) {
-		err = result;
-		goto on_error;
-	}
 
 	g_hash_table_iter_init(&iter, modem_imsi);
 
@@ -880,7 +996,45 @@ static void prv_get_modems_cb(int result, utils_ofono_handle_t handle,
 			}
 		}
 	}
+}
+
+static gchar *prv_make_imsis_setting(ofono_plugin_t *plugin_instance,
+				     const gchar *default_imsi)
+{
+	GHashTableIter iter;
+	gpointer key;
+	GString *imsis_setting;
+
+	imsis_setting = g_string_new(default_imsi);
+	g_hash_table_iter_init(&iter, plugin_instance->modems);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		if (strcmp((const char*) key, default_imsi)) {
+			g_string_append_c(imsis_setting, ',');
+			g_string_append(imsis_setting, key);
+		}
+	}
+
+	return g_string_free(imsis_setting, FALSE);
+}
+
+static void prv_get_modems_cb(int result, utils_ofono_handle_t handle,
+			      GHashTable *modem_imsi, gchar *default_imsi,
+			      void *user_data)
+{
+	int err = PROVMAN_ERR_NONE;
+	bool again;
+	ofono_plugin_modem_t *modem;
+
+	ofono_plugin_t *plugin_instance = user_data;
+
+	plugin_instance->of_handle = NULL;
+
+	if (result != PROVMAN_ERR_NONE) {
+		err = result;
+		goto on_error;
+	}
 
+	prv_update_modems(plugin_instance, modem_imsi);
 	g_hash_table_unref(modem_imsi);
 
 	g_free(plugin_instance->default_imsi);
@@ -906,16 +1060,9 @@ static void prv_get_modems_cb(int result, utils_ofono_handle_t handle,
 		goto on_error;
 	}
 
-	imsis_setting = g_string_new(default_imsi);
-	g_hash_table_iter_init(&iter, plugin_instance->modems);
-	while (g_hash_table_iter_next(&iter, &key, NULL)) {
-		if (strcmp((const char*) key, default_imsi)) {
-			g_string_append_c(imsis_setting, ',');
-			g_string_append(imsis_setting, key);
-		}
-	}
 	g_hash_table_insert(modem->settings, g_strdup(LOCAL_KEY_IMSIS),
-			    g_string_free(imsis_setting, FALSE));
+			    prv_make_imsis_setting(plugin_instance,
+						   default_imsi));
 
 	do {
 		err = prv_sync_in_step(plugin_instance, &again);
@@ -932,6 +1079,198 @@ on_error:
 		g_idle_add(prv_complete_sync_in, plugin_instance);
 }
 
+/* In a multi-SIM session the plugin instance acts as a parent to one
+   child instance per modem.  Each child runs an ordinary single IMSI
+   sync_in or sync_out for its own modem, concurrently with the others.
+   The children share the parent's modems and map file.  The parent
+   moves each child's settings under /telephony/sims/<IMSI>/ and back
+   again. */
+
+static ofono_plugin_t *prv_ofono_plugin_child_new(ofono_plugin_t *parent)
+{
+	ofono_plugin_t *child = g_new0(ofono_plugin_t, 1);
+
+	child->parent = parent;
+	child->modems = g_hash_table_ref(parent->modems);
+	child->map_file = parent->map_file;
+	child->state = OFONO_PLUGIN_IDLE;
+
+	return child;
+}
+
+static void prv_ofono_plugin_child_free(gpointer data)
+{
+	ofono_plugin_t *child = data;
+
+	g_hash_table_unref(child->modems);
+	g_free(child->imsi);
+	g_free(child);
+}
+
+static void prv_multi_sim_reset(ofono_plugin_t *plugin_instance)
+{
+	if (plugin_instance->children) {
+		g_ptr_array_unref(plugin_instance->children);
+		plugin_instance->children = NULL;
+	}
+
+	if (plugin_instance->all_settings) {
+		g_hash_table_unref(plugin_instance->all_settings);
+		plugin_instance->all_settings = NULL;
+	}
+
+	if (plugin_instance->child_settings) {
+		g_hash_table_unref(plugin_instance->child_settings);
+		plugin_instance->child_settings = NULL;
+	}
+}
+
+static gboolean prv_multi_sim_complete_sync_in(gpointer user_data)
+{
+	ofono_plugin_t *plugin_instance = user_data;
+	GHashTable *settings = NULL;
+
+	plugin_instance->state = OFONO_PLUGIN_IDLE;
+	plugin_instance->completion_source = 0;
+
+	if (plugin_instance->cb_err == PROVMAN_ERR_NONE) {
+#ifdef PROVMAN_LOGGING
+		provman_utils_dump_hash_table(plugin_instance->all_settings);
+#endif
+		settings = plugin_instance->all_settings;
+	} else {
+		prv_multi_sim_reset(plugin_instance);
+	}
+
+	plugin_instance->sync_in_cb(plugin_instance->cb_err, settings,
+				    plugin_instance->sync_in_user_data);
+
+	return FALSE;
+}
+
+static void prv_multi_sim_child_sync_in_cb(int result, GHashTable *settings,
+					   void *user_data)
+{
+	ofono_plugin_t *child = user_data;
+	ofono_plugin_t *plugin_instance = child->parent;
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	const gchar *rel_key;
+
+	PROVMAN_LOGF("Sync In of %s completed with error %d", child->imsi,
+		     result);
+
+	if (result != PROVMAN_ERR_NONE) {
+		if (plugin_instance->cb_err == PROVMAN_ERR_NONE)
+			plugin_instance->cb_err = result;
+	} else {
+		g_hash_table_iter_init(&iter, settings);
+		while (g_hash_table_iter_next(&iter, &key, &value)) {
+			if (!strcmp(key, LOCAL_KEY_IMSIS))
+				continue;
+			rel_key = (const gchar *) key +
+				strlen(LOCAL_KEY_TEL_ROOT);
+			g_hash_table_insert(plugin_instance->all_settings,
+					    g_strdup_printf("%s%s/%s",
+							    LOCAL_KEY_SIMS_ROOT,
+							    child->imsi,
+							    rel_key),
+					    g_strdup(value));
+		}
+	}
+
+	if (--plugin_instance->children_pending == 0)
+		plugin_instance->completion_source =
+			g_idle_add(prv_multi_sim_complete_sync_in,
+				   plugin_instance);
+}
+
+static void prv_multi_sim_get_modems_cb(int result,
+					utils_ofono_handle_t handle,
+					GHashTable *modem_imsi,
+					gchar *default_imsi,
+					void *user_data)
+{
+	int err = PROVMAN_ERR_NONE;
+	GHashTableIter iter;
+	gpointer key;
+	ofono_plugin_t *child;
+	ofono_plugin_t *plugin_instance = user_data;
+
+	plugin_instance->of_handle = NULL;
+
+	if (result != PROVMAN_ERR_NONE) {
+		err = result;
+		goto on_error;
+	}
+
+	prv_update_modems(plugin_instance, modem_imsi);
+	g_hash_table_unref(modem_imsi);
+
+	g_free(plugin_instance->default_imsi);
+	plugin_instance->default_imsi = default_imsi;
+
+	if (!default_imsi) {
+		PROVMAN_LOG("No Modems Found.");
+		err = PROVMAN_ERR_NOT_FOUND;
+		goto on_error;
+	}
+
+	plugin_instance->state = OFONO_PLUGIN_EXECUTING;
+	plugin_instance->all_settings =
+		g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert(plugin_instance->all_settings,
+			    g_strdup(LOCAL_KEY_IMSIS),
+			    prv_make_imsis_setting(plugin_instance,
+						   default_imsi));
+
+	plugin_instance->children =
+		g_ptr_array_new_with_free_func(prv_ofono_plugin_child_free);
+	plugin_instance->children_pending = 0;
+
+	g_hash_table_iter_init(&iter, plugin_instance->modems);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		child = prv_ofono_plugin_child_new(plugin_instance);
+		g_ptr_array_add(plugin_instance->children, child);
+		err = ofono_plugin_sync_in(child, key,
+					   prv_multi_sim_child_sync_in_cb,
+					   child);
+		if (err == PROVMAN_ERR_NONE)
+			++plugin_instance->children_pending;
+		else if (plugin_instance->cb_err == PROVMAN_ERR_NONE)
+			plugin_instance->cb_err = err;
+	}
+
+	if (plugin_instance->children_pending == 0)
+		plugin_instance->completion_source =
+			g_idle_add(prv_multi_sim_complete_sync_in,
+				   plugin_instance);
+
+	return;
+
+on_error:
+
+	plugin_instance->cb_err = err;
+	plugin_instance->completion_source =
+		g_idle_add(prv_multi_sim_complete_sync_in, plugin_instance);
+}
+
+static int prv_multi_sim_sync_in(ofono_plugin_t *plugin_instance)
+{
+	PROVMAN_LOG("Retrieving Modems for a multi-SIM session");
+
+	prv_multi_sim_reset(plugin_instance);
+	plugin_instance->multi_sim = true;
+	plugin_instance->imsi = g_strdup(PROVMAN_IMSI_ALL);
+	plugin_instance->cb_err = PROVMAN_ERR_NONE;
+	plugin_instance->state = OFONO_PLUGIN_GETTING_MODEMS;
+
+	return utils_ofono_get_modems(prv_multi_sim_get_modems_cb,
+				      plugin_instance,
+				      &plugin_instance->of_handle);
+}
+
 int ofono_plugin_sync_in(provman_plugin_instance instance,
 			 const char* imsi,
 			 provman_plugin_sync_in_cb callback,
@@ -951,6 +1290,18 @@ int ofono_plugin_sync_in(provman_plugin_instance instance,
 
 	plugin_instance->sync_in_cb = callback;
 	plugin_instance->sync_in_user_data = user_data;
+	plugin_instance->multi_sim = false;
+
+	if (!strcmp(imsi, PROVMAN_IMSI_ALL)) {
+		err = prv_multi_sim_sync_in(plugin_instance);
+		if (err != PROVMAN_ERR_NONE) {
+			plugin_instance->state = OFONO_PLUGIN_IDLE;
+			g_free(plugin_instance->imsi);
+			plugin_instance->imsi = NULL;
+		}
+		goto on_error;
+	}
+
 	if (strlen(imsi) > 0)
 		plugin_instance->imsi = g_strdup(imsi);
 	else
@@ -970,8 +1321,13 @@ on_error:
 void ofono_plugin_sync_in_cancel(provman_plugin_instance instance)
 {
 	ofono_plugin_t *plugin_instance = instance;
+	unsigned int i;
 
-	if (plugin_instance->of_handle) {
+	if (plugin_instance->children) {
+		for (i = 0; i < plugin_instance->children->len; ++i)
+			ofono_plugin_sync_in_cancel(
+				plugin_instance->children->pdata[i]);
+	} else if (plugin_instance->of_handle) {
 		utils_ofono_get_modems_cancel(plugin_instance->of_handle);
 		plugin_instance->of_handle = NULL;
 	} else if (plugin_instance->cancellable) {
@@ -1028,6 +1384,30 @@ static bool prv_have_mms(GHashTable *settings)
 }
 
 
+/* Returns the index of the command that adds the context to which key
+   belongs, if the context is being added. */
+
+static int prv_find_blocker(const gchar *key, GHashTable *added,
+			    int add_mms)
+{
+	gchar *context;
+	gpointer index;
+	int blocker = OFONO_PLUGIN_NO_BLOCKER;
+
+	if (!strncmp(LOCAL_KEY_MMS_ROOT, key, sizeof(LOCAL_KEY_MMS_ROOT) - 1))
+		return add_mms;
+
+	context = provman_utils_get_context_from_key(
+		key, LOCAL_KEY_CONTEXT_ROOT,
+		sizeof(LOCAL_KEY_CONTEXT_ROOT) - 1);
+	if (context && g_hash_table_lookup_extended(added, context, NULL,
+						    &index))
+		blocker = GPOINTER_TO_INT(index);
+	g_free(context);
+
+	return blocker;
+}
+
 static void prv_ofono_plugin_anaylse(ofono_plugin_t *plugin_instance,
 				     ofono_plugin_modem_t *modem,
 				     GHashTable *new_settings)
@@ -1041,6 +1421,8 @@ static void prv_ofono_plugin_anaylse(ofono_plugin_t *plugin_instance,
 	gpointer value;
 	gpointer old_value;
 	ofono_plugin_cmd_t *cmd;
+	GHashTable *added;
+	int add_mms = OFONO_PLUGIN_NO_BLOCKER;
 
 	in_contexts =
 		provman_utils_get_contexts(modem->settings,
@@ -1055,23 +1437,23 @@ static void prv_ofono_plugin_anaylse(ofono_plugin_t *plugin_instance,
 	in_mms = modem->mms_context != NULL;
 	out_mms = prv_have_mms(new_settings);
 
-	plugin_instance->current_cmd = 0;
+	plugin_instance->first_pending = 0;
+	plugin_instance->in_flight = 0;
 	plugin_instance->cmds =
 		g_ptr_array_new_with_free_func(prv_ofono_plugin_cmd_free);
+	added = g_hash_table_new(g_str_hash, g_str_equal);
 
 	g_hash_table_iter_init(&iter, in_contexts);
 	while (g_hash_table_iter_next(&iter, &key, NULL))
 		if (!g_hash_table_lookup_extended(out_contexts, key, NULL,
 						  NULL)) {
-			cmd = g_new0(ofono_plugin_cmd_t,1);
-			cmd->type = OFONO_PLUGIN_DELETE;
+			cmd = prv_ofono_plugin_cmd_new(OFONO_PLUGIN_DELETE);
 			cmd->path = g_strdup(key);
 			g_ptr_array_add(plugin_instance->cmds, cmd);
 		}
 
 	if (in_mms && !out_mms) {
-		cmd = g_new0(ofono_plugin_cmd_t,1);
-		cmd->type = OFONO_PLUGIN_DELETE_MMS;
+		cmd = prv_ofono_plugin_cmd_new(OFONO_PLUGIN_DELETE_MMS);
 		cmd->path = g_strdup(modem->mms_context);
 		g_ptr_array_add(plugin_instance->cmds, cmd);
 	}
@@ -1080,16 +1462,18 @@ static void prv_ofono_plugin_anaylse(ofono_plugin_t *plugin_instance,
 	while (g_hash_table_iter_next(&iter, &key, NULL))
 		if (!g_hash_table_lookup_extended(in_contexts, key, NULL,
 						  NULL)) {
-			cmd = g_new0(ofono_plugin_cmd_t,1);
-			cmd->type = OFONO_PLUGIN_ADD;
+			cmd = prv_ofono_plugin_cmd_new(OFONO_PLUGIN_ADD);
 			cmd->path = g_strdup(key);
+			g_hash_table_insert(
+				added, cmd->path,
+				GINT_TO_POINTER(plugin_instance->cmds->len));
 			g_ptr_array_add(plugin_instance->cmds, cmd);
 		}
 
 	if (!in_mms && out_mms) {
-		cmd = g_new0(ofono_plugin_cmd_t,1);
-		cmd->type = OFONO_PLUGIN_ADD_MMS;
+		cmd = prv_ofono_plugin_cmd_new(OFONO_PLUGIN_ADD_MMS);
 		cmd->path = NULL;
+		add_mms = plugin_instance->cmds->len;
 		g_ptr_array_add(plugin_instance->cmds, cmd);
 	}
 
@@ -1097,10 +1481,10 @@ static void prv_ofono_plugin_anaylse(ofono_plugin_t *plugin_instance,
 	while (g_hash_table_iter_next(&iter, &key, &value)) {
 		old_value = g_hash_table_lookup(modem->settings, key);
 		if (!old_value || strcmp(value, old_value)) {
-			cmd = g_new0(ofono_plugin_cmd_t,1);
-			cmd->type = OFONO_PLUGIN_SET;
+			cmd = prv_ofono_plugin_cmd_new(OFONO_PLUGIN_SET);
 			cmd->path = g_strdup(key);
 			cmd->value = g_strdup(value);
+			cmd->blocker = prv_find_blocker(key, added, add_mms);
 			g_ptr_array_add(plugin_instance->cmds, cmd);
 		}
 	}
@@ -1112,10 +1496,10 @@ static void prv_ofono_plugin_anaylse(ofono_plugin_t *plugin_instance,
 	g_hash_table_iter_init(&iter, modem->settings);
 	while (g_hash_table_iter_next(&iter, &key, &value)) {
 		if (!g_hash_table_lookup(new_settings, key)) {
-			cmd = g_new0(ofono_plugin_cmd_t,1);
-			cmd->type = OFONO_PLUGIN_SET;
+			cmd = prv_ofono_plugin_cmd_new(OFONO_PLUGIN_SET);
 			cmd->path = g_strdup(key);
 			cmd->value = g_strdup("");
+			cmd->blocker = prv_find_blocker(key, added, add_mms);
 			g_ptr_array_add(plugin_instance->cmds, cmd);
 		}
 	}
@@ -1125,222 +1509,166 @@ static void prv_ofono_plugin_anaylse(ofono_plugin_t *plugin_instance,
 	prv_dump_tasks(plugin_instance->cmds);
 #endif
 
+	g_hash_table_unref(added);
 	g_hash_table_unref(out_contexts);
 	g_hash_table_unref(in_contexts);
 }
 
-static int prv_context_deleted(ofono_plugin_t *plugin_instance,
-			       ofono_plugin_modem_t *modem,
-			       GObject *source_object,
-			       GAsyncResult *result,
-			       gpointer user_data)
+static void prv_complete_cmd(ofono_plugin_call_t *call)
 {
-	int err = PROVMAN_ERR_NONE;
-	GVariant *retvals;
-	bool again;
-
-	err = prv_complete_results_call(plugin_instance, modem->cm_proxy,
-					result, prv_complete_sync_out,
-					&retvals);
-
-	PROVMAN_LOGF("Context Delete returned with err %d", err);
-	syslog(LOG_INFO, "oFono Plugin: Context deleted with err %u", err);
-
-	if (err != PROVMAN_ERR_CANCELLED) {
-		++plugin_instance->current_cmd;
-		do
-			prv_sync_out_step(plugin_instance, &again);
-		while (again);
+	ofono_plugin_t *plugin_instance = call->plugin_instance;
+	ofono_plugin_cmd_t *cmd = plugin_instance->cmds->pdata[call->cmd];
 
-		if (err == PROVMAN_ERR_NONE)
-			g_variant_unref(retvals);
-	}
+	cmd->state = OFONO_PLUGIN_CMD_DONE;
+	--plugin_instance->in_flight;
+	g_free(call->ctx_path);
+	g_free(call);
 
-	return err;
+	prv_sync_out_issue(plugin_instance);
 }
 
 static void prv_context_deleted_cb(GObject *source_object,
 				   GAsyncResult *result,
 				   gpointer user_data)
 {
-	ofono_plugin_t *plugin_instance = user_data;
-	ofono_plugin_modem_t *modem;
+	int err;
+	ofono_plugin_call_t *call = user_data;
+	GVariant *retvals;
 
-	modem = g_hash_table_lookup(plugin_instance->modems,
-				    plugin_instance->imsi);
+	retvals = g_dbus_proxy_call_finish(G_DBUS_PROXY(source_object),
+					   result, NULL);
+	err = prv_end_cmd_call(call, retvals != NULL);
 
-	(void) prv_context_deleted(plugin_instance, modem, source_object,
-				   result, user_data);
+	PROVMAN_LOGF("Context Delete returned with err %d", err);
+	syslog(LOG_INFO, "oFono Plugin: Context deleted with err %u", err);
+
+	if (retvals)
+		g_variant_unref(retvals);
+
+	prv_complete_cmd(call);
 }
 
-static void prv_context_added_complete_cb(GObject *source_object,
-					  GAsyncResult *result,
-					  gpointer user_data)
+static void prv_context_proxy_added_cb(GObject *source_object,
+				       GAsyncResult *result,
+				       gpointer user_data)
 {
-	int err = PROVMAN_ERR_NONE;
-	ofono_plugin_t *plugin_instance = user_data;
-	GDBusProxy *proxy;
+	ofono_plugin_call_t *call = user_data;
+	ofono_plugin_t *plugin_instance = call->plugin_instance;
 	ofono_plugin_modem_t *modem;
-	bool again;
-
-	err = prv_complete_proxy_call(plugin_instance, result,
-				      prv_complete_sync_out,
-				      &proxy);
+	GDBusProxy *proxy;
 
-	if (err != PROVMAN_ERR_NONE) {
-		g_free(plugin_instance->current_ctx_path);
-		plugin_instance->current_ctx_path = NULL;
-		if (err == PROVMAN_ERR_CANCELLED)
-			goto on_error;
-	} else if (err == PROVMAN_ERR_NONE) {
+	proxy = g_dbus_proxy_new_finish(result, NULL);
+	if (prv_end_cmd_call(call, proxy != NULL) == PROVMAN_ERR_NONE) {
 		modem = g_hash_table_lookup(plugin_instance->modems,
 					    plugin_instance->imsi);
 
-		g_hash_table_insert(modem->ctxt_proxies,
-				    plugin_instance->current_ctx_path,
-				    proxy);
+		/* ctxt_proxies now owns the path */
 
-		PROVMAN_LOGF("Context Proxy Created for %s",
-			 plugin_instance->current_ctx_path);
-		plugin_instance->current_ctx_path = NULL;
+		g_hash_table_insert(modem->ctxt_proxies, call->ctx_path,
+				    proxy);
+		PROVMAN_LOGF("Context Proxy Created for %s", call->ctx_path);
+		call->ctx_path = NULL;
+	} else if (proxy) {
+		g_object_unref(proxy);
 	}
 
-	++plugin_instance->current_cmd;
-	do
-		prv_sync_out_step(plugin_instance, &again);
-	while (again);
-
-	return;
-
-on_error:
-
-	return;
+	prv_complete_cmd(call);
 }
 
-static const gchar *prv_context_added(ofono_plugin_t *plugin_instance,
-				      ofono_plugin_modem_t *modem,
-				      GObject *source_object,
-				      GAsyncResult *result,
-				      gpointer user_data)
-{
-	int err = PROVMAN_ERR_NONE;
-	GVariant *retvals;
-	gchar *plugin_id;
-	bool again;
-	const gchar *path = NULL;
-
-	err = prv_complete_results_call(plugin_instance, modem->cm_proxy,
-					result, prv_complete_sync_out,
-					&retvals);
-	if ((err != PROVMAN_ERR_NONE) && (err != PROVMAN_ERR_CANCELLED)) {
-		++plugin_instance->current_cmd;
-		do
-			prv_sync_out_step(plugin_instance, &again);
-		while (again);
-	} else if (err == PROVMAN_ERR_NONE) {
-		g_variant_get(retvals, "(o)", &plugin_id);
-
-		plugin_instance->cancellable = g_cancellable_new();
-
-		/* plugin_instance->current_ctx_path now owns plugin_id */
-		plugin_instance->current_ctx_path = plugin_id;
-		path = plugin_id;
-		g_dbus_proxy_new_for_bus(
-			G_BUS_TYPE_SYSTEM,
-			G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES,
-			NULL, OFONO_SERVER_NAME, plugin_id,
-			OFONO_CONTEXT_INTERFACE,
-			plugin_instance->cancellable,
-			prv_context_added_complete_cb,
-			plugin_instance);
-
-		g_variant_unref(retvals);
-	}
-
-	return path;
-}
+/* The command that adds a context is only done once a proxy for the new
+   context has been created, so that the properties of the context can be
+   set by the commands that it blocks. */
 
 static void prv_context_added_cb(GObject *source_object,
 				 GAsyncResult *result,
 				 gpointer user_data)
 {
-	ofono_plugin_t *plugin_instance = user_data;
+	ofono_plugin_call_t *call = user_data;
+	ofono_plugin_t *plugin_instance = call->plugin_instance;
+	ofono_plugin_cmd_t *cmd = plugin_instance->cmds->pdata[call->cmd];
 	ofono_plugin_modem_t *modem;
-	const gchar *path;
-	ofono_plugin_cmd_t *cmd;
+	GVariant *retvals;
+
+	retvals = g_dbus_proxy_call_finish(G_DBUS_PROXY(source_object),
+					   result, NULL);
+	if (prv_end_cmd_call(call, retvals != NULL) != PROVMAN_ERR_NONE) {
+		if (cmd->type == OFONO_PLUGIN_ADD)
+			syslog(LOG_INFO,
+			       "oFono Plugin: Failed to add Internet Context");
+		else
+			syslog(LOG_INFO,
+			       "oFono Plugin: Failed to add MMS Context");
+		goto on_error;
+	}
+
+	g_variant_get(retvals, "(o)", &call->ctx_path);
+	g_variant_unref(retvals);
 
 	modem = g_hash_table_lookup(plugin_instance->modems,
 				    plugin_instance->imsi);
 
-	path = prv_context_added(plugin_instance, modem, source_object, result,
-				 user_data);
-
-	if (path) {
+	if (cmd->type == OFONO_PLUGIN_ADD) {
 		syslog(LOG_INFO,"oFono Plugin: Internet Context %s added",
-			path);
-		PROVMAN_LOGF("Internet Access Point added %s",path);
-		cmd = plugin_instance->cmds->pdata[
-			plugin_instance->current_cmd];
-
+			call->ctx_path);
+		PROVMAN_LOGF("Internet Access Point added %s",
+			     call->ctx_path);
 		provman_map_file_store_map(plugin_instance->map_file,
 					   plugin_instance->imsi,
-					   cmd->path, path);
+					   cmd->path, call->ctx_path);
+	} else if (!modem->mms_context) {
+		syslog(LOG_INFO,"oFono Plugin: MMS Context %s added",
+		       call->ctx_path);
+		PROVMAN_LOGF("MMS Access Point added %s", call->ctx_path);
+		modem->mms_context = g_strdup(call->ctx_path);
 	} else {
-		syslog(LOG_INFO,"oFono Plugin: Failed to add Internet Context");
+		syslog(LOG_INFO,"oFono Plugin: Failed to add MMS Context");
 	}
-}
 
-static void prv_mms_context_added_cb(GObject *source_object,
-				     GAsyncResult *result,
-				     gpointer user_data)
-{
-	ofono_plugin_t *plugin_instance = user_data;
-	ofono_plugin_modem_t *modem;
-	const gchar *path;
+	call->trace_id = PROVMAN_TRACE_BEGIN(PROVMAN_TRACE_CAT_DBUS,
+					     OFONO_CONTEXT_INTERFACE,
+					     call->ctx_path);
+	g_dbus_proxy_new_for_bus(
+		G_BUS_TYPE_SYSTEM,
+		G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES,
+		NULL, OFONO_SERVER_NAME, call->ctx_path,
+		OFONO_CONTEXT_INTERFACE,
+		plugin_instance->cancellable,
+		prv_context_proxy_added_cb,
+		call);
 
-	modem = g_hash_table_lookup(plugin_instance->modems,
-				    plugin_instance->imsi);
+	return;
 
-	path = prv_context_added(plugin_instance, modem, source_object, result,
-				 user_data);
-	if (path && !modem->mms_context) {
-		syslog(LOG_INFO,"oFono Plugin: MMS Context %s added", path);
-		PROVMAN_LOGF("MMS Access Point added %s",path);
-		modem->mms_context = g_strdup(path);
-	} else {
-		syslog(LOG_INFO,"oFono Plugin: Failed to add MMS Context");
-	}
+on_error:
+
+	if (retvals)
+		g_variant_unref(retvals);
+
+	prv_complete_cmd(call);
 }
 
 static void prv_prop_set_cb(GObject *source_object,
 			    GAsyncResult *result,
 			    gpointer user_data)
 {
-	int err = PROVMAN_ERR_NONE;
+	ofono_plugin_call_t *call = user_data;
 	GVariant *retvals;
-	ofono_plugin_t *plugin_instance = user_data;
-	bool again;
 
-	err = prv_complete_results_call(plugin_instance,
-					plugin_instance->current_ctx_proxy,
-					result, prv_complete_sync_out,
-					&retvals);
+	retvals = g_dbus_proxy_call_finish(G_DBUS_PROXY(source_object),
+					   result, NULL);
+	(void) prv_end_cmd_call(call, retvals != NULL);
 
-	if (err != PROVMAN_ERR_CANCELLED) {
-		if (err == PROVMAN_ERR_NONE)
-			g_variant_unref(retvals);
+	if (retvals)
+		g_variant_unref(retvals);
 
-		++plugin_instance->current_cmd;
-		do
-			prv_sync_out_step(plugin_instance, &again);
-		while (again);
-	}
+	prv_complete_cmd(call);
 }
 
 static bool prv_sync_context_set_prop(ofono_plugin_t *plugin_instance,
 				      ofono_plugin_modem_t *modem,
-				      ofono_plugin_cmd_t *cmd)
+				      unsigned int index)
 {
+	ofono_plugin_cmd_t *cmd = plugin_instance->cmds->pdata[index];
+	ofono_plugin_call_t *call;
 	gchar *context = NULL;
 	const char *local_prop;
 	const char *prop;
@@ -1421,14 +1749,14 @@ static bool prv_sync_context_set_prop(ofono_plugin_t *plugin_instance,
 
 	PROVMAN_LOGF("Setting %s=%s on Path %s", prop, value, plugin_id);
 
-	plugin_instance->current_ctx_proxy = proxy;
-	plugin_instance->cancellable = g_cancellable_new();
+	call = prv_begin_cmd_call(plugin_instance, index, OFONO_SET_PROP,
+				  prop);
 	g_dbus_proxy_call(proxy, OFONO_SET_PROP,
 			  g_variant_new("(sv)", prop,
 					g_variant_new_string(value)),
 			  G_DBUS_CALL_FLAGS_NONE,
 			  -1, plugin_instance->cancellable,
-			  prv_prop_set_cb, plugin_instance);
+			  prv_prop_set_cb, call);
 
 	g_free(ofono_context);
 
@@ -1438,16 +1766,16 @@ err:
 
 	g_free(ofono_context);
 	g_free(context);
-	++plugin_instance->current_cmd;
 
 	return false;
 }
 
 static bool prv_delete_internet_context(ofono_plugin_t *plugin_instance,
 					ofono_plugin_modem_t *modem,
-					ofono_plugin_cmd_t *cmd)
+					unsigned int index)
 {
-	bool retval = false;
+	ofono_plugin_cmd_t *cmd = plugin_instance->cmds->pdata[index];
+	ofono_plugin_call_t *call;
 	gchar *plugin_id;
 
 	plugin_id =
@@ -1455,92 +1783,248 @@ static bool prv_delete_internet_context(ofono_plugin_t *plugin_instance,
 						plugin_instance->imsi,
 						cmd->path);
 	if (!plugin_id)
-		goto err;
+		return false;
 
 	syslog(LOG_INFO, "oFono Plugin: Deleting Internet Context %s",
 	       plugin_id);
 
-	plugin_instance->cancellable = g_cancellable_new();
+	call = prv_begin_cmd_call(plugin_instance, index,
+				  OFONO_CONNMAN_REMOVE_CONTEXT, plugin_id);
 	g_dbus_proxy_call(modem->cm_proxy,
 			  OFONO_CONNMAN_REMOVE_CONTEXT,
 			  g_variant_new("(o)", plugin_id),
 			  G_DBUS_CALL_FLAGS_NONE,
 			  -1, plugin_instance->cancellable,
-			  prv_context_deleted_cb, plugin_instance);
+			  prv_context_deleted_cb, call);
 	g_free(plugin_id);
 
-	retval = true;
+	return true;
+}
 
-err:
+/* Returns false if the command could not be issued. */
 
-	return retval;
+static bool prv_issue_cmd(ofono_plugin_t *plugin_instance,
+			  ofono_plugin_modem_t *modem, unsigned int index)
+{
+	ofono_plugin_cmd_t *cmd = plugin_instance->cmds->pdata[index];
+	ofono_plugin_call_t *call;
+	const gchar *type;
+	bool issued = true;
+
+	if (cmd->type == OFONO_PLUGIN_DELETE) {
+		issued = prv_delete_internet_context(plugin_instance, modem,
+						     index);
+	} else if (cmd->type == OFONO_PLUGIN_DELETE_MMS) {
+		syslog(LOG_INFO, "oFono Plugin: Deleting MMS Context %s",
+		       modem->mms_context);
+		call = prv_begin_cmd_call(plugin_instance, index,
+					  OFONO_CONNMAN_REMOVE_CONTEXT,
+					  modem->mms_context);
+		g_dbus_proxy_call(modem->cm_proxy,
+				  OFONO_CONNMAN_REMOVE_CONTEXT,
+				  g_variant_new("(o)", modem->mms_context),
+				  G_DBUS_CALL_FLAGS_NONE,
+				  -1, plugin_instance->cancellable,
+				  prv_context_deleted_cb, call);
+	} else if (cmd->type == OFONO_PLUGIN_ADD ||
+		   cmd->type == OFONO_PLUGIN_ADD_MMS) {
+		if (cmd->type == OFONO_PLUGIN_ADD) {
+			syslog(LOG_INFO,
+			       "oFono Plugin: Creating Internet Context");
+			type = "internet";
+		} else {
+			syslog(LOG_INFO,
+			       "oFono Plugin: Creating MMS Context");
+			type = "mms";
+		}
+		call = prv_begin_cmd_call(plugin_instance, index,
+					  OFONO_CONNMAN_ADD_CONTEXT, type);
+		g_dbus_proxy_call(modem->cm_proxy,
+				  OFONO_CONNMAN_ADD_CONTEXT,
+				  g_variant_new("(s)", type),
+				  G_DBUS_CALL_FLAGS_NONE,
+				  -1, plugin_instance->cancellable,
+				  prv_context_added_cb, call);
+	} else if (cmd->type == OFONO_PLUGIN_SET) {
+		issued = prv_sync_context_set_prop(plugin_instance, modem,
+						   index);
+	}
+
+	return issued;
 }
 
+/* Issues, in order, every pending command that is not blocked, until
+   OFONO_PLUGIN_MAX_IN_FLIGHT calls are outstanding.  Commands that modify
+   different contexts are independent, so the only ordering enforced is
+   that the properties of a new context are not set until the context
+   has been added.  Calls made on the same proxy are delivered to oFono in
+   the order in which they were issued. */
 
-static void prv_sync_out_step(ofono_plugin_t *plugin_instance, bool *again)
+static void prv_sync_out_issue(ofono_plugin_t *plugin_instance)
 {
 	ofono_plugin_modem_t *modem;
 	ofono_plugin_cmd_t *cmd;
-	bool recall = false;
+	ofono_plugin_cmd_t *blocker;
+	GPtrArray *cmds = plugin_instance->cmds;
+	unsigned int i;
+	bool cancelled;
 
 	modem = g_hash_table_lookup(plugin_instance->modems,
 				    plugin_instance->imsi);
+	cancelled = g_cancellable_is_cancelled(plugin_instance->cancellable);
 
-	if (plugin_instance->current_cmd < plugin_instance->cmds->len) {
-		cmd = plugin_instance->cmds->pdata[
-			plugin_instance->current_cmd];
-		if (cmd->type == OFONO_PLUGIN_DELETE) {
-			recall = !prv_delete_internet_context(plugin_instance,
-							      modem, cmd);
-		} else if (cmd->type == OFONO_PLUGIN_DELETE_MMS) {
-			syslog(LOG_INFO,
-			       "oFono Plugin: Deleting MMS Context %s",
-			       modem->mms_context);
-			plugin_instance->cancellable = g_cancellable_new();
-			g_dbus_proxy_call(modem->cm_proxy,
-					  OFONO_CONNMAN_REMOVE_CONTEXT,
-					  g_variant_new(
-						  "(o)",modem->mms_context),
-					  G_DBUS_CALL_FLAGS_NONE,
-					  -1, plugin_instance->cancellable,
-					  prv_context_deleted_cb,
-					  plugin_instance);
-		}
-		else if (cmd->type == OFONO_PLUGIN_ADD) {
-			syslog(LOG_INFO,
-			       "oFono Plugin: Creating Internet Context");
-			plugin_instance->cancellable = g_cancellable_new();
-			g_dbus_proxy_call(modem->cm_proxy,
-					  OFONO_CONNMAN_ADD_CONTEXT,
-					  g_variant_new("(s)", "internet"),
-					  G_DBUS_CALL_FLAGS_NONE,
-					  -1, plugin_instance->cancellable,
-					  prv_context_added_cb,
-					  plugin_instance);
-		} else if (cmd->type == OFONO_PLUGIN_ADD_MMS) {
-			syslog(LOG_INFO,
-			       "oFono Plugin: Creating MMS Context");
-			plugin_instance->cancellable = g_cancellable_new();
-			g_dbus_proxy_call(modem->cm_proxy,
-					  OFONO_CONNMAN_ADD_CONTEXT,
-					  g_variant_new("(s)", "mms"),
-					  G_DBUS_CALL_FLAGS_NONE,
-					  -1, plugin_instance->cancellable,
-					  prv_mms_context_added_cb,
-					  plugin_instance);
+	for (i = plugin_instance->first_pending; !cancelled && i < cmds->len &&
+		     plugin_instance->in_flight < OFONO_PLUGIN_MAX_IN_FLIGHT;
+	     ++i) {
+		cmd = cmds->pdata[i];
+		if (cmd->state != OFONO_PLUGIN_CMD_PENDING)
+			continue;
+		if (cmd->blocker != OFONO_PLUGIN_NO_BLOCKER) {
+			blocker = cmds->pdata[cmd->blocker];
+			if (blocker->state != OFONO_PLUGIN_CMD_DONE)
+				continue;
 		}
-		else if (cmd->type == OFONO_PLUGIN_SET) {
-			recall = !prv_sync_context_set_prop(plugin_instance,
-							    modem, cmd);
+		if (prv_issue_cmd(plugin_instance, modem, i)) {
+			cmd->state = OFONO_PLUGIN_CMD_ISSUED;
+			++plugin_instance->in_flight;
+		} else {
+			cmd->state = OFONO_PLUGIN_CMD_DONE;
 		}
 	}
-	else {
-		plugin_instance->cb_err = PROVMAN_ERR_NONE;
+
+	while (plugin_instance->first_pending < cmds->len) {
+		cmd = cmds->pdata[plugin_instance->first_pending];
+		if (cmd->state == OFONO_PLUGIN_CMD_PENDING)
+			break;
+		++plugin_instance->first_pending;
+	}
+
+	if (plugin_instance->in_flight > 0 ||
+	    plugin_instance->completion_source)
+		return;
+
+	if (cancelled || plugin_instance->first_pending == cmds->len)
 		plugin_instance->completion_source =
 			g_idle_add(prv_complete_sync_out, plugin_instance);
+}
+
+static gboolean prv_multi_sim_complete_sync_out(gpointer user_data)
+{
+	ofono_plugin_t *plugin_instance = user_data;
+
+	plugin_instance->completion_source = 0;
+	plugin_instance->multi_sim = false;
+	prv_multi_sim_reset(plugin_instance);
+	g_free(plugin_instance->imsi);
+	plugin_instance->imsi = NULL;
+
+	plugin_instance->sync_out_cb(plugin_instance->cb_err,
+				     plugin_instance->sync_out_user_data);
+
+	return FALSE;
+}
+
+static void prv_multi_sim_child_sync_out_cb(int result, void *user_data)
+{
+	ofono_plugin_t *plugin_instance = user_data;
+
+	if (result != PROVMAN_ERR_NONE &&
+	    plugin_instance->cb_err == PROVMAN_ERR_NONE)
+		plugin_instance->cb_err = result;
+
+	if (--plugin_instance->children_pending == 0)
+		plugin_instance->completion_source =
+			g_idle_add(prv_multi_sim_complete_sync_out,
+				   plugin_instance);
+}
+
+static void prv_multi_sim_split(ofono_plugin_t *plugin_instance,
+				GHashTable *settings)
+{
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	const gchar *imsi;
+	const gchar *rel_key;
+	gchar *child_imsi;
+	GHashTable *child_settings;
+	ofono_plugin_t *child;
+	unsigned int i;
+
+	plugin_instance->child_settings =
+		g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+				      (GDestroyNotify) g_hash_table_unref);
+
+	for (i = 0; i < plugin_instance->children->len; ++i) {
+		child = plugin_instance->children->pdata[i];
+		g_hash_table_insert(plugin_instance->child_settings,
+				    g_strdup(child->imsi),
+				    g_hash_table_new_full(g_str_hash,
+							  g_str_equal,
+							  g_free, g_free));
 	}
 
-	*again = recall;
+	g_hash_table_iter_init(&iter, settings);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		if (!g_str_has_prefix(key, LOCAL_KEY_SIMS_ROOT))
+			continue;
+		imsi = (const gchar *) key + strlen(LOCAL_KEY_SIMS_ROOT);
+		rel_key = strchr(imsi, '/');
+		if (!rel_key)
+			continue;
+
+		child_imsi = g_strndup(imsi, rel_key - imsi);
+		child_settings = g_hash_table_lookup(
+			plugin_instance->child_settings, child_imsi);
+		g_free(child_imsi);
+
+		if (!child_settings) {
+			PROVMAN_LOGF("Ignoring %s.  Unknown IMSI", key);
+			continue;
+		}
+
+		g_hash_table_insert(child_settings,
+				    g_strdup_printf("%s%s", LOCAL_KEY_TEL_ROOT,
+						    rel_key + 1),
+				    g_strdup(value));
+	}
+}
+
+static int prv_multi_sim_sync_out(ofono_plugin_t *plugin_instance,
+				  GHashTable *settings)
+{
+	int err;
+	ofono_plugin_t *child;
+	GHashTable *child_settings;
+	unsigned int i;
+
+	if (!plugin_instance->children)
+		return PROVMAN_ERR_NOT_FOUND;
+
+	prv_multi_sim_split(plugin_instance, settings);
+
+	plugin_instance->cb_err = PROVMAN_ERR_NONE;
+	plugin_instance->children_pending = 0;
+
+	for (i = 0; i < plugin_instance->children->len; ++i) {
+		child = plugin_instance->children->pdata[i];
+		child_settings = g_hash_table_lookup(
+			plugin_instance->child_settings, child->imsi);
+		err = ofono_plugin_sync_out(child, child_settings,
+					    prv_multi_sim_child_sync_out_cb,
+					    plugin_instance);
+		if (err == PROVMAN_ERR_NONE)
+			++plugin_instance->children_pending;
+		else if (plugin_instance->cb_err == PROVMAN_ERR_NONE)
+			plugin_instance->cb_err = err;
+	}
+
+	if (plugin_instance->children_pending == 0)
+		plugin_instance->completion_source =
+			g_idle_add(prv_multi_sim_complete_sync_out,
+				   plugin_instance);
+
+	return PROVMAN_ERR_NONE;
 }
 
 int ofono_plugin_sync_out(provman_plugin_instance instance,
@@ -1550,9 +2034,15 @@ int ofono_plugin_sync_out(provman_plugin_instance instance,
 {
 	int err = PROVMAN_ERR_NONE;
 	ofono_plugin_t *plugin_instance = instance;
-	bool again;
 	ofono_plugin_modem_t *modem;
 
+	if (plugin_instance->multi_sim) {
+		plugin_instance->sync_out_cb = callback;
+		plugin_instance->sync_out_user_data = user_data;
+		err = prv_multi_sim_sync_out(plugin_instance, settings);
+		goto on_error;
+	}
+
 	modem = g_hash_table_lookup(plugin_instance->modems,
 				    plugin_instance->imsi);
 	if (!modem) {
@@ -1569,9 +2059,9 @@ int ofono_plugin_sync_out(provman_plugin_instance instance,
 
 	prv_ofono_plugin_anaylse(plugin_instance, modem, settings);
 
-	do
-		prv_sync_out_step(plugin_instance, &again);
-	while (again);
+	plugin_instance->cb_err = PROVMAN_ERR_NONE;
+	plugin_instance->cancellable = g_cancellable_new();
+	prv_sync_out_issue(plugin_instance);
 
 	return PROVMAN_ERR_NONE;
 
@@ -1583,14 +2073,26 @@ on_error:
 void ofono_plugin_sync_out_cancel(provman_plugin_instance instance)
 {
 	ofono_plugin_t *plugin_instance = instance;
+	unsigned int i;
 
-	if (plugin_instance->cancellable)
+	if (plugin_instance->children)
+		for (i = 0; i < plugin_instance->children->len; ++i)
+			ofono_plugin_sync_out_cancel(
+				plugin_instance->children->pdata[i]);
+	else if (plugin_instance->cancellable)
 		g_cancellable_cancel(plugin_instance->cancellable);
 }
 
 void ofono_plugin_abort(provman_plugin_instance instance)
 {
 	ofono_plugin_t *plugin_instance = instance;
+	unsigned int i;
+
+	if (plugin_instance->children)
+		for (i = 0; i < plugin_instance->children->len; ++i)
+			ofono_plugin_abort(plugin_instance->children->pdata[i]);
+	prv_multi_sim_reset(plugin_instance);
+	plugin_instance->multi_sim = false;
 
 	g_free(plugin_instance->imsi);
 	plugin_instance->imsi = NULL;
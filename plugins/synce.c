@@ -44,6 +44,7 @@
 #include "utils.h"
 #include "plugin.h"
 #include "synce.h"
+#include "trace.h"
 
 #define SYNCE_SERVER_NAME "org.syncevolution"
 #define SYNCE_SERVER_OBJECT "/org/syncevolution/Server"
@@ -51,9 +52,11 @@
 #define SYNCE_SERVER_GET_CONFIGS "GetConfigs"
 #define SYNCE_SERVER_GET_CONFIG "GetConfig"
 #define SYNCE_SERVER_START_SESSION_WITH_FLAGS "StartSessionWithFlags"
+#define SYNCE_SERVER_CONFIG_CHANGED "ConfigChanged"
 
 #define SYNCE_SESSION_INTERFACE "org.syncevolution.Session"
 #define SYNCE_SESSION_SET_CONFIG "SetConfig"
+#define SYNCE_SESSION_SET_NAMED_CONFIG "SetNamedConfig"
 #define SYNCE_SESSION_DETACH "Detach"
 
 #define SYNCE_DEFAULT_CONTEXT "SyncEvolution_Client"
@@ -111,6 +114,8 @@
 
 #define PLUGIN_ID_TARGET_CONFIG "target-config@"
 
+#define SYNCE_PLUGIN_MAX_IN_FLIGHT 8
+
 enum synce_plugin_so_state_t_ {
 	SYNCE_PLUGIN_REMOVE,
 	SYNCE_PLUGIN_ADD,
@@ -133,12 +138,16 @@ struct synce_plugin_t_ {
 	guint completion_source;
 	GCancellable *cancellable;
 	GDBusProxy *server_proxy;
+	gulong config_signal_id;
+	gulong owner_signal_id;
+	bool stale;
+	bool changed_in_sync_out;
 	int cb_err;
 	GHashTable *accounts;
 	GPtrArray *new_accounts;
 	unsigned int updated;
+	unsigned int in_flight;
 	GHashTableIter iter;
-	const gchar *current_account;
 	GPtrArray *to_remove;
 	GHashTable *to_update;
 	GHashTable *to_add;
@@ -148,6 +157,11 @@ struct synce_plugin_t_ {
 	session_command_t session_command;
 	gchar *current_context;
 	GHashTable *current_settings;
+	guint trace_id;
+	GVariant *template;
+	GPtrArray *cmds;
+	unsigned int next_cmd;
+	bool no_batch;
 };
 
 typedef struct synce_source_pair_t_ synce_source_pair_t;
@@ -157,6 +171,28 @@ struct synce_source_pair_t_ {
 	const char *client_source;
 };
 
+/* A configuration to be removed, added or updated by a batched
+   sync_out.  account and settings belong to the tables built by
+   prv_analyse. */
+
+typedef struct synce_plugin_cmd_t_ synce_plugin_cmd_t;
+struct synce_plugin_cmd_t_ {
+	synce_plugin_so_state_t type;
+	const gchar *account;
+	GHashTable *settings;
+};
+
+/* Tracks a single GetConfig call made during sync_in, or a single
+   SetNamedConfig call made during a batched sync_out.  Several of these
+   may be outstanding at the same time. */
+
+typedef struct synce_plugin_call_t_ synce_plugin_call_t;
+struct synce_plugin_call_t_ {
+	synce_plugin_t *plugin_instance;
+	unsigned int index;
+	guint trace_id;
+};
+
 static synce_source_pair_t g_synce_source_map[] = {
 	{ PLUGIN_PROP_SYNCE_ADDRESSBOOK, PLUGIN_KEY_ADDRESSBOOK_ROOT,
 	  LOCAL_KEY_CONTACTS_ROOT },
@@ -182,6 +218,7 @@ static const size_t g_synce_source_map_len =
 
 static void prv_get_config(synce_plugin_t *plugin_instance);
 static void prv_step_sync_out(synce_plugin_t *plugin_instance);
+static void prv_batch_issue(synce_plugin_t *plugin_instance);
 
 static void prv_g_hash_table_unref(gpointer object)
 {
@@ -218,10 +255,19 @@ void synce_plugin_delete(provman_plugin_instance instance)
 			g_hash_table_unref(plugin_instance->settings);
 		if (plugin_instance->accounts)
 			g_hash_table_unref(plugin_instance->accounts);
+		if (plugin_instance->template)
+			g_variant_unref(plugin_instance->template);
 		if (plugin_instance->cancellable)
 			g_object_unref(plugin_instance->cancellable);
-		if (plugin_instance->server_proxy)
+		if (plugin_instance->server_proxy) {
+			g_signal_handler_disconnect(
+				plugin_instance->server_proxy,
+				plugin_instance->config_signal_id);
+			g_signal_handler_disconnect(
+				plugin_instance->server_proxy,
+				plugin_instance->owner_signal_id);
 			g_object_unref(plugin_instance->server_proxy);
+		}
 		g_free(instance);
 	}
 }
@@ -255,6 +301,35 @@ static gboolean prv_complete_sync_in(gpointer user_data)
 	return FALSE;
 }
 
+static void prv_begin_call(synce_plugin_t *plugin_instance,
+			   const gchar *call, const gchar *detail)
+{
+	g_cancellable_reset(plugin_instance->cancellable);
+	plugin_instance->trace_id = PROVMAN_TRACE_BEGIN(PROVMAN_TRACE_CAT_DBUS,
+							call, detail);
+}
+
+static void prv_end_call(synce_plugin_t *plugin_instance, bool succeeded)
+{
+	PROVMAN_TRACE_END(plugin_instance->trace_id,
+			  succeeded ? PROVMAN_ERR_NONE : PROVMAN_ERR_IO);
+}
+
+static synce_plugin_call_t *prv_new_call(synce_plugin_t *plugin_instance,
+					 unsigned int index,
+					 const gchar *call_name,
+					 const gchar *detail)
+{
+	synce_plugin_call_t *call = g_new0(synce_plugin_call_t, 1);
+
+	call->plugin_instance = plugin_instance;
+	call->index = index;
+	call->trace_id = PROVMAN_TRACE_BEGIN(PROVMAN_TRACE_CAT_DBUS,
+					     call_name, detail);
+
+	return call;
+}
+
 static int prv_complete_results_call(synce_plugin_t *plugin_instance,
 				     GDBusProxy *proxy, GAsyncResult *result,
 				     GSourceFunc quit_callback,
@@ -265,6 +340,7 @@ static int prv_complete_results_call(synce_plugin_t *plugin_instance,
 	GError *error = NULL;
 
 	res = g_dbus_proxy_call_finish(proxy, result, &error);
+	prv_end_call(plugin_instance, res != NULL);
 
 	if (g_cancellable_is_cancelled(plugin_instance->cancellable)) {
 		PROVMAN_LOG("Operation Cancelled");
@@ -305,6 +381,7 @@ static int prv_complete_proxy_call(synce_plugin_t *plugin_instance,
 	GDBusProxy *res;
 
 	res = g_dbus_proxy_new_finish(result, NULL);
+	prv_end_call(plugin_instance, res != NULL);
 
 	if (g_cancellable_is_cancelled(plugin_instance->cancellable)) {
 		PROVMAN_LOG("Operation Cancelled");
@@ -457,14 +534,12 @@ static void prv_map_general_settings(synce_plugin_t *plugin_instance,
 }
 
 static void prv_get_account(synce_plugin_t *plugin_instance,
-			    GVariant *dictionary)
+			    const gchar *account_uid, GVariant *dictionary)
 {
 	GVariantIter *iter;
 	const gchar *name = NULL;
 	GVariant *settings;
-	const gchar *account_uid;
 
-	account_uid = plugin_instance->current_account;
 	iter = g_variant_iter_new(dictionary);
 
 	while (g_variant_iter_next(iter,"{&s@a{ss}}", &name, &settings)) {
@@ -479,57 +554,119 @@ static void prv_get_account(synce_plugin_t *plugin_instance,
 	g_variant_iter_free(iter);
 }
 
+/* Each GetConfig call updates the settings of a different account so the
+   replies can be merged in whatever order they arrive.  An account whose
+   configuration cannot be retrieved is left out of the accounts table and
+   is fetched again during the next sync_in. */
+
 static void prv_get_config_cb(GObject *source_object, GAsyncResult *result,
 			      gpointer user_data)
 {
-	synce_plugin_t *plugin_instance = user_data;
-	int err;
+	synce_plugin_call_t *call = user_data;
+	synce_plugin_t *plugin_instance = call->plugin_instance;
+	int err = PROVMAN_ERR_NONE;
 	GVariant *retvals;
 	GVariant *dictionary;
-	gpointer *current_account;
+	gpointer *account;
+	GError *error = NULL;
 
-	err = prv_complete_results_call(plugin_instance,
-					plugin_instance->server_proxy,
-					result, prv_complete_sync_in, &retvals);
-	if (err == PROVMAN_ERR_NONE) {
-		current_account = &
-			plugin_instance->new_accounts->pdata[
-				plugin_instance->updated];
-		g_hash_table_insert(plugin_instance->accounts,
-				    *((gchar **) current_account), NULL);
-		*current_account = NULL;
-		++plugin_instance->updated;
+	retvals = g_dbus_proxy_call_finish(plugin_instance->server_proxy,
+					   result, &error);
+
+	if (g_cancellable_is_cancelled(plugin_instance->cancellable)) {
+		PROVMAN_LOG("Operation Cancelled");
+		err = PROVMAN_ERR_CANCELLED;
+		plugin_instance->cb_err = err;
+	} else if (!retvals) {
+		PROVMAN_LOGF("Operation Failed: %s", error->message);
+		err = PROVMAN_ERR_IO;
+	} else {
+		account = &plugin_instance->new_accounts->pdata[call->index];
 		dictionary = g_variant_get_child_value(retvals, 0);
-		prv_get_account(plugin_instance, dictionary);
+		prv_get_account(plugin_instance, *account, dictionary);
 		g_variant_unref(dictionary);
-		g_variant_unref(retvals);
+		g_hash_table_insert(plugin_instance->accounts, *account, NULL);
+		*account = NULL;
 	}
 
-	if (err != PROVMAN_ERR_CANCELLED)
-		prv_get_config(plugin_instance);
+	PROVMAN_TRACE_END(call->trace_id, err);
+
+	if (retvals)
+		g_variant_unref(retvals);
+	if (error)
+		g_error_free(error);
+	g_free(call);
+
+	--plugin_instance->in_flight;
+	prv_get_config(plugin_instance);
 }
 
+/* Issues GetConfig calls for the accounts that are not yet known until
+   SYNCE_PLUGIN_MAX_IN_FLIGHT calls are outstanding.  sync_in completes
+   once all of the calls have returned, or once the last outstanding call
+   has returned after the operation has been cancelled. */
+
 static void prv_get_config(synce_plugin_t *plugin_instance)
 {
-	if (plugin_instance->updated < plugin_instance->new_accounts->len) {
-		plugin_instance->current_account =
-			g_ptr_array_index(plugin_instance->new_accounts,
-					  plugin_instance->updated);
-		g_cancellable_reset(plugin_instance->cancellable);
+	synce_plugin_call_t *call;
+	const gchar *account;
+	bool cancelled;
+
+	cancelled = g_cancellable_is_cancelled(plugin_instance->cancellable);
+
+	while (!cancelled &&
+	       plugin_instance->updated < plugin_instance->new_accounts->len &&
+	       plugin_instance->in_flight < SYNCE_PLUGIN_MAX_IN_FLIGHT) {
+		account = g_ptr_array_index(plugin_instance->new_accounts,
+					    plugin_instance->updated);
+		call = prv_new_call(plugin_instance, plugin_instance->updated,
+				    SYNCE_SERVER_GET_CONFIG, account);
 		g_dbus_proxy_call(plugin_instance->server_proxy,
 				  SYNCE_SERVER_GET_CONFIG,
-				  g_variant_new(
-					  "(sb)",
-					  plugin_instance->current_account,
-					  FALSE),
+				  g_variant_new("(sb)", account, FALSE),
 				  G_DBUS_CALL_FLAGS_NONE,
 				  -1, plugin_instance->cancellable,
-				  prv_get_config_cb, plugin_instance);
-	} else {
-		plugin_instance->cb_err = PROVMAN_ERR_NONE;
-		plugin_instance->completion_source =
-			g_idle_add(prv_complete_sync_in, plugin_instance);
+				  prv_get_config_cb, call);
+		++plugin_instance->updated;
+		++plugin_instance->in_flight;
 	}
+
+	if (plugin_instance->in_flight > 0 ||
+	    plugin_instance->completion_source)
+		return;
+
+	plugin_instance->completion_source =
+		g_idle_add(prv_complete_sync_in, plugin_instance);
+}
+
+/* Removes from the cache the accounts that are no longer returned by
+   GetConfigs, together with their settings. */
+
+static void prv_prune_accounts(synce_plugin_t *plugin_instance,
+			       GVariant *array)
+{
+	GHashTable *configs;
+	GHashTableIter iter;
+	GVariantIter *array_iter;
+	const gchar *config;
+	gpointer key;
+
+	configs = g_hash_table_new(g_str_hash, g_str_equal);
+	array_iter = g_variant_iter_new(array);
+	while (g_variant_iter_next(array_iter, "&s", &config))
+		g_hash_table_insert(configs, (gpointer) config, NULL);
+	g_variant_iter_free(array_iter);
+
+	g_hash_table_iter_init(&iter, plugin_instance->accounts);
+	while (g_hash_table_iter_next(&iter, &key, NULL))
+		if (!g_hash_table_lookup_extended(configs, key, NULL, NULL)) {
+			PROVMAN_LOGF("Account %s no longer exists", key);
+			provman_utils_remove_account(plugin_instance->settings,
+						     LOCAL_KEY_SYNC_ROOT, key);
+			g_hash_table_iter_remove(&iter);
+		}
+
+	g_hash_table_unref(configs);
 }
 
 static void prv_get_configs_cb(GObject *source_object, GAsyncResult *result,
@@ -544,6 +681,7 @@ static void prv_get_configs_cb(GObject *source_object, GAsyncResult *result,
 
 	res = g_dbus_proxy_call_finish(plugin_instance->server_proxy, result,
 				       NULL);
+	prv_end_call(plugin_instance, res != NULL);
 
 	if (g_cancellable_is_cancelled(plugin_instance->cancellable)) {
 		PROVMAN_LOG("Operation Cancelled");
@@ -561,6 +699,16 @@ static void prv_get_configs_cb(GObject *source_object, GAsyncResult *result,
 		g_ptr_array_new_with_free_func(g_free);
 
 	array = g_variant_get_child_value(res, 0);
+
+	if (plugin_instance->stale) {
+		PROVMAN_LOG("SyncEvolution configs changed.  Refetching all");
+		g_hash_table_remove_all(plugin_instance->accounts);
+		g_hash_table_remove_all(plugin_instance->settings);
+		plugin_instance->stale = false;
+	} else {
+		prv_prune_accounts(plugin_instance, array);
+	}
+
 	iter = g_variant_iter_new(array);
 	while (g_variant_iter_next(iter, "s", &config))
 		if (!g_hash_table_lookup_extended(plugin_instance->accounts,
@@ -574,6 +722,8 @@ static void prv_get_configs_cb(GObject *source_object, GAsyncResult *result,
 	g_variant_unref(array);
 
 	plugin_instance->updated = 0;
+	plugin_instance->in_flight = 0;
+	plugin_instance->cb_err = PROVMAN_ERR_NONE;
 
 	prv_get_config(plugin_instance);
 
@@ -592,6 +742,60 @@ on_error:
 		g_idle_add(prv_complete_sync_in, plugin_instance);
 }
 
+static void prv_get_configs(synce_plugin_t *plugin_instance)
+{
+	prv_begin_call(plugin_instance, SYNCE_SERVER_GET_CONFIGS, NULL);
+	g_dbus_proxy_call(plugin_instance->server_proxy,
+			  SYNCE_SERVER_GET_CONFIGS,
+			  g_variant_new("(b)", FALSE),
+			  G_DBUS_CALL_FLAGS_NONE,
+			  -1, plugin_instance->cancellable,
+			  prv_get_configs_cb, plugin_instance);
+}
+
+/* ConfigChanged does not say which configuration was modified, so any
+   change invalidates every cached account.  While a sync_out is in
+   progress we cannot tell the changes we make from those made by someone
+   else, so the signal is only recorded and the cache is marked stale once
+   the sync_out has completed. */
+
+static void prv_server_signal(GDBusProxy *proxy, gchar *sender_name,
+			      gchar *signal_name, GVariant *parameters,
+			      gpointer user_data)
+{
+	synce_plugin_t *plugin_instance = user_data;
+
+	if (strcmp(signal_name, SYNCE_SERVER_CONFIG_CHANGED))
+		return;
+
+	if (plugin_instance->to_remove) {
+		plugin_instance->changed_in_sync_out = true;
+		return;
+	}
+
+	PROVMAN_LOG("SyncEvolution configs changed.  Cache is stale");
+	plugin_instance->stale = true;
+}
+
+/* SyncEvolution exits when it has been idle for a while and its
+   configurations can be modified directly while it is not running.  The
+   cache cannot be trusted once the server has gone away, and the server
+   that replaces it may be a different version. */
+
+static void prv_server_owner_changed(GObject *object, GParamSpec *pspec,
+				     gpointer user_data)
+{
+	synce_plugin_t *plugin_instance = user_data;
+
+	PROVMAN_LOG("SyncEvolution owner changed.  Cache is stale");
+	plugin_instance->stale = true;
+	plugin_instance->no_batch = false;
+	if (plugin_instance->template) {
+		g_variant_unref(plugin_instance->template);
+		plugin_instance->template = NULL;
+	}
+}
+
 static void prv_server_proxy_created(GObject *source_object,
 				     GAsyncResult *result,
 				     gpointer user_data)
@@ -601,6 +805,7 @@ static void prv_server_proxy_created(GObject *source_object,
 	GDBusProxy *proxy = NULL;
 
 	proxy = g_dbus_proxy_new_finish(result, NULL);
+	prv_end_call(plugin_instance, proxy != NULL);
 
 	if (g_cancellable_is_cancelled(plugin_instance->cancellable)) {
 		PROVMAN_LOG("Operation Cancelled");
@@ -613,16 +818,18 @@ static void prv_server_proxy_created(GObject *source_object,
 	}
 
 	plugin_instance->server_proxy = proxy;
+	plugin_instance->config_signal_id =
+		g_signal_connect(proxy, "g-signal",
+				 G_CALLBACK(prv_server_signal),
+				 plugin_instance);
+	plugin_instance->owner_signal_id =
+		g_signal_connect(proxy, "notify::g-name-owner",
+				 G_CALLBACK(prv_server_owner_changed),
+				 plugin_instance);
 
 	PROVMAN_LOG("SyncEvolution Server Proxy Created.");
 
-	g_cancellable_reset(plugin_instance->cancellable);
-	g_dbus_proxy_call(plugin_instance->server_proxy,
-			  SYNCE_SERVER_GET_CONFIGS,
-			  g_variant_new("(b)", FALSE),
-			  G_DBUS_CALL_FLAGS_NONE,
-			  -1, plugin_instance->cancellable,
-			  prv_get_configs_cb, plugin_instance);
+	prv_get_configs(plugin_instance);
 
 	return;
 
@@ -657,16 +864,26 @@ int synce_plugin_sync_in(provman_plugin_instance instance,
 
 	plugin_instance->cancellable = g_cancellable_new();
 
-	g_dbus_proxy_new_for_bus(G_BUS_TYPE_SESSION,
-				 G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES,
-				 NULL,
-				 SYNCE_SERVER_NAME,
-				 SYNCE_SERVER_OBJECT,
-				 SYNCE_SERVER_INTERFACE,
-				 plugin_instance->cancellable,
-				 prv_server_proxy_created,
-				 plugin_instance);
+	/* The server proxy is kept between sessions so that we are told
+	   about configuration changes and only need to fetch the accounts
+	   that are new or whose configuration may have changed. */
 
+	if (plugin_instance->server_proxy) {
+		prv_get_configs(plugin_instance);
+	} else {
+		plugin_instance->trace_id = PROVMAN_TRACE_BEGIN(
+			PROVMAN_TRACE_CAT_DBUS, SYNCE_SERVER_INTERFACE, NULL);
+		g_dbus_proxy_new_for_bus(
+			G_BUS_TYPE_SESSION,
+			G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES,
+			NULL,
+			SYNCE_SERVER_NAME,
+			SYNCE_SERVER_OBJECT,
+			SYNCE_SERVER_INTERFACE,
+			plugin_instance->cancellable,
+			prv_server_proxy_created,
+			plugin_instance);
+	}
 
 	return PROVMAN_ERR_NONE;
 }
@@ -689,9 +906,22 @@ static gboolean prv_complete_sync_out(gpointer user_data)
 		plugin_instance->cancellable = NULL;
 	}
 
+	if (plugin_instance->changed_in_sync_out) {
+		PROVMAN_LOG("SyncEvolution configs changed during sync_out.  "
+			    "Cache is stale");
+		plugin_instance->stale = true;
+		plugin_instance->changed_in_sync_out = false;
+	}
+
+	plugin_instance->completion_source = 0;
 	plugin_instance->sync_out_cb(plugin_instance->cb_err,
 				     plugin_instance->sync_out_user_data);
 
+	if (plugin_instance->cmds) {
+		g_ptr_array_unref(plugin_instance->cmds);
+		plugin_instance->cmds = NULL;
+	}
+
 	g_hash_table_unref(plugin_instance->to_update);
 	plugin_instance->to_update = NULL;
 
@@ -968,7 +1198,11 @@ static GVariant* prv_create_prop_ht(GHashTable *ht)
 	return retval;
 }
 
-static GVariant *prv_make_set_context_params(GHashTable *general_settings,
+/* If name is not NULL the parameters are those of SetNamedConfig rather
+   than SetConfig. */
+
+static GVariant *prv_make_set_context_params(const gchar *name,
+					     GHashTable *general_settings,
 					     GHashTable *sources,
 					     bool update)
 {
@@ -996,18 +1230,21 @@ static GVariant *prv_make_set_context_params(GHashTable *general_settings,
 					 i);
 	g_free(settings);
 
-	settings = g_new0(GVariant *, 3);
-	settings[0] = g_variant_new_boolean(update);
-	settings[1] = g_variant_new_boolean(false);
-	settings[2] = dictionary;
+	i = 0;
+	settings = g_new0(GVariant *, 4);
+	if (name)
+		settings[i++] = g_variant_new_string(name);
+	settings[i++] = g_variant_new_boolean(update);
+	settings[i++] = g_variant_new_boolean(false);
+	settings[i++] = dictionary;
 
-	retval = g_variant_new_tuple(settings, 3);
+	retval = g_variant_new_tuple(settings, i);
 	g_free(settings);
 
 	return retval;
 }
 
-static void prv_make_context(synce_plugin_t *plugin_instance,
+static void prv_make_context(GHashTable *account_settings,
 			     GHashTable *general_settings,
 			     GHashTable *sources)
 {
@@ -1016,7 +1253,7 @@ static void prv_make_context(synce_plugin_t *plugin_instance,
 	gpointer value;
 	gchar *prop_start;
 
-	g_hash_table_iter_init(&iter, plugin_instance->current_settings);
+	g_hash_table_iter_init(&iter, account_settings);
 
 	while (g_hash_table_iter_next(&iter, &key, &value)) {
 		prop_start = ((gchar*) key) + sizeof(LOCAL_KEY_SYNC_ROOT) - 1;
@@ -1051,7 +1288,7 @@ static void prv_detach_cb(GObject *source_object, GAsyncResult *result,
 
 static void prv_session_detach(synce_plugin_t *plugin_instance)
 {
-	g_cancellable_reset(plugin_instance->cancellable);
+	prv_begin_call(plugin_instance, SYNCE_SESSION_DETACH, NULL);
 	g_dbus_proxy_call(plugin_instance->session_proxy,
 			  SYNCE_SESSION_DETACH,
 			  NULL,
@@ -1110,15 +1347,17 @@ static void prv_set_context(synce_plugin_t *plugin_instance)
 	sources = g_hash_table_new_full(g_str_hash, g_str_equal,
 					NULL, prv_g_hash_table_unref);
 
-	prv_make_context(plugin_instance, general_settings,
+	prv_make_context(plugin_instance->current_settings, general_settings,
 			 sources);
 
-	params = prv_make_set_context_params(general_settings, sources, true);
+	params = prv_make_set_context_params(NULL, general_settings, sources,
+					     true);
 
 	g_hash_table_unref(sources);
 	g_hash_table_unref(general_settings);
 
-	g_cancellable_reset(plugin_instance->cancellable);
+	prv_begin_call(plugin_instance, SYNCE_SESSION_SET_CONFIG,
+		       plugin_instance->current_context);
 	g_dbus_proxy_call(plugin_instance->session_proxy,
 			  SYNCE_SESSION_SET_CONFIG,
 			  params,
@@ -1190,68 +1429,82 @@ static void prv_merge_sources(GHashTable *sources, GHashTable *template_sources)
 	}
 }
 
+/* Builds the parameters used to create a new configuration from the
+   settings of an account and the default template.  template is the
+   dictionary returned by GetConfig for SYNCE_DEFAULT_CONTEXT. */
+
+static GVariant *prv_make_add_params(const gchar *name, const gchar *account,
+				     GHashTable *account_settings,
+				     GVariant *template)
+{
+	GHashTable *general_settings;
+	GHashTable *sources;
+	GHashTable *template_sources;
+	GVariant *params;
+
+	general_settings = g_hash_table_new_full(g_str_hash, g_str_equal,
+						 NULL, NULL);
+	sources = g_hash_table_new_full(g_str_hash, g_str_equal,
+					NULL, prv_g_hash_table_unref);
+	template_sources = g_hash_table_new_full(g_str_hash, g_str_equal,
+						 NULL, prv_g_hash_table_unref);
+	prv_unpack_template(template, general_settings, template_sources);
+
+	g_hash_table_remove(general_settings, PLUGIN_PROP_SYNCE_USERNAME);
+	g_hash_table_remove(general_settings, PLUGIN_PROP_SYNCE_PASSWORD);
+
+	prv_make_context(account_settings, general_settings, sources);
+
+	/* We don't want default source settings for local sync. */
+
+	if (strncmp(account, PLUGIN_ID_TARGET_CONFIG,
+		    sizeof(PLUGIN_ID_TARGET_CONFIG) -1))
+		prv_merge_sources(sources, template_sources);
+
+	params = prv_make_set_context_params(name, general_settings, sources,
+					     false);
+
+	g_hash_table_unref(template_sources);
+	g_hash_table_unref(sources);
+	g_hash_table_unref(general_settings);
+
+	return params;
+}
+
+static void prv_set_new_context(synce_plugin_t *plugin_instance)
+{
+	GVariant *params;
+
+	params = prv_make_add_params(NULL, plugin_instance->current_context,
+				     plugin_instance->current_settings,
+				     plugin_instance->template);
+	prv_begin_call(plugin_instance, SYNCE_SESSION_SET_CONFIG,
+		       plugin_instance->current_context);
+	g_dbus_proxy_call(plugin_instance->session_proxy,
+			  SYNCE_SESSION_SET_CONFIG,
+			  params,
+			  G_DBUS_CALL_FLAGS_NONE,
+			  -1, plugin_instance->cancellable,
+			  prv_context_set_cb, plugin_instance);
+}
+
 static void prv_context_add_cb(GObject *source_object, GAsyncResult *result,
 			       gpointer user_data)
 {
 	synce_plugin_t *plugin_instance = user_data;
 	int err;
 	GVariant *res;
-	GHashTable *general_settings;
-	GHashTable *sources;
-	GHashTable *template_sources;
-	GVariant *params;
-	GVariant *dictionary;
 
 	err = prv_complete_results_call(plugin_instance,
-					plugin_instance->session_proxy,
+					plugin_instance->server_proxy,
 					result, prv_complete_sync_out, &res);
 
-	PROVMAN_LOGF("Context added with err %d", err);
+	PROVMAN_LOGF("Template retrieved with err %d", err);
 
 	if (err == PROVMAN_ERR_NONE) {
-		general_settings = g_hash_table_new_full(g_str_hash,
-							 g_str_equal, NULL,
-							 NULL);
-
-		sources = g_hash_table_new_full(g_str_hash, g_str_equal,
-						NULL, prv_g_hash_table_unref);
-		template_sources = g_hash_table_new_full(
-			g_str_hash, g_str_equal, NULL, prv_g_hash_table_unref);
-		dictionary = g_variant_get_child_value(res, 0);
-		prv_unpack_template(dictionary, general_settings,
-				    template_sources);
-
-		g_hash_table_remove(general_settings,
-				    PLUGIN_PROP_SYNCE_USERNAME);
-		g_hash_table_remove(general_settings,
-				    PLUGIN_PROP_SYNCE_PASSWORD);
-
-		prv_make_context(plugin_instance, general_settings,
-				 sources);
-
-		/* We don't want default source settings for local sync. */
-
-		if (strncmp(plugin_instance->current_context,
-			    PLUGIN_ID_TARGET_CONFIG,
-			    sizeof(PLUGIN_ID_TARGET_CONFIG) -1))
-		    prv_merge_sources(sources, template_sources);
-
-		params = prv_make_set_context_params(general_settings, sources,
-						     false);
-		g_cancellable_reset(plugin_instance->cancellable);
-		g_dbus_proxy_call(plugin_instance->session_proxy,
-				  SYNCE_SESSION_SET_CONFIG,
-				  params,
-				  G_DBUS_CALL_FLAGS_NONE,
-				  -1, plugin_instance->cancellable,
-				  prv_context_set_cb, plugin_instance);
-
-
-		g_hash_table_unref(template_sources);
-		g_hash_table_unref(sources);
-		g_hash_table_unref(general_settings);
-		g_variant_unref(dictionary);
+		plugin_instance->template = g_variant_get_child_value(res, 0);
 		g_variant_unref(res);
+		prv_set_new_context(plugin_instance);
 	} else if (err != PROVMAN_ERR_CANCELLED) {
 		prv_session_detach(plugin_instance);
 	} else {
@@ -1259,11 +1512,20 @@ static void prv_context_add_cb(GObject *source_object, GAsyncResult *result,
 	}
 }
 
+/* The default template only changes when SyncEvolution is upgraded so it
+   is retrieved once and kept until the server goes away. */
+
 static void prv_add_context(synce_plugin_t *plugin_instance)
 {
 	PROVMAN_LOG("Adding Context Proxy");
 
-	g_cancellable_reset(plugin_instance->cancellable);
+	if (plugin_instance->template) {
+		prv_set_new_context(plugin_instance);
+		return;
+	}
+
+	prv_begin_call(plugin_instance, SYNCE_SERVER_GET_CONFIG,
+		       SYNCE_DEFAULT_CONTEXT);
 	g_dbus_proxy_call(plugin_instance->server_proxy,
 			  SYNCE_SERVER_GET_CONFIG,
 			  g_variant_new("(sb)", SYNCE_DEFAULT_CONTEXT, 1),
@@ -1311,7 +1573,8 @@ static void prv_remove_context(synce_plugin_t *plugin_instance)
 	PROVMAN_LOG("Removing Proxy");
 
 	params = g_variant_new_parsed("( false, false, @a{sa{ss}} {} )");
-	g_cancellable_reset(plugin_instance->cancellable);
+	prv_begin_call(plugin_instance, SYNCE_SESSION_SET_CONFIG,
+		       plugin_instance->current_context);
 	g_dbus_proxy_call(plugin_instance->session_proxy,
 			  SYNCE_SESSION_SET_CONFIG,
 			  params,
@@ -1360,7 +1623,7 @@ static void prv_session_proxy_cb(GObject *source_object, GAsyncResult *result,
 	if (err == PROVMAN_ERR_NONE) {
 		g_variant_get(res, "(&o)", &path);
 		PROVMAN_LOGF("Session object Path %s", path);
-		g_cancellable_reset(plugin_instance->cancellable);
+		prv_begin_call(plugin_instance, SYNCE_SESSION_INTERFACE, path);
 		g_dbus_proxy_new_for_bus(
 			G_BUS_TYPE_SESSION,
 			G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES,
@@ -1389,7 +1652,8 @@ static void prv_create_session_proxy(synce_plugin_t *plugin_instance,
 
 	params = g_variant_new_parsed("(%s, ['no-sync'])", plugin_id);
 
-	g_cancellable_reset(plugin_instance->cancellable);
+	prv_begin_call(plugin_instance, SYNCE_SERVER_START_SESSION_WITH_FLAGS,
+		       NULL);
 	plugin_instance->session_command = command;
 	g_dbus_proxy_call(plugin_instance->server_proxy,
 			  SYNCE_SERVER_START_SESSION_WITH_FLAGS,
@@ -1475,6 +1739,337 @@ static void prv_step_sync_out(synce_plugin_t *plugin_instance)
 		(void) g_idle_add(prv_complete_sync_out, plugin_instance);
 }
 
+static GVariant *prv_make_batch_params(synce_plugin_t *plugin_instance,
+					synce_plugin_cmd_t *cmd)
+{
+	GVariant *params = NULL;
+	GHashTable *general_settings;
+	GHashTable *sources;
+
+	if (cmd->type == SYNCE_PLUGIN_REMOVE) {
+		params = g_variant_new_parsed(
+			"(%s, false, false, @a{sa{ss}} {})", cmd->account);
+	} else if (cmd->type == SYNCE_PLUGIN_ADD) {
+		if (plugin_instance->template)
+			params = prv_make_add_params(cmd->account,
+						     cmd->account,
+						     cmd->settings,
+						     plugin_instance->template);
+	} else {
+		general_settings = g_hash_table_new_full(g_str_hash,
+							 g_str_equal, NULL,
+							 NULL);
+		sources = g_hash_table_new_full(g_str_hash, g_str_equal,
+						NULL, prv_g_hash_table_unref);
+		prv_make_context(cmd->settings, general_settings, sources);
+		params = prv_make_set_context_params(cmd->account,
+						     general_settings, sources,
+						     true);
+		g_hash_table_unref(sources);
+		g_hash_table_unref(general_settings);
+	}
+
+	return params;
+}
+
+static void prv_batch_cmd_cb(GObject *source_object, GAsyncResult *result,
+			     gpointer user_data)
+{
+	synce_plugin_call_t *call = user_data;
+	synce_plugin_t *plugin_instance = call->plugin_instance;
+	synce_plugin_cmd_t *cmd = plugin_instance->cmds->pdata[call->index];
+	int err = PROVMAN_ERR_NONE;
+	GVariant *res;
+	GError *error = NULL;
+
+	res = g_dbus_proxy_call_finish(plugin_instance->session_proxy, result,
+				       &error);
+
+	if (g_cancellable_is_cancelled(plugin_instance->cancellable)) {
+		PROVMAN_LOG("Operation Cancelled");
+		err = PROVMAN_ERR_CANCELLED;
+		plugin_instance->cb_err = err;
+	} else if (!res) {
+		PROVMAN_LOGF("Operation Failed: %s", error->message);
+		err = PROVMAN_ERR_IO;
+		if (g_error_matches(error, G_DBUS_ERROR,
+				    G_DBUS_ERROR_UNKNOWN_METHOD))
+			plugin_instance->no_batch = true;
+	} else {
+		PROVMAN_LOGF("Deleting proxy and settings for %s",
+			     cmd->account);
+		provman_utils_remove_account(plugin_instance->settings,
+					     LOCAL_KEY_SYNC_ROOT,
+					     cmd->account);
+		g_hash_table_remove(plugin_instance->accounts, cmd->account);
+	}
+
+	syslog(LOG_INFO, "synce Plugin: Set config %s with error %u",
+	       cmd->account, err);
+
+	PROVMAN_TRACE_END(call->trace_id, err);
+
+	if (res)
+		g_variant_unref(res);
+	if (error)
+		g_error_free(error);
+	g_free(call);
+
+	--plugin_instance->in_flight;
+	prv_batch_issue(plugin_instance);
+}
+
+static void prv_batch_detach_cb(GObject *source_object, GAsyncResult *result,
+				gpointer user_data)
+{
+	synce_plugin_t *plugin_instance = user_data;
+	int err;
+	GVariant *res;
+
+	err = prv_complete_results_call(plugin_instance,
+					plugin_instance->session_proxy,
+					result, prv_complete_sync_out, &res);
+
+	prv_session_command_cleanup(plugin_instance);
+
+	if (err == PROVMAN_ERR_CANCELLED)
+		return;
+
+	if (err == PROVMAN_ERR_NONE)
+		g_variant_unref(res);
+
+	if (plugin_instance->no_batch) {
+		PROVMAN_LOG("SetNamedConfig not supported.  "
+			    "Using one session per account");
+		prv_step_sync_out(plugin_instance);
+	} else {
+		plugin_instance->completion_source =
+			g_idle_add(prv_complete_sync_out, plugin_instance);
+	}
+}
+
+/* Issues SetNamedConfig calls on the shared session until
+   SYNCE_PLUGIN_MAX_IN_FLIGHT calls are outstanding.  Each command
+   modifies a different configuration so they are independent of each
+   other.  The session is detached once the last call has returned. */
+
+static void prv_batch_issue(synce_plugin_t *plugin_instance)
+{
+	synce_plugin_cmd_t *cmd;
+	synce_plugin_call_t *call;
+	GVariant *params;
+	GPtrArray *cmds = plugin_instance->cmds;
+	bool cancelled;
+
+	cancelled = g_cancellable_is_cancelled(plugin_instance->cancellable);
+
+	while (!cancelled && !plugin_instance->no_batch &&
+	       plugin_instance->next_cmd < cmds->len &&
+	       plugin_instance->in_flight < SYNCE_PLUGIN_MAX_IN_FLIGHT) {
+		cmd = cmds->pdata[plugin_instance->next_cmd];
+		params = prv_make_batch_params(plugin_instance, cmd);
+		if (params) {
+			call = prv_new_call(plugin_instance,
+					    plugin_instance->next_cmd,
+					    SYNCE_SESSION_SET_NAMED_CONFIG,
+					    cmd->account);
+			g_dbus_proxy_call(plugin_instance->session_proxy,
+					  SYNCE_SESSION_SET_NAMED_CONFIG,
+					  params, G_DBUS_CALL_FLAGS_NONE,
+					  -1, plugin_instance->cancellable,
+					  prv_batch_cmd_cb, call);
+			++plugin_instance->in_flight;
+		} else {
+			/* The template is only dropped if the server goes
+			   away during the sync_out. */
+
+			syslog(LOG_INFO, "synce Plugin: No template.  "
+			       "Unable to add %s", cmd->account);
+			plugin_instance->cb_err = PROVMAN_ERR_IO;
+		}
+		++plugin_instance->next_cmd;
+	}
+
+	if (plugin_instance->in_flight > 0)
+		return;
+
+	if (cancelled) {
+		prv_session_command_cleanup(plugin_instance);
+		plugin_instance->completion_source =
+			g_idle_add(prv_complete_sync_out, plugin_instance);
+	} else {
+		prv_begin_call(plugin_instance, SYNCE_SESSION_DETACH, NULL);
+		g_dbus_proxy_call(plugin_instance->session_proxy,
+				  SYNCE_SESSION_DETACH,
+				  NULL,
+				  G_DBUS_CALL_FLAGS_NONE,
+				  -1, plugin_instance->cancellable,
+				  prv_batch_detach_cb, plugin_instance);
+	}
+}
+
+static void prv_batch_session_created_cb(GObject *source_object,
+					 GAsyncResult *result,
+					 gpointer user_data)
+{
+	int err;
+	synce_plugin_t *plugin_instance = user_data;
+	GDBusProxy *proxy = NULL;
+
+	err = prv_complete_proxy_call(plugin_instance, result,
+				      prv_complete_sync_out, &proxy);
+
+	PROVMAN_LOGF("Created batch Session Proxy with err %d", err);
+
+	if (err == PROVMAN_ERR_NONE) {
+		plugin_instance->session_proxy = proxy;
+		prv_batch_issue(plugin_instance);
+	} else if (err != PROVMAN_ERR_CANCELLED) {
+		prv_step_sync_out(plugin_instance);
+	}
+}
+
+static void prv_batch_session_cb(GObject *source_object, GAsyncResult *result,
+				 gpointer user_data)
+{
+	synce_plugin_t *plugin_instance = user_data;
+	int err;
+	GVariant *res;
+	const gchar *path;
+
+	err = prv_complete_results_call(plugin_instance,
+					plugin_instance->server_proxy,
+					result, prv_complete_sync_out, &res);
+
+	PROVMAN_LOGF("Created batch Session with err %d", err);
+
+	if (err == PROVMAN_ERR_NONE) {
+		g_variant_get(res, "(&o)", &path);
+		PROVMAN_LOGF("Session object Path %s", path);
+		prv_begin_call(plugin_instance, SYNCE_SESSION_INTERFACE, path);
+		g_dbus_proxy_new_for_bus(
+			G_BUS_TYPE_SESSION,
+			G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES,
+			NULL,
+			SYNCE_SERVER_NAME,
+			path,
+			SYNCE_SESSION_INTERFACE,
+			plugin_instance->cancellable,
+			prv_batch_session_created_cb,
+			plugin_instance);
+		g_variant_unref(res);
+	} else if (err != PROVMAN_ERR_CANCELLED) {
+		prv_step_sync_out(plugin_instance);
+	}
+}
+
+static void prv_batch_start_session(synce_plugin_t *plugin_instance)
+{
+	GVariant *params;
+
+	params = g_variant_new_parsed("('', ['no-sync', 'all-configs'])");
+
+	prv_begin_call(plugin_instance, SYNCE_SERVER_START_SESSION_WITH_FLAGS,
+		       NULL);
+	g_dbus_proxy_call(plugin_instance->server_proxy,
+			  SYNCE_SERVER_START_SESSION_WITH_FLAGS,
+			  params, G_DBUS_CALL_FLAGS_NONE,
+			  -1, plugin_instance->cancellable,
+			  prv_batch_session_cb,
+			  plugin_instance);
+}
+
+static void prv_batch_template_cb(GObject *source_object,
+				  GAsyncResult *result, gpointer user_data)
+{
+	synce_plugin_t *plugin_instance = user_data;
+	int err;
+	GVariant *res;
+
+	err = prv_complete_results_call(plugin_instance,
+					plugin_instance->server_proxy,
+					result, prv_complete_sync_out, &res);
+
+	PROVMAN_LOGF("Template retrieved with err %d", err);
+
+	if (err == PROVMAN_ERR_NONE) {
+		plugin_instance->template = g_variant_get_child_value(res, 0);
+		g_variant_unref(res);
+		prv_batch_start_session(plugin_instance);
+	} else if (err != PROVMAN_ERR_CANCELLED) {
+		/* Without the template the new accounts cannot be added
+		   in the batch.  The per account path retrieves the
+		   template again for each account it adds. */
+
+		PROVMAN_LOG("No template.  Using one session per account");
+		prv_step_sync_out(plugin_instance);
+	}
+}
+
+static void prv_batch_add_cmds(GPtrArray *cmds, GHashTable *accounts,
+			       synce_plugin_so_state_t type)
+{
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	synce_plugin_cmd_t *cmd;
+
+	g_hash_table_iter_init(&iter, accounts);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		cmd = g_new0(synce_plugin_cmd_t, 1);
+		cmd->type = type;
+		cmd->account = key;
+		cmd->settings = value;
+		g_ptr_array_add(cmds, cmd);
+	}
+}
+
+/* All the accounts that need to be removed, added or updated are
+   modified from a single session created with the all-configs flag.
+   Older versions of SyncEvolution that do not support SetNamedConfig
+   fall back to prv_step_sync_out, which creates one session per
+   account. */
+
+static void prv_batch_sync_out(synce_plugin_t *plugin_instance)
+{
+	synce_plugin_cmd_t *cmd;
+	unsigned int i;
+
+	plugin_instance->cmds = g_ptr_array_new_with_free_func(g_free);
+	plugin_instance->next_cmd = 0;
+	plugin_instance->in_flight = 0;
+
+	for (i = 0; i < plugin_instance->to_remove->len; ++i) {
+		cmd = g_new0(synce_plugin_cmd_t, 1);
+		cmd->type = SYNCE_PLUGIN_REMOVE;
+		cmd->account = g_ptr_array_index(plugin_instance->to_remove,
+						 i);
+		g_ptr_array_add(plugin_instance->cmds, cmd);
+	}
+	prv_batch_add_cmds(plugin_instance->cmds, plugin_instance->to_add,
+			   SYNCE_PLUGIN_ADD);
+	prv_batch_add_cmds(plugin_instance->cmds, plugin_instance->to_update,
+			   SYNCE_PLUGIN_UPDATE);
+
+	if (plugin_instance->cmds->len == 0) {
+		plugin_instance->completion_source =
+			g_idle_add(prv_complete_sync_out, plugin_instance);
+	} else if (g_hash_table_size(plugin_instance->to_add) > 0 &&
+		   !plugin_instance->template) {
+		prv_begin_call(plugin_instance, SYNCE_SERVER_GET_CONFIG,
+			       SYNCE_DEFAULT_CONTEXT);
+		g_dbus_proxy_call(plugin_instance->server_proxy,
+				  SYNCE_SERVER_GET_CONFIG,
+				  g_variant_new("(sb)", SYNCE_DEFAULT_CONTEXT,
+						TRUE),
+				  G_DBUS_CALL_FLAGS_NONE,
+				  -1, plugin_instance->cancellable,
+				  prv_batch_template_cb, plugin_instance);
+	} else {
+		prv_batch_start_session(plugin_instance);
+	}
+}
+
 int synce_plugin_sync_out(provman_plugin_instance instance,
 			  GHashTable* settings,
 			  provman_plugin_sync_out_cb callback,
@@ -1491,8 +2086,12 @@ int synce_plugin_sync_out(provman_plugin_instance instance,
 
 	prv_analyse(plugin_instance, settings);
 	plugin_instance->cancellable = g_cancellable_new();
+	plugin_instance->cb_err = PROVMAN_ERR_NONE;
 
-	prv_step_sync_out(plugin_instance);
+	if (plugin_instance->no_batch)
+		prv_step_sync_out(plugin_instance);
+	else
+		prv_batch_sync_out(plugin_instance);
 
 	return PROVMAN_ERR_NONE;
 }
@@ -0,0 +1,364 @@
+/*
+ * Provman
+ *
+ * Copyright (C) 2011 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+
+/*!
+ * @file synthetic.c
+ *
+ * @brief contains function definitions for the synthetic load plugin
+ *
+ * The synthetic plugin simulates a middleware containing a configurable
+ * number of accounts, each with a configurable number of properties.  The
+ * settings are generated deterministically the first time the plugin is
+ * synced in and are then held in memory, so that subsequent sessions see
+ * the changes made by earlier ones.  The completion of sync_in and
+ * sync_out can be delayed to simulate slow middleware.
+ *
+ * The plugin is configured using the following environment variables:
+ *
+ * PROVMAN_SYNTHETIC_ACCOUNTS     number of accounts per root (default 10)
+ * PROVMAN_SYNTHETIC_PROPERTIES   properties per account, 1-100 (default 10)
+ * PROVMAN_SYNTHETIC_ROOTS        number of roots populated, 1-4 (default 1)
+ * PROVMAN_SYNTHETIC_SYNC_IN_MS   sync_in latency in ms (default 0)
+ * PROVMAN_SYNTHETIC_SYNC_OUT_MS  sync_out latency in ms (default 0)
+ * PROVMAN_SYNTHETIC_JITTER_MS    maximum random latency added (default 0)
+ * PROVMAN_SYNTHETIC_SEED         seed for the jitter generator (default 0)
+ *
+ * Instances registered under roots beyond PROVMAN_SYNTHETIC_ROOTS contain
+ * no settings and complete immediately.
+ *
+ *****************************************************************************/
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "error.h"
+#include "log.h"
+
+#include "plugin.h"
+#include "synthetic.h"
+
+#define SYNTHETIC_ROOT_PREFIX "/applications/synthetic"
+#define SYNTHETIC_MAX_PROPERTIES 100
+
+typedef struct synthetic_config_t_ synthetic_config_t;
+struct synthetic_config_t_ {
+	unsigned int accounts;
+	unsigned int properties;
+	unsigned int roots;
+	unsigned int sync_in_ms;
+	unsigned int sync_out_ms;
+	unsigned int jitter_ms;
+	unsigned int seed;
+};
+
+typedef struct synthetic_plugin_t_ synthetic_plugin_t;
+struct synthetic_plugin_t_ {
+	unsigned int root_index;
+	gchar *root;
+	GHashTable *store;
+	GHashTable *settings;
+	GRand *rand;
+	int cb_err;
+	guint completion_source;
+	provman_plugin_sync_in_cb sync_in_cb;
+	void *sync_in_user_data;
+	provman_plugin_sync_out_cb sync_out_cb;
+	void *sync_out_user_data;
+};
+
+static synthetic_config_t g_synthetic_config;
+static bool g_synthetic_config_read;
+
+static unsigned int prv_read_uint(const char *name, unsigned int def_value,
+				  unsigned int min_value,
+				  unsigned int max_value)
+{
+	const char *str = g_getenv(name);
+	char *end;
+	unsigned long value;
+
+	if (!str || !*str)
+		return def_value;
+
+	value = strtoul(str, &end, 10);
+	if (*end || value < min_value || value > max_value) {
+		PROVMAN_LOGF("Ignoring invalid value %s for %s", str, name);
+		return def_value;
+	}
+
+	return (unsigned int) value;
+}
+
+static void prv_read_config(void)
+{
+	synthetic_config_t *config = &g_synthetic_config;
+
+	if (g_synthetic_config_read)
+		return;
+
+	config->accounts = prv_read_uint("PROVMAN_SYNTHETIC_ACCOUNTS", 10, 0,
+					 G_MAXINT);
+	config->properties = prv_read_uint("PROVMAN_SYNTHETIC_PROPERTIES", 10,
+					   1, SYNTHETIC_MAX_PROPERTIES);
+	config->roots = prv_read_uint("PROVMAN_SYNTHETIC_ROOTS", 1, 1,
+				      SYNTHETIC_PLUGIN_MAX_ROOTS);
+	config->sync_in_ms = prv_read_uint("PROVMAN_SYNTHETIC_SYNC_IN_MS", 0,
+					   0, G_MAXINT);
+	config->sync_out_ms = prv_read_uint("PROVMAN_SYNTHETIC_SYNC_OUT_MS", 0,
+					    0, G_MAXINT);
+	config->jitter_ms = prv_read_uint("PROVMAN_SYNTHETIC_JITTER_MS", 0, 0,
+					  G_MAXINT);
+	config->seed = prv_read_uint("PROVMAN_SYNTHETIC_SEED", 0, 0,
+				     G_MAXUINT);
+
+	PROVMAN_LOGF("Synthetic plugin: %u accounts x %u properties on %u "
+		     "roots", config->accounts, config->properties,
+		     config->roots);
+
+	g_synthetic_config_read = true;
+}
+
+static int prv_synthetic_plugin_new(provman_plugin_instance *instance,
+				    unsigned int root_index)
+{
+	synthetic_plugin_t *retval;
+
+	prv_read_config();
+
+	retval = g_new0(synthetic_plugin_t, 1);
+	retval->root_index = root_index;
+	retval->root = g_strdup_printf(SYNTHETIC_ROOT_PREFIX"%u/",
+				       root_index);
+	retval->rand = g_rand_new_with_seed(g_synthetic_config.seed +
+					    root_index);
+
+	*instance = retval;
+
+	return PROVMAN_ERR_NONE;
+}
+
+int synthetic_plugin_new0(provman_plugin_instance *instance, bool system)
+{
+	return prv_synthetic_plugin_new(instance, 0);
+}
+
+int synthetic_plugin_new1(provman_plugin_instance *instance, bool system)
+{
+	return prv_synthetic_plugin_new(instance, 1);
+}
+
+int synthetic_plugin_new2(provman_plugin_instance *instance, bool system)
+{
+	return prv_synthetic_plugin_new(instance, 2);
+}
+
+int synthetic_plugin_new3(provman_plugin_instance *instance, bool system)
+{
+	return prv_synthetic_plugin_new(instance, 3);
+}
+
+void synthetic_plugin_delete(provman_plugin_instance instance)
+{
+	synthetic_plugin_t *plugin_instance;
+
+	if (instance) {
+		plugin_instance = instance;
+		if (plugin_instance->completion_source)
+			(void) g_source_remove(
+				plugin_instance->completion_source);
+		if (plugin_instance->settings)
+			g_hash_table_unref(plugin_instance->settings);
+		if (plugin_instance->store)
+			g_hash_table_unref(plugin_instance->store);
+		g_rand_free(plugin_instance->rand);
+		g_free(plugin_instance->root);
+		g_free(instance);
+	}
+}
+
+static GHashTable *prv_copy_settings(GHashTable *settings)
+{
+	GHashTable *copy;
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+
+	copy = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_iter_init(&iter, settings);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+		g_hash_table_insert(copy, g_strdup(key), g_strdup(value));
+
+	return copy;
+}
+
+static GHashTable *prv_generate_settings(synthetic_plugin_t *plugin_instance)
+{
+	GHashTable *settings;
+	unsigned int accounts = 0;
+	unsigned int i;
+	unsigned int j;
+
+	settings = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+					 g_free);
+
+	if (plugin_instance->root_index < g_synthetic_config.roots)
+		accounts = g_synthetic_config.accounts;
+
+	for (i = 0; i < accounts; ++i)
+		for (j = 0; j < g_synthetic_config.properties; ++j)
+			g_hash_table_insert(
+				settings,
+				g_strdup_printf("%sacct%05u/p%02u",
+						plugin_instance->root, i, j),
+				g_strdup_printf("value-%u-%u-%u",
+						plugin_instance->root_index,
+						i, j));
+
+	return settings;
+}
+
+static void prv_schedule_completion(synthetic_plugin_t *plugin_instance,
+				    unsigned int latency_ms,
+				    GSourceFunc callback)
+{
+	unsigned int delay = latency_ms;
+
+	if (plugin_instance->root_index < g_synthetic_config.roots &&
+	    g_synthetic_config.jitter_ms > 0)
+		delay += g_rand_int_range(plugin_instance->rand, 0,
+					  g_synthetic_config.jitter_ms + 1);
+
+	if (plugin_instance->root_index >= g_synthetic_config.roots ||
+	    delay == 0)
+		plugin_instance->completion_source =
+			g_idle_add(callback, plugin_instance);
+	else
+		plugin_instance->completion_source =
+			g_timeout_add(delay, callback, plugin_instance);
+}
+
+static gboolean prv_complete_sync_in(gpointer user_data)
+{
+	synthetic_plugin_t *plugin_instance = user_data;
+	GHashTable *settings = plugin_instance->settings;
+
+	plugin_instance->completion_source = 0;
+	plugin_instance->settings = NULL;
+
+	plugin_instance->sync_in_cb(plugin_instance->cb_err,
+				    plugin_instance->cb_err == PROVMAN_ERR_NONE ?
+				    settings : NULL,
+				    plugin_instance->sync_in_user_data);
+
+	g_hash_table_unref(settings);
+
+	return FALSE;
+}
+
+int synthetic_plugin_sync_in(provman_plugin_instance instance,
+			     const char* imsi,
+			     provman_plugin_sync_in_cb callback,
+			     void *user_data)
+{
+	synthetic_plugin_t *plugin_instance = instance;
+
+	if (!plugin_instance->store)
+		plugin_instance->store = prv_generate_settings(plugin_instance);
+
+	plugin_instance->settings = prv_copy_settings(plugin_instance->store);
+	plugin_instance->cb_err = PROVMAN_ERR_NONE;
+	plugin_instance->sync_in_cb = callback;
+	plugin_instance->sync_in_user_data = user_data;
+
+	prv_schedule_completion(plugin_instance,
+				g_synthetic_config.sync_in_ms,
+				prv_complete_sync_in);
+
+	return PROVMAN_ERR_NONE;
+}
+
+static void prv_cancel(synthetic_plugin_t *plugin_instance,
+		       GSourceFunc callback)
+{
+	if (plugin_instance->completion_source) {
+		(void) g_source_remove(plugin_instance->completion_source);
+		plugin_instance->cb_err = PROVMAN_ERR_CANCELLED;
+		plugin_instance->completion_source =
+			g_idle_add(callback, plugin_instance);
+	}
+}
+
+void synthetic_plugin_sync_in_cancel(provman_plugin_instance instance)
+{
+	prv_cancel(instance, prv_complete_sync_in);
+}
+
+static gboolean prv_complete_sync_out(gpointer user_data)
+{
+	synthetic_plugin_t *plugin_instance = user_data;
+
+	plugin_instance->completion_source = 0;
+
+	if (plugin_instance->cb_err == PROVMAN_ERR_NONE) {
+		if (plugin_instance->store)
+			g_hash_table_unref(plugin_instance->store);
+		plugin_instance->store = plugin_instance->settings;
+	} else {
+		g_hash_table_unref(plugin_instance->settings);
+	}
+	plugin_instance->settings = NULL;
+
+	plugin_instance->sync_out_cb(plugin_instance->cb_err,
+				     plugin_instance->sync_out_user_data);
+
+	return FALSE;
+}
+
+int synthetic_plugin_sync_out(provman_plugin_instance instance,
+			      GHashTable* settings,
+			      provman_plugin_sync_out_cb callback,
+			      void *user_data)
+{
+	synthetic_plugin_t *plugin_instance = instance;
+
+	plugin_instance->settings = prv_copy_settings(settings);
+	plugin_instance->cb_err = PROVMAN_ERR_NONE;
+	plugin_instance->sync_out_cb = callback;
+	plugin_instance->sync_out_user_data = user_data;
+
+	prv_schedule_completion(plugin_instance,
+				g_synthetic_config.sync_out_ms,
+				prv_complete_sync_out);
+
+	return PROVMAN_ERR_NONE;
+}
+
+void synthetic_plugin_sync_out_cancel(provman_plugin_instance instance)
+{
+	prv_cancel(instance, prv_complete_sync_out);
+}
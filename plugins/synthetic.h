@@ -0,0 +1,61 @@
+/*
+ * Provman
+ *
+ * Copyright (C) 2011 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+
+/*!
+ * @file synthetic.h
+ *
+ * @brief contains function declarations for the synthetic load plugin
+ *
+ *****************************************************************************/
+
+#ifndef PROVMAN_PLUGIN_SYNTHETIC_H
+#define PROVMAN_PLUGIN_SYNTHETIC_H
+
+#include "plugin.h"
+
+/* The synthetic plugin can be registered under up to four roots,
+   /applications/synthetic0/ to /applications/synthetic3/.  Each root has
+   its own constructor so that an instance knows which root it manages. */
+
+#define SYNTHETIC_PLUGIN_MAX_ROOTS 4
+
+int synthetic_plugin_new0(provman_plugin_instance *instance, bool system);
+int synthetic_plugin_new1(provman_plugin_instance *instance, bool system);
+int synthetic_plugin_new2(provman_plugin_instance *instance, bool system);
+int synthetic_plugin_new3(provman_plugin_instance *instance, bool system);
+void synthetic_plugin_delete(provman_plugin_instance instance);
+
+int synthetic_plugin_sync_in(provman_plugin_instance instance,
+			     const char* imsi,
+			     provman_plugin_sync_in_cb callback,
+			     void *user_data);
+void synthetic_plugin_sync_in_cancel(provman_plugin_instance instance);
+int synthetic_plugin_sync_out(provman_plugin_instance instance,
+			      GHashTable* settings,
+			      provman_plugin_sync_out_cb callback,
+			      void *user_data);
+void synthetic_plugin_sync_out_cancel(provman_plugin_instance instance);
+
+#endif
@@ -32,6 +32,7 @@
 #include "config.h"
 
 #include <string.h>
+#include <unistd.h>
 
 #include <glib.h>
 #include <gio/gio.h>
@@ -39,18 +40,21 @@
 #include "error.h"
 #include "log.h"
 #include "utils.h"
+#include "store.h"
 
 #include "plugin.h"
 #include "test.h"
 
-#define TEST_KEY_FILE_NAME "test-plugin-storage.ini"
+#define TEST_STORE_NAME "test-plugin-storage"
+#define TEST_KEY_FILE_EXT ".ini"
 #define TEST_GROUP_NAME "GROUP"
 #define TEST_DEFAULT_IMSI "012345678987654321"
 
 typedef struct test_plugin_t_ test_plugin_t;
 struct test_plugin_t_ {
 	bool system;
-	gchar *fname;
+	provman_store_t *store;
+	gchar *ns;
 	gchar *imsi;
 	GHashTable *settings;
 	provman_plugin_sync_in_cb sync_in_cb;
@@ -61,14 +65,25 @@ struct test_plugin_t_ {
 
 int test_plugin_new(provman_plugin_instance *instance, bool system)
 {
+	int err;
 	test_plugin_t *retval;
 
 	retval = g_new0(test_plugin_t, 1);
 	retval->system = system;
 
+	err = provman_store_open(system, &retval->store);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
 	*instance = retval;
 
 	return PROVMAN_ERR_NONE;
+
+on_error:
+
+	g_free(retval);
+
+	return err;
 }
 
 void test_plugin_delete(provman_plugin_instance instance)
@@ -77,8 +92,9 @@ void test_plugin_delete(provman_plugin_instance instance)
 
 	if (instance) {
 		plugin_instance = instance;
+		provman_store_close(plugin_instance->store);
 		g_free(plugin_instance->imsi);
-		g_free(plugin_instance->fname);
+		g_free(plugin_instance->ns);
 		g_free(instance);
 	}
 }
@@ -99,19 +115,70 @@ static gboolean prv_complete_sync_in(gpointer user_data)
 	return FALSE;
 }
 
+static void prv_migrate_key_file(test_plugin_t *plugin_instance)
+{
+	gchar *fname = NULL;
+	gchar *path = NULL;
+	GKeyFile *key_file;
+	gchar **keys;
+	gchar *value;
+	unsigned int i;
+
+	/* Settings used to be stored in an ini file of their own.  If one
+	   exists its contents are moved into the store. */
+
+	fname = g_strdup_printf("%s%s", plugin_instance->ns,
+				TEST_KEY_FILE_EXT);
+	if (provman_utils_make_file_path(fname, plugin_instance->system,
+					 &path) != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	key_file = g_key_file_new();
+	if (g_key_file_load_from_file(key_file, path, G_KEY_FILE_NONE,
+				      NULL)) {
+		keys = g_key_file_get_keys(key_file, TEST_GROUP_NAME,
+					   NULL, NULL);
+		for (i = 0; keys && keys[i]; ++i) {
+			value = g_key_file_get_value(key_file,
+						     TEST_GROUP_NAME, keys[i],
+						     NULL);
+			if (value)
+				provman_store_set(plugin_instance->store,
+						  plugin_instance->ns, keys[i],
+						  value);
+			g_free(value);
+		}
+		g_strfreev(keys);
+
+		if (provman_store_sync(plugin_instance->store) ==
+		    PROVMAN_ERR_NONE) {
+			PROVMAN_LOGF("Migrated %s to the store", path);
+			(void) unlink(path);
+		}
+	}
+	g_key_file_free(key_file);
+
+on_error:
+
+	g_free(path);
+	g_free(fname);
+}
+
+static void prv_add_setting(const gchar *key, const gchar *value,
+			    void *user_data)
+{
+	GHashTable *settings = user_data;
+
+	g_hash_table_insert(settings, g_strdup(key), g_strdup(value));
+}
+
 int test_plugin_sync_in(provman_plugin_instance instance,
 			const char* imsi,
 			provman_plugin_sync_in_cb callback,
 			void *user_data)
 {
-	int err = PROVMAN_ERR_NONE;
 	test_plugin_t *plugin_instance = instance;
-	gchar *value;
-	gchar **keys;
-	unsigned int i;
 	GHashTable *settings;
-	GString *fname = NULL;
-	GKeyFile *key_file;
 	gchar *test_imsi;
 
 	if (imsi[0])
@@ -119,50 +186,22 @@ int test_plugin_sync_in(provman_plugin_instance instance,
 	else
 		test_imsi = g_strdup(TEST_DEFAULT_IMSI);
 
-	fname = g_string_new(test_imsi);
-	g_string_append_c(fname, '-');
-	g_string_append(fname, TEST_KEY_FILE_NAME);
-
-	err = provman_utils_make_file_path(fname->str, plugin_instance->system,
-					   &plugin_instance->fname);
-	if (err != PROVMAN_ERR_NONE)
-		goto on_error;
+	g_free(plugin_instance->ns);
+	plugin_instance->ns = g_strdup_printf("%s-%s", test_imsi,
+					      TEST_STORE_NAME);
+	prv_migrate_key_file(plugin_instance);
 
-	key_file = g_key_file_new();
-	(void) g_key_file_load_from_file(key_file, plugin_instance->fname,
-					 G_KEY_FILE_NONE, NULL);
 	settings = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
 					 g_free);
-
-	keys = g_key_file_get_keys(key_file, TEST_GROUP_NAME,
-				   NULL, NULL);
-	if (keys)
-		for (i = 0; keys[i]; ++i) {
-			value = g_key_file_get_value(key_file,
-						     TEST_GROUP_NAME, keys[i],
-						     NULL);
-			if (!value)
-				g_free(keys[i]);
-			else
-				g_hash_table_insert(settings, keys[i], value);
-		}
-
-	g_key_file_free(key_file);
+	provman_store_foreach(plugin_instance->store, plugin_instance->ns,
+			      "", prv_add_setting, settings);
 
 	plugin_instance->imsi = test_imsi;
-	test_imsi = NULL;
 	plugin_instance->settings = settings;
 	plugin_instance->sync_in_cb = callback;
 	plugin_instance->sync_in_user_data = user_data;
 	(void) g_idle_add(prv_complete_sync_in, plugin_instance);
 
-	g_free(keys);
-
-on_error:
-
-	g_string_free(fname, TRUE);
-	g_free(test_imsi);
-
 	return PROVMAN_ERR_NONE;
 }
 
@@ -180,12 +219,27 @@ static gboolean prv_complete_sync_out(gpointer user_data)
 
 	g_free(plugin_instance->imsi);
 	plugin_instance->imsi = NULL;
-	g_free(plugin_instance->fname);
-	plugin_instance->fname = NULL;
+	g_free(plugin_instance->ns);
+	plugin_instance->ns = NULL;
 
 	return FALSE;
 }
 
+typedef struct test_plugin_removed_t_ test_plugin_removed_t;
+struct test_plugin_removed_t_ {
+	GHashTable *settings;
+	GPtrArray *removed;
+};
+
+static void prv_find_removed(const gchar *key, const gchar *value,
+			     void *user_data)
+{
+	test_plugin_removed_t *removed = user_data;
+
+	if (!g_hash_table_lookup(removed->settings, key))
+		g_ptr_array_add(removed->removed, g_strdup(key));
+}
+
 
 int test_plugin_sync_out(provman_plugin_instance instance,
 			  GHashTable* settings,
@@ -196,29 +250,28 @@ int test_plugin_sync_out(provman_plugin_instance instance,
 	GHashTableIter iter;
 	gpointer key;
 	gpointer value;
-	gsize length;
-	GKeyFile *key_file;
-	gchar *data = NULL;
+	test_plugin_removed_t removed;
+	unsigned int i;
 	test_plugin_t *plugin_instance = instance;
 
-	key_file = g_key_file_new();
-	g_hash_table_iter_init(&iter, settings);
-	while (g_hash_table_iter_next(&iter, &key, &value)) {
-		g_key_file_set_value(key_file,
-				     TEST_GROUP_NAME, key, value);
-	}
-
-	data = g_key_file_to_data(key_file, &length, NULL);
+	removed.settings = settings;
+	removed.removed = g_ptr_array_new_with_free_func(g_free);
+	provman_store_foreach(plugin_instance->store, plugin_instance->ns,
+			      "", prv_find_removed, &removed);
+	for (i = 0; i < removed.removed->len; ++i)
+		(void) provman_store_remove(plugin_instance->store,
+					    plugin_instance->ns,
+					    removed.removed->pdata[i]);
+	g_ptr_array_free(removed.removed, TRUE);
 
-	if (!data) {
-		err = PROVMAN_ERR_OOM;
-		goto on_error;
-	}
+	g_hash_table_iter_init(&iter, settings);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+		provman_store_set(plugin_instance->store, plugin_instance->ns,
+				  key, value);
 
-	if (!g_file_set_contents(plugin_instance->fname, data, length, NULL))  {
-		err = PROVMAN_ERR_IO;
+	err = provman_store_commit(plugin_instance->store);
+	if (err != PROVMAN_ERR_NONE)
 		goto on_error;
-	}
 
 	plugin_instance->sync_out_cb = callback;
 	plugin_instance->sync_out_user_data = user_data;
@@ -226,13 +279,10 @@ int test_plugin_sync_out(provman_plugin_instance instance,
 
 on_error:
 
-	g_free(data);
-	g_key_file_free(key_file);
-
 #ifdef PROVMAN_LOGGING
 	if (err != PROVMAN_ERR_NONE)
-		PROVMAN_LOGF("Unable to write key file %s",
-			     plugin_instance->fname);
+		PROVMAN_LOGF("Unable to write settings to %s",
+			     plugin_instance->ns);
 #endif
 
 	return err;
@@ -249,8 +299,8 @@ void test_plugin_abort(provman_plugin_instance instance)
 
 	g_free(plugin_instance->imsi);
 	plugin_instance->imsi = NULL;
-	g_free(plugin_instance->fname);
-	plugin_instance->fname = NULL;
+	g_free(plugin_instance->ns);
+	plugin_instance->ns = NULL;
 }
 
 const gchar* test_plugin_sim_id(provman_plugin_instance instance)
@@ -49,6 +49,37 @@
 #define OFONO_MANAGER_GET_MODEMS "GetModems"
 #define OFONO_SIM_MANAGER_GET_PROPERTIES "GetProperties"
 #define OFONO_IMSI_PROP_NAME "SubscriberIdentity"
+#define OFONO_PRESENT_PROP_NAME "Present"
+#define OFONO_MANAGER_MODEM_ADDED "ModemAdded"
+#define OFONO_MANAGER_MODEM_REMOVED "ModemRemoved"
+#define OFONO_PROPERTY_CHANGED "PropertyChanged"
+
+/* The registry caches the modems exported by oFono and the IMSI numbers of
+   their SIM cards.  It is filled in by the first utils_ofono_get_modems
+   call and then kept up to date from oFono's ModemAdded, ModemRemoved and
+   SimManager PropertyChanged signals.  Once it is ready, calls to
+   utils_ofono_get_modems are answered without any D-Bus round trips.
+
+   dirty is set whenever a signal modifies the registry.  It is cleared
+   when a scan starts, and a scan that overlaps a signal does not mark
+   the registry as ready, as the scan's results may be stale. */
+
+typedef struct utils_ofono_registry_t_ utils_ofono_registry_t;
+struct utils_ofono_registry_t_ {
+	unsigned int ref_count;
+	GDBusProxy *manager;
+	GDBusConnection *connection;
+	gulong manager_signal_id;
+	gulong owner_signal_id;
+	guint sim_signal_id;
+	GCancellable *cancellable;
+	GPtrArray *modem_paths;
+	GHashTable *imsis;
+	bool ready;
+	bool dirty;
+};
+
+static utils_ofono_registry_t *g_registry;
 
 typedef struct utils_ofono_modems_context_ utils_ofono_modems_context;
 struct utils_ofono_modems_context_ {
@@ -59,7 +90,17 @@ struct utils_ofono_modems_context_ {
 	int result;
 	GHashTable *modems;
 	GPtrArray *modem_paths;
-	unsigned int current_modem;
+	unsigned int outstanding;
+	bool cached;
+};
+
+/* The SimManager of every modem is queried concurrently.  Each query
+   records the index of its modem in modem_paths. */
+
+typedef struct utils_ofono_sim_query_ utils_ofono_sim_query;
+struct utils_ofono_sim_query_ {
+	utils_ofono_modems_context *task_context;
+	unsigned int modem;
 };
 
 static void prv_utils_ofono_modems_context_free(
@@ -84,8 +125,233 @@ static void prv_utils_ofono_modems_context_free(
 	}
 }
 
-static void prv_get_sim_manager_proxy(
-			utils_ofono_modems_context *task_context);
+static gchar *prv_find_imsi(GVariant *dictionary)
+{
+	GVariantIter *iter;
+	const gchar *prop_name;
+	GVariant *value;
+	gchar *imsi = NULL;
+
+	iter = g_variant_iter_new(dictionary);
+	while (!imsi && g_variant_iter_next(iter, "{&sv}", &prop_name,
+					    &value)) {
+		if (!strcmp(prop_name, OFONO_IMSI_PROP_NAME))
+			imsi = g_variant_dup_string(value, NULL);
+		g_variant_unref(value);
+	}
+	g_variant_iter_free(iter);
+
+	return imsi;
+}
+
+static int prv_find_modem(utils_ofono_registry_t *registry,
+			  const gchar *path)
+{
+	unsigned int i;
+
+	for (i = 0; i < registry->modem_paths->len; ++i)
+		if (!strcmp(g_ptr_array_index(registry->modem_paths, i), path))
+			return (int) i;
+
+	return -1;
+}
+
+static void prv_registry_clear(utils_ofono_registry_t *registry)
+{
+	registry->ready = false;
+	g_ptr_array_set_size(registry->modem_paths, 0);
+	g_hash_table_remove_all(registry->imsis);
+}
+
+static void prv_registry_sim_props_cb(GObject *source_object,
+				      GAsyncResult *result,
+				      gpointer user_data)
+{
+	gchar *path = user_data;
+	GVariant *retvals;
+	GVariant *dictionary;
+	gchar *imsi = NULL;
+
+	retvals = g_dbus_connection_call_finish(
+		G_DBUS_CONNECTION(source_object), result, NULL);
+
+	if (retvals) {
+		dictionary = g_variant_get_child_value(retvals, 0);
+		imsi = prv_find_imsi(dictionary);
+		g_variant_unref(dictionary);
+		g_variant_unref(retvals);
+	}
+
+	if (imsi && g_registry && prv_find_modem(g_registry, path) >= 0) {
+		PROVMAN_LOGF("Found IMSI %s for new modem %s", imsi, path);
+		g_hash_table_insert(g_registry->imsis, path, imsi);
+	} else {
+		g_free(imsi);
+		g_free(path);
+	}
+}
+
+static void prv_registry_manager_signal(GDBusProxy *proxy,
+					gchar *sender_name,
+					gchar *signal_name,
+					GVariant *parameters,
+					gpointer user_data)
+{
+	utils_ofono_registry_t *registry = user_data;
+	gchar *path;
+	int index;
+
+	if (!strcmp(signal_name, OFONO_MANAGER_MODEM_ADDED)) {
+		g_variant_get_child(parameters, 0, "o", &path);
+		PROVMAN_LOGF("Modem %s added", path);
+		registry->dirty = true;
+		if (prv_find_modem(registry, path) < 0) {
+			g_ptr_array_add(registry->modem_paths, g_strdup(path));
+
+			/* The SIM may already be ready, in which case no
+			   PropertyChanged signal will carry its IMSI. */
+
+			g_dbus_connection_call(
+				registry->connection, OFONO_SERVER_NAME, path,
+				OFONO_SIM_MANAGER_INTERFACE,
+				OFONO_SIM_MANAGER_GET_PROPERTIES, NULL,
+				G_VARIANT_TYPE("(a{sv})"),
+				G_DBUS_CALL_FLAGS_NONE, -1,
+				registry->cancellable,
+				prv_registry_sim_props_cb, path);
+		} else {
+			g_free(path);
+		}
+	} else if (!strcmp(signal_name, OFONO_MANAGER_MODEM_REMOVED)) {
+		g_variant_get_child(parameters, 0, "o", &path);
+		PROVMAN_LOGF("Modem %s removed", path);
+		registry->dirty = true;
+		index = prv_find_modem(registry, path);
+		if (index >= 0)
+			(void) g_ptr_array_remove_index(registry->modem_paths,
+							(guint) index);
+		(void) g_hash_table_remove(registry->imsis, path);
+		g_free(path);
+	}
+}
+
+static void prv_registry_sim_changed(GDBusConnection *connection,
+				     const gchar *sender_name,
+				     const gchar *object_path,
+				     const gchar *interface_name,
+				     const gchar *signal_name,
+				     GVariant *parameters,
+				     gpointer user_data)
+{
+	utils_ofono_registry_t *registry = user_data;
+	const gchar *prop_name;
+	GVariant *value;
+	gchar *imsi;
+
+	g_variant_get(parameters, "(&sv)", &prop_name, &value);
+
+	if (prv_find_modem(registry, object_path) < 0)
+		goto on_error;
+
+	if (!strcmp(prop_name, OFONO_IMSI_PROP_NAME)) {
+		registry->dirty = true;
+		imsi = g_variant_dup_string(value, NULL);
+		PROVMAN_LOGF("IMSI of %s changed to %s", object_path, imsi);
+		if (imsi[0]) {
+			g_hash_table_insert(registry->imsis,
+					    g_strdup(object_path), imsi);
+		} else {
+			(void) g_hash_table_remove(registry->imsis,
+						   object_path);
+			g_free(imsi);
+		}
+	} else if (!strcmp(prop_name, OFONO_PRESENT_PROP_NAME) &&
+		   !g_variant_get_boolean(value)) {
+		PROVMAN_LOGF("SIM removed from %s", object_path);
+		registry->dirty = true;
+		(void) g_hash_table_remove(registry->imsis, object_path);
+	}
+
+on_error:
+
+	g_variant_unref(value);
+}
+
+static void prv_registry_owner_changed(GObject *object, GParamSpec *pspec,
+				       gpointer user_data)
+{
+	utils_ofono_registry_t *registry = user_data;
+
+	PROVMAN_LOG("oFono owner changed.  Discarding cached modems");
+
+	registry->dirty = true;
+	prv_registry_clear(registry);
+}
+
+static void prv_registry_watch(utils_ofono_registry_t *registry,
+			       GDBusProxy *manager)
+{
+	registry->manager = g_object_ref(manager);
+	registry->connection = g_dbus_proxy_get_connection(manager);
+	registry->manager_signal_id =
+		g_signal_connect(manager, "g-signal",
+				 G_CALLBACK(prv_registry_manager_signal),
+				 registry);
+	registry->owner_signal_id =
+		g_signal_connect(manager, "notify::g-name-owner",
+				 G_CALLBACK(prv_registry_owner_changed),
+				 registry);
+	registry->sim_signal_id =
+		g_dbus_connection_signal_subscribe(
+			registry->connection, OFONO_SERVER_NAME,
+			OFONO_SIM_MANAGER_INTERFACE, OFONO_PROPERTY_CHANGED,
+			NULL, NULL, G_DBUS_SIGNAL_FLAGS_NONE,
+			prv_registry_sim_changed, registry, NULL);
+}
+
+static void prv_registry_update(utils_ofono_registry_t *registry,
+				utils_ofono_modems_context *task_context)
+{
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	unsigned int i;
+	const gchar *path;
+
+	prv_registry_clear(registry);
+
+	for (i = 0; i < task_context->modem_paths->len; ++i) {
+		path = g_ptr_array_index(task_context->modem_paths, i);
+		g_ptr_array_add(registry->modem_paths, g_strdup(path));
+	}
+
+	g_hash_table_iter_init(&iter, task_context->modems);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+		g_hash_table_insert(registry->imsis, g_strdup(value),
+				    g_strdup(key));
+
+	registry->ready = registry->manager && !registry->dirty;
+
+	PROVMAN_LOGF("Modem registry %s", registry->ready ? "ready" :
+		     "out of date");
+}
+
+static void prv_registry_lookup(utils_ofono_registry_t *registry,
+				utils_ofono_modems_context *task_context)
+{
+	unsigned int i;
+	const gchar *path;
+	const gchar *imsi;
+
+	for (i = 0; i < registry->modem_paths->len; ++i) {
+		path = g_ptr_array_index(registry->modem_paths, i);
+		g_ptr_array_add(task_context->modem_paths, g_strdup(path));
+		imsi = g_hash_table_lookup(registry->imsis, path);
+		if (imsi)
+			g_hash_table_insert(task_context->modems,
+					    g_strdup(imsi), g_strdup(path));
+	}
+}
 
 static gboolean prv_imsi_task_finished(gpointer user_data)
 {
@@ -98,8 +364,16 @@ static gboolean prv_imsi_task_finished(gpointer user_data)
 	GHashTableIter iter;
 
 
+	if (task_context->cached &&
+	    g_cancellable_is_cancelled(task_context->cancellable))
+		task_context->result = PROVMAN_ERR_CANCELLED;
+
 	PROVMAN_LOGF("get_modems finished result %u", task_context->result);
 
+	if (!task_context->cached && g_registry &&
+	    task_context->result == PROVMAN_ERR_NONE)
+		prv_registry_update(g_registry, task_context);
+
 	if (task_context->cancellable) {
 		g_object_unref(task_context->cancellable);
 		task_context->cancellable = NULL;
@@ -135,119 +409,87 @@ static gboolean prv_imsi_task_finished(gpointer user_data)
 	return FALSE;
 }
 
-static void prv_get_imsi_numbers(utils_ofono_modems_context *task_context)
-{
-	PROVMAN_LOG("Any more modems to check?");
-	PROVMAN_LOGF("current_modem %p", task_context->current_modem);
-
-	if (task_context->current_modem == task_context->modem_paths->len) {
-		task_context->result = PROVMAN_ERR_NONE;
-		(void) g_idle_add(prv_imsi_task_finished, task_context);
-	} else
-		prv_get_sim_manager_proxy(task_context);
-}
-
 static void prv_get_sim_properties_cb(GObject *source_object,
 				      GAsyncResult *result,
 				      gpointer user_data)
 {
-	utils_ofono_modems_context *task_context = user_data;
+	utils_ofono_sim_query *query = user_data;
+	utils_ofono_modems_context *task_context = query->task_context;
 	GVariant *retvals;
 	GVariant *dictionary;
-	GVariant *value;
 	gchar *imsi;
-	const gchar *prop_name;
-	GVariantIter *iter;
-	gboolean found;
 	gchar *path;
 
-	retvals = g_dbus_proxy_call_finish(task_context->proxy, result, NULL);
+	retvals = g_dbus_connection_call_finish(
+		G_DBUS_CONNECTION(source_object), result, NULL);
 
 	if (g_cancellable_is_cancelled(task_context->cancellable)) {
 		PROVMAN_LOG("Sim Property Get Cancelled");
 		task_context->result = PROVMAN_ERR_CANCELLED;
-		(void) g_idle_add(prv_imsi_task_finished, user_data);
 	} else if (!retvals) {
 		PROVMAN_LOG("Sim Property Get Failed");
-
-		++task_context->current_modem;
-		prv_get_imsi_numbers(task_context);
 	} else {
 		dictionary = g_variant_get_child_value(retvals, 0);
-		iter = g_variant_iter_new(dictionary);
-		while ((found = g_variant_iter_next(iter, "{&sv}", &prop_name,
-						    &value))
-		       &&
-		       (!prop_name || strcmp(prop_name, OFONO_IMSI_PROP_NAME)));
-
-		g_variant_iter_free(iter);
+		imsi = prv_find_imsi(dictionary);
+		g_variant_unref(dictionary);
 
-		if (found && value) {
-			g_variant_get(value, "s", &imsi);
+		if (imsi) {
 			PROVMAN_LOGF("Found IMSI: %s", imsi);
 			path = g_strdup(g_ptr_array_index(
 						task_context->modem_paths,
-						task_context->current_modem));
+						query->modem));
 
 			g_hash_table_insert(task_context->modems, imsi, path);
 		}
-
-		++task_context->current_modem;
-
-		prv_get_imsi_numbers(task_context);
 	}
-}
 
-static void prv_sim_manager_proxy_created(GObject *source_object,
-					  GAsyncResult *result,
-					  gpointer user_data)
-{
-	utils_ofono_modems_context *task_context = user_data;
+	if (retvals)
+		g_variant_unref(retvals);
 
-	task_context->proxy = g_dbus_proxy_new_finish(result, NULL);
+	g_free(query);
 
-	if (g_cancellable_is_cancelled(task_context->cancellable)) {
-		PROVMAN_LOG("SIM Manager Proxy creation Cancelled");
-		task_context->result = PROVMAN_ERR_CANCELLED;
-		(void) g_idle_add(prv_imsi_task_finished, user_data);
-	} else if (!task_context->proxy) {
-		PROVMAN_LOG("Unable to create SIM Manager Proxy");
-		task_context->result = PROVMAN_ERR_IO;
-		(void) g_idle_add(prv_imsi_task_finished, user_data);
-	} else {
-		PROVMAN_LOG("Invoking SimManager.GetProperties");
+	/* The replies may arrive in any order.  The default IMSI does not
+	   depend on it, as prv_imsi_task_finished picks it by walking
+	   modem_paths, which is in the order reported by oFono. */
 
-		g_object_unref(task_context->cancellable);
+	if (--task_context->outstanding == 0)
+		(void) g_idle_add(prv_imsi_task_finished, task_context);
+}
 
-		task_context->cancellable = g_cancellable_new();
+static void prv_get_imsi_numbers(utils_ofono_modems_context *task_context)
+{
+	GDBusConnection *connection;
+	utils_ofono_sim_query *query;
+	unsigned int i;
+
+	task_context->result = PROVMAN_ERR_NONE;
 
-		g_dbus_proxy_call(task_context->proxy,
-				  OFONO_SIM_MANAGER_GET_PROPERTIES,
-				  NULL, G_DBUS_CALL_FLAGS_NONE,
-				  -1, task_context->cancellable,
-				  prv_get_sim_properties_cb,
-				  task_context);
+	if (task_context->modem_paths->len == 0) {
+		(void) g_idle_add(prv_imsi_task_finished, task_context);
+		return;
 	}
-}
 
-static void prv_get_sim_manager_proxy(utils_ofono_modems_context *task_context)
-{
-	const gchar *path;
+	connection = g_dbus_proxy_get_connection(task_context->proxy);
 
 	g_object_unref(task_context->cancellable);
 	task_context->cancellable = g_cancellable_new();
-	g_object_unref(task_context->proxy);
-	task_context->proxy = NULL;
-
-	path = g_ptr_array_index(task_context->modem_paths,
-				 task_context->current_modem);
-
-	g_dbus_proxy_new_for_bus(G_BUS_TYPE_SYSTEM,
-				 G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES,
-				 NULL, OFONO_SERVER_NAME, path,
-				 OFONO_SIM_MANAGER_INTERFACE,
-				 task_context->cancellable,
-				 prv_sim_manager_proxy_created, task_context);
+
+	for (i = 0; i < task_context->modem_paths->len; ++i) {
+		query = g_new0(utils_ofono_sim_query, 1);
+		query->task_context = task_context;
+		query->modem = i;
+		++task_context->outstanding;
+
+		g_dbus_connection_call(connection, OFONO_SERVER_NAME,
+				       g_ptr_array_index(
+					       task_context->modem_paths, i),
+				       OFONO_SIM_MANAGER_INTERFACE,
+				       OFONO_SIM_MANAGER_GET_PROPERTIES, NULL,
+				       G_VARIANT_TYPE("(a{sv})"),
+				       G_DBUS_CALL_FLAGS_NONE, -1,
+				       task_context->cancellable,
+				       prv_get_sim_properties_cb, query);
+	}
 }
 
 static void prv_get_modems_cb(GObject *source_object, GAsyncResult *result,
@@ -285,9 +527,8 @@ static void prv_get_modems_cb(GObject *source_object, GAsyncResult *result,
 		g_variant_iter_free(iter);
 
 		PROVMAN_LOGF("Found %d modem(s)",
-			 g_hash_table_size(task_context->modems));
+			 task_context->modem_paths->len);
 
-		task_context->current_modem = 0;
 		prv_get_imsi_numbers(task_context);
 	}
 }
@@ -296,6 +537,9 @@ static void prv_get_modems(utils_ofono_modems_context *task_context)
 {
 	PROVMAN_LOG("Invoking GetModems");
 
+	if (g_registry)
+		g_registry->dirty = false;
+
 	g_object_unref(task_context->cancellable);
 
 	task_context->cancellable = g_cancellable_new();
@@ -325,9 +569,11 @@ static void prv_ofono_proxy_created(GObject *source_object,
 
 		task_context->result = PROVMAN_ERR_IO;
 		(void) g_idle_add(prv_imsi_task_finished, user_data);
-	}
-	else
+	} else {
+		if (g_registry && !g_registry->manager)
+			prv_registry_watch(g_registry, task_context->proxy);
 		prv_get_modems(task_context);
+	}
 }
 
 int utils_ofono_get_modems(utils_ofono_get_modems_t finished,
@@ -351,14 +597,24 @@ int utils_ofono_get_modems(utils_ofono_get_modems_t finished,
 
 	task_context->modem_paths = g_ptr_array_new_with_free_func(g_free);
 
-	g_dbus_proxy_new_for_bus(G_BUS_TYPE_SYSTEM,
-				 G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES,
-				 NULL, OFONO_SERVER_NAME, OFONO_OBJECT,
-				 OFONO_MANAGER_INTERFACE,
-				 task_context->cancellable,
-				 prv_ofono_proxy_created, task_context);
+	if (g_registry && g_registry->ready) {
+		PROVMAN_LOG("Using cached modems");
 
-	PROVMAN_LOG("Attempting to create proxy for ofono");
+		task_context->cached = true;
+		prv_registry_lookup(g_registry, task_context);
+		task_context->result = PROVMAN_ERR_NONE;
+		(void) g_idle_add(prv_imsi_task_finished, task_context);
+	} else {
+		g_dbus_proxy_new_for_bus(
+			G_BUS_TYPE_SYSTEM,
+			G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES,
+			NULL, OFONO_SERVER_NAME, OFONO_OBJECT,
+			OFONO_MANAGER_INTERFACE,
+			task_context->cancellable,
+			prv_ofono_proxy_created, task_context);
+
+		PROVMAN_LOG("Attempting to create proxy for ofono");
+	}
 
 	return PROVMAN_ERR_NONE;
 }
@@ -372,3 +628,41 @@ void utils_ofono_get_modems_cancel(utils_ofono_handle_t handle)
 	if (task_context && task_context->cancellable)
 		g_cancellable_cancel(task_context->cancellable);
 }
+
+void utils_ofono_registry_ref(void)
+{
+	if (!g_registry) {
+		g_registry = g_new0(utils_ofono_registry_t, 1);
+		g_registry->cancellable = g_cancellable_new();
+		g_registry->modem_paths =
+			g_ptr_array_new_with_free_func(g_free);
+		g_registry->imsis = g_hash_table_new_full(g_str_hash,
+							  g_str_equal,
+							  g_free, g_free);
+	}
+
+	++g_registry->ref_count;
+}
+
+void utils_ofono_registry_unref(void)
+{
+	if (!g_registry || --g_registry->ref_count > 0)
+		return;
+
+	if (g_registry->manager) {
+		g_dbus_connection_signal_unsubscribe(g_registry->connection,
+						     g_registry->sim_signal_id);
+		g_signal_handler_disconnect(g_registry->manager,
+					    g_registry->manager_signal_id);
+		g_signal_handler_disconnect(g_registry->manager,
+					    g_registry->owner_signal_id);
+		g_object_unref(g_registry->manager);
+	}
+
+	g_cancellable_cancel(g_registry->cancellable);
+	g_object_unref(g_registry->cancellable);
+	g_ptr_array_unref(g_registry->modem_paths);
+	g_hash_table_unref(g_registry->imsis);
+	g_free(g_registry);
+	g_registry = NULL;
+}
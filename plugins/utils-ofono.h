@@ -51,6 +51,13 @@ int utils_ofono_get_modems(utils_ofono_get_modems_t finished,
 
 void utils_ofono_get_modems_cancel(utils_ofono_handle_t handle);
 
+/* While at least one reference is held, the modems and IMSI numbers found
+   by utils_ofono_get_modems are cached and kept up to date from oFono's
+   signals, and later calls are answered from the cache. */
+
+void utils_ofono_registry_ref(void);
+void utils_ofono_registry_unref(void);
+
 
 
 #ifdef __cplusplus
@@ -0,0 +1,558 @@
+/*
+ * Provman
+ *
+ * Copyright (C) 2011 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+/*!
+ * @file capture.c
+ *
+ * @brief contains functions for recording the method calls received by
+ *        provman to a capture file and for reading them back
+ *
+ * Calls are recorded by provman_capture_call, which is invoked on the main
+ * thread as each call arrives.  Replies are sent from many different
+ * places, so rather than instrumenting each of them a filter is added to
+ * the connection which records outgoing replies to the calls that have
+ * been captured.  The filter runs on GDBus's worker thread, so access to
+ * the capture file is serialised by a lock.
+ *
+ * The values of password keys are replaced by PROVMAN_CAPTURE_REDACTED
+ * before they are written, both in the parameters of Set and SetMultiple
+ * and in the replies to Get, GetMultiple and GetAll.
+ *
+ *****************************************************************************/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "error.h"
+#include "utils.h"
+#include "capture.h"
+
+#define PROVMAN_CAPTURE_MAGIC "PMCAP"
+#define PROVMAN_CAPTURE_MAGIC_LEN 5
+#define PROVMAN_CAPTURE_VERSION 1
+#define PROVMAN_CAPTURE_MAX_STRING (64 * 1024 * 1024)
+#define PROVMAN_CAPTURE_SECRET "password"
+#define PROVMAN_CAPTURE_REDACTED "<redacted>"
+
+enum provman_capture_redact_t_ {
+	PROVMAN_CAPTURE_REDACT_NONE,
+	PROVMAN_CAPTURE_REDACT_VALUE,
+	PROVMAN_CAPTURE_REDACT_DICT
+};
+typedef enum provman_capture_redact_t_ provman_capture_redact_t;
+
+typedef struct provman_capture_pending_t_ provman_capture_pending_t;
+struct provman_capture_pending_t_ {
+	guint32 id;
+	provman_capture_redact_t redact;
+};
+
+struct provman_capture_reader_t_ {
+	FILE *file;
+};
+
+bool g_provman_capture_enabled;
+
+G_LOCK_DEFINE_STATIC(g_capture);
+static FILE *g_capture_file;
+static GDBusConnection *g_capture_connection;
+static guint g_capture_filter_id;
+static GHashTable *g_capture_pending;
+static guint32 g_capture_next_id;
+static gint64 g_capture_start;
+
+static void prv_write_u32(guint32 value)
+{
+	value = GUINT32_TO_LE(value);
+	(void) fwrite(&value, sizeof(value), 1, g_capture_file);
+}
+
+static void prv_write_string(const gchar *str)
+{
+	guint32 len = str ? strlen(str) : 0;
+
+	prv_write_u32(len);
+	if (len > 0)
+		(void) fwrite(str, 1, len, g_capture_file);
+}
+
+static void prv_write_variant(GVariant *variant)
+{
+	GVariant *value;
+	guint32 size;
+
+	if (!variant)
+		value = g_variant_ref_sink(g_variant_new_tuple(NULL, 0));
+	else if (G_BYTE_ORDER == G_BIG_ENDIAN)
+		value = g_variant_byteswap(variant);
+	else
+		value = g_variant_ref(variant);
+
+	size = g_variant_get_size(value);
+	prv_write_string(g_variant_get_type_string(value));
+	prv_write_u32(size);
+	(void) fwrite(g_variant_get_data(value), 1, size, g_capture_file);
+
+	g_variant_unref(value);
+}
+
+static void prv_write_header(provman_capture_kind_t kind, guint32 id)
+{
+	guint64 timestamp = g_get_monotonic_time() - g_capture_start;
+
+	timestamp = GUINT64_TO_LE(timestamp);
+	(void) fputc(kind, g_capture_file);
+	prv_write_u32(id);
+	(void) fwrite(&timestamp, sizeof(timestamp), 1, g_capture_file);
+}
+
+static bool prv_is_secret(const gchar *key)
+{
+	const gchar *name = strrchr(key, '/');
+
+	return !g_ascii_strcasecmp(name ? name + 1 : key,
+				   PROVMAN_CAPTURE_SECRET);
+}
+
+static GVariant *prv_redact_dict(GVariant *dict)
+{
+	GVariantBuilder builder;
+	GVariantIter iter;
+	const gchar *key;
+	const gchar *value;
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a{ss}"));
+	(void) g_variant_iter_init(&iter, dict);
+	while (g_variant_iter_next(&iter, "{&s&s}", &key, &value))
+		g_variant_builder_add(&builder, "{ss}", key,
+				      prv_is_secret(key) ?
+				      PROVMAN_CAPTURE_REDACTED : value);
+
+	return g_variant_builder_end(&builder);
+}
+
+/* Returns a new reference to variant, or to a copy of it from which the
+   values of password keys have been removed. */
+
+static GVariant *prv_redact(GVariant *variant, provman_capture_redact_t redact)
+{
+	GVariant *dict;
+	GVariant *retval = NULL;
+
+	if (variant && redact == PROVMAN_CAPTURE_REDACT_VALUE &&
+	    g_variant_is_of_type(variant, G_VARIANT_TYPE("(s)"))) {
+		retval = g_variant_new("(s)", PROVMAN_CAPTURE_REDACTED);
+	} else if (variant && redact == PROVMAN_CAPTURE_REDACT_DICT &&
+		   g_variant_is_of_type(variant, G_VARIANT_TYPE("(a{ss})"))) {
+		dict = g_variant_get_child_value(variant, 0);
+		retval = g_variant_new("(@a{ss})", prv_redact_dict(dict));
+		g_variant_unref(dict);
+	}
+
+	if (retval)
+		retval = g_variant_ref_sink(retval);
+	else if (variant)
+		retval = g_variant_ref(variant);
+
+	return retval;
+}
+
+static GVariant *prv_redact_call(const gchar *method, GVariant *parameters)
+{
+	const gchar *key;
+	GVariant *retval = NULL;
+
+	if (!g_strcmp0(method, "Set") &&
+	    g_variant_is_of_type(parameters, G_VARIANT_TYPE("(ss)"))) {
+		g_variant_get(parameters, "(&s&s)", &key, NULL);
+		if (prv_is_secret(key))
+			retval = g_variant_ref_sink(
+				g_variant_new("(ss)", key,
+					      PROVMAN_CAPTURE_REDACTED));
+	} else if (!g_strcmp0(method, "SetMultiple")) {
+		retval = prv_redact(parameters, PROVMAN_CAPTURE_REDACT_DICT);
+	}
+
+	return retval ? retval : g_variant_ref(parameters);
+}
+
+static provman_capture_redact_t prv_reply_redaction(const gchar *method,
+						    GVariant *parameters)
+{
+	const gchar *key;
+	provman_capture_redact_t redact = PROVMAN_CAPTURE_REDACT_NONE;
+
+	if (!g_strcmp0(method, "Get") &&
+	    g_variant_is_of_type(parameters, G_VARIANT_TYPE("(s)"))) {
+		g_variant_get(parameters, "(&s)", &key);
+		if (prv_is_secret(key))
+			redact = PROVMAN_CAPTURE_REDACT_VALUE;
+	} else if (!g_strcmp0(method, "GetMultiple") ||
+		   !g_strcmp0(method, "GetAll")) {
+		redact = PROVMAN_CAPTURE_REDACT_DICT;
+	}
+
+	return redact;
+}
+
+static gchar *prv_make_pending_key(const gchar *client, guint32 serial)
+{
+	return g_strdup_printf("%s/%u", client ? client : "", serial);
+}
+
+static GDBusMessage *prv_filter(GDBusConnection *connection,
+				GDBusMessage *message, gboolean incoming,
+				gpointer user_data)
+{
+	GDBusMessageType type = g_dbus_message_get_message_type(message);
+	gchar *key;
+	provman_capture_pending_t *pending;
+	GVariant *body;
+
+	if (incoming || (type != G_DBUS_MESSAGE_TYPE_METHOD_RETURN &&
+			 type != G_DBUS_MESSAGE_TYPE_ERROR))
+		goto on_error;
+
+	key = prv_make_pending_key(g_dbus_message_get_destination(message),
+				   g_dbus_message_get_reply_serial(message));
+
+	G_LOCK(g_capture);
+	pending = g_capture_file ?
+		g_hash_table_lookup(g_capture_pending, key) : NULL;
+	if (pending) {
+		if (type == G_DBUS_MESSAGE_TYPE_ERROR) {
+			prv_write_header(PROVMAN_CAPTURE_ERROR, pending->id);
+			prv_write_string(
+				g_dbus_message_get_error_name(message));
+		} else {
+			prv_write_header(PROVMAN_CAPTURE_REPLY, pending->id);
+			body = prv_redact(g_dbus_message_get_body(message),
+					  pending->redact);
+			prv_write_variant(body);
+			if (body)
+				g_variant_unref(body);
+		}
+		g_hash_table_remove(g_capture_pending, key);
+	}
+	G_UNLOCK(g_capture);
+
+	g_free(key);
+
+on_error:
+
+	return message;
+}
+
+int provman_capture_open(GDBusConnection *connection, const char *path)
+{
+	int ret_val = PROVMAN_ERR_NONE;
+	FILE *file;
+
+	if (g_capture_file)
+		goto on_error;
+
+	if (!path) {
+		ret_val = PROVMAN_ERR_OPEN;
+		goto on_error;
+	}
+
+	ret_val = provman_utils_create_private_file(path, &file);
+	if (ret_val != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	(void) fwrite(PROVMAN_CAPTURE_MAGIC, 1, PROVMAN_CAPTURE_MAGIC_LEN,
+		      file);
+	(void) fputc(PROVMAN_CAPTURE_VERSION, file);
+
+	G_LOCK(g_capture);
+	g_capture_file = file;
+	g_capture_pending = g_hash_table_new_full(g_str_hash, g_str_equal,
+						  g_free, g_free);
+	g_capture_next_id = 1;
+	g_capture_start = g_get_monotonic_time();
+	G_UNLOCK(g_capture);
+
+	g_capture_connection = g_object_ref(connection);
+	g_capture_filter_id = g_dbus_connection_add_filter(connection,
+							   prv_filter, NULL,
+							   NULL);
+	g_provman_capture_enabled = true;
+
+on_error:
+
+	return ret_val;
+}
+
+void provman_capture_close(void)
+{
+	g_provman_capture_enabled = false;
+
+	if (g_capture_connection) {
+		g_dbus_connection_remove_filter(g_capture_connection,
+						g_capture_filter_id);
+		g_object_unref(g_capture_connection);
+		g_capture_connection = NULL;
+		g_capture_filter_id = 0;
+	}
+
+	/* The filter may still be running on the worker thread, in which
+	   case it will find g_capture_file set to NULL. */
+
+	G_LOCK(g_capture);
+	if (g_capture_file) {
+		fclose(g_capture_file);
+		g_capture_file = NULL;
+		g_hash_table_unref(g_capture_pending);
+		g_capture_pending = NULL;
+	}
+	G_UNLOCK(g_capture);
+}
+
+void provman_capture_call(GDBusMethodInvocation *invocation)
+{
+	GDBusMessage *message;
+	const gchar *client = g_dbus_method_invocation_get_sender(invocation);
+	const gchar *method =
+		g_dbus_method_invocation_get_method_name(invocation);
+	GVariant *parameters =
+		g_dbus_method_invocation_get_parameters(invocation);
+	provman_capture_pending_t *pending;
+	gchar *key;
+
+	message = g_dbus_method_invocation_get_message(invocation);
+	key = prv_make_pending_key(client, g_dbus_message_get_serial(message));
+	parameters = prv_redact_call(method, parameters);
+
+	G_LOCK(g_capture);
+	if (g_capture_file) {
+		pending = g_new(provman_capture_pending_t, 1);
+		pending->id = g_capture_next_id++;
+		pending->redact = prv_reply_redaction(method, parameters);
+		g_hash_table_insert(g_capture_pending, key, pending);
+		key = NULL;
+
+		prv_write_header(PROVMAN_CAPTURE_CALL, pending->id);
+		prv_write_string(client);
+		prv_write_string(method);
+		prv_write_variant(parameters);
+	}
+	G_UNLOCK(g_capture);
+
+	g_variant_unref(parameters);
+	g_free(key);
+}
+
+int provman_capture_reader_new(const char *path,
+			       provman_capture_reader_t **reader)
+{
+	int ret_val = PROVMAN_ERR_NONE;
+	FILE *file;
+	gchar header[PROVMAN_CAPTURE_MAGIC_LEN + 1];
+
+	file = fopen(path, "rb");
+	if (!file) {
+		ret_val = PROVMAN_ERR_OPEN;
+		goto on_error;
+	}
+
+	if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+	    memcmp(header, PROVMAN_CAPTURE_MAGIC,
+		   PROVMAN_CAPTURE_MAGIC_LEN) ||
+	    header[PROVMAN_CAPTURE_MAGIC_LEN] != PROVMAN_CAPTURE_VERSION) {
+		fclose(file);
+		ret_val = PROVMAN_ERR_CORRUPT;
+		goto on_error;
+	}
+
+	*reader = g_new0(provman_capture_reader_t, 1);
+	(*reader)->file = file;
+
+on_error:
+
+	return ret_val;
+}
+
+void provman_capture_reader_delete(provman_capture_reader_t *reader)
+{
+	if (reader) {
+		fclose(reader->file);
+		g_free(reader);
+	}
+}
+
+static int prv_read_u32(FILE *file, guint32 *value)
+{
+	if (fread(value, sizeof(*value), 1, file) != 1)
+		return PROVMAN_ERR_CORRUPT;
+
+	*value = GUINT32_FROM_LE(*value);
+
+	return PROVMAN_ERR_NONE;
+}
+
+static int prv_read_data(FILE *file, gchar **data, guint32 *size)
+{
+	int err;
+	gchar *buffer;
+
+	err = prv_read_u32(file, size);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	if (*size > PROVMAN_CAPTURE_MAX_STRING) {
+		err = PROVMAN_ERR_CORRUPT;
+		goto on_error;
+	}
+
+	buffer = g_malloc(*size + 1);
+	if (fread(buffer, 1, *size, file) != *size) {
+		g_free(buffer);
+		err = PROVMAN_ERR_CORRUPT;
+		goto on_error;
+	}
+	buffer[*size] = 0;
+	*data = buffer;
+
+on_error:
+
+	return err;
+}
+
+static int prv_read_string(FILE *file, gchar **str)
+{
+	guint32 len;
+
+	return prv_read_data(file, str, &len);
+}
+
+static int prv_read_variant(FILE *file, GVariant **variant)
+{
+	int err;
+	gchar *type = NULL;
+	gchar *data = NULL;
+	guint32 size;
+	GVariant *value;
+
+	err = prv_read_string(file, &type);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	if (!g_variant_type_string_is_valid(type)) {
+		err = PROVMAN_ERR_CORRUPT;
+		goto on_error;
+	}
+
+	err = prv_read_data(file, &data, &size);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	value = g_variant_new_from_data(G_VARIANT_TYPE(type), data, size,
+					FALSE, g_free, data);
+	if (G_BYTE_ORDER == G_BIG_ENDIAN) {
+		*variant = g_variant_byteswap(value);
+		g_variant_unref(g_variant_ref_sink(value));
+	} else {
+		*variant = g_variant_ref_sink(value);
+	}
+
+on_error:
+
+	g_free(type);
+
+	return err;
+}
+
+int provman_capture_reader_next(provman_capture_reader_t *reader,
+				provman_capture_record_t **record)
+{
+	int err;
+	int kind;
+	provman_capture_record_t *rec = NULL;
+	guint64 timestamp;
+
+	*record = NULL;
+
+	kind = fgetc(reader->file);
+	if (kind == EOF)
+		return PROVMAN_ERR_NONE;
+
+	rec = g_new0(provman_capture_record_t, 1);
+	rec->kind = kind;
+
+	err = prv_read_u32(reader->file, &rec->id);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	if (fread(&timestamp, sizeof(timestamp), 1, reader->file) != 1) {
+		err = PROVMAN_ERR_CORRUPT;
+		goto on_error;
+	}
+	rec->timestamp = (gint64) GUINT64_FROM_LE(timestamp);
+
+	switch (kind) {
+	case PROVMAN_CAPTURE_CALL:
+		err = prv_read_string(reader->file, &rec->client);
+		if (err == PROVMAN_ERR_NONE)
+			err = prv_read_string(reader->file, &rec->method);
+		if (err == PROVMAN_ERR_NONE)
+			err = prv_read_variant(reader->file, &rec->variant);
+		break;
+	case PROVMAN_CAPTURE_REPLY:
+		err = prv_read_variant(reader->file, &rec->variant);
+		break;
+	case PROVMAN_CAPTURE_ERROR:
+		err = prv_read_string(reader->file, &rec->error);
+		break;
+	default:
+		err = PROVMAN_ERR_CORRUPT;
+		break;
+	}
+
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	*record = rec;
+
+	return PROVMAN_ERR_NONE;
+
+on_error:
+
+	provman_capture_record_delete(rec);
+
+	return err;
+}
+
+void provman_capture_record_delete(provman_capture_record_t *record)
+{
+	if (record) {
+		g_free(record->client);
+		g_free(record->method);
+		g_free(record->error);
+		if (record->variant)
+			g_variant_unref(record->variant);
+		g_free(record);
+	}
+}
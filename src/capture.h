@@ -0,0 +1,84 @@
+/*
+ * Provman
+ *
+ * Copyright (C) 2011 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+/*!
+ * @file capture.h
+ *
+ * @brief Contains function declarations for recording the method calls
+ *        received by provman and reading them back
+ *
+ * A capture file starts with a six byte header, "PMCAP" followed by a
+ * version number.  This is followed by a sequence of records, one for
+ * each method call received and one for each reply sent.  Each record
+ * begins with a kind byte, a 32 bit record identifier and a 64 bit
+ * timestamp, in microseconds from the point at which the capture was
+ * started.  Calls then contain the unique name of the client, the method
+ * name and the parameters.  Replies contain the value returned and errors
+ * the name of the D-Bus error.  Replies and errors carry the identifier of
+ * the call to which they correspond.  Integers are little endian.
+ * Strings are preceded by their length.  GVariants are stored as their
+ * type string followed by their serialised data.
+ *
+ *****************************************************************************/
+
+#ifndef PROVMAN_CAPTURE_H
+#define PROVMAN_CAPTURE_H
+
+#include <stdbool.h>
+#include <gio/gio.h>
+
+enum provman_capture_kind_t_ {
+	PROVMAN_CAPTURE_CALL = 'C',
+	PROVMAN_CAPTURE_REPLY = 'R',
+	PROVMAN_CAPTURE_ERROR = 'E'
+};
+typedef enum provman_capture_kind_t_ provman_capture_kind_t;
+
+typedef struct provman_capture_record_t_ provman_capture_record_t;
+struct provman_capture_record_t_ {
+	provman_capture_kind_t kind;
+	guint32 id;
+	gint64 timestamp;
+	gchar *client;
+	gchar *method;
+	gchar *error;
+	GVariant *variant;
+};
+
+typedef struct provman_capture_reader_t_ provman_capture_reader_t;
+
+extern bool g_provman_capture_enabled;
+
+int provman_capture_open(GDBusConnection *connection, const char *path);
+void provman_capture_close(void);
+void provman_capture_call(GDBusMethodInvocation *invocation);
+
+int provman_capture_reader_new(const char *path,
+			       provman_capture_reader_t **reader);
+int provman_capture_reader_next(provman_capture_reader_t *reader,
+				provman_capture_record_t **record);
+void provman_capture_reader_delete(provman_capture_reader_t *reader);
+void provman_capture_record_delete(provman_capture_record_t *record);
+
+#endif
@@ -28,17 +28,178 @@
  * @brief
  * Macros and functions for logging
  *
+ * The ring buffer is a bounded multi-producer, single consumer queue.
+ * Each slot carries a sequence number.  A producer may claim slot
+ * pos % PROVMAN_LOG_SLOTS only when its sequence number equals pos, and
+ * publishes the message by setting it to pos + 1.  The writer thread
+ * consumes the slot when its sequence number is pos + 1 and hands it back
+ * to the producers by setting it to pos + PROVMAN_LOG_SLOTS.
+ *
+ * The writer thread blocks on an eventfd while the ring buffer is empty.
+ * Before it does so it sets g_log_sleeping and checks the buffer once
+ * more.  A producer that finds g_log_sleeping set after publishing a
+ * message clears it and wakes the writer, so only the first message
+ * logged after a quiet period pays for a system call.
+ *
  ******************************************************************************/
 
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <glib.h>
 
 #include "config.h"
 #include "log.h"
 #include "error.h"
 
+#define PROVMAN_LOG_SLOTS 1024
+#define PROVMAN_LOG_MESSAGE_SIZE 512
+
+#define PROVMAN_LOG_LEVEL_ENV "PROVMAN_LOG_LEVEL"
+
+int g_provman_log_level = PROVMAN_LOG_LEVEL_DEBUG;
+
 #ifdef PROVMAN_LOGGING
+
+typedef struct provman_log_slot_t_ provman_log_slot_t;
+struct provman_log_slot_t_ {
+	volatile gint sequence;
+	char message[PROVMAN_LOG_MESSAGE_SIZE];
+};
+
 static FILE *g_log_file;
+static provman_log_slot_t *g_log_slots;
+static volatile gint g_log_head;
+static volatile gint g_log_dropped;
+static volatile gint g_log_quit;
+static volatile gint g_log_sleeping;
+static guint g_log_tail;
+static GThread *g_log_writer;
+static int g_log_event = -1;
+
+static const char *g_log_level_names[] = {
+	"none", "error", "info", "debug"
+};
+
+static void prv_wake_writer(void)
+{
+	if (g_atomic_int_get(&g_log_sleeping) &&
+	    g_atomic_int_compare_and_exchange(&g_log_sleeping, 1, 0))
+		(void) eventfd_write(g_log_event, 1);
+}
+
+static provman_log_slot_t *prv_claim_slot(void)
+{
+	provman_log_slot_t *slot;
+	guint pos;
+	gint diff;
+
+	for (;;) {
+		pos = (guint) g_atomic_int_get(&g_log_head);
+		slot = &g_log_slots[pos % PROVMAN_LOG_SLOTS];
+		diff = (gint) ((guint) g_atomic_int_get(&slot->sequence) - pos);
+
+		if (diff == 0) {
+			if (g_atomic_int_compare_and_exchange(
+				    &g_log_head, (gint) pos, (gint) (pos + 1)))
+				return slot;
+		} else if (diff < 0) {
+			g_atomic_int_inc(&g_log_dropped);
+			prv_wake_writer();
+			return NULL;
+		}
+	}
+}
+
+static void prv_publish_slot(provman_log_slot_t *slot)
+{
+	g_atomic_int_add(&slot->sequence, 1);
+	prv_wake_writer();
+}
+
+static bool prv_write_pending(void)
+{
+	provman_log_slot_t *slot;
+	bool written = false;
+	gint dropped;
+
+	for (;;) {
+		slot = &g_log_slots[g_log_tail % PROVMAN_LOG_SLOTS];
+		if ((guint) g_atomic_int_get(&slot->sequence) !=
+		    g_log_tail + 1)
+			break;
+
+		fputs(slot->message, g_log_file);
+		fputc('\n', g_log_file);
+		g_atomic_int_set(&slot->sequence,
+				 (gint) (g_log_tail + PROVMAN_LOG_SLOTS));
+		++g_log_tail;
+		written = true;
+	}
+
+	do
+		dropped = g_atomic_int_get(&g_log_dropped);
+	while (dropped &&
+	       !g_atomic_int_compare_and_exchange(&g_log_dropped, dropped, 0));
+
+	if (dropped) {
+		fprintf(g_log_file, "*** %d log messages dropped ***\n",
+			dropped);
+		written = true;
+	}
+
+	if (written)
+		fflush(g_log_file);
+
+	return written;
+}
+
+static gpointer prv_writer_thread(gpointer data)
+{
+	eventfd_t count;
+
+	while (!g_atomic_int_get(&g_log_quit)) {
+		if (prv_write_pending())
+			continue;
+
+		g_atomic_int_set(&g_log_sleeping, 1);
+		if (!prv_write_pending() && !g_atomic_int_get(&g_log_quit))
+			(void) eventfd_read(g_log_event, &count);
+		g_atomic_int_set(&g_log_sleeping, 0);
+	}
+
+	(void) prv_write_pending();
+
+	return NULL;
+}
+
+static void prv_read_level(void)
+{
+	const char *level = g_getenv(PROVMAN_LOG_LEVEL_ENV);
+	unsigned int i;
+	char *end;
+	long value;
+
+	if (!level)
+		return;
+
+	for (i = 0; i < G_N_ELEMENTS(g_log_level_names); ++i)
+		if (!g_ascii_strcasecmp(level, g_log_level_names[i])) {
+			g_provman_log_level = i;
+			return;
+		}
+
+	value = strtol(level, &end, 10);
+	if (*level && !*end && value >= PROVMAN_LOG_LEVEL_NONE &&
+	    value <= PROVMAN_LOG_LEVEL_DEBUG)
+		g_provman_log_level = value;
+}
+
 #endif
 
 int provman_log_open(const char *log_file_name)
@@ -46,23 +207,82 @@ int provman_log_open(const char *log_file_name)
 	int ret_val = PROVMAN_ERR_NONE;
 
 #ifdef PROVMAN_LOGGING
+	guint i;
+
 	if (!g_log_file)
 	{
 		g_log_file = fopen(log_file_name, "w");
 
-		if (!g_log_file)
+		if (!g_log_file) {
 			ret_val = PROVMAN_ERR_OPEN;
+			goto on_error;
+		}
+
+		g_log_event = eventfd(0, 0);
+		if (g_log_event == -1) {
+			fclose(g_log_file);
+			g_log_file = NULL;
+			ret_val = PROVMAN_ERR_IO;
+			goto on_error;
+		}
+
+		g_log_slots = g_new(provman_log_slot_t, PROVMAN_LOG_SLOTS);
+		for (i = 0; i < PROVMAN_LOG_SLOTS; ++i)
+			g_log_slots[i].sequence = (gint) i;
+		g_log_head = 0;
+		g_log_tail = 0;
+		g_log_dropped = 0;
+		g_log_quit = 0;
+		g_log_sleeping = 0;
+
+#if GLIB_CHECK_VERSION(2, 32, 0)
+		g_log_writer = g_thread_new("provman-log", prv_writer_thread,
+					    NULL);
+#else
+		g_log_writer = g_thread_create(prv_writer_thread, NULL, TRUE,
+					       NULL);
+#endif
+		if (!g_log_writer) {
+			(void) close(g_log_event);
+			g_log_event = -1;
+			fclose(g_log_file);
+			g_log_file = NULL;
+			g_free(g_log_slots);
+			g_log_slots = NULL;
+			ret_val = PROVMAN_ERR_UNKNOWN;
+			goto on_error;
+		}
+
+		prv_read_level();
 	}
+
+on_error:
+
 #endif
 
 	return ret_val;
 }
 
+void provman_log_set_level(provman_log_level_t level)
+{
+	g_provman_log_level = level;
+}
+
 void provman_log_close()
 {
 #ifdef PROVMAN_LOGGING
-	if (g_log_file)
+	if (g_log_file) {
+		g_atomic_int_set(&g_log_quit, 1);
+		(void) eventfd_write(g_log_event, 1);
+		(void) g_thread_join(g_log_writer);
+		g_log_writer = NULL;
+		(void) close(g_log_event);
+		g_log_event = -1;
 		fclose(g_log_file);
+		g_log_file = NULL;
+		g_free(g_log_slots);
+		g_log_slots = NULL;
+	}
 #endif
 }
 
@@ -72,27 +292,39 @@ void provman_log_printf(unsigned int line_number, const char *file_name,
 				const char *message, ...)
 {
 	va_list args;
+	provman_log_slot_t *slot;
+	int len;
 
-	if (g_log_file) {
-		va_start(args, message);
-		fprintf(g_log_file, "%s:%u ",file_name, line_number);
-		vfprintf(g_log_file, message, args);
-		fprintf(g_log_file, "\n");
-		va_end(args);
-		fflush(g_log_file);
+	if (g_log_slots) {
+		slot = prv_claim_slot();
+		if (slot) {
+			len = snprintf(slot->message, sizeof(slot->message),
+				       "%s:%u ", file_name, line_number);
+			if (len < 0 || len >= (int) sizeof(slot->message))
+				len = 0;
+			va_start(args, message);
+			vsnprintf(slot->message + len,
+				  sizeof(slot->message) - len, message, args);
+			va_end(args);
+			prv_publish_slot(slot);
+		}
 	}
 }
 
 void provman_logu_printf(const char *message, ...)
 {
 	va_list args;
+	provman_log_slot_t *slot;
 
-	if (g_log_file) {
-		va_start(args, message);
-		vfprintf(g_log_file, message, args);
-		fprintf(g_log_file, "\n");
-		va_end(args);
-		fflush(g_log_file);
+	if (g_log_slots) {
+		slot = prv_claim_slot();
+		if (slot) {
+			va_start(args, message);
+			vsnprintf(slot->message, sizeof(slot->message),
+				  message, args);
+			va_end(args);
+			prv_publish_slot(slot);
+		}
 	}
 }
 
@@ -30,122 +30,179 @@
  *        account ids, e.g., test, and middleware assigned account ids or plugin
  *        ids, e.g., 122121@comdev.
  *
+ * The mappings are kept in two namespaces of the provman store.  The first
+ * maps imsi and client id to plugin id and the second, whose name is that
+ * of the first with PROVMAN_MAP_FILE_REVERSE_SUFFIX appended, maps imsi
+ * and plugin id to client id.  The keys of both namespaces consist of the
+ * imsi and the id separated by a tab.
+ *
  ******************************************************************************/
 
 #include "config.h"
 
 #include <glib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "map-file.h"
+#include "store.h"
 #include "log.h"
 #include "error.h"
 
+#define PROVMAN_MAP_FILE_INI_SUFFIX ".ini"
+#define PROVMAN_MAP_FILE_REVERSE_SUFFIX ".reverse"
+#define PROVMAN_MAP_FILE_SEPARATOR "\t"
+
 struct provman_map_file_t_ {
-	GKeyFile *key_file;
-	gchar *fname;
-	gboolean dirty;
-	GHashTable *reverse_maps;
+	provman_store_t *store;
+	gchar *ns;
+	gchar *reverse_ns;
 };
 
-static void prv_hash_table_free(gpointer hash_table)
+static gchar *prv_make_key(const gchar *imsi, const gchar *id)
 {
-	if (hash_table)
-		g_hash_table_unref((GHashTable*) hash_table);
+	return g_strconcat(imsi, PROVMAN_MAP_FILE_SEPARATOR, id, NULL);
 }
 
-void provman_map_file_new(const char *fname, provman_map_file_t **map_file)
-{
-	provman_map_file_t *mf = g_new0(provman_map_file_t, 1);
-	mf->key_file = g_key_file_new();
-	(void) g_key_file_load_from_file(mf->key_file, fname,
-					 G_KEY_FILE_NONE, NULL);
-	mf->fname = g_strdup(fname);
-	mf->reverse_maps = g_hash_table_new_full(g_str_hash, g_str_equal,
-						 g_free, prv_hash_table_free);
-	*map_file = mf;
-}
-
-void provman_map_file_delete(provman_map_file_t *map_file)
+static void prv_store_map(provman_map_file_t *map_file, const gchar *imsi,
+			  const gchar *client_id, const gchar *plugin_id)
 {
-	if (map_file) {
-		g_hash_table_unref(map_file->reverse_maps);
-		g_free(map_file->fname);
-		g_key_file_free(map_file->key_file);
-		g_free(map_file);
+	gchar *key;
+	gchar *old_plugin_id;
+
+	key = prv_make_key(imsi, client_id);
+	old_plugin_id = provman_store_get(map_file->store, map_file->ns, key);
+	if (old_plugin_id && !strcmp(old_plugin_id, plugin_id)) {
+		g_free(old_plugin_id);
+		g_free(key);
+		return;
 	}
+	provman_store_set(map_file->store, map_file->ns, key, plugin_id);
+	g_free(key);
+
+	if (old_plugin_id) {
+		key = prv_make_key(imsi, old_plugin_id);
+		(void) provman_store_remove(map_file->store,
+					    map_file->reverse_ns, key);
+		g_free(key);
+		g_free(old_plugin_id);
+	}
+
+	key = prv_make_key(imsi, plugin_id);
+	provman_store_set(map_file->store, map_file->reverse_ns, key,
+			  client_id);
+	g_free(key);
 }
 
-static GHashTable* prv_provman_map_file_get_reverse_map(
-	provman_map_file_t *map_file, const gchar *imsi)
+/* Imports the mappings from an ini file written by an earlier version of
+   provman.  The ini file is deleted once its contents have been committed
+   to the store. */
+
+static void prv_migrate(provman_map_file_t *map_file, const char *fname)
 {
+	GKeyFile *key_file = g_key_file_new();
+	gchar **groups = NULL;
 	gchar **keys;
-	gsize len;
+	gchar *plugin_id;
 	unsigned int i;
-	gchar *value = NULL;
-	GHashTable *map;
-
-	map = g_hash_table_lookup(map_file->reverse_maps, imsi);
-	if (!map) {
-		map = g_hash_table_new_full(g_str_hash, g_str_equal,
-					    g_free, g_free);
-
-		keys = g_key_file_get_keys(map_file->key_file, imsi, &len,
-					   NULL);
-		if (keys)
-		{
-			for (i = 0; i < len; ++i) {
-				value = provman_map_file_find_plugin_id(
-					map_file, imsi, keys[i]);
-				g_hash_table_insert(map, value, keys[i]);
-			}
-
-			/* Ownership of keys has been transfered to the
-			   hash table.  Just need to free array */
-
-			g_free(keys);
+	unsigned int j;
+
+	if (!g_key_file_load_from_file(key_file, fname, G_KEY_FILE_NONE,
+				       NULL))
+		goto on_error;
+
+	PROVMAN_LOGF("Migrating map file %s", fname);
+
+	groups = g_key_file_get_groups(key_file, NULL);
+	for (i = 0; groups[i]; ++i) {
+		keys = g_key_file_get_keys(key_file, groups[i], NULL, NULL);
+		if (!keys)
+			continue;
+		for (j = 0; keys[j]; ++j) {
+			plugin_id = g_key_file_get_string(key_file, groups[i],
+							  keys[j], NULL);
+			if (plugin_id)
+				prv_store_map(map_file, groups[i], keys[j],
+					      plugin_id);
+			g_free(plugin_id);
 		}
+		g_strfreev(keys);
+	}
 
-		g_hash_table_insert(map_file->reverse_maps, g_strdup(imsi),
-				    map);
+	if (provman_store_sync(map_file->store) == PROVMAN_ERR_NONE &&
+	    unlink(fname) != 0) {
+		PROVMAN_LOGF("Unable to remove %s", fname);
 	}
 
-	return map;
+on_error:
+
+	g_strfreev(groups);
+	g_key_file_free(key_file);
+}
+
+void provman_map_file_new(const char *fname, provman_map_file_t **map_file)
+{
+	provman_map_file_t *mf = g_new0(provman_map_file_t, 1);
+	gchar *dir;
+	gchar *name;
+
+	dir = g_path_get_dirname(fname);
+	provman_store_open_dir(dir, &mf->store);
+	g_free(dir);
+
+	name = g_path_get_basename(fname);
+	if (g_str_has_suffix(name, PROVMAN_MAP_FILE_INI_SUFFIX))
+		name[strlen(name) - strlen(PROVMAN_MAP_FILE_INI_SUFFIX)] = 0;
+	mf->ns = name;
+	mf->reverse_ns = g_strconcat(name, PROVMAN_MAP_FILE_REVERSE_SUFFIX,
+				     NULL);
+
+	prv_migrate(mf, fname);
+
+	*map_file = mf;
+}
+
+void provman_map_file_delete(provman_map_file_t *map_file)
+{
+	if (map_file) {
+		provman_store_close(map_file->store);
+		g_free(map_file->reverse_ns);
+		g_free(map_file->ns);
+		g_free(map_file);
+	}
 }
 
 void provman_map_file_store_map(provman_map_file_t *map_file, const gchar *imsi,
 				const gchar *client_id, const gchar *plugin_id)
 {
-	GHashTable *reverse_map;
-
-	reverse_map = prv_provman_map_file_get_reverse_map(map_file, imsi);
-	g_hash_table_insert(reverse_map, g_strdup(plugin_id),
-			    g_strdup(client_id));
-	g_key_file_set_string(map_file->key_file, imsi, client_id, plugin_id);
-	map_file->dirty = TRUE;
+	prv_store_map(map_file, imsi, client_id, plugin_id);
 }
 
 int provman_map_file_delete_map(provman_map_file_t *map_file, const gchar *imsi,
 				const gchar *client_id)
 {
 	int err = PROVMAN_ERR_NONE;
-	GHashTable *reverse_map;
+	gchar *key;
 	gchar *plugin_id;
 
-	reverse_map = prv_provman_map_file_get_reverse_map(map_file, imsi);
-	plugin_id =  provman_map_file_find_plugin_id(map_file, imsi, client_id);
-
-	if (!g_key_file_remove_key(map_file->key_file, imsi, client_id, NULL)) {
+	key = prv_make_key(imsi, client_id);
+	plugin_id = provman_store_get(map_file->store, map_file->ns, key);
+	if (!plugin_id) {
 		err = PROVMAN_ERR_NOT_FOUND;
 		goto on_error;
 	}
 
-	(void) g_hash_table_remove(reverse_map, plugin_id);
-	map_file->dirty = TRUE;
+	(void) provman_store_remove(map_file->store, map_file->ns, key);
+	g_free(key);
+
+	key = prv_make_key(imsi, plugin_id);
+	(void) provman_store_remove(map_file->store, map_file->reverse_ns,
+				    key);
 
 on_error:
 
 	g_free(plugin_id);
+	g_free(key);
 
 	return err;
 }
@@ -154,79 +211,93 @@ gchar* provman_map_file_find_client_id(provman_map_file_t *map_file,
 				       const gchar *imsi,
 				       const gchar *plugin_id)
 {
-	GHashTable *reverse_map;
-	gchar *id;
+	gchar *key;
+	gchar *client_id;
 
-	reverse_map = prv_provman_map_file_get_reverse_map(map_file, imsi);
-	id = g_hash_table_lookup(reverse_map, plugin_id);
-	if (id)
-		id = g_strdup(id);
+	key = prv_make_key(imsi, plugin_id);
+	client_id = provman_store_get(map_file->store, map_file->reverse_ns,
+				      key);
+	g_free(key);
 
-	return id;
+	return client_id;
 }
 
 void provman_map_file_save(provman_map_file_t *map_file)
 {
-	gsize length;
-	gchar *data;
-
-	if (map_file->dirty) {
-		data = g_key_file_to_data(map_file->key_file, &length, NULL);
-
-		if (data) {
-			if (g_file_set_contents(map_file->fname, data,
-						length, NULL))
-				map_file->dirty = FALSE;
-#ifdef PROVMAN_LOGGING
-			else
-				PROVMAN_LOGF("Unable to write map file %s",
-					 map_file->fname);
-#endif
-			g_free(data);
-		}
-	}
+	(void) provman_store_commit(map_file->store);
 }
 
 gchar* provman_map_file_find_plugin_id(provman_map_file_t *map_file,
 				       const gchar *imsi,
 				       const gchar *client_id)
 {
-	return g_key_file_get_string(map_file->key_file, imsi,
-				     client_id, NULL);
+	gchar *key;
+	gchar *plugin_id;
+
+	key = prv_make_key(imsi, client_id);
+	plugin_id = provman_store_get(map_file->store, map_file->ns, key);
+	g_free(key);
+
+	return plugin_id;
+}
+
+typedef struct provman_map_file_unused_t_ provman_map_file_unused_t;
+struct provman_map_file_unused_t_ {
+	const gchar *imsi;
+	GHashTable *used_plugin_ids;
+	GPtrArray *stale_keys;
+};
+
+/* Records the forward and reverse keys of each mapping whose plugin id
+   is not in use.  The store cannot be modified while it is being
+   enumerated, so the keys are removed afterwards. */
+
+static void prv_find_unused(const gchar *key, const gchar *value,
+			    void *user_data)
+{
+	provman_map_file_unused_t *unused = user_data;
+
+	if (g_hash_table_lookup_extended(unused->used_plugin_ids, value, NULL,
+					 NULL))
+		return;
+
+	PROVMAN_LOGF("Removing unused context %s->%s",
+		     strchr(key, '\t') + 1, value);
+
+	g_ptr_array_add(unused->stale_keys, g_strdup(key));
+	g_ptr_array_add(unused->stale_keys, prv_make_key(unused->imsi,
+							 value));
 }
 
-void provman_map_file_remove_unused(provman_map_file_t *map_file,
-				    const gchar *imsi,
-				    GHashTable *used_plugin_ids)
+unsigned int provman_map_file_remove_unused(provman_map_file_t *map_file,
+					    const gchar *imsi,
+					    GHashTable *used_plugin_ids)
 {
+	provman_map_file_unused_t unused;
+	gchar *prefix;
 	unsigned int i;
-	gsize len;
-	gchar **keys;
-	gchar *plugin_id;
+	unsigned int removed;
+
+	unused.imsi = imsi;
+	unused.used_plugin_ids = used_plugin_ids;
+	unused.stale_keys = g_ptr_array_new_with_free_func(g_free);
+
+	prefix = prv_make_key(imsi, "");
+	provman_store_foreach(map_file->store, map_file->ns, prefix,
+			      prv_find_unused, &unused);
+	g_free(prefix);
+
+	for (i = 0; i < unused.stale_keys->len; i += 2) {
+		(void) provman_store_remove(
+			map_file->store, map_file->ns,
+			g_ptr_array_index(unused.stale_keys, i));
+		(void) provman_store_remove(
+			map_file->store, map_file->reverse_ns,
+			g_ptr_array_index(unused.stale_keys, i + 1));
+	}
 
-	keys = g_key_file_get_keys(map_file->key_file, imsi, &len, NULL);
-
-	if (keys)
-	{
-		for (i = 0; i < len; ++i) {
-			plugin_id = provman_map_file_find_plugin_id(map_file,
-								    imsi,
-								    keys[i]);
-			if (!g_hash_table_lookup_extended(used_plugin_ids,
-							  plugin_id, NULL,
-							  NULL)) {
-
-				PROVMAN_LOGF("Removing unused context %s->%s",
-					     keys[i], plugin_id);
-
-				(void) provman_map_file_delete_map(map_file,
-								   imsi,
-								   keys[i]);
-			}
-			g_free(plugin_id);
-		}
+	removed = unused.stale_keys->len / 2;
+	g_ptr_array_unref(unused.stale_keys);
 
-		g_strfreev(keys);
-	}
+	return removed;
 }
-
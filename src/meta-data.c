@@ -29,19 +29,35 @@
  * existing settings.  Meta data is store persistently and survives the end
  * of a session.
  *
+ * The meta data of each plugin is kept in its own namespace of the provman
+ * store.  Each meta data property is stored under a key that consists of
+ * the name of the setting or directory to which it is attached, followed
+ * by a tab and the name of the property.  As keys cannot contain white
+ * space, the first tab always separates the two.  The store keeps the keys
+ * of a namespace sorted, so the meta data of a subtree can be retrieved
+ * without visiting the meta data of any other keys.
+ *
+ * Earlier versions of provman stored meta data in a key file, one group
+ * per key.  These files are migrated to the store when the meta data is
+ * first loaded.
+ *
  ******************************************************************************/
 
 #include "config.h"
 
 #include <string.h>
-#include <stdbool.h>
+#include <unistd.h>
 
 #include "meta-data.h"
+#include "error.h"
+#include "utils.h"
 #include "log.h"
 
+#define PROVMAN_META_DATA_SEPARATOR '\t'
+
 struct provman_meta_data_t_ {
-	GKeyFile *key_file;
-	gchar *fname;
+	provman_store_t *store;
+	gchar *ns;
 };
 
 static void prv_unref_ht(gpointer ht)
@@ -50,158 +66,250 @@ static void prv_unref_ht(gpointer ht)
 		g_hash_table_unref((GHashTable *) ht);
 }
 
-void provman_meta_data_new(const gchar *fname, provman_meta_data_t **meta_data)
+static gchar *prv_make_key(const gchar *group, const gchar *prop)
+{
+	GString *key = g_string_new(group);
+
+	g_string_append_c(key, PROVMAN_META_DATA_SEPARATOR);
+	g_string_append(key, prop);
+
+	return g_string_free(key, FALSE);
+}
+
+/* Imports the meta data from a key file written by an earlier version of
+   provman.  The key file is deleted once its contents have been committed
+   to the store. */
+
+static void prv_migrate(provman_meta_data_t *md, const gchar *fname)
+{
+	GKeyFile *key_file = g_key_file_new();
+	gchar **groups;
+	gchar **keys;
+	gchar *value;
+	gchar *key;
+	unsigned int i;
+	unsigned int j;
+
+	if (!g_key_file_load_from_file(key_file, fname, G_KEY_FILE_NONE,
+				       NULL))
+		goto on_error;
+
+	PROVMAN_LOGF("Migrating meta data file %s", fname);
+
+	groups = g_key_file_get_groups(key_file, NULL);
+	for (i = 0; groups[i]; ++i) {
+		keys = g_key_file_get_keys(key_file, groups[i], NULL, NULL);
+		if (!keys)
+			continue;
+		for (j = 0; keys[j]; ++j) {
+			value = g_key_file_get_value(key_file, groups[i],
+						     keys[j], NULL);
+			if (value) {
+				key = prv_make_key(groups[i], keys[j]);
+				provman_store_set(md->store, md->ns, key,
+						  value);
+				g_free(key);
+				g_free(value);
+			}
+		}
+		g_strfreev(keys);
+	}
+	g_strfreev(groups);
+
+	if (provman_store_sync(md->store) == PROVMAN_ERR_NONE)
+		(void) unlink(fname);
+
+on_error:
+
+	g_key_file_free(key_file);
+}
+
+void provman_meta_data_new(provman_store_t *store, const gchar *name,
+			   const gchar *legacy_fname,
+			   provman_meta_data_t **meta_data)
 {
 	provman_meta_data_t *md = g_new0(provman_meta_data_t, 1);
-	md->key_file = g_key_file_new();
-	(void) g_key_file_load_from_file(md->key_file, fname,
-					 G_KEY_FILE_NONE, NULL);
-	md->fname = g_strdup(fname);
+
+	md->store = store;
+	md->ns = g_strdup(name);
+
+	if (legacy_fname)
+		prv_migrate(md, legacy_fname);
+
 	*meta_data = md;
 }
 
 void provman_meta_data_delete(provman_meta_data_t *meta_data)
 {
 	if (meta_data) {
-		g_free(meta_data->fname);
-		g_key_file_free(meta_data->key_file);
+		g_free(meta_data->ns);
 		g_free(meta_data);
 	}
 }
 
-GHashTable *provman_meta_data_get_all(provman_meta_data_t *meta_data)
+static void prv_add_prop(const gchar *key, const gchar *value,
+			 void *user_data)
 {
-	GHashTable *md_settings;
+	GHashTable *md_settings = user_data;
+	const gchar *sep = strchr(key, PROVMAN_META_DATA_SEPARATOR);
+	gchar *group;
 	GHashTable *props;
-	gchar **groups;
-	unsigned int i;
-	unsigned int j;
-	gchar **keys;
-	gchar *value;
 
-	md_settings = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
-					    prv_unref_ht);
+	if (!sep)
+		return;
 
-	groups = g_key_file_get_groups(meta_data->key_file, NULL);
+	group = g_strndup(key, sep - key);
+	props = g_hash_table_lookup(md_settings, group);
+	if (!props) {
+		props = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+					      g_free);
+		g_hash_table_insert(md_settings, group, props);
+	} else {
+		g_free(group);
+	}
 
-	for (i = 0; groups[i]; ++i) {
-		keys = g_key_file_get_keys(meta_data->key_file, groups[i], NULL,
-					   NULL);
-		if (keys) {
-			props = g_hash_table_new_full(g_str_hash, g_str_equal,
-						      g_free, g_free);
-			for (j = 0; keys[j]; ++j) {
-				value = g_key_file_get_value(
-					meta_data->key_file, groups[i], keys[j],
-					NULL);
-				if (value)
-					g_hash_table_insert(props, keys[j],
-							    value);
-				else
-					g_free(keys[j]);
-			}
-			g_free(keys);
-			g_hash_table_insert(md_settings, groups[i], props);
-		} else {
-			g_free(groups[i]);
-		}
+	g_hash_table_insert(props, g_strdup(sep + 1), g_strdup(value));
+}
+
+/* Invokes func for each meta data property in the subtree identified by
+   root. */
+
+static void prv_foreach_in_subtree(provman_meta_data_t *meta_data,
+				   const gchar *root,
+				   provman_store_foreach_cb_t func,
+				   void *user_data)
+{
+	GString *prefix = g_string_new(root);
+
+	while (prefix->len > 0 && prefix->str[prefix->len - 1] == '/')
+		g_string_truncate(prefix, prefix->len - 1);
+
+	if (prefix->len > 0) {
+		g_string_append_c(prefix, PROVMAN_META_DATA_SEPARATOR);
+		provman_store_foreach(meta_data->store, meta_data->ns,
+				      prefix->str, func, user_data);
+		g_string_truncate(prefix, prefix->len - 1);
 	}
 
-	g_free(groups);
+	g_string_append_c(prefix, '/');
+	provman_store_foreach(meta_data->store, meta_data->ns, prefix->str,
+			      func, user_data);
 
-	return md_settings;
+	g_string_free(prefix, TRUE);
 }
 
-static void prv_insert_new_group(provman_meta_data_t *meta_data,
-				 const gchar* group_name, GHashTable *props)
+GHashTable *provman_meta_data_get_subtree(provman_meta_data_t *meta_data,
+					  const gchar *root)
 {
-	GHashTableIter iter;
-	gpointer key;
-	gpointer value;
+	GHashTable *md_settings;
 
-	g_hash_table_iter_init(&iter, props);
-	while (g_hash_table_iter_next(&iter, &key, &value)) {
-		g_key_file_set_value(meta_data->key_file, group_name,
-				     key, value);
-	}
+	md_settings = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+					    prv_unref_ht);
+	prv_foreach_in_subtree(meta_data, root, prv_add_prop, md_settings);
+
+	return md_settings;
 }
 
-static bool prv_update_group(provman_meta_data_t *meta_data,
-			     const gchar* group_name, GHashTable *props)
+static void prv_add_key(const gchar *key, const gchar *value,
+			void *user_data)
 {
-	GHashTableIter iter;
-	gpointer key;
-	gpointer value;
-	gchar *old_value;
-	bool dirty = false;
-
-	g_hash_table_iter_init(&iter, props);
-	while (g_hash_table_iter_next(&iter, &key, &value)) {
-		old_value = g_key_file_get_value(meta_data->key_file,
-						 group_name, key, NULL);
-		if (!old_value || strcmp(old_value, value)) {
-			g_key_file_set_value(meta_data->key_file, group_name,
-					     key, value);
-			dirty = true;
-		}
-		g_free(old_value);
-	}
+	g_ptr_array_add(user_data, g_strdup(key));
+}
+
+static bool prv_group_in(GHashTable *groups, const gchar *key)
+{
+	const gchar *sep = strchr(key, PROVMAN_META_DATA_SEPARATOR);
+	gchar *group;
+	bool found;
 
-	return dirty;
+	if (!sep)
+		return false;
+
+	group = g_strndup(key, sep - key);
+	found = g_hash_table_lookup(groups, group) != NULL;
+	g_free(group);
+
+	return found;
 }
 
 void provman_meta_data_update(provman_meta_data_t *meta_data,
-			      GHashTable *md_settings)
+			      GPtrArray *roots, GHashTable *md_settings)
 {
-	bool dirty = false;
-	gchar **groups;
+	GPtrArray *keys;
 	unsigned int i;
 	GHashTableIter iter;
-	gpointer key;
+	GHashTableIter props_iter;
+	gpointer group;
+	gpointer props;
+	gpointer prop;
 	gpointer value;
-	gsize length;
-	gchar *data;
-#ifdef PROVMAN_LOGGING
-	bool saved = false;
-#endif
-
-	groups = g_key_file_get_groups(meta_data->key_file, NULL);
-
-	for (i = 0; groups[i]; ++i)
-		if (!g_hash_table_lookup(md_settings, groups[i]))
-			if (g_key_file_remove_group(meta_data->key_file,
-						    groups[i], NULL))
-				dirty = true;
-	g_strfreev(groups);
+	gchar *key;
+
+	/* The store cannot be modified while it is being enumerated so the
+	   keys are copied first.  Groups that no longer have any meta data
+	   are removed but properties are never removed from a group. */
+
+	keys = g_ptr_array_new_with_free_func(g_free);
+	for (i = 0; i < roots->len; ++i)
+		prv_foreach_in_subtree(meta_data, g_ptr_array_index(roots, i),
+				       prv_add_key, keys);
+
+	for (i = 0; i < keys->len; ++i)
+		if (!prv_group_in(md_settings, g_ptr_array_index(keys, i)))
+			(void) provman_store_remove(
+				meta_data->store, meta_data->ns,
+				g_ptr_array_index(keys, i));
+	g_ptr_array_unref(keys);
 
 	g_hash_table_iter_init(&iter, md_settings);
-	while (g_hash_table_iter_next(&iter, &key, &value)) {
-		if (!g_key_file_has_group(meta_data->key_file, key)) {
-			prv_insert_new_group(meta_data, key, value);
-			dirty = true;
-		} else if (prv_update_group(meta_data, key, value)) {
-			dirty = true;
+	while (g_hash_table_iter_next(&iter, &group, &props)) {
+		g_hash_table_iter_init(&props_iter, props);
+		while (g_hash_table_iter_next(&props_iter, &prop, &value)) {
+			key = prv_make_key(group, prop);
+			provman_store_set(meta_data->store, meta_data->ns,
+					  key, value);
+			g_free(key);
 		}
 	}
+}
 
-	if (dirty) {
-		data = g_key_file_to_data(meta_data->key_file, &length, NULL);
-		if (data) {
-#ifdef PROVMAN_LOGGING
-			saved = g_file_set_contents(meta_data->fname, data,
-						    length, NULL);
-#else
-			(void) g_file_set_contents(meta_data->fname, data,
-						   length, NULL);
-#endif
-			g_free(data);
-		}
+void provman_meta_data_prune(provman_meta_data_t *meta_data,
+			     const gchar *root, provman_meta_data_keep_t keep,
+			     void *user_data)
+{
+	GPtrArray *keys;
+	GHashTable *kept;
+	const gchar *key;
+	const gchar *sep;
+	gchar *group;
+	gpointer keep_group;
+	unsigned int i;
+
+	keys = g_ptr_array_new_with_free_func(g_free);
+	prv_foreach_in_subtree(meta_data, root, prv_add_key, keys);
+
+	/* Each group may have many properties.  Only ask about each group
+	   once. */
 
-#ifdef PROVMAN_LOGGING
-		if (!saved)
-			PROVMAN_LOGF("Unable to write meta file %s",
-				     meta_data->fname);
-#endif
+	kept = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	for (i = 0; i < keys->len; ++i) {
+		key = g_ptr_array_index(keys, i);
+		sep = strchr(key, PROVMAN_META_DATA_SEPARATOR);
+		if (!sep)
+			continue;
+		group = g_strndup(key, sep - key);
+		if (!g_hash_table_lookup_extended(kept, group, NULL,
+						  &keep_group)) {
+			keep_group = GINT_TO_POINTER(keep(group, user_data));
+			g_hash_table_insert(kept, group, keep_group);
+		} else {
+			g_free(group);
+		}
+		if (!keep_group)
+			(void) provman_store_remove(meta_data->store,
+						    meta_data->ns, key);
 	}
 
+	g_hash_table_unref(kept);
+	g_ptr_array_unref(keys);
 }
@@ -46,12 +46,22 @@
 #define PROVMAN_META_DATA_H
 
 #include <glib.h>
+#include <stdbool.h>
+
+#include "store.h"
 
 typedef struct provman_meta_data_t_ provman_meta_data_t;
+typedef bool (*provman_meta_data_keep_t)(const gchar *key, void *user_data);
 
-void provman_meta_data_new(const gchar *fname, provman_meta_data_t **meta_data);
+void provman_meta_data_new(provman_store_t *store, const gchar *name,
+			   const gchar *legacy_fname,
+			   provman_meta_data_t **meta_data);
 void provman_meta_data_delete(provman_meta_data_t *meta_data);
-GHashTable *provman_meta_data_get_all(provman_meta_data_t *meta_data);
+GHashTable *provman_meta_data_get_subtree(provman_meta_data_t *meta_data,
+					  const gchar *root);
 void provman_meta_data_update(provman_meta_data_t *meta_data,
-			      GHashTable *md_settings);
+			      GPtrArray *roots, GHashTable *md_settings);
+void provman_meta_data_prune(provman_meta_data_t *meta_data,
+			     const gchar *root, provman_meta_data_keep_t keep,
+			     void *user_data);
 #endif
@@ -0,0 +1,149 @@
+/*
+ * Provman
+ *
+ * Copyright (C) 2011 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+
+/*!
+ * @file plugin-bench.c
+ *
+ * @brief Contains plugin definitions for provman-bench and the temporary
+ *        home directory in which it runs them
+ *
+ ******************************************************************************/
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "error.h"
+#include "plugin.h"
+#include "test-schemas.h"
+#include "plugin-bench.h"
+
+#include "plugins/test.h"
+
+#ifdef PROVMAN_SYNTHETIC_PLUGIN
+#include "plugins/synthetic.h"
+#endif
+
+/*! \cond */
+
+provman_plugin g_provman_plugins[] = {
+	{ "test", "/applications/test_plugin/",
+	  g_provman_test_schema,
+	  test_plugin_new, test_plugin_delete,
+	  test_plugin_sync_in, test_plugin_sync_in_cancel,
+	  test_plugin_sync_out, test_plugin_sync_out_cancel,
+	  test_plugin_abort, test_plugin_sim_id
+	}
+#ifdef PROVMAN_SYNTHETIC_PLUGIN
+	,
+	{ "synthetic0", "/applications/synthetic0/",
+	  g_provman_synthetic_schema0,
+	  synthetic_plugin_new0, synthetic_plugin_delete,
+	  synthetic_plugin_sync_in, synthetic_plugin_sync_in_cancel,
+	  synthetic_plugin_sync_out, synthetic_plugin_sync_out_cancel,
+	  NULL, NULL
+	},
+	{ "synthetic1", "/applications/synthetic1/",
+	  g_provman_synthetic_schema1,
+	  synthetic_plugin_new1, synthetic_plugin_delete,
+	  synthetic_plugin_sync_in, synthetic_plugin_sync_in_cancel,
+	  synthetic_plugin_sync_out, synthetic_plugin_sync_out_cancel,
+	  NULL, NULL
+	},
+	{ "synthetic2", "/applications/synthetic2/",
+	  g_provman_synthetic_schema2,
+	  synthetic_plugin_new2, synthetic_plugin_delete,
+	  synthetic_plugin_sync_in, synthetic_plugin_sync_in_cancel,
+	  synthetic_plugin_sync_out, synthetic_plugin_sync_out_cancel,
+	  NULL, NULL
+	},
+	{ "synthetic3", "/applications/synthetic3/",
+	  g_provman_synthetic_schema3,
+	  synthetic_plugin_new3, synthetic_plugin_delete,
+	  synthetic_plugin_sync_in, synthetic_plugin_sync_in_cancel,
+	  synthetic_plugin_sync_out, synthetic_plugin_sync_out_cancel,
+	  NULL, NULL
+	}
+#endif
+};
+
+const unsigned int g_provman_plugins_count =
+	sizeof(g_provman_plugins) / sizeof(provman_plugin);
+
+/*! \endcond */
+
+static void prv_remove_tree(const gchar *path)
+{
+	GDir *dir;
+	const gchar *name;
+	gchar *child;
+
+	dir = g_dir_open(path, 0, NULL);
+	if (dir) {
+		while ((name = g_dir_read_name(dir))) {
+			child = g_build_filename(path, name, NULL);
+			if (g_file_test(child, G_FILE_TEST_IS_DIR) &&
+			    !g_file_test(child, G_FILE_TEST_IS_SYMLINK))
+				prv_remove_tree(child);
+			else
+				(void) g_unlink(child);
+			g_free(child);
+		}
+		g_dir_close(dir);
+	}
+
+	(void) g_rmdir(path);
+}
+
+int provman_bench_home_new(gchar **home)
+{
+	int err = PROVMAN_ERR_NONE;
+	gchar *dir;
+
+	dir = g_build_filename(g_get_tmp_dir(), "provman-bench-XXXXXX", NULL);
+	if (!mkdtemp(dir)) {
+		g_free(dir);
+		err = PROVMAN_ERR_IO;
+		goto on_error;
+	}
+
+	(void) g_setenv("HOME", dir, TRUE);
+	*home = dir;
+
+on_error:
+
+	return err;
+}
+
+void provman_bench_home_delete(gchar *home)
+{
+	if (home) {
+		prv_remove_tree(home);
+		g_free(home);
+	}
+}
@@ -0,0 +1,48 @@
+/*
+ * Provman
+ *
+ * Copyright (C) 2011 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+/*!
+ * @file plugin-bench.h
+ *
+ * @brief Contains function declarations shared by the tools that run the
+ *        plugin manager in process
+ *
+ *****************************************************************************/
+
+#ifndef PROVMAN_PLUGIN_BENCH_H
+#define PROVMAN_PLUGIN_BENCH_H
+
+#include <glib.h>
+
+/* The test plugin, the meta data and the map files keep their state in
+   provman's data directory, which lies under $HOME.  provman_bench_home_new
+   creates an empty temporary directory and points HOME at it so that a
+   tool does not read or modify the user's settings.  It must be called
+   before the plugin manager is created.  GLib only honours HOME from
+   version 2.36 onwards. */
+
+int provman_bench_home_new(gchar **home);
+void provman_bench_home_delete(gchar *home);
+
+#endif
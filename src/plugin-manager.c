@@ -42,7 +42,9 @@
 #include "plugin.h"
 #include "cache.h"
 #include "utils.h"
+#include "store.h"
 #include "meta-data.h"
+#include "trace.h"
 
 enum plugin_manager_state_t_ {
 	PLUGIN_MANAGER_STATE_IDLE,
@@ -58,7 +60,8 @@ typedef enum plugin_manager_state_t_ plugin_manager_state_t;
 
 #define PLUGIN_MANAGER_UNNAMED_DIR "<X>"
 
-#define PROVMAN_META_DATA_NAME "metadata.ini"
+#define PROVMAN_META_DATA_NAME "metadata"
+#define PLUGIN_MANAGER_SIMS_DIR "sims/"
 
 enum plugin_manager_cmd_type_t_ {
 	PLUGIN_MANAGER_CMD_TYPE_VOID,
@@ -94,20 +97,36 @@ struct plugin_manager_cmd_t_ {
 struct plugin_manager_t_ {
 	bool system;
 	plugin_manager_state_t state;
+	provman_store_t *store;
 	provman_plugin_instance *plugin_instances;
 	provman_schema_t **plugin_schemas;
 	GHashTable **plugin_meta_data;
+	bool *plugin_loaded;
 	provman_cache_t *cache;
 	bool *plugin_synced;
+	GPtrArray **plugin_md_roots;
+	GPtrArray **plugin_md_views;
 	unsigned int synced;
 	guint completion_source;
 	gchar *imsi;
 	plugin_manager_cmd_t cb;
 	plugin_manager_cb_t sync_in_cb;
+	guint trace_id;
+};
+
+typedef struct plugin_manager_md_view_t_ plugin_manager_md_view_t;
+struct plugin_manager_md_view_t_ {
+	provman_meta_data_t *md;
+	provman_cache_t *cache;
+	gchar *session_dir;
+	gchar *md_dir;
+	gchar *sims_dir;
+	bool sim;
 };
 
 static void prv_sync_out_next_plugin(plugin_manager_t *manager);
 static bool prv_sync_plugins(plugin_manager_t *manager);
+static void prv_add_plugin_index(GArray *indicies, const char *key);
 
 static void prv_plugin_manager_cmd_free(plugin_manager_cmd_t *cmd)
 {
@@ -133,52 +152,110 @@ static void prv_free_meta_data(gpointer md)
 		provman_meta_data_delete(md);
 }
 
+static void prv_free_md_view(gpointer data)
+{
+	plugin_manager_md_view_t *view = data;
+
+	g_free(view->session_dir);
+	g_free(view->md_dir);
+	g_free(view->sims_dir);
+	g_free(view);
+}
+
+/* Plugins that are built into provman are instantiated when the plugin
+   manager is created.  Plugins provided by loadable modules are only loaded
+   and instantiated the first time one of their keys is accessed. */
+
+static int prv_load_plugin(plugin_manager_t *manager, unsigned int pindex)
+{
+	int err = PROVMAN_ERR_NONE;
+	const provman_plugin *plugin;
+
+	if (manager->plugin_loaded[pindex])
+		goto on_error;
+
+	err = provman_plugin_load(pindex);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	plugin = provman_plugin_get(pindex);
+
+	err = provman_schema_new(plugin->schema, strlen(plugin->schema),
+				 &manager->plugin_schemas[pindex]);
+	if (err != PROVMAN_ERR_NONE) {
+		PROVMAN_LOGF("Unable to instantiate schema for plugin %s",
+			     plugin->name);
+		goto on_error;
+	}
+
+	err = plugin->new_fn(&manager->plugin_instances[pindex],
+			     manager->system);
+	if (err != PROVMAN_ERR_NONE) {
+		PROVMAN_LOGF("Unable to instantiate plugin %s", plugin->name);
+		provman_schema_delete(manager->plugin_schemas[pindex]);
+		manager->plugin_schemas[pindex] = NULL;
+		goto on_error;
+	}
+
+	manager->plugin_loaded[pindex] = true;
+
+on_error:
+
+	return err;
+}
+
 int plugin_manager_new(plugin_manager_t **manager, bool system)
 {
 	int err = PROVMAN_ERR_NONE;
 
-	unsigned int count = provman_plugin_get_count();
+	unsigned int count;
 	unsigned int i;
-	const provman_plugin *plugin;
 	plugin_manager_t *retval = g_new0(plugin_manager_t, 1);
 
 	PROVMAN_LOGF("%s called system %d", __FUNCTION__, system);
 
+	err = provman_plugin_load_manifests(system);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
 	err = provman_plugin_check();
 	if (err != PROVMAN_ERR_NONE)
 		goto on_error;
 
+	count = provman_plugin_get_count();
 	retval->system = system;
+	if (provman_store_open(system, &retval->store) != PROVMAN_ERR_NONE) {
+		PROVMAN_LOG("Unable to open store.  Meta data will not "
+			    "persist");
+	}
 	retval->state = PLUGIN_MANAGER_STATE_IDLE;
 	retval->plugin_instances = g_new0(provman_plugin_instance, count);
 	retval->plugin_schemas = g_new0(provman_schema_t*, count);
 	retval->plugin_meta_data = g_new0(GHashTable*, count);
+	retval->plugin_loaded = g_new0(bool, count);
 
 	for (i = 0; i < count; ++i) {
-		plugin = provman_plugin_get(i);
-
-		err = provman_schema_new(plugin->schema, strlen(plugin->schema),
-					 &retval->plugin_schemas[i]);
-		if (err != PROVMAN_ERR_NONE) {
-			PROVMAN_LOGF("Unable to instantiate schema for plugin"
-				     " %s", plugin->name);
-			goto on_error;
-		}
-
-		err = plugin->new_fn(&retval->plugin_instances[i], system);
-		if (err != PROVMAN_ERR_NONE) {
-			PROVMAN_LOGF("Unable to instantiate plugin %s",
-				      plugin->name);
-			goto on_error;
-		}
-
 		retval->plugin_meta_data[i] =
 			g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
 					      prv_free_meta_data);
+
+		if (!provman_plugin_is_module(i)) {
+			err = prv_load_plugin(retval, i);
+			if (err != PROVMAN_ERR_NONE)
+				goto on_error;
+		}
 	}
 
 	provman_cache_new(&retval->cache);
 	retval->plugin_synced = g_new0(bool, count);
+	retval->plugin_md_roots = g_new0(GPtrArray*, count);
+	retval->plugin_md_views = g_new0(GPtrArray*, count);
+	for (i = 0; i < count; ++i) {
+		retval->plugin_md_roots[i] =
+			g_ptr_array_new_with_free_func(g_free);
+		retval->plugin_md_views[i] =
+			g_ptr_array_new_with_free_func(prv_free_md_view);
+	}
 	*manager = retval;
 
 	return err;
@@ -197,8 +274,11 @@ static void prv_clear_cache(plugin_manager_t *manager)
 	unsigned int i;
 	unsigned int count = provman_plugin_get_count();
 
-	for (i = 0; i < count; ++i)
+	for (i = 0; i < count; ++i) {
 		manager->plugin_synced[i] = false;
+		g_ptr_array_set_size(manager->plugin_md_roots[i], 0);
+		g_ptr_array_set_size(manager->plugin_md_views[i], 0);
+	}
 
 	(void) provman_cache_remove(manager->cache, "/");
 }
@@ -212,19 +292,36 @@ void plugin_manager_delete(plugin_manager_t *manager)
 	PROVMAN_LOGF("%s called", __FUNCTION__);
 
 	if (manager) {
-		count = provman_plugin_get_count();
+		count = manager->plugin_loaded ? provman_plugin_get_count() :
+			0;
 		for (i = 0; i < count; ++i) {
-			provman_schema_delete(manager->plugin_schemas[i]);
-			plugin = provman_plugin_get(i);
-			plugin->delete_fn(manager->plugin_instances[i]);
 			if (manager->plugin_meta_data[i])
 				g_hash_table_unref(
 					manager->plugin_meta_data[i]);
+			if (!manager->plugin_loaded[i])
+				continue;
+			provman_schema_delete(manager->plugin_schemas[i]);
+			plugin = provman_plugin_get(i);
+			plugin->delete_fn(manager->plugin_instances[i]);
 		}
+		provman_plugin_unload_modules();
+		g_free(manager->plugin_loaded);
 		g_free(manager->plugin_meta_data);
 		g_free(manager->plugin_schemas);
 		g_free(manager->plugin_instances);
 		provman_cache_delete(manager->cache);
+		if (manager->store)
+			provman_store_close(manager->store);
+		if (manager->plugin_md_roots) {
+			for (i = 0; i < count; ++i)
+				g_ptr_array_unref(manager->plugin_md_roots[i]);
+			g_free(manager->plugin_md_roots);
+		}
+		if (manager->plugin_md_views) {
+			for (i = 0; i < count; ++i)
+				g_ptr_array_unref(manager->plugin_md_views[i]);
+			g_free(manager->plugin_md_views);
+		}
 		g_free(manager->plugin_synced);
 		g_free(manager->imsi);
 		g_free(manager);
@@ -268,67 +365,379 @@ static void prv_schedule_completion(plugin_manager_t *manager, int err)
 }
 
 static provman_meta_data_t* prv_get_plugin_md(plugin_manager_t *manager,
-					      unsigned int pindex)
+					      unsigned int pindex,
+					      const gchar *imsi)
 {
 	const provman_plugin *plugin;
-	const gchar *imsi;
 	provman_meta_data_t* md = NULL;
-	gchar *meta_data_path = NULL;
-	GString *fname = NULL;
+	gchar *legacy_path = NULL;
+	GString *name = NULL;
+	gchar *legacy_fname = NULL;
 	GHashTable *ht = manager->plugin_meta_data[pindex];
 
+	if (!manager->store)
+		goto on_error;
+
 	plugin = provman_plugin_get(pindex);
-	imsi = plugin->sim_id_fn ?
-		plugin->sim_id_fn(manager->plugin_instances[pindex]) :
-		"";
 	md = g_hash_table_lookup(ht, imsi);
 	if (!md) {
-		fname = g_string_new(plugin->name);
+		name = g_string_new(plugin->name);
 		if (imsi[0]) {
-			g_string_append_c(fname, '-');
-			g_string_append(fname, imsi);
+			g_string_append_c(name, '-');
+			g_string_append(name, imsi);
 		}
-		g_string_append_c(fname, '-');
-		g_string_append(fname, PROVMAN_META_DATA_NAME);
-		if (provman_utils_make_file_path(fname->str, manager->system,
-						 &meta_data_path) !=
+		g_string_append_c(name, '-');
+		g_string_append(name, PROVMAN_META_DATA_NAME);
+
+		/* Meta data used to be stored in an ini file of its own.
+		   If one exists it is migrated into the store. */
+
+		legacy_fname = g_strdup_printf("%s.ini", name->str);
+		if (provman_utils_make_file_path(legacy_fname, manager->system,
+						 &legacy_path) !=
 		    PROVMAN_ERR_NONE)
 			goto on_error;
 
-		PROVMAN_LOGF("Loading meta data file %s", meta_data_path);
+		PROVMAN_LOGF("Loading meta data %s", name->str);
 
-		provman_meta_data_new(meta_data_path, &md);
+		provman_meta_data_new(manager->store, name->str, legacy_path,
+				      &md);
 		g_hash_table_insert(ht, g_strdup(imsi), md);
 	}
 
 on_error:
 
-	if (fname)
-		g_string_free(fname, TRUE);
-	g_free(meta_data_path);
+	if (name)
+		g_string_free(name, TRUE);
+	g_free(legacy_fname);
+	g_free(legacy_path);
 
 	return md;
 }
 
+/* The meta data of a plugin is not copied into the cache when the plugin
+   is synchronised.  Instead it is attached to the cache one subtree at a
+   time, when a meta data command first touches that subtree.  The roots
+   of the subtrees whose meta data is held in the cache are recorded in
+   plugin_md_roots.  Only the meta data beneath these roots is written
+   back to the meta data file during sync_out.  The roots of subtrees that
+   have been removed are recorded too, so that their meta data is deleted,
+   even though it was never loaded.  So are the roots of subtrees that are
+   created by Set or SetMultiple, as any meta data stored for them belongs
+   to settings that no longer exist.  Stored meta data of keys that the
+   plugin no longer reports is discarded when its subtree is loaded.
+
+   In a multi-SIM session a plugin places the settings of each SIM beneath
+   <root>sims/<IMSI>/.  Their meta data is kept with the meta data of that
+   SIM, under the keys the same settings have in a session for that SIM
+   alone.  For example, the meta data of /telephony/sims/<IMSI>/contexts/a
+   is stored as that of /telephony/contexts/a.  Both kinds of session
+   therefore see, and prune, the same meta data.  The meta data of the
+   settings outside the sims directory, which are not SIM specific, is
+   kept in the multi-SIM session's own meta data.
+
+   Each part of a plugin's tree whose meta data is kept in one place is
+   described by a plugin_manager_md_view_t.  The meta data of the keys
+   beneath session_dir is stored in md beneath md_dir.  A session for a
+   single SIM has one view, in which both directories are the plugin's
+   root.  The view of a multi-SIM session's own meta data ignores the keys
+   beneath sims_dir.  The view of a SIM in a multi-SIM session ignores the
+   keys outside the SIM's directory, i.e., those that exist in the
+   session's cache under their own names. */
+
+static const gchar *prv_md_root(unsigned int pindex, const gchar *key)
+{
+	const provman_plugin *plugin = provman_plugin_get(pindex);
+
+	return provman_utils_key_in_subtree(key, plugin->root) ? key :
+		plugin->root;
+}
+
+static bool prv_md_root_covered(GPtrArray *roots, const gchar *key)
+{
+	unsigned int i;
+
+	for (i = 0; i < roots->len; ++i)
+		if (provman_utils_key_in_subtree(key,
+						 g_ptr_array_index(roots, i)))
+			return true;
+
+	return false;
+}
+
+static void prv_md_add_root(plugin_manager_t *manager, unsigned int pindex,
+			    const gchar *root)
+{
+	GPtrArray *roots = manager->plugin_md_roots[pindex];
+	unsigned int i = 0;
+
+	/* Any existing roots that lie beneath the new root are redundant */
+
+	while (i < roots->len) {
+		if (provman_utils_key_in_subtree(g_ptr_array_index(roots, i),
+						 root))
+			g_ptr_array_remove_index_fast(roots, i);
+		else
+			++i;
+	}
+
+	g_ptr_array_add(roots, g_strdup(root));
+}
+
+static gchar *prv_md_move_key(const gchar *key, const gchar *from,
+			      const gchar *to)
+{
+	return g_strconcat(to, key + strlen(from), NULL);
+}
+
+static bool prv_md_view_excludes(plugin_manager_md_view_t *view,
+				 const gchar *md_key)
+{
+	size_t len = strlen(view->md_dir);
+	bool leaf;
+
+	if (view->sims_dir)
+		return provman_utils_key_in_subtree(md_key, view->sims_dir);
+
+	if (!view->sim || !provman_utils_key_in_subtree(md_key, view->md_dir) ||
+	    !md_key[len] || !md_key[len + 1])
+		return false;
+
+	return provman_cache_exists(view->cache, md_key, &leaf) ==
+		PROVMAN_ERR_NONE;
+}
+
+/* Returns the root in view->md of the meta data of the keys beneath root,
+   or NULL if view->md does not hold any of it. */
+
+static gchar *prv_md_view_root(plugin_manager_md_view_t *view,
+			       const gchar *root)
+{
+	gchar *md_root = NULL;
+
+	if (provman_utils_key_in_subtree(root, view->session_dir))
+		md_root = prv_md_move_key(root, view->session_dir,
+					  view->md_dir);
+	else if (provman_utils_key_in_subtree(view->session_dir, root))
+		md_root = g_strdup(view->md_dir);
+
+	if (md_root && prv_md_view_excludes(view, md_root)) {
+		g_free(md_root);
+		md_root = NULL;
+	}
+
+	return md_root;
+}
+
+static void prv_add_md_view(plugin_manager_t *manager, unsigned int pindex,
+			    const gchar *imsi, const gchar *session_dir,
+			    const gchar *md_dir, const gchar *sims_dir)
+{
+	plugin_manager_md_view_t *view;
+	provman_meta_data_t* md = prv_get_plugin_md(manager, pindex, imsi);
+
+	if (!md)
+		return;
+
+	view = g_new0(plugin_manager_md_view_t, 1);
+	view->md = md;
+	view->cache = manager->cache;
+	view->session_dir = g_strdup(session_dir);
+	view->md_dir = g_strdup(md_dir);
+	view->sims_dir = g_strdup(sims_dir);
+	view->sim = strcmp(session_dir, md_dir) != 0;
+	g_ptr_array_add(manager->plugin_md_views[pindex], view);
+}
+
+static void prv_add_md_views(plugin_manager_t *manager, unsigned int pindex)
+{
+	const provman_plugin *plugin = provman_plugin_get(pindex);
+	const gchar *sim_id = "";
+	gchar *root;
+	gchar *sims_dir;
+	gchar *session_dir;
+	GHashTable *settings;
+	GHashTable *imsis;
+	GHashTableIter iter;
+	gpointer key;
+	const gchar *imsi;
+	const gchar *end;
+	size_t len;
+
+	if (plugin->sim_id_fn)
+		sim_id = plugin->sim_id_fn(manager->plugin_instances[pindex]);
+
+	len = strlen(plugin->root);
+	while (len > 0 && plugin->root[len - 1] == '/')
+		--len;
+	root = g_strndup(plugin->root, len);
+
+	if (strcmp(sim_id, PROVMAN_IMSI_ALL)) {
+		prv_add_md_view(manager, pindex, sim_id, root, root, NULL);
+		goto on_error;
+	}
+
+	sims_dir = g_strconcat(plugin->root, PLUGIN_MANAGER_SIMS_DIR, NULL);
+	prv_add_md_view(manager, pindex, sim_id, root, root, sims_dir);
+
+	imsis = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	settings = provman_cache_get_settings(manager->cache, sims_dir);
+	g_hash_table_iter_init(&iter, settings);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		imsi = (const gchar *) key + strlen(sims_dir);
+		end = strchr(imsi, '/');
+		if (end)
+			g_hash_table_insert(imsis, g_strndup(imsi, end - imsi),
+					    NULL);
+	}
+	g_hash_table_unref(settings);
+
+	g_hash_table_iter_init(&iter, imsis);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		session_dir = g_strconcat(sims_dir, key, NULL);
+		prv_add_md_view(manager, pindex, key, session_dir, root, NULL);
+		g_free(session_dir);
+	}
+	g_hash_table_unref(imsis);
+
+	g_free(sims_dir);
+
+on_error:
+
+	g_free(root);
+}
+
+static bool prv_md_keep_cb(const gchar *key, void *user_data)
+{
+	plugin_manager_md_view_t *view = user_data;
+	gchar *session_key;
+	bool leaf;
+	bool keep;
+
+	if (prv_md_view_excludes(view, key))
+		return true;
+
+	if (provman_utils_key_in_subtree(key, view->md_dir))
+		session_key = prv_md_move_key(key, view->md_dir,
+					      view->session_dir);
+	else
+		session_key = g_strdup(key);
+
+	keep = provman_cache_exists(view->cache, session_key, &leaf) ==
+		PROVMAN_ERR_NONE;
+	g_free(session_key);
+
+	return keep;
+}
+
+static void prv_load_view_md(plugin_manager_t *manager, unsigned int pindex,
+			     plugin_manager_md_view_t *view, const gchar *root)
+{
+	gchar *md_root;
+	GHashTable *md_ht;
+	GHashTable *ht;
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	gchar *session_key;
+
+	md_root = prv_md_view_root(view, root);
+	if (!md_root)
+		return;
+
+	provman_meta_data_prune(view->md, md_root, prv_md_keep_cb, view);
+
+	/* The cache already holds the meta data of any subtrees of root
+	   that have been loaded or removed. */
+
+	ht = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+				   (GDestroyNotify) g_hash_table_unref);
+	md_ht = provman_meta_data_get_subtree(view->md, md_root);
+	g_hash_table_iter_init(&iter, md_ht);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		if (prv_md_view_excludes(view, key))
+			continue;
+		session_key = prv_md_move_key(key, view->md_dir,
+					      view->session_dir);
+		if (prv_md_root_covered(manager->plugin_md_roots[pindex],
+					session_key))
+			g_free(session_key);
+		else
+			g_hash_table_insert(ht, session_key,
+					    g_hash_table_ref(value));
+	}
+	provman_cache_add_meta_data(manager->cache, ht);
+
+	g_hash_table_unref(md_ht);
+	g_hash_table_unref(ht);
+	g_free(md_root);
+}
+
+static void prv_load_plugin_md(plugin_manager_t *manager, unsigned int pindex,
+			       const gchar *key)
+{
+	GPtrArray *views = manager->plugin_md_views[pindex];
+	const gchar *root;
+	unsigned int i;
+
+	if (!manager->plugin_synced[pindex])
+		return;
+
+	root = prv_md_root(pindex, key);
+	if (prv_md_root_covered(manager->plugin_md_roots[pindex], root))
+		return;
+
+	PROVMAN_LOGF("Loading meta data for %s", root);
+
+	for (i = 0; i < views->len; ++i)
+		prv_load_view_md(manager, pindex,
+				 g_ptr_array_index(views, i), root);
+
+	prv_md_add_root(manager, pindex, root);
+}
+
+static void prv_load_md(plugin_manager_t *manager, const gchar *key)
+{
+	plugin_manager_cmd_t *cmd = &manager->cb;
+	unsigned int i;
+
+	for (i = 0; i < cmd->indicies->len; ++i)
+		prv_load_plugin_md(manager,
+				   g_array_index(cmd->indicies, guint, i),
+				   key);
+}
+
+static void prv_md_removed(plugin_manager_t *manager, const gchar *key)
+{
+	GArray *indicies = g_array_new(FALSE, FALSE, sizeof(guint));
+	unsigned int pindex;
+	unsigned int i;
+	const gchar *root;
+
+	prv_add_plugin_index(indicies, key);
+	for (i = 0; i < indicies->len; ++i) {
+		pindex = g_array_index(indicies, guint, i);
+		root = prv_md_root(pindex, key);
+		if (manager->plugin_synced[pindex] &&
+		    !prv_md_root_covered(manager->plugin_md_roots[pindex],
+					 root))
+			prv_md_add_root(manager, pindex, root);
+	}
+	(void) g_array_free(indicies, TRUE);
+}
+
 static void prv_plugin_sync_cb(int err, GHashTable *settings, void *user_data)
 {
 	plugin_manager_t *manager = user_data;
-	provman_meta_data_t* md;
-	GHashTable *ht;
 
 	PROVMAN_LOGF("Plugin %s sync_in completed with error %d",
 		      provman_plugin_get(manager->synced)->name, err);
+	PROVMAN_TRACE_END(manager->trace_id, err);
 
 	if (err == PROVMAN_ERR_NONE) {
 		provman_cache_add_settings(manager->cache, settings);
-
-		md = prv_get_plugin_md(manager, manager->synced);
-		if (md) {
-			ht = provman_meta_data_get_all(md);
-			provman_cache_add_meta_data(manager->cache, ht);
-			g_hash_table_unref(ht);
-		}
 		manager->plugin_synced[manager->synced] = true;
+		prv_add_md_views(manager, manager->synced);
 	}
 
 	manager->sync_in_cb(err, manager);
@@ -342,11 +751,20 @@ static int prv_sync_plugin(plugin_manager_t *manager, unsigned int pindex,
 	const char *imsi = (const char*) manager->imsi;
 
 	plugin = provman_plugin_get(pindex);
+
+	err = prv_load_plugin(manager, pindex);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	manager->trace_id = PROVMAN_TRACE_BEGIN(PROVMAN_TRACE_CAT_PLUGIN,
+						"sync_in", plugin->name);
 	err = plugin->sync_in_fn(manager->plugin_instances[pindex],
 				 imsi, prv_plugin_sync_cb, manager);
 
-	if (err != PROVMAN_ERR_NONE)
+	if (err != PROVMAN_ERR_NONE) {
+		PROVMAN_TRACE_END(manager->trace_id, err);
 		goto on_error;
+	}
 
 	manager->synced = pindex;
 	manager->sync_in_cb = callback;
@@ -397,6 +815,7 @@ static void prv_plugin_sync_out_cb(int err, void *user_data)
 
 	PROVMAN_LOGF("Plugin %s sync_out completed with error %d",
 		 provman_plugin_get(manager->synced)->name, err);
+	PROVMAN_TRACE_END(manager->trace_id, err);
 
 	if (err == PROVMAN_ERR_CANCELLED) {
 		prv_clear_cache(manager);
@@ -409,31 +828,110 @@ static void prv_plugin_sync_out_cb(int err, void *user_data)
 	}
 }
 
+static void prv_sync_out_view_md(plugin_manager_t *manager,
+				 unsigned int pindex,
+				 plugin_manager_md_view_t *view)
+{
+	GPtrArray *roots = manager->plugin_md_roots[pindex];
+	GPtrArray *md_roots;
+	GHashTable *ht;
+	GHashTable *root_ht;
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	const gchar *root;
+	gchar *md_root;
+	gchar *md_key;
+	unsigned int i;
+
+	md_roots = g_ptr_array_new_with_free_func(g_free);
+	ht = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+				   (GDestroyNotify) g_hash_table_unref);
+
+	for (i = 0; i < roots->len; ++i) {
+		root = g_ptr_array_index(roots, i);
+		md_root = prv_md_view_root(view, root);
+		if (!md_root)
+			continue;
+		g_ptr_array_add(md_roots, md_root);
+
+		if (!provman_utils_key_in_subtree(root, view->session_dir))
+			root = view->session_dir;
+
+		root_ht = provman_cache_get_meta_data(manager->cache, root);
+		g_hash_table_iter_init(&iter, root_ht);
+		while (g_hash_table_iter_next(&iter, &key, &value)) {
+			g_hash_table_iter_steal(&iter);
+			md_key = prv_md_move_key(key, view->session_dir,
+						 view->md_dir);
+			g_free(key);
+			if (prv_md_view_excludes(view, md_key)) {
+				g_free(md_key);
+				g_hash_table_unref(value);
+			} else {
+				g_hash_table_insert(ht, md_key, value);
+			}
+		}
+		g_hash_table_unref(root_ht);
+
+		/* The meta data of the keys that belong to other views is
+		   written back as it is, so that the update does not delete
+		   it. */
+
+		if (!view->sim && !view->sims_dir)
+			continue;
+
+		root_ht = provman_meta_data_get_subtree(view->md, md_root);
+		g_hash_table_iter_init(&iter, root_ht);
+		while (g_hash_table_iter_next(&iter, &key, &value))
+			if (prv_md_view_excludes(view, key))
+				g_hash_table_insert(ht, g_strdup(key),
+						    g_hash_table_ref(value));
+		g_hash_table_unref(root_ht);
+	}
+
+	if (md_roots->len > 0)
+		provman_meta_data_update(view->md, md_roots, ht);
+
+	g_hash_table_unref(ht);
+	g_ptr_array_unref(md_roots);
+}
+
+static void prv_sync_out_md(plugin_manager_t *manager, unsigned int pindex)
+{
+	GPtrArray *views = manager->plugin_md_views[pindex];
+	unsigned int i;
+
+	if (manager->plugin_md_roots[pindex]->len == 0)
+		return;
+
+	for (i = 0; i < views->len; ++i)
+		prv_sync_out_view_md(manager, pindex,
+				     g_ptr_array_index(views, i));
+}
+
 static void prv_sync_out_next_plugin(plugin_manager_t *manager)
 {
 	const provman_plugin *plugin;
 	unsigned int count = provman_plugin_get_count();
 	int err;
 	GHashTable *settings;
-	GHashTable *ht;
-	provman_meta_data_t* md;
 
 	while (manager->synced < count) {
 		plugin = provman_plugin_get(manager->synced);
 		if (manager->plugin_synced[manager->synced]) {
 			settings = provman_cache_get_settings(manager->cache,
 							      plugin->root);
+			manager->trace_id = PROVMAN_TRACE_BEGIN(
+				PROVMAN_TRACE_CAT_PLUGIN, "sync_out",
+				plugin->name);
 			err = plugin->sync_out_fn(
 				manager->plugin_instances[manager->synced],
 				settings, prv_plugin_sync_out_cb,
 				manager);
-			md = prv_get_plugin_md(manager, manager->synced);
-			if (md) {
-				ht = provman_cache_get_meta_data(manager->cache,
-								 plugin->root);
-				provman_meta_data_update(md, ht);
-				g_hash_table_unref(ht);
-			}
+			if (err != PROVMAN_ERR_NONE)
+				PROVMAN_TRACE_END(manager->trace_id, err);
+			prv_sync_out_md(manager, manager->synced);
 			g_hash_table_unref(settings);
 
 			if (err == PROVMAN_ERR_NONE)
@@ -446,6 +944,15 @@ static void prv_sync_out_next_plugin(plugin_manager_t *manager)
 	}
 
 	if (manager->synced == count) {
+
+		/* The meta data of all the plugins is written to the store
+		   in a single transaction. */
+
+		if (manager->store &&
+		    provman_store_commit(manager->store) !=
+		    PROVMAN_ERR_NONE) {
+			PROVMAN_LOG("Unable to commit meta data to the store");
+		}
 		prv_clear_cache(manager);
 		prv_schedule_completion(manager, PROVMAN_ERR_NONE);
 		g_free(manager->imsi);
@@ -885,9 +1392,11 @@ static void prv_get_all_meta_cb(int result, void *user_data)
 	plugin_manager_t *manager = user_data;
 	plugin_manager_cmd_t *cmd = &manager->cb;
 
-	if (result == PROVMAN_ERR_NONE)
+	if (result == PROVMAN_ERR_NONE) {
+		prv_load_md(manager, cmd->key);
 		result = provman_cache_get_all_meta(manager->cache, cmd->key,
 						    &cmd->ret_variant);
+	}
 	prv_schedule_completion(manager, result);
 }
 
@@ -969,6 +1478,10 @@ static int prv_set_common(plugin_manager_t *manager, const gchar *key,
 	if (err != PROVMAN_ERR_NONE)
 		goto on_error;
 
+	err = prv_load_plugin(manager, index);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
 	root = manager->plugin_schemas[index];
 
 	err = prv_validate_set(root, key, value);
@@ -982,14 +1495,61 @@ on_error:
 	return err;
 }
 
+/* Returns the shallowest key, between the plugin's root and key, that
+   does not exist in the cache, or NULL if key already exists. */
+
+static gchar *prv_first_missing_key(plugin_manager_t *manager,
+				    unsigned int pindex, const gchar *key)
+{
+	const provman_plugin *plugin = provman_plugin_get(pindex);
+	size_t len = strlen(plugin->root);
+	const gchar *end;
+	gchar *prefix;
+	bool leaf;
+
+	while (len > 0 && plugin->root[len - 1] == '/')
+		--len;
+
+	for (;;) {
+		prefix = g_strndup(key, len);
+		if (provman_cache_exists(manager->cache, prefix, &leaf) !=
+		    PROVMAN_ERR_NONE)
+			return prefix;
+		g_free(prefix);
+
+		if (!key[len])
+			break;
+
+		end = strchr(key + len + 1, '/');
+		len = end ? (size_t) (end - key) : strlen(key);
+	}
+
+	return NULL;
+}
+
+static int prv_cache_set(plugin_manager_t *manager, unsigned int pindex,
+			 const gchar *key, const gchar *value)
+{
+	gchar *created = prv_first_missing_key(manager, pindex, key);
+	int err;
+
+	err = provman_cache_set(manager->cache, key, value);
+	if (err == PROVMAN_ERR_NONE && created)
+		prv_md_removed(manager, created);
+	g_free(created);
+
+	return err;
+}
+
 static void prv_set_cb(int result, void *user_data)
 {
 	plugin_manager_t *manager = user_data;
 	plugin_manager_cmd_t *cmd = &manager->cb;
 
 	if (result == PROVMAN_ERR_NONE)
-		result = provman_cache_set(manager->cache, cmd->key,
-					   cmd->value);
+		result = prv_cache_set(manager,
+				       g_array_index(cmd->indicies, guint, 0),
+				       cmd->key, cmd->value);
 	prv_schedule_completion(manager, result);
 }
 
@@ -1061,8 +1621,8 @@ static void prv_set_multiple_cb(int result, void *user_data)
 			if (!manager->plugin_synced[index])
 				err = PROVMAN_ERR_UNKNOWN;
 			else
-				err = provman_cache_set(manager->cache,
-							key, value);
+				err = prv_cache_set(manager, index, key,
+						    value);
 		}
 		if (err != PROVMAN_ERR_NONE)
 			g_variant_builder_add(&vb, "s", key);
@@ -1137,11 +1697,13 @@ static void prv_set_multiple_meta_cb(int result, void *user_data)
 		g_strstrip(key);
 		err = prv_get_plugin_index(manager, key, &index);
 		if (err == PROVMAN_ERR_NONE) {
-			if (!manager->plugin_synced[index])
+			if (!manager->plugin_synced[index]) {
 				err = PROVMAN_ERR_UNKNOWN;
-			else
+			} else {
+				prv_load_plugin_md(manager, index, key);
 				err = provman_cache_set_meta(manager->cache,
 							     key, prop, value);
+			}
 		}
 		if (err != PROVMAN_ERR_NONE)
 			g_variant_builder_add(&vb, "(ss)", key, prop);
@@ -1207,6 +1769,10 @@ static int prv_remove_common(plugin_manager_t *manager, const gchar *key)
 		goto on_error;
 
 	if (provman_plugin_find_index(key, &index) == PROVMAN_ERR_NONE) {
+		err = prv_load_plugin(manager, index);
+		if (err != PROVMAN_ERR_NONE)
+			goto on_error;
+
 		root = manager->plugin_schemas[index];
 
 		err = provman_schema_locate(root, key, &schema);
@@ -1229,8 +1795,11 @@ static void prv_remove_cb(int result, void *user_data)
 	plugin_manager_t *manager = user_data;
 	plugin_manager_cmd_t *cmd = &manager->cb;
 
-	if (result == PROVMAN_ERR_NONE)
+	if (result == PROVMAN_ERR_NONE) {
 		result = provman_cache_remove(manager->cache, cmd->key);
+		if (result == PROVMAN_ERR_NONE)
+			prv_md_removed(manager, cmd->key);
+	}
 
 	prv_schedule_completion(manager, result);
 }
@@ -1302,6 +1871,8 @@ static void prv_remove_multiple_cb(int result, void *user_data)
 		err = prv_remove_common(manager, key);
 		if (err == PROVMAN_ERR_NONE)
 			err = provman_cache_remove(manager->cache, key);
+		if (err == PROVMAN_ERR_NONE)
+			prv_md_removed(manager, key);
 		if (err != PROVMAN_ERR_NONE)
 			g_variant_builder_add(&vb, "s", key);
 
@@ -1369,6 +1940,9 @@ int plugin_manager_abort(plugin_manager_t *manager)
 	}
 
 	for (i = 0; i < count; ++i) {
+		if (!manager->plugin_loaded[i])
+			continue;
+
 		plugin = provman_plugin_get(i);
 
 		if (plugin->abort_fn) {
@@ -1442,6 +2016,10 @@ static int prv_get_schema_dir_type_info(plugin_manager_t *manager,
 	gchar *type;
 	gchar *key_name;
 
+	err = prv_load_plugin(manager, index);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
 	root = manager->plugin_schemas[index];
 
 	err = provman_schema_locate(root, search_key, &parent);
@@ -1556,6 +2134,10 @@ int plugin_manager_get_type_info(plugin_manager_t *manager,
 
 	err = provman_plugin_find_index(search_key, &index);
 	if (err == PROVMAN_ERR_NONE) {
+		err = prv_load_plugin(manager, index);
+		if (err != PROVMAN_ERR_NONE)
+			goto on_error;
+
 		schema_root = manager->plugin_schemas[index];
 
 		err = provman_schema_locate(schema_root, search_key, &schema);
@@ -1589,10 +2171,12 @@ static void prv_get_meta_cb(int result, void *user_data)
 	plugin_manager_t *manager = user_data;
 	plugin_manager_cmd_t *cmd = &manager->cb;
 
-	if (result == PROVMAN_ERR_NONE)
+	if (result == PROVMAN_ERR_NONE) {
+		prv_load_md(manager, cmd->key);
 		result = provman_cache_get_meta(manager->cache,
 						cmd->key, cmd->prop,
 						&cmd->ret_value);
+	}
 	prv_schedule_completion(manager, result);
 }
 
@@ -1624,9 +2208,11 @@ static void prv_set_meta_cb(int result, void *user_data)
 	plugin_manager_t *manager = user_data;
 	plugin_manager_cmd_t *cmd = &manager->cb;
 
-	if (result == PROVMAN_ERR_NONE)
+	if (result == PROVMAN_ERR_NONE) {
+		prv_load_md(manager, cmd->key);
 		result = provman_cache_set_meta(manager->cache, cmd->key,
 						cmd->value, cmd->prop);
+	}
 	prv_schedule_completion(manager, result);
 }
 
@@ -31,11 +31,18 @@
 
 #include "config.h"
 
+/* When loadable plugin modules are enabled the eds plugin is built as a
+   module and is described by a manifest rather than by this table. */
+
+#if defined(PROVMAN_EVOLUTION) && !defined(PROVMAN_PLUGIN_MODULES)
+#define PROVMAN_EVOLUTION_BUILTIN 1
+#endif
+
 #include "plugin.h"
 #include "standard-schemas.h"
 #include "test-schemas.h"
 
-#ifdef PROVMAN_EVOLUTION
+#ifdef PROVMAN_EVOLUTION_BUILTIN
 #include "plugins/eds.h"
 #endif
 
@@ -47,27 +54,33 @@
 #include "plugins/test.h"
 #endif
 
+#ifdef PROVMAN_SYNTHETIC_PLUGIN
+#include "plugins/synthetic.h"
+#endif
+
 /*! \var g_provman_plugins
     \brief Array of plugins structures
 
-  Currently, all plugins are hardcoded.  To add a new plugin you need to create
-  all the required functions and then add a new element to this array,
-  specifying the name of your plugin, its root and pointers to all the plugin
-  functions.
+  Plugins built into provman are listed here.  To add a new plugin you need
+  to create all the required functions and then add a new element to this
+  array, specifying the name of your plugin, its root and pointers to all the
+  plugin functions.  Alternatively, when provman is configured with
+  --enable-plugin-modules, a plugin can be built as a loadable module
+  described by a manifest.  See #PROVMAN_PLUGIN_MODULE_SYMBOL.
 */
 
 provman_plugin g_provman_plugins[] = {
-#ifdef PROVMAN_EVOLUTION
+#ifdef PROVMAN_EVOLUTION_BUILTIN
 	{ "eds", "/applications/email/",
 	  g_provman_email_schema,
 	  eds_plugin_new, eds_plugin_delete,
 	  eds_plugin_sync_in, eds_plugin_sync_in_cancel,
 	  eds_plugin_sync_out, eds_plugin_sync_out_cancel,
-	  NULL, NULL
+	  eds_plugin_abort, NULL
 	}
 #endif
 #ifdef PROVMAN_SYNC_EVOLUTION
-#ifdef PROVMAN_EVOLUTION
+#ifdef PROVMAN_EVOLUTION_BUILTIN
 	,
 #endif
 	{ "sync-evolution", "/applications/sync/",
@@ -79,7 +92,7 @@ provman_plugin g_provman_plugins[] = {
 	}
 #endif
 #ifdef PROVMAN_TEST_PLUGIN
-#if (defined PROVMAN_EVOLUTION || PROVMAN_SYNC_EVOLUTION)
+#if (defined PROVMAN_EVOLUTION_BUILTIN || PROVMAN_SYNC_EVOLUTION)
 	,
 #endif
 	{ "test", "/applications/test_plugin/",
@@ -90,6 +103,40 @@ provman_plugin g_provman_plugins[] = {
 	  test_plugin_abort, test_plugin_sim_id
 	}
 #endif
+#ifdef PROVMAN_SYNTHETIC_PLUGIN
+#if (defined PROVMAN_EVOLUTION_BUILTIN || defined PROVMAN_SYNC_EVOLUTION || \
+     defined PROVMAN_TEST_PLUGIN)
+	,
+#endif
+	{ "synthetic0", "/applications/synthetic0/",
+	  g_provman_synthetic_schema0,
+	  synthetic_plugin_new0, synthetic_plugin_delete,
+	  synthetic_plugin_sync_in, synthetic_plugin_sync_in_cancel,
+	  synthetic_plugin_sync_out, synthetic_plugin_sync_out_cancel,
+	  NULL, NULL
+	},
+	{ "synthetic1", "/applications/synthetic1/",
+	  g_provman_synthetic_schema1,
+	  synthetic_plugin_new1, synthetic_plugin_delete,
+	  synthetic_plugin_sync_in, synthetic_plugin_sync_in_cancel,
+	  synthetic_plugin_sync_out, synthetic_plugin_sync_out_cancel,
+	  NULL, NULL
+	},
+	{ "synthetic2", "/applications/synthetic2/",
+	  g_provman_synthetic_schema2,
+	  synthetic_plugin_new2, synthetic_plugin_delete,
+	  synthetic_plugin_sync_in, synthetic_plugin_sync_in_cancel,
+	  synthetic_plugin_sync_out, synthetic_plugin_sync_out_cancel,
+	  NULL, NULL
+	},
+	{ "synthetic3", "/applications/synthetic3/",
+	  g_provman_synthetic_schema3,
+	  synthetic_plugin_new3, synthetic_plugin_delete,
+	  synthetic_plugin_sync_in, synthetic_plugin_sync_in_cancel,
+	  synthetic_plugin_sync_out, synthetic_plugin_sync_out_cancel,
+	  NULL, NULL
+	}
+#endif
 };
 
 /*! \cond */
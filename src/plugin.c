@@ -33,7 +33,13 @@
 
 #include <string.h>
 
+#ifdef PROVMAN_PLUGIN_MODULES
+#include <syslog.h>
+#include <gmodule.h>
+#endif
+
 #include "error.h"
+#include "log.h"
 #include "plugin.h"
 
 #include "utils.h"
@@ -41,6 +47,30 @@
 extern provman_plugin g_provman_plugins[];
 extern const unsigned int g_provman_plugins_count;
 
+#ifdef PROVMAN_PLUGIN_MODULES
+
+#define PROVMAN_PLUGIN_MANIFEST_EXT ".plugin"
+#define PROVMAN_PLUGIN_MANIFEST_GROUP "Plugin"
+#define PROVMAN_PLUGIN_MANIFEST_NAME "Name"
+#define PROVMAN_PLUGIN_MANIFEST_ROOT "Root"
+#define PROVMAN_PLUGIN_MANIFEST_MODULE "Module"
+#define PROVMAN_PLUGIN_MODULE_DIR "modules"
+
+typedef const provman_plugin *(*provman_plugin_module_get_t)(void);
+
+typedef struct provman_plugin_module_t_ provman_plugin_module_t;
+struct provman_plugin_module_t_ {
+	provman_plugin plugin;
+	gchar *name;
+	gchar *root;
+	gchar *path;
+	GModule *module;
+};
+
+static GPtrArray *g_provman_modules;
+
+#endif
+
 static int prv_check_relationship(const char *key1, const char *key2)
 {
 	const char *tmp;
@@ -58,23 +88,241 @@ static int prv_check_relationship(const char *key1, const char *key2)
 		PROVMAN_ERR_CORRUPT;
 }
 
+#ifdef PROVMAN_PLUGIN_MODULES
+
+static void prv_plugin_module_free(gpointer data)
+{
+	provman_plugin_module_t *module = data;
+
+	if (module) {
+		if (module->module)
+			(void) g_module_close(module->module);
+		g_free(module->path);
+		g_free(module->root);
+		g_free(module->name);
+		g_free(module);
+	}
+}
+
+static bool prv_root_available(const char *root)
+{
+	unsigned int count = provman_plugin_get_count();
+	unsigned int i;
+
+	if (provman_utils_validate_key(root) != PROVMAN_ERR_NONE)
+		return false;
+
+	for (i = 0; i < count; ++i)
+		if (prv_check_relationship(root, provman_plugin_get(i)->root) !=
+		    PROVMAN_ERR_NONE)
+			return false;
+
+	return true;
+}
+
+static void prv_load_manifest(const gchar *dir, const gchar *fname)
+{
+	GKeyFile *key_file = g_key_file_new();
+	gchar *path = g_build_filename(dir, fname, NULL);
+	gchar *name = NULL;
+	gchar *root = NULL;
+	gchar *module_name = NULL;
+	gchar *module_dir = NULL;
+	provman_plugin_module_t *module;
+
+	if (!g_key_file_load_from_file(key_file, path, G_KEY_FILE_NONE, NULL))
+		goto on_error;
+
+	name = g_key_file_get_string(key_file, PROVMAN_PLUGIN_MANIFEST_GROUP,
+				     PROVMAN_PLUGIN_MANIFEST_NAME, NULL);
+	root = g_key_file_get_string(key_file, PROVMAN_PLUGIN_MANIFEST_GROUP,
+				     PROVMAN_PLUGIN_MANIFEST_ROOT, NULL);
+	module_name = g_key_file_get_string(key_file,
+					    PROVMAN_PLUGIN_MANIFEST_GROUP,
+					    PROVMAN_PLUGIN_MANIFEST_MODULE,
+					    NULL);
+	if (!name || !root || !module_name)
+		goto on_error;
+
+	if (!prv_root_available(root))
+		goto on_error;
+
+	module = g_new0(provman_plugin_module_t, 1);
+	module->name = name;
+	module->root = root;
+	if (g_path_is_absolute(module_name)) {
+		module->path = module_name;
+	} else {
+		module_dir = g_build_filename(PROVMAN_PLUGIN_DIR,
+					      PROVMAN_PLUGIN_MODULE_DIR, NULL);
+		module->path = g_module_build_path(module_dir, module_name);
+		g_free(module_name);
+	}
+	module->plugin.name = module->name;
+	module->plugin.root = module->root;
+	g_ptr_array_add(g_provman_modules, module);
+
+	PROVMAN_LOGF("Registered module plugin %s for %s", module->name,
+		     module->root);
+
+	g_free(module_dir);
+	g_free(path);
+	g_key_file_free(key_file);
+
+	return;
+
+on_error:
+
+	syslog(LOG_WARNING, "Ignoring invalid plugin manifest %s", path);
+
+	g_free(module_name);
+	g_free(root);
+	g_free(name);
+	g_free(path);
+	g_key_file_free(key_file);
+}
+
+#endif
+
+int provman_plugin_load_manifests(bool system)
+{
+#ifdef PROVMAN_PLUGIN_MODULES
+	GDir *dir;
+	gchar *dir_name;
+	const gchar *fname;
+
+	if (g_provman_modules)
+		return PROVMAN_ERR_NONE;
+
+	g_provman_modules = g_ptr_array_new_with_free_func(
+		prv_plugin_module_free);
+
+	dir_name = g_build_filename(PROVMAN_PLUGIN_DIR,
+				    system ? "system" : "session", NULL);
+	dir = g_dir_open(dir_name, 0, NULL);
+	if (dir) {
+		while ((fname = g_dir_read_name(dir)))
+			if (g_str_has_suffix(fname,
+					     PROVMAN_PLUGIN_MANIFEST_EXT))
+				prv_load_manifest(dir_name, fname);
+		g_dir_close(dir);
+	}
+	g_free(dir_name);
+#endif
+
+	return PROVMAN_ERR_NONE;
+}
+
+void provman_plugin_unload_modules()
+{
+#ifdef PROVMAN_PLUGIN_MODULES
+	if (g_provman_modules) {
+		g_ptr_array_unref(g_provman_modules);
+		g_provman_modules = NULL;
+	}
+#endif
+}
+
+bool provman_plugin_is_module(unsigned int i)
+{
+	return i >= g_provman_plugins_count;
+}
+
+int provman_plugin_load(unsigned int i)
+{
+#ifdef PROVMAN_PLUGIN_MODULES
+	int err = PROVMAN_ERR_NONE;
+	provman_plugin_module_t *module = NULL;
+	gpointer symbol;
+	const provman_plugin *desc;
+
+	if (i < g_provman_plugins_count)
+		goto on_error;
+
+	if (!g_provman_modules || i - g_provman_plugins_count >=
+	    g_provman_modules->len) {
+		err = PROVMAN_ERR_NOT_FOUND;
+		goto on_error;
+	}
+
+	module = g_ptr_array_index(g_provman_modules,
+				   i - g_provman_plugins_count);
+	if (module->module)
+		goto on_error;
+
+	PROVMAN_LOGF("Loading plugin module %s", module->path);
+
+	module->module = g_module_open(module->path, G_MODULE_BIND_LAZY |
+				       G_MODULE_BIND_LOCAL);
+	if (!module->module) {
+		syslog(LOG_ERR, "Unable to load plugin module %s: %s",
+		       module->path, g_module_error());
+		err = PROVMAN_ERR_SUBSYSTEM;
+		goto on_error;
+	}
+
+	if (!g_module_symbol(module->module, PROVMAN_PLUGIN_MODULE_SYMBOL,
+			     &symbol) || !symbol) {
+		err = PROVMAN_ERR_CORRUPT;
+		goto on_error;
+	}
+
+	desc = ((provman_plugin_module_get_t) symbol)();
+	if (!desc || !desc->root || strcmp(desc->root, module->root) ||
+	    !desc->schema || !desc->new_fn || !desc->delete_fn ||
+	    !desc->sync_in_fn || !desc->sync_in_cancel_fn ||
+	    !desc->sync_out_fn || !desc->sync_out_cancel_fn) {
+		err = PROVMAN_ERR_CORRUPT;
+		goto on_error;
+	}
+
+	/* The name and root remain those of the manifest so that the
+	   routing decisions made before the module was loaded stay valid. */
+
+	module->plugin.schema = desc->schema;
+	module->plugin.new_fn = desc->new_fn;
+	module->plugin.delete_fn = desc->delete_fn;
+	module->plugin.sync_in_fn = desc->sync_in_fn;
+	module->plugin.sync_in_cancel_fn = desc->sync_in_cancel_fn;
+	module->plugin.sync_out_fn = desc->sync_out_fn;
+	module->plugin.sync_out_cancel_fn = desc->sync_out_cancel_fn;
+	module->plugin.abort_fn = desc->abort_fn;
+	module->plugin.sim_id_fn = desc->sim_id_fn;
+
+	return PROVMAN_ERR_NONE;
+
+on_error:
+
+	if (err != PROVMAN_ERR_NONE && module && module->module) {
+		(void) g_module_close(module->module);
+		module->module = NULL;
+	}
+
+	return err;
+#else
+	return i < g_provman_plugins_count ? PROVMAN_ERR_NONE :
+		PROVMAN_ERR_NOT_FOUND;
+#endif
+}
+
 int provman_plugin_check()
 {
 	int err = PROVMAN_ERR_NONE;
 
 	unsigned int i;
 	unsigned int j;
+	unsigned int count = provman_plugin_get_count();
 
-	for (i = 0; i < g_provman_plugins_count; ++i) {
+	for (i = 0; i < count; ++i) {
 		err = provman_utils_validate_key(
-			g_provman_plugins[i].root);
+			provman_plugin_get(i)->root);
 		if (err != PROVMAN_ERR_NONE)
 			goto on_error;
 
-		for (j = i + 1; j < g_provman_plugins_count; ++j) {
+		for (j = i + 1; j < count; ++j) {
 			err = prv_check_relationship(
-				g_provman_plugins[i].root,
-				g_provman_plugins[j].root);
+				provman_plugin_get(i)->root,
+				provman_plugin_get(j)->root);
 			if (err != PROVMAN_ERR_NONE)
 				goto on_error;
 		}
@@ -87,11 +335,27 @@ on_error:
 
 unsigned int provman_plugin_get_count()
 {
+#ifdef PROVMAN_PLUGIN_MODULES
+	if (g_provman_modules)
+		return g_provman_plugins_count + g_provman_modules->len;
+#endif
 	return g_provman_plugins_count;
 }
 
 const provman_plugin *provman_plugin_get(unsigned int i)
 {
+#ifdef PROVMAN_PLUGIN_MODULES
+	provman_plugin_module_t *module;
+
+	if (i >= g_provman_plugins_count) {
+		if (!g_provman_modules ||
+		    i - g_provman_plugins_count >= g_provman_modules->len)
+			return NULL;
+		module = g_ptr_array_index(g_provman_modules,
+					   i - g_provman_plugins_count);
+		return &module->plugin;
+	}
+#endif
 	return (i < g_provman_plugins_count) ?
 		&g_provman_plugins[i] : NULL;
 }
@@ -99,12 +363,13 @@ const provman_plugin *provman_plugin_get(unsigned int i)
 int provman_plugin_find_index(const char *uri, unsigned int *index)
 {
 	unsigned int i = 0;
-	provman_plugin *plugin;
+	const provman_plugin *plugin;
+	unsigned int count = provman_plugin_get_count();
 
 	unsigned int plugin_uri_len = 0;
 
-	for (i = 0; i < g_provman_plugins_count; ++i) {
-		plugin = &g_provman_plugins[i];
+	for (i = 0; i < count; ++i) {
+		plugin = provman_plugin_get(i);
 		plugin_uri_len = strlen(plugin->root);
 
 		if ((plugin_uri_len == strlen(uri) + 1)
@@ -117,8 +382,7 @@ int provman_plugin_find_index(const char *uri, unsigned int *index)
 		}
 	}
 
-	return i < g_provman_plugins_count ? PROVMAN_ERR_NONE :
-		PROVMAN_ERR_NOT_FOUND;
+	return i < count ? PROVMAN_ERR_NONE : PROVMAN_ERR_NOT_FOUND;
 }
 
 /* The following three functions maybe a little confusing and deserve
@@ -149,12 +413,13 @@ GPtrArray *provman_plugin_find_children(const char *uri)
 {
 	GPtrArray *children = g_ptr_array_new();
 	unsigned int uri_len = strlen(uri);
-	provman_plugin *plugin;
+	const provman_plugin *plugin;
+	unsigned int count = provman_plugin_get_count();
 	unsigned int plugin_uri_len = 0;
 	unsigned int i;
 
-	for (i = 0; i < g_provman_plugins_count; ++i) {
-		plugin = &g_provman_plugins[i];
+	for (i = 0; i < count; ++i) {
+		plugin = provman_plugin_get(i);
 		plugin_uri_len = strlen(plugin->root);
 
 		if (uri_len >  plugin_uri_len)
@@ -183,7 +448,8 @@ GPtrArray *provman_plugin_find_direct_children(const char *uri)
 {
 	GPtrArray *children = g_ptr_array_new_with_free_func(g_free);
 	unsigned int uri_len = strlen(uri);
-	provman_plugin *plugin;
+	const provman_plugin *plugin;
+	unsigned int count = provman_plugin_get_count();
 	unsigned int plugin_uri_len = 0;
 	unsigned int i;
 	const char *direct_child;
@@ -191,8 +457,8 @@ GPtrArray *provman_plugin_find_direct_children(const char *uri)
 	gchar *name;
 	unsigned int j;
 
-	for (i = 0; i < g_provman_plugins_count; ++i) {
-		plugin = &g_provman_plugins[i];
+	for (i = 0; i < count; ++i) {
+		plugin = provman_plugin_get(i);
 		plugin_uri_len = strlen(plugin->root);
 
 		if (uri_len >  plugin_uri_len)
@@ -233,12 +499,13 @@ GPtrArray *provman_plugin_find_direct_children(const char *uri)
 bool provman_plugin_uri_exists(const char *uri)
 {
 	unsigned int uri_len = strlen(uri);
-	provman_plugin *plugin;
+	const provman_plugin *plugin;
+	unsigned int count = provman_plugin_get_count();
 	unsigned int plugin_uri_len = 0;
 	unsigned int i;
 
-	for (i = 0; i < g_provman_plugins_count; ++i) {
-		plugin = &g_provman_plugins[i];
+	for (i = 0; i < count; ++i) {
+		plugin = provman_plugin_get(i);
 		plugin_uri_len = strlen(plugin->root);
 
 		if (uri_len >  plugin_uri_len)
@@ -250,7 +517,7 @@ bool provman_plugin_uri_exists(const char *uri)
 			break;
 	}
 
-	return i < g_provman_plugins_count;
+	return i < count;
 }
 
 /* Returns the indicies of all the plugins whose root nodes are descendents of
@@ -260,12 +527,13 @@ bool provman_plugin_uri_exists(const char *uri)
 void provman_plugin_find_plugins(const char *uri, GArray *indicies)
 {
 	unsigned int uri_len = strlen(uri);
-	provman_plugin *plugin;
+	const provman_plugin *plugin;
+	unsigned int count = provman_plugin_get_count();
 	unsigned int plugin_uri_len;
 	unsigned int i;
 
-	for (i = 0; i < g_provman_plugins_count; ++i) {
-		plugin = &g_provman_plugins[i];
+	for (i = 0; i < count; ++i) {
+		plugin = provman_plugin_get(i);
 		plugin_uri_len = strlen(plugin->root);
 
 		if (uri_len >  plugin_uri_len)
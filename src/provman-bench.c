@@ -0,0 +1,436 @@
+/*
+ * Provman
+ *
+ * Copyright (C) 2011 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+
+/*!
+ * @file provman-bench.c
+ *
+ * @brief Main file for provman-bench
+ *
+ * provman-bench measures the performance of the plugin manager, the cache
+ * and the schemas without D-Bus.  It links in the same sources as the
+ * provman daemons together with the test plugin and drives the plugin
+ * manager directly from a private main loop.
+ *
+ * Each iteration runs two sessions against the test plugin.  The first
+ * creates contexts x keys settings with a single SetMultiple, reads them
+ * back with Get and GetAll, and writes them out.  The second deletes them
+ * all with a single DeleteMultiple.  The first command of each session
+ * triggers the plugin's sync_in and is reported separately as sync_in.
+ * With --sync-all the first command is a GetAll of /, which syncs in every
+ * plugin, including the synthetic plugins if they are configured.
+ *
+ ******************************************************************************/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "error.h"
+#include "plugin-manager.h"
+#include "plugin-bench.h"
+
+#define BENCH_ROOT "/applications/test_plugin/"
+#define BENCH_KEY_DIR "subdir_many_keys"
+#define BENCH_MAX_KEYS 100
+#define BENCH_IMSI "provman-bench"
+
+enum bench_op_t_ {
+	BENCH_OP_SYNC_IN,
+	BENCH_OP_SET_MULTIPLE,
+	BENCH_OP_GET,
+	BENCH_OP_GET_ALL,
+	BENCH_OP_REMOVE_MULTIPLE,
+	BENCH_OP_SYNC_OUT,
+	BENCH_OP_MAX
+};
+typedef enum bench_op_t_ bench_op_t;
+
+typedef struct bench_t_ bench_t;
+struct bench_t_ {
+	plugin_manager_t *manager;
+	GMainLoop *loop;
+	int result;
+	GArray *latencies[BENCH_OP_MAX];
+	guint64 keys[BENCH_OP_MAX];
+};
+
+static const gchar *g_bench_op_names[BENCH_OP_MAX] = {
+	"sync_in",
+	"set_multiple",
+	"get",
+	"get_all",
+	"remove_multiple",
+	"sync_out"
+};
+
+static gint g_bench_contexts = 10;
+static gint g_bench_keys = 10;
+static gint g_bench_gets = 100;
+static gint g_bench_iterations = 10;
+static gboolean g_bench_sync_all;
+
+static GOptionEntry g_bench_options[] = {
+	{ "contexts", 'c', 0, G_OPTION_ARG_INT, &g_bench_contexts,
+	  "Number of contexts (directories) under the plugin root", "N" },
+	{ "keys", 'k', 0, G_OPTION_ARG_INT, &g_bench_keys,
+	  "Number of keys in each context, at most 100", "N" },
+	{ "gets", 'g', 0, G_OPTION_ARG_INT, &g_bench_gets,
+	  "Number of individual Gets per iteration", "N" },
+	{ "iterations", 'n', 0, G_OPTION_ARG_INT, &g_bench_iterations,
+	  "Number of iterations", "N" },
+	{ "sync-all", 's', 0, G_OPTION_ARG_NONE, &g_bench_sync_all,
+	  "Sync in all plugins at the start of each session", NULL },
+	{ NULL, 0, 0, 0, NULL, NULL, NULL }
+};
+
+static gchar *prv_make_context(int context)
+{
+	return g_strdup_printf(BENCH_ROOT"ctx%05d/", context);
+}
+
+static gchar *prv_make_key(int context, int key)
+{
+	return g_strdup_printf(BENCH_ROOT"ctx%05d/"BENCH_KEY_DIR"/key%03d",
+			       context, key + 1);
+}
+
+static void prv_void_cb(int result, void *user_data)
+{
+	bench_t *bench = user_data;
+
+	bench->result = result;
+	g_main_loop_quit(bench->loop);
+}
+
+static void prv_value_cb(int result, gchar *value, void *user_data)
+{
+	bench_t *bench = user_data;
+
+	g_free(value);
+	bench->result = result;
+	g_main_loop_quit(bench->loop);
+}
+
+static void prv_variant_cb(int result, GVariant *variant, void *user_data)
+{
+	bench_t *bench = user_data;
+
+	if (variant)
+		g_variant_unref(variant);
+	bench->result = result;
+	g_main_loop_quit(bench->loop);
+}
+
+/* Called after a command has been issued.  Waits for it to complete and
+   records its latency. */
+
+static int prv_wait(bench_t *bench, int err, bench_op_t op, gint64 start,
+		    guint64 keys)
+{
+	gint64 latency;
+
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	g_main_loop_run(bench->loop);
+	err = bench->result;
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	latency = g_get_monotonic_time() - start;
+	g_array_append_val(bench->latencies[op], latency);
+	bench->keys[op] += keys;
+
+on_error:
+
+	if (err != PROVMAN_ERR_NONE)
+		fprintf(stderr, "%s failed with error %d\n",
+			g_bench_op_names[op], err);
+
+	return err;
+}
+
+static int prv_sync_in(bench_t *bench)
+{
+	int err;
+	gint64 start;
+
+	err = plugin_manager_sync_in(bench->manager, BENCH_IMSI);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	start = g_get_monotonic_time();
+	err = plugin_manager_get_all(bench->manager,
+				     g_bench_sync_all ? "/" : BENCH_ROOT,
+				     prv_variant_cb, bench);
+	err = prv_wait(bench, err, BENCH_OP_SYNC_IN, start, 0);
+
+on_error:
+
+	return err;
+}
+
+static int prv_sync_out(bench_t *bench)
+{
+	int err;
+	gint64 start;
+
+	start = g_get_monotonic_time();
+	err = plugin_manager_sync_out(bench->manager, prv_void_cb, bench);
+
+	return prv_wait(bench, err, BENCH_OP_SYNC_OUT, start, 0);
+}
+
+static int prv_create_session(bench_t *bench)
+{
+	int err;
+	gint64 start;
+	GVariantBuilder vb;
+	int i;
+	int j;
+	gchar *key;
+	guint64 count = (guint64) g_bench_contexts * g_bench_keys;
+
+	err = prv_sync_in(bench);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	g_variant_builder_init(&vb, G_VARIANT_TYPE("a{ss}"));
+	for (i = 0; i < g_bench_contexts; ++i)
+		for (j = 0; j < g_bench_keys; ++j) {
+			key = prv_make_key(i, j);
+			g_variant_builder_add(&vb, "{ss}", key, key);
+			g_free(key);
+		}
+
+	start = g_get_monotonic_time();
+	err = plugin_manager_set_multiple(bench->manager,
+					  g_variant_builder_end(&vb),
+					  prv_variant_cb, bench);
+	err = prv_wait(bench, err, BENCH_OP_SET_MULTIPLE, start, count);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	for (i = 0; i < g_bench_gets; ++i) {
+		key = prv_make_key(g_random_int_range(0, g_bench_contexts),
+				   g_random_int_range(0, g_bench_keys));
+		start = g_get_monotonic_time();
+		err = plugin_manager_get(bench->manager, key, prv_value_cb,
+					 bench);
+		g_free(key);
+		err = prv_wait(bench, err, BENCH_OP_GET, start, 1);
+		if (err != PROVMAN_ERR_NONE)
+			goto on_error;
+	}
+
+	start = g_get_monotonic_time();
+	err = plugin_manager_get_all(bench->manager, BENCH_ROOT,
+				     prv_variant_cb, bench);
+	err = prv_wait(bench, err, BENCH_OP_GET_ALL, start, count);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	err = prv_sync_out(bench);
+
+on_error:
+
+	return err;
+}
+
+static int prv_delete_session(bench_t *bench)
+{
+	int err;
+	gint64 start;
+	GVariantBuilder vb;
+	int i;
+	gchar *key;
+	guint64 count = (guint64) g_bench_contexts * g_bench_keys;
+
+	err = prv_sync_in(bench);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	g_variant_builder_init(&vb, G_VARIANT_TYPE("as"));
+	for (i = 0; i < g_bench_contexts; ++i) {
+		key = prv_make_context(i);
+		g_variant_builder_add(&vb, "s", key);
+		g_free(key);
+	}
+
+	start = g_get_monotonic_time();
+	err = plugin_manager_remove_multiple(bench->manager,
+					     g_variant_builder_end(&vb),
+					     prv_variant_cb, bench);
+	err = prv_wait(bench, err, BENCH_OP_REMOVE_MULTIPLE, start, count);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	err = prv_sync_out(bench);
+
+on_error:
+
+	return err;
+}
+
+static gint prv_compare_latency(gconstpointer a, gconstpointer b)
+{
+	gint64 la = *((const gint64 *) a);
+	gint64 lb = *((const gint64 *) b);
+
+	return la < lb ? -1 : la > lb ? 1 : 0;
+}
+
+static gint64 prv_percentile(GArray *latencies, unsigned int percentile)
+{
+	guint index = (latencies->len * percentile) / 100;
+
+	if (index >= latencies->len)
+		index = latencies->len - 1;
+
+	return g_array_index(latencies, gint64, index);
+}
+
+static void prv_report(bench_t *bench)
+{
+	unsigned int i;
+	unsigned int j;
+	GArray *latencies;
+	gint64 total;
+
+	printf("%-16s %8s %12s %12s %10s %10s %10s %10s\n", "command", "count",
+	       "ops/s", "keys/s", "p50(us)", "p90(us)", "p99(us)",
+	       "max(us)");
+
+	for (i = 0; i < BENCH_OP_MAX; ++i) {
+		latencies = bench->latencies[i];
+		if (latencies->len == 0)
+			continue;
+
+		g_array_sort(latencies, prv_compare_latency);
+		total = 0;
+		for (j = 0; j < latencies->len; ++j)
+			total += g_array_index(latencies, gint64, j);
+		if (total == 0)
+			total = 1;
+
+		printf("%-16s %8u %12.1f %12.1f %10" G_GINT64_FORMAT
+		       " %10" G_GINT64_FORMAT " %10" G_GINT64_FORMAT
+		       " %10" G_GINT64_FORMAT "\n", g_bench_op_names[i],
+		       latencies->len, latencies->len * 1000000.0 / total,
+		       bench->keys[i] * 1000000.0 / total,
+		       prv_percentile(latencies, 50),
+		       prv_percentile(latencies, 90),
+		       prv_percentile(latencies, 99),
+		       g_array_index(latencies, gint64, latencies->len - 1));
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int err = PROVMAN_ERR_NONE;
+	GOptionContext *context;
+	GError *error = NULL;
+	bench_t bench;
+	unsigned int i;
+	int iteration;
+	gchar *home = NULL;
+
+	memset(&bench, 0, sizeof(bench));
+
+	context = g_option_context_new("- benchmark the provman plugin "
+				       "manager");
+	g_option_context_add_main_entries(context, g_bench_options, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	if (g_bench_contexts < 1 || g_bench_keys < 1 ||
+	    g_bench_keys > BENCH_MAX_KEYS || g_bench_gets < 0 ||
+	    g_bench_iterations < 1) {
+		fprintf(stderr, "Invalid arguments\n");
+		return 1;
+	}
+
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+	g_thread_init(NULL);
+#endif
+	g_type_init();
+	g_random_set_seed(0);
+
+	for (i = 0; i < BENCH_OP_MAX; ++i)
+		bench.latencies[i] = g_array_new(FALSE, FALSE,
+						 sizeof(gint64));
+
+	bench.loop = g_main_loop_new(NULL, FALSE);
+
+	err = provman_bench_home_new(&home);
+	if (err != PROVMAN_ERR_NONE) {
+		fprintf(stderr, "Unable to create home directory: %d\n", err);
+		goto on_error;
+	}
+
+	err = plugin_manager_new(&bench.manager, false);
+	if (err != PROVMAN_ERR_NONE) {
+		fprintf(stderr, "Unable to create plugin manager: %d\n", err);
+		goto on_error;
+	}
+
+	printf("%d contexts x %d keys, %d gets, %d iterations\n\n",
+	       g_bench_contexts, g_bench_keys, g_bench_gets,
+	       g_bench_iterations);
+
+	for (iteration = 0; iteration < g_bench_iterations; ++iteration) {
+		err = prv_create_session(&bench);
+		if (err != PROVMAN_ERR_NONE)
+			goto on_error;
+		err = prv_delete_session(&bench);
+		if (err != PROVMAN_ERR_NONE)
+			goto on_error;
+	}
+
+	prv_report(&bench);
+
+on_error:
+
+	if (bench.manager)
+		plugin_manager_delete(bench.manager);
+
+	provman_bench_home_delete(home);
+
+	g_main_loop_unref(bench.loop);
+
+	for (i = 0; i < BENCH_OP_MAX; ++i)
+		g_array_free(bench.latencies[i], TRUE);
+
+	return err == PROVMAN_ERR_NONE ? 0 : 1;
+}
@@ -0,0 +1,981 @@
+/*
+ * Provman
+ *
+ * Copyright (C) 2011 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+/*!
+ * @file provman-load.c
+ *
+ * @brief Main file for provman-load
+ *
+ * provman-load replays the management sessions described by the scripts
+ * in testcases/ against a provman daemon, from many concurrent client
+ * connections, and reports how the daemon copes.  Unless the address of
+ * an existing bus is given, it starts a private dbus-daemon, launches the
+ * provman daemon on that bus and stops both when it has finished.
+ *
+ * The scripts are not executed.  Instead provman-load extracts the calls
+ * they make on the provman interface, in the order in which they appear,
+ * and converts their arguments to GVariants using the daemon's
+ * introspection data.  Control flow is ignored, so each call is replayed
+ * exactly once per session.  Arguments that refer to sys.argv, directly
+ * or through a variable, are taken from the command line, e.g.,
+ * testcases/get-all-session:/applications/ replays get-all-session with
+ * sys.argv[1] set to /applications/.  A session that calls Start but does
+ * not call End or Abort is terminated with an End.
+ *
+ * Sessions are assigned to the scripts in round robin order and are
+ * started at a fixed rate, or as soon as a client becomes free if no rate
+ * is given.  For each session the tool measures
+ *
+ * - session: the time from the start of the session to the reply to its
+ *   last call.
+ * - queue_wait: the time between sending Start and receiving its reply,
+ *   i.e., the time the client spends in the daemon's queue of clients
+ *   waiting for the session lock.
+ * - first_reply: the time between sending Start and receiving the reply
+ *   to the first call that follows it, which includes the queue wait and
+ *   the plugins' sync_in.
+ * - schedule_lag: with --rate, the time a session spends waiting for a
+ *   free client after it was due to start.
+ *
+ ******************************************************************************/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "error.h"
+
+#define LOAD_START "Start"
+#define LOAD_END "End"
+#define LOAD_ABORT "Abort"
+#define LOAD_MANAGER "manager."
+#define LOAD_ARGV "sys.argv["
+#define LOAD_NAME_TIMEOUT 10000000
+
+enum load_stat_t_ {
+	LOAD_STAT_SESSION,
+	LOAD_STAT_QUEUE_WAIT,
+	LOAD_STAT_FIRST_REPLY,
+	LOAD_STAT_SCHEDULE_LAG,
+	LOAD_STAT_MAX
+};
+typedef enum load_stat_t_ load_stat_t;
+
+typedef struct load_call_t_ load_call_t;
+struct load_call_t_ {
+	gchar *method;
+	GVariant *params;
+	gboolean is_start;
+};
+
+typedef struct load_scenario_t_ load_scenario_t;
+struct load_scenario_t_ {
+	gchar *spec;
+	GPtrArray *calls;
+};
+
+typedef struct load_parser_t_ load_parser_t;
+struct load_parser_t_ {
+	GDBusInterfaceInfo *interface;
+	GHashTable *vars;
+	gchar **argv;
+	guint argc;
+	load_scenario_t *scenario;
+};
+
+typedef struct load_t_ load_t;
+
+typedef struct load_client_t_ load_client_t;
+struct load_client_t_ {
+	load_t *load;
+	GDBusConnection *connection;
+	load_scenario_t *scenario;
+	guint call;
+	gint64 session_start;
+	gint64 call_sent;
+	gint64 start_sent;
+	gboolean first_reply_pending;
+};
+
+struct load_t_ {
+	GMainLoop *loop;
+	GPtrArray *scenarios;
+	GPtrArray *clients;
+	GQueue idle;
+	guint started;
+	guint completed;
+	guint failed;
+	guint64 calls;
+	guint64 errors;
+	gint64 t0;
+	guint timer_id;
+	GArray *latencies[LOAD_STAT_MAX];
+	GPid bus_pid;
+	GPid daemon_pid;
+};
+
+static const gchar *g_load_stat_names[LOAD_STAT_MAX] = {
+	"session",
+	"queue_wait",
+	"first_reply",
+	"schedule_lag"
+};
+
+static gchar *g_load_address;
+static gchar *g_load_dbus_daemon = "dbus-daemon";
+static gchar *g_load_daemon = "./provman-session";
+static gint g_load_clients = 10;
+static gint g_load_sessions = 100;
+static gdouble g_load_rate;
+
+static GOptionEntry g_load_options[] = {
+	{ "address", 'a', 0, G_OPTION_ARG_STRING, &g_load_address,
+	  "Address of a running bus on which provman is available", "ADDR" },
+	{ "dbus-daemon", 'b', 0, G_OPTION_ARG_STRING, &g_load_dbus_daemon,
+	  "dbus-daemon used to start a private bus", "PATH" },
+	{ "daemon", 'd', 0, G_OPTION_ARG_STRING, &g_load_daemon,
+	  "provman daemon to launch on the private bus", "PATH" },
+	{ "clients", 'c', 0, G_OPTION_ARG_INT, &g_load_clients,
+	  "Number of concurrent client connections", "N" },
+	{ "sessions", 's', 0, G_OPTION_ARG_INT, &g_load_sessions,
+	  "Total number of sessions to replay", "N" },
+	{ "rate", 'r', 0, G_OPTION_ARG_DOUBLE, &g_load_rate,
+	  "Sessions started per second, 0 to start them back to back",
+	  "RATE" },
+	{ NULL, 0, 0, 0, NULL, NULL, NULL }
+};
+
+static void prv_call_free(gpointer data)
+{
+	load_call_t *call = data;
+
+	g_free(call->method);
+	g_variant_unref(call->params);
+	g_free(call);
+}
+
+static void prv_scenario_free(gpointer data)
+{
+	load_scenario_t *scenario = data;
+
+	g_ptr_array_free(scenario->calls, TRUE);
+	g_free(scenario->spec);
+	g_free(scenario);
+}
+
+static const gchar *prv_skip_space(const gchar *p)
+{
+	while (*p == ' ' || *p == '\t')
+		++p;
+
+	return p;
+}
+
+static const gchar *prv_skip_identifier(const gchar *p)
+{
+	while (isalnum((unsigned char) *p) || *p == '_')
+		++p;
+
+	return p;
+}
+
+/* p points to the opening quote of a python string literal.  Returns a
+   pointer to the character following the closing quote. */
+
+static const gchar *prv_skip_string(const gchar *p)
+{
+	gchar quote = *p++;
+
+	while (*p && *p != quote) {
+		if (*p == '\\' && p[1])
+			++p;
+		++p;
+	}
+
+	return *p ? p + 1 : p;
+}
+
+static gchar *prv_quote(const gchar *value)
+{
+	GVariant *variant = g_variant_ref_sink(g_variant_new_string(value));
+	gchar *text = g_variant_print(variant, FALSE);
+
+	g_variant_unref(variant);
+
+	return text;
+}
+
+/* Converts an argument expression to the GVariant text format.  Python's
+   string, list and dictionary literals are already valid GVariant text, so
+   only references to sys.argv and to variables need to be resolved. */
+
+static gchar *prv_resolve(load_parser_t *parser, const gchar *expr)
+{
+	guint index;
+	const gchar *value;
+
+	if (g_str_has_prefix(expr, LOAD_ARGV)) {
+		index = (guint) atoi(expr + strlen(LOAD_ARGV));
+		return prv_quote(index < parser->argc ? parser->argv[index] :
+				 "");
+	}
+
+	value = g_hash_table_lookup(parser->vars, expr);
+
+	return g_strdup(value ? value : expr);
+}
+
+static void prv_parse_assignment(load_parser_t *parser, const gchar *line,
+				 const gchar *end)
+{
+	const gchar *p = prv_skip_identifier(line);
+	gchar *name;
+	gchar *value;
+	gsize len;
+
+	if (p == line)
+		return;
+
+	name = g_strndup(line, p - line);
+	p = prv_skip_space(p);
+	if (*p != '=' || p[1] == '=')
+		goto on_error;
+
+	p = prv_skip_space(p + 1);
+	value = g_strstrip(g_strndup(p, end - p));
+	len = strlen(value);
+	if (len > 0 && value[len - 1] == ';')
+		value[len - 1] = 0;
+	(void) g_strstrip(value);
+
+	if (value[0] == '"' || value[0] == '\'' ||
+	    g_str_has_prefix(value, LOAD_ARGV)) {
+		g_hash_table_insert(parser->vars, name,
+				    prv_resolve(parser, value));
+		name = NULL;
+	}
+
+	g_free(value);
+
+on_error:
+
+	g_free(name);
+}
+
+static void prv_add_arg(GPtrArray *args, const gchar *start,
+			const gchar *end)
+{
+	gchar *arg = g_strstrip(g_strndup(start, end - start));
+
+	if (arg[0])
+		g_ptr_array_add(args, arg);
+	else
+		g_free(arg);
+}
+
+/* Splits the arguments of a call into a list of expressions.  *pp points
+   to the opening parenthesis and is updated to point to the character
+   following the closing one. */
+
+static int prv_split_args(const gchar **pp, GPtrArray *args)
+{
+	const gchar *p = *pp + 1;
+	const gchar *start = p;
+	unsigned int depth = 0;
+
+	for (;;) {
+		if (!*p)
+			return PROVMAN_ERR_CORRUPT;
+
+		if (*p == '"' || *p == '\'') {
+			p = prv_skip_string(p);
+			continue;
+		}
+
+		if (*p == '(' || *p == '[' || *p == '{') {
+			++depth;
+		} else if (*p == ')' || *p == ']' || *p == '}') {
+			if (depth == 0)
+				break;
+			--depth;
+		} else if (*p == ',' && depth == 0) {
+			prv_add_arg(args, start, p);
+			start = p + 1;
+		}
+		++p;
+	}
+
+	prv_add_arg(args, start, p);
+	*pp = p + 1;
+
+	return PROVMAN_ERR_NONE;
+}
+
+static int prv_parse_call(load_parser_t *parser, const gchar **pp)
+{
+	int err = PROVMAN_ERR_NONE;
+	const gchar *method_start = *pp;
+	const gchar *p = prv_skip_identifier(method_start);
+	gchar *method;
+	GDBusMethodInfo *info;
+	GPtrArray *args;
+	GVariant **children = NULL;
+	gchar *text;
+	GError *error = NULL;
+	load_call_t *call;
+	guint n_in = 0;
+	guint i;
+
+	if (*p != '(') {
+		*pp = p;
+		return PROVMAN_ERR_NONE;
+	}
+
+	method = g_strndup(method_start, p - method_start);
+	args = g_ptr_array_new_with_free_func(g_free);
+
+	err = prv_split_args(&p, args);
+	if (err != PROVMAN_ERR_NONE) {
+		fprintf(stderr, "%s: unterminated call to %s\n",
+			parser->scenario->spec, method);
+		goto on_error;
+	}
+	*pp = p;
+
+	info = g_dbus_interface_info_lookup_method(parser->interface, method);
+	if (!info) {
+		fprintf(stderr, "%s: unknown method %s\n",
+			parser->scenario->spec, method);
+		err = PROVMAN_ERR_NOT_FOUND;
+		goto on_error;
+	}
+
+	while (info->in_args && info->in_args[n_in])
+		++n_in;
+
+	if (n_in != args->len) {
+		fprintf(stderr, "%s: %s expects %u arguments\n",
+			parser->scenario->spec, method, n_in);
+		err = PROVMAN_ERR_BAD_ARGS;
+		goto on_error;
+	}
+
+	children = g_new0(GVariant *, n_in + 1);
+	for (i = 0; i < n_in; ++i) {
+		text = prv_resolve(parser, g_ptr_array_index(args, i));
+		children[i] = g_variant_parse(
+			G_VARIANT_TYPE(info->in_args[i]->signature), text,
+			NULL, NULL, &error);
+		g_free(text);
+		if (!children[i]) {
+			fprintf(stderr, "%s: bad argument to %s: %s\n",
+				parser->scenario->spec, method,
+				error->message);
+			g_error_free(error);
+			err = PROVMAN_ERR_BAD_ARGS;
+			goto on_error;
+		}
+	}
+
+	call = g_new0(load_call_t, 1);
+	call->method = method;
+	call->params = g_variant_ref_sink(g_variant_new_tuple(children,
+							      n_in));
+	call->is_start = !strcmp(method, LOAD_START);
+	g_ptr_array_add(parser->scenario->calls, call);
+	method = NULL;
+
+on_error:
+
+	if (children) {
+		for (i = 0; i < n_in && children[i]; ++i)
+			g_variant_unref(children[i]);
+		g_free(children);
+	}
+	g_ptr_array_free(args, TRUE);
+	g_free(method);
+
+	return err;
+}
+
+static int prv_load_scenario(load_t *load, GDBusInterfaceInfo *interface,
+			     const gchar *spec)
+{
+	int err = PROVMAN_ERR_NONE;
+	load_parser_t parser;
+	gchar *contents = NULL;
+	const gchar *p;
+	const gchar *line_end;
+	const gchar *call;
+	load_call_t *last = NULL;
+	GVariant *empty;
+	gboolean has_start = FALSE;
+	GError *error = NULL;
+	guint i;
+
+	memset(&parser, 0, sizeof(parser));
+	parser.interface = interface;
+	parser.vars = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+					    g_free);
+	parser.argv = g_strsplit(spec, ":", -1);
+	parser.argc = g_strv_length(parser.argv);
+	parser.scenario = g_new0(load_scenario_t, 1);
+	parser.scenario->spec = g_strdup(spec);
+	parser.scenario->calls = g_ptr_array_new_with_free_func(prv_call_free);
+
+	if (!g_file_get_contents(parser.argv[0], &contents, NULL, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		err = PROVMAN_ERR_OPEN;
+		goto on_error;
+	}
+
+	p = contents;
+	while (*p) {
+		line_end = strchr(p, '\n');
+		if (!line_end)
+			line_end = p + strlen(p);
+
+		p = prv_skip_space(p);
+		if (*p != '#') {
+			prv_parse_assignment(&parser, p, line_end);
+			call = g_strstr_len(p, line_end - p, LOAD_MANAGER);
+			if (call) {
+				p = call + strlen(LOAD_MANAGER);
+				err = prv_parse_call(&parser, &p);
+				if (err != PROVMAN_ERR_NONE)
+					goto on_error;
+				continue;
+			}
+		}
+
+		p = *line_end ? line_end + 1 : line_end;
+	}
+
+	if (parser.scenario->calls->len == 0) {
+		fprintf(stderr, "%s: no calls to replay\n", spec);
+		err = PROVMAN_ERR_NOT_FOUND;
+		goto on_error;
+	}
+
+	for (i = 0; i < parser.scenario->calls->len; ++i) {
+		last = g_ptr_array_index(parser.scenario->calls, i);
+		has_start = has_start || last->is_start;
+	}
+
+	if (has_start && strcmp(last->method, LOAD_END) &&
+	    strcmp(last->method, LOAD_ABORT)) {
+		empty = g_variant_new_tuple(NULL, 0);
+		last = g_new0(load_call_t, 1);
+		last->method = g_strdup(LOAD_END);
+		last->params = g_variant_ref_sink(empty);
+		g_ptr_array_add(parser.scenario->calls, last);
+	}
+
+	g_ptr_array_add(load->scenarios, parser.scenario);
+	parser.scenario = NULL;
+
+on_error:
+
+	if (parser.scenario)
+		prv_scenario_free(parser.scenario);
+	g_free(contents);
+	g_strfreev(parser.argv);
+	g_hash_table_unref(parser.vars);
+
+	return err;
+}
+
+static void prv_dispatch(load_t *load);
+
+static void prv_record(load_t *load, load_stat_t stat, gint64 latency)
+{
+	g_array_append_val(load->latencies[stat], latency);
+}
+
+static void prv_session_done(load_client_t *client, gboolean succeeded)
+{
+	load_t *load = client->load;
+
+	if (succeeded) {
+		prv_record(load, LOAD_STAT_SESSION,
+			   g_get_monotonic_time() - client->session_start);
+		++load->completed;
+	} else {
+		++load->failed;
+	}
+
+	client->scenario = NULL;
+	g_queue_push_tail(&load->idle, client);
+
+	if (load->completed + load->failed == (guint) g_load_sessions)
+		g_main_loop_quit(load->loop);
+	else
+		prv_dispatch(load);
+}
+
+static void prv_next_call(load_client_t *client);
+
+static void prv_call_cb(GObject *source, GAsyncResult *res,
+			gpointer user_data)
+{
+	load_client_t *client = user_data;
+	load_t *load = client->load;
+	load_call_t *call = g_ptr_array_index(client->scenario->calls,
+					      client->call);
+	GVariant *result;
+	GError *error = NULL;
+	gint64 now;
+
+	result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source),
+					       res, &error);
+	now = g_get_monotonic_time();
+	++load->calls;
+
+	if (result) {
+		g_variant_unref(result);
+	} else {
+		++load->errors;
+		g_error_free(error);
+		if (call->is_start) {
+			prv_session_done(client, FALSE);
+			return;
+		}
+	}
+
+	if (call->is_start) {
+		prv_record(load, LOAD_STAT_QUEUE_WAIT, now - client->call_sent);
+	} else if (client->first_reply_pending) {
+		prv_record(load, LOAD_STAT_FIRST_REPLY,
+			   now - client->start_sent);
+		client->first_reply_pending = FALSE;
+	}
+
+	++client->call;
+	prv_next_call(client);
+}
+
+static void prv_next_call(load_client_t *client)
+{
+	load_call_t *call;
+
+	if (client->call == client->scenario->calls->len) {
+		prv_session_done(client, TRUE);
+		return;
+	}
+
+	call = g_ptr_array_index(client->scenario->calls, client->call);
+	client->call_sent = g_get_monotonic_time();
+	if (call->is_start) {
+		client->start_sent = client->call_sent;
+		client->first_reply_pending = TRUE;
+	}
+
+	g_dbus_connection_call(client->connection, PROVMAN_SERVER_NAME,
+			       PROVMAN_OBJECT, PROVMAN_INTERFACE, call->method,
+			       call->params, NULL, G_DBUS_CALL_FLAGS_NONE,
+			       G_MAXINT, NULL, prv_call_cb, client);
+}
+
+static gboolean prv_session_due(load_t *load, gint64 now,
+				gint64 *scheduled)
+{
+	if (load->started >= (guint) g_load_sessions)
+		return FALSE;
+
+	if (g_load_rate <= 0) {
+		*scheduled = now;
+		return TRUE;
+	}
+
+	*scheduled = load->t0 + (gint64) (load->started * 1000000.0 /
+					  g_load_rate);
+
+	return *scheduled <= now;
+}
+
+static void prv_dispatch(load_t *load)
+{
+	gint64 now = g_get_monotonic_time();
+	gint64 scheduled;
+	load_client_t *client;
+
+	while (!g_queue_is_empty(&load->idle) &&
+	       prv_session_due(load, now, &scheduled)) {
+		client = g_queue_pop_head(&load->idle);
+		if (g_load_rate > 0)
+			prv_record(load, LOAD_STAT_SCHEDULE_LAG,
+				   now - scheduled);
+
+		client->scenario = g_ptr_array_index(
+			load->scenarios, load->started %
+			load->scenarios->len);
+		client->call = 0;
+		client->session_start = now;
+		client->first_reply_pending = FALSE;
+		++load->started;
+
+		prv_next_call(client);
+	}
+}
+
+static gboolean prv_timer_cb(gpointer user_data)
+{
+	prv_dispatch(user_data);
+
+	return TRUE;
+}
+
+static int prv_start_bus(load_t *load, gchar **address)
+{
+	int err = PROVMAN_ERR_NONE;
+	gchar *bus_argv[] = { g_load_dbus_daemon, "--session", "--nofork",
+			      "--print-address=1", NULL };
+	gchar *daemon_argv[] = { g_load_daemon, NULL };
+	GError *error = NULL;
+	gint out_fd;
+	FILE *out;
+	gchar line[512];
+
+	if (!g_spawn_async_with_pipes(NULL, bus_argv, NULL,
+				      G_SPAWN_SEARCH_PATH |
+				      G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL,
+				      &load->bus_pid, NULL, &out_fd, NULL,
+				      &error))
+		goto on_error;
+
+	out = fdopen(out_fd, "r");
+	if (!out || !fgets(line, sizeof(line), out)) {
+		fprintf(stderr, "Unable to read the bus address\n");
+		if (out)
+			fclose(out);
+		err = PROVMAN_ERR_IO;
+		goto on_error;
+	}
+	fclose(out);
+
+	*address = g_strdup(g_strstrip(line));
+
+	/* Both addresses point to the private bus so that the session and
+	   the system daemons can be tested. */
+
+	(void) g_setenv("DBUS_SESSION_BUS_ADDRESS", *address, TRUE);
+	(void) g_setenv("DBUS_SYSTEM_BUS_ADDRESS", *address, TRUE);
+
+	if (!g_spawn_async(NULL, daemon_argv, NULL,
+			   G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL,
+			   &load->daemon_pid, &error))
+		goto on_error;
+
+	return PROVMAN_ERR_NONE;
+
+on_error:
+
+	if (error) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		err = PROVMAN_ERR_OPEN;
+	}
+
+	return err;
+}
+
+static void prv_stop_process(GPid pid)
+{
+	if (pid) {
+		(void) kill(pid, SIGTERM);
+		(void) waitpid(pid, NULL, 0);
+		g_spawn_close_pid(pid);
+	}
+}
+
+static int prv_wait_for_provman(GDBusConnection *connection)
+{
+	gint64 deadline = g_get_monotonic_time() + LOAD_NAME_TIMEOUT;
+	GVariant *result;
+	gboolean has_owner = FALSE;
+
+	while (!has_owner && g_get_monotonic_time() < deadline) {
+		result = g_dbus_connection_call_sync(
+			connection, "org.freedesktop.DBus",
+			"/org/freedesktop/DBus", "org.freedesktop.DBus",
+			"NameHasOwner", g_variant_new("(s)",
+						      PROVMAN_SERVER_NAME),
+			G_VARIANT_TYPE("(b)"), G_DBUS_CALL_FLAGS_NONE, -1,
+			NULL, NULL);
+		if (result) {
+			g_variant_get(result, "(b)", &has_owner);
+			g_variant_unref(result);
+		}
+		if (!has_owner)
+			g_usleep(100000);
+	}
+
+	return has_owner ? PROVMAN_ERR_NONE : PROVMAN_ERR_TIMEOUT;
+}
+
+static GDBusNodeInfo *prv_introspect(GDBusConnection *connection)
+{
+	GVariant *result;
+	const gchar *xml;
+	GDBusNodeInfo *node_info = NULL;
+	GError *error = NULL;
+
+	result = g_dbus_connection_call_sync(
+		connection, PROVMAN_SERVER_NAME, PROVMAN_OBJECT,
+		"org.freedesktop.DBus.Introspectable", "Introspect", NULL,
+		G_VARIANT_TYPE("(s)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+		&error);
+	if (!result)
+		goto on_error;
+
+	g_variant_get(result, "(&s)", &xml);
+	node_info = g_dbus_node_info_new_for_xml(xml, &error);
+	g_variant_unref(result);
+
+on_error:
+
+	if (error) {
+		fprintf(stderr, "Unable to introspect provman: %s\n",
+			error->message);
+		g_error_free(error);
+	}
+
+	return node_info;
+}
+
+static int prv_connect_clients(load_t *load, const gchar *address)
+{
+	int err = PROVMAN_ERR_NONE;
+	load_client_t *client;
+	GError *error = NULL;
+	int i;
+
+	for (i = 0; i < g_load_clients; ++i) {
+		client = g_new0(load_client_t, 1);
+		client->load = load;
+		g_ptr_array_add(load->clients, client);
+		client->connection = g_dbus_connection_new_for_address_sync(
+			address,
+			G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+			G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+			NULL, NULL, &error);
+		if (!client->connection) {
+			fprintf(stderr, "Unable to connect to %s: %s\n",
+				address, error->message);
+			g_error_free(error);
+			err = PROVMAN_ERR_OPEN;
+			break;
+		}
+		g_queue_push_tail(&load->idle, client);
+	}
+
+	return err;
+}
+
+static void prv_client_free(gpointer data)
+{
+	load_client_t *client = data;
+
+	if (client->connection)
+		g_object_unref(client->connection);
+	g_free(client);
+}
+
+static gint prv_compare_latency(gconstpointer a, gconstpointer b)
+{
+	gint64 la = *((const gint64 *) a);
+	gint64 lb = *((const gint64 *) b);
+
+	return la < lb ? -1 : la > lb ? 1 : 0;
+}
+
+static gint64 prv_percentile(GArray *latencies, unsigned int percentile)
+{
+	guint index = (latencies->len * percentile) / 100;
+
+	if (index >= latencies->len)
+		index = latencies->len - 1;
+
+	return g_array_index(latencies, gint64, index);
+}
+
+static void prv_report(load_t *load, gint64 elapsed)
+{
+	unsigned int i;
+	GArray *latencies;
+	double seconds = elapsed / 1000000.0;
+
+	if (seconds <= 0)
+		seconds = 1e-6;
+
+	printf("%u sessions completed, %u failed, in %.2f s\n",
+	       load->completed, load->failed, seconds);
+	printf("%.1f sessions/s, %.1f calls/s, %" G_GUINT64_FORMAT
+	       " calls failed\n\n", load->completed / seconds,
+	       load->calls / seconds, load->errors);
+
+	printf("%-14s %8s %10s %10s %10s %10s\n", "metric", "count",
+	       "p50(us)", "p90(us)", "p99(us)", "max(us)");
+
+	for (i = 0; i < LOAD_STAT_MAX; ++i) {
+		latencies = load->latencies[i];
+		if (latencies->len == 0)
+			continue;
+
+		g_array_sort(latencies, prv_compare_latency);
+		printf("%-14s %8u %10" G_GINT64_FORMAT " %10" G_GINT64_FORMAT
+		       " %10" G_GINT64_FORMAT " %10" G_GINT64_FORMAT "\n",
+		       g_load_stat_names[i], latencies->len,
+		       prv_percentile(latencies, 50),
+		       prv_percentile(latencies, 90),
+		       prv_percentile(latencies, 99),
+		       g_array_index(latencies, gint64, latencies->len - 1));
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int err = PROVMAN_ERR_NONE;
+	GOptionContext *context;
+	GError *error = NULL;
+	load_t load;
+	gchar *address = NULL;
+	GDBusNodeInfo *node_info = NULL;
+	GDBusInterfaceInfo *interface;
+	load_client_t *client;
+	guint interval;
+	int i;
+
+	memset(&load, 0, sizeof(load));
+
+	context = g_option_context_new("TESTCASE[:ARG...]... - replay provman "
+				       "testcases concurrently");
+	g_option_context_add_main_entries(context, g_load_options, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	if (argc < 2 || g_load_clients < 1 || g_load_sessions < 1 ||
+	    g_load_rate < 0) {
+		fprintf(stderr, "Invalid arguments\n");
+		return 1;
+	}
+
+	g_type_init();
+
+	for (i = 0; i < LOAD_STAT_MAX; ++i)
+		load.latencies[i] = g_array_new(FALSE, FALSE, sizeof(gint64));
+	load.scenarios = g_ptr_array_new_with_free_func(prv_scenario_free);
+	load.clients = g_ptr_array_new_with_free_func(prv_client_free);
+	g_queue_init(&load.idle);
+	load.loop = g_main_loop_new(NULL, FALSE);
+
+	if (g_load_address) {
+		address = g_strdup(g_load_address);
+	} else {
+		err = prv_start_bus(&load, &address);
+		if (err != PROVMAN_ERR_NONE)
+			goto on_error;
+	}
+
+	err = prv_connect_clients(&load, address);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	client = g_ptr_array_index(load.clients, 0);
+	err = prv_wait_for_provman(client->connection);
+	if (err != PROVMAN_ERR_NONE) {
+		fprintf(stderr, "%s did not appear on the bus\n",
+			PROVMAN_SERVER_NAME);
+		goto on_error;
+	}
+
+	node_info = prv_introspect(client->connection);
+	interface = node_info ? g_dbus_node_info_lookup_interface(
+		node_info, PROVMAN_INTERFACE) : NULL;
+	if (!interface) {
+		err = PROVMAN_ERR_NOT_FOUND;
+		goto on_error;
+	}
+
+	for (i = 1; i < argc; ++i) {
+		err = prv_load_scenario(&load, interface, argv[i]);
+		if (err != PROVMAN_ERR_NONE)
+			goto on_error;
+	}
+
+	printf("%u testcases, %d clients, %d sessions, ", load.scenarios->len,
+	       g_load_clients, g_load_sessions);
+	if (g_load_rate > 0)
+		printf("%.1f sessions/s\n\n", g_load_rate);
+	else
+		printf("back to back\n\n");
+
+	load.t0 = g_get_monotonic_time();
+	if (g_load_rate > 0) {
+		interval = (guint) (1000 / g_load_rate);
+		load.timer_id = g_timeout_add(CLAMP(interval, 1, 100),
+					      prv_timer_cb, &load);
+	}
+	prv_dispatch(&load);
+	g_main_loop_run(load.loop);
+
+	prv_report(&load, g_get_monotonic_time() - load.t0);
+
+	if (load.failed > 0)
+		err = PROVMAN_ERR_UNKNOWN;
+
+on_error:
+
+	if (load.timer_id)
+		(void) g_source_remove(load.timer_id);
+	if (node_info)
+		g_dbus_node_info_unref(node_info);
+	g_ptr_array_free(load.clients, TRUE);
+	g_ptr_array_free(load.scenarios, TRUE);
+	g_queue_clear(&load.idle);
+	g_main_loop_unref(load.loop);
+	for (i = 0; i < LOAD_STAT_MAX; ++i)
+		g_array_free(load.latencies[i], TRUE);
+
+	prv_stop_process(load.daemon_pid);
+	prv_stop_process(load.bus_pid);
+	g_free(address);
+
+	return err == PROVMAN_ERR_NONE ? 0 : 1;
+}
@@ -0,0 +1,651 @@
+/*
+ * Provman
+ *
+ * Copyright (C) 2011 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+/*!
+ * @file provman-microbench.c
+ *
+ * @brief Main file for provman-microbench
+ *
+ * provman-microbench times, in isolation, the building blocks that the
+ * plugin manager calls for every key: the cache, the schema lookups, the
+ * plugin routing functions, the key utilities and the map file.  The
+ * benchmarks operate on contexts x keys keys of the form
+ * /applications/test_plugin/ctxNNNNN/subdir_many_keys/keyNNN, which are
+ * valid in the test plugin's schema and are routed to the test plugin.
+ *
+ * For each benchmark the tool reports the average time per operation, the
+ * average number of allocations per operation and the peak resident set
+ * size of the process once the benchmark has completed.  Allocations are
+ * counted with a GMemVTable, which is only honoured by versions of GLib
+ * older than 2.46.  On later versions allocations are reported as n/a.
+ *
+ ******************************************************************************/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "error.h"
+#include "schema.h"
+#include "plugin.h"
+#include "cache.h"
+#include "utils.h"
+#include "store.h"
+#include "map-file.h"
+
+#define MICROBENCH_ROOT "/applications/test_plugin/"
+#define MICROBENCH_KEY_DIR "subdir_many_keys"
+#define MICROBENCH_MAX_KEYS 100
+#define MICROBENCH_IMSI "provman-microbench"
+
+#if !GLIB_CHECK_VERSION(2, 46, 0)
+#define MICROBENCH_COUNT_ALLOCS
+#endif
+
+typedef struct microbench_t_ microbench_t;
+struct microbench_t_ {
+	GPtrArray *keys;
+	GPtrArray *contexts;
+	GPtrArray *plugin_ids;
+	GHashTable *settings;
+	provman_schema_t *schema;
+	gint64 start;
+	gint64 elapsed;
+	guint64 start_allocs;
+	guint64 allocs;
+};
+
+static gint g_microbench_contexts = 100;
+static gint g_microbench_keys = 10;
+static gint g_microbench_iterations = 10;
+
+static GOptionEntry g_microbench_options[] = {
+	{ "contexts", 'c', 0, G_OPTION_ARG_INT, &g_microbench_contexts,
+	  "Number of contexts (directories) under the plugin root", "N" },
+	{ "keys", 'k', 0, G_OPTION_ARG_INT, &g_microbench_keys,
+	  "Number of keys in each context, at most 100", "N" },
+	{ "iterations", 'n', 0, G_OPTION_ARG_INT, &g_microbench_iterations,
+	  "Number of passes over the keys in each benchmark", "N" },
+	{ NULL, 0, 0, 0, NULL, NULL, NULL }
+};
+
+#ifdef MICROBENCH_COUNT_ALLOCS
+
+static guint64 g_microbench_allocs;
+
+static gpointer prv_malloc(gsize n_bytes)
+{
+	++g_microbench_allocs;
+	return malloc(n_bytes);
+}
+
+static gpointer prv_realloc(gpointer mem, gsize n_bytes)
+{
+	if (!mem)
+		++g_microbench_allocs;
+	return realloc(mem, n_bytes);
+}
+
+static gpointer prv_calloc(gsize n_blocks, gsize n_block_bytes)
+{
+	++g_microbench_allocs;
+	return calloc(n_blocks, n_block_bytes);
+}
+
+static GMemVTable g_microbench_vtable = {
+	prv_malloc,
+	prv_realloc,
+	free,
+	prv_calloc,
+	prv_malloc,
+	prv_realloc
+};
+
+#endif
+
+/* prv_resume and prv_pause bracket the code being measured.  Set up and
+   tear down code that runs between them is not included in the results. */
+
+static void prv_resume(microbench_t *mb)
+{
+#ifdef MICROBENCH_COUNT_ALLOCS
+	mb->start_allocs = g_microbench_allocs;
+#endif
+	mb->start = g_get_monotonic_time();
+}
+
+static void prv_pause(microbench_t *mb)
+{
+	mb->elapsed += g_get_monotonic_time() - mb->start;
+#ifdef MICROBENCH_COUNT_ALLOCS
+	mb->allocs += g_microbench_allocs - mb->start_allocs;
+#endif
+}
+
+static void prv_report(microbench_t *mb, const gchar *name, guint64 ops)
+{
+	struct rusage usage;
+	gchar allocs[32];
+
+	if (ops == 0)
+		ops = 1;
+
+#ifdef MICROBENCH_COUNT_ALLOCS
+	g_snprintf(allocs, sizeof(allocs), "%.2f",
+		   mb->allocs / (double) ops);
+#else
+	g_strlcpy(allocs, "n/a", sizeof(allocs));
+#endif
+
+	memset(&usage, 0, sizeof(usage));
+	(void) getrusage(RUSAGE_SELF, &usage);
+
+	printf("%-26s %10" G_GUINT64_FORMAT " %10.1f %10s %12ld\n", name,
+	       ops, mb->elapsed * 1000.0 / ops, allocs, usage.ru_maxrss);
+
+	mb->elapsed = 0;
+	mb->allocs = 0;
+}
+
+static void prv_cache_fill(microbench_t *mb, provman_cache_t *cache)
+{
+	unsigned int i;
+	const gchar *key;
+
+	for (i = 0; i < mb->keys->len; ++i) {
+		key = g_ptr_array_index(mb->keys, i);
+		(void) provman_cache_set(cache, key, key);
+	}
+}
+
+static int prv_bench_cache(microbench_t *mb)
+{
+	int err = PROVMAN_ERR_NONE;
+	provman_cache_t *cache;
+	unsigned int i;
+	int j;
+	gchar *value;
+	GVariant *variant;
+	guint64 ops = (guint64) mb->keys->len * g_microbench_iterations;
+
+	provman_cache_new(&cache);
+
+	prv_resume(mb);
+	for (j = 0; j < g_microbench_iterations; ++j)
+		prv_cache_fill(mb, cache);
+	prv_pause(mb);
+	prv_report(mb, "cache_set", ops);
+
+	prv_resume(mb);
+	for (j = 0; j < g_microbench_iterations; ++j)
+		for (i = 0; i < mb->keys->len; ++i) {
+			err = provman_cache_get(cache,
+						g_ptr_array_index(mb->keys, i),
+						&value);
+			if (err != PROVMAN_ERR_NONE)
+				goto on_error;
+			g_free(value);
+		}
+	prv_pause(mb);
+	prv_report(mb, "cache_get", ops);
+
+	prv_resume(mb);
+	for (j = 0; j < g_microbench_iterations; ++j)
+		for (i = 0; i < mb->contexts->len; ++i) {
+			err = provman_cache_get_all(
+				cache, g_ptr_array_index(mb->contexts, i),
+				&variant);
+			if (err != PROVMAN_ERR_NONE)
+				goto on_error;
+			g_variant_unref(variant);
+		}
+	prv_pause(mb);
+	prv_report(mb, "cache_get_all(context)",
+		   (guint64) mb->contexts->len * g_microbench_iterations);
+
+	prv_resume(mb);
+	for (j = 0; j < g_microbench_iterations; ++j) {
+		err = provman_cache_get_all(cache, MICROBENCH_ROOT, &variant);
+		if (err != PROVMAN_ERR_NONE)
+			goto on_error;
+		g_variant_unref(variant);
+	}
+	prv_pause(mb);
+	prv_report(mb, "cache_get_all(root)", g_microbench_iterations);
+
+	for (j = 0; j < g_microbench_iterations; ++j) {
+		if (j > 0)
+			prv_cache_fill(mb, cache);
+		prv_resume(mb);
+		for (i = 0; i < mb->keys->len; ++i)
+			(void) provman_cache_remove(
+				cache, g_ptr_array_index(mb->keys, i));
+		prv_pause(mb);
+	}
+	prv_report(mb, "cache_remove", ops);
+
+on_error:
+
+	provman_cache_delete(cache);
+
+	return err;
+}
+
+static int prv_bench_schema(microbench_t *mb)
+{
+	int err = PROVMAN_ERR_NONE;
+	unsigned int i;
+	int j;
+	provman_schema_t *schema;
+	guint64 ops = (guint64) mb->keys->len * g_microbench_iterations;
+
+	prv_resume(mb);
+	for (j = 0; j < g_microbench_iterations; ++j)
+		for (i = 0; i < mb->keys->len; ++i) {
+			err = provman_schema_locate(
+				mb->schema, g_ptr_array_index(mb->keys, i),
+				&schema);
+			if (err != PROVMAN_ERR_NONE)
+				goto on_error;
+		}
+	prv_pause(mb);
+	prv_report(mb, "schema_locate", ops);
+
+	prv_resume(mb);
+	for (j = 0; j < g_microbench_iterations; ++j)
+		for (i = 0; i < mb->keys->len; ++i) {
+			err = provman_schema_check_value(schema, "value");
+			if (err != PROVMAN_ERR_NONE)
+				goto on_error;
+		}
+	prv_pause(mb);
+	prv_report(mb, "schema_check_value(string)", ops);
+
+	err = provman_schema_locate(mb->schema,
+				    MICROBENCH_ROOT"ctx00000/subdir_big_enum/"
+				    "enum", &schema);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	prv_resume(mb);
+	for (j = 0; j < g_microbench_iterations; ++j)
+		for (i = 0; i < mb->keys->len; ++i) {
+			err = provman_schema_check_value(schema, "val100");
+			if (err != PROVMAN_ERR_NONE)
+				goto on_error;
+		}
+	prv_pause(mb);
+	prv_report(mb, "schema_check_value(enum)", ops);
+
+on_error:
+
+	return err;
+}
+
+static int prv_bench_plugin(microbench_t *mb)
+{
+	int err = PROVMAN_ERR_NONE;
+	unsigned int i;
+	int j;
+	unsigned int index;
+	GArray *indicies;
+	guint64 ops = (guint64) mb->keys->len * g_microbench_iterations;
+
+	prv_resume(mb);
+	for (j = 0; j < g_microbench_iterations; ++j)
+		for (i = 0; i < mb->keys->len; ++i) {
+			err = provman_plugin_find_index(
+				g_ptr_array_index(mb->keys, i), &index);
+			if (err != PROVMAN_ERR_NONE)
+				goto on_error;
+		}
+	prv_pause(mb);
+	prv_report(mb, "plugin_find_index", ops);
+
+	indicies = g_array_new(FALSE, FALSE, sizeof(unsigned int));
+	prv_resume(mb);
+	for (j = 0; j < g_microbench_iterations; ++j)
+		for (i = 0; i < mb->keys->len; ++i) {
+			provman_plugin_find_plugins("/applications/",
+						    indicies);
+			g_array_set_size(indicies, 0);
+		}
+	prv_pause(mb);
+	g_array_free(indicies, TRUE);
+	prv_report(mb, "plugin_find_plugins", ops);
+
+on_error:
+
+	return err;
+}
+
+static int prv_bench_utils(microbench_t *mb)
+{
+	int err = PROVMAN_ERR_NONE;
+	unsigned int i;
+	int j;
+	GHashTable *contexts;
+	guint64 ops = (guint64) mb->keys->len * g_microbench_iterations;
+
+	prv_resume(mb);
+	for (j = 0; j < g_microbench_iterations; ++j)
+		for (i = 0; i < mb->keys->len; ++i) {
+			err = provman_utils_validate_key(
+				g_ptr_array_index(mb->keys, i));
+			if (err != PROVMAN_ERR_NONE)
+				goto on_error;
+		}
+	prv_pause(mb);
+	prv_report(mb, "utils_validate_key", ops);
+
+	prv_resume(mb);
+	for (j = 0; j < g_microbench_iterations; ++j) {
+		contexts = provman_utils_get_contexts(mb->settings,
+						      MICROBENCH_ROOT,
+						      strlen(MICROBENCH_ROOT));
+		g_hash_table_unref(contexts);
+	}
+	prv_pause(mb);
+	prv_report(mb, "utils_get_contexts", g_microbench_iterations);
+
+on_error:
+
+	return err;
+}
+
+static int prv_bench_map_file(microbench_t *mb)
+{
+	int err = PROVMAN_ERR_NONE;
+	gchar *dir;
+	gchar *fname;
+	gchar *store_fname;
+	provman_map_file_t *map_file;
+	unsigned int i;
+	int j;
+	gchar *id;
+	const gchar *client_id;
+	const gchar *plugin_id;
+	GHashTable *used;
+	unsigned int removed;
+	guint64 ops = (guint64) mb->contexts->len * g_microbench_iterations;
+
+	/* Map files are kept in the store located in the directory of the
+	   file name passed to provman_map_file_new, so the benchmark uses a
+	   directory of its own. */
+
+	dir = g_build_filename(g_get_tmp_dir(), "provman-microbench", NULL);
+	(void) g_mkdir_with_parents(dir, 0700);
+	fname = g_build_filename(dir, "map-file.ini", NULL);
+	store_fname = g_build_filename(dir, PROVMAN_STORE_FILE_NAME, NULL);
+	(void) g_unlink(store_fname);
+
+	provman_map_file_new(fname, &map_file);
+
+	for (j = 0; j < g_microbench_iterations; ++j) {
+		prv_resume(mb);
+		for (i = 0; i < mb->contexts->len; ++i)
+			provman_map_file_store_map(
+				map_file, MICROBENCH_IMSI,
+				g_ptr_array_index(mb->contexts, i),
+				g_ptr_array_index(mb->plugin_ids, i));
+		prv_pause(mb);
+
+		if (j + 1 == g_microbench_iterations)
+			break;
+
+		for (i = 0; i < mb->contexts->len; ++i)
+			(void) provman_map_file_delete_map(
+				map_file, MICROBENCH_IMSI,
+				g_ptr_array_index(mb->contexts, i));
+	}
+	prv_report(mb, "map_file_store_map", ops);
+
+	prv_resume(mb);
+	for (j = 0; j < g_microbench_iterations; ++j)
+		for (i = 0; i < mb->contexts->len; ++i) {
+			plugin_id = g_ptr_array_index(mb->plugin_ids, i);
+			id = provman_map_file_find_client_id(map_file,
+							     MICROBENCH_IMSI,
+							     plugin_id);
+			if (!id) {
+				err = PROVMAN_ERR_NOT_FOUND;
+				goto on_error;
+			}
+			g_free(id);
+		}
+	prv_pause(mb);
+	prv_report(mb, "map_file_find_client_id", ops);
+
+	prv_resume(mb);
+	for (j = 0; j < g_microbench_iterations; ++j)
+		for (i = 0; i < mb->contexts->len; ++i) {
+			client_id = g_ptr_array_index(mb->contexts, i);
+			id = provman_map_file_find_plugin_id(map_file,
+							     MICROBENCH_IMSI,
+							     client_id);
+			if (!id) {
+				err = PROVMAN_ERR_NOT_FOUND;
+				goto on_error;
+			}
+			g_free(id);
+		}
+	prv_pause(mb);
+	prv_report(mb, "map_file_find_plugin_id", ops);
+
+	for (j = 0; j < g_microbench_iterations; ++j) {
+		prv_resume(mb);
+		provman_map_file_save(map_file);
+		prv_pause(mb);
+
+		/* Make the map file dirty again so that the next save
+		   writes it out. */
+
+		client_id = g_ptr_array_index(mb->contexts, 0);
+		plugin_id = g_ptr_array_index(mb->plugin_ids, 0);
+		(void) provman_map_file_delete_map(map_file, MICROBENCH_IMSI,
+						   client_id);
+		provman_map_file_store_map(map_file, MICROBENCH_IMSI,
+					   client_id, plugin_id);
+	}
+	prv_report(mb, "map_file_save", g_microbench_iterations);
+
+	/* Half of the contexts are stale each time the reconciliation
+	   runs. */
+
+	used = g_hash_table_new(g_str_hash, g_str_equal);
+	for (i = 0; i < mb->plugin_ids->len; i += 2)
+		g_hash_table_insert(used, g_ptr_array_index(mb->plugin_ids, i),
+				    NULL);
+	for (j = 0; j < g_microbench_iterations; ++j) {
+		prv_resume(mb);
+		removed = provman_map_file_remove_unused(map_file,
+							 MICROBENCH_IMSI,
+							 used);
+		prv_pause(mb);
+
+		if (removed != mb->contexts->len / 2) {
+			g_hash_table_unref(used);
+			err = PROVMAN_ERR_CORRUPT;
+			goto on_error;
+		}
+
+		for (i = 1; i < mb->contexts->len; i += 2)
+			provman_map_file_store_map(
+				map_file, MICROBENCH_IMSI,
+				g_ptr_array_index(mb->contexts, i),
+				g_ptr_array_index(mb->plugin_ids, i));
+	}
+	g_hash_table_unref(used);
+	prv_report(mb, "map_file_remove_unused", g_microbench_iterations);
+
+	prv_resume(mb);
+	for (i = 0; i < mb->contexts->len; ++i)
+		(void) provman_map_file_delete_map(
+			map_file, MICROBENCH_IMSI,
+			g_ptr_array_index(mb->contexts, i));
+	prv_pause(mb);
+	prv_report(mb, "map_file_delete_map", mb->contexts->len);
+
+on_error:
+
+	provman_map_file_delete(map_file);
+	(void) g_unlink(store_fname);
+	(void) g_rmdir(dir);
+	g_free(store_fname);
+	g_free(fname);
+	g_free(dir);
+
+	return err;
+}
+
+static void prv_make_keys(microbench_t *mb)
+{
+	int i;
+	int j;
+	gchar *key;
+
+	mb->keys = g_ptr_array_new_with_free_func(g_free);
+	mb->contexts = g_ptr_array_new_with_free_func(g_free);
+	mb->plugin_ids = g_ptr_array_new_with_free_func(g_free);
+	mb->settings = g_hash_table_new_full(g_str_hash, g_str_equal,
+					     g_free, g_free);
+
+	for (i = 0; i < g_microbench_contexts; ++i) {
+		g_ptr_array_add(mb->contexts,
+				g_strdup_printf(MICROBENCH_ROOT"ctx%05d/", i));
+		g_ptr_array_add(mb->plugin_ids,
+				g_strdup_printf("context%d", i));
+		for (j = 0; j < g_microbench_keys; ++j) {
+			key = g_strdup_printf(MICROBENCH_ROOT"ctx%05d/"
+					      MICROBENCH_KEY_DIR"/key%03d",
+					      i, j + 1);
+			g_ptr_array_add(mb->keys, key);
+			g_hash_table_insert(mb->settings, g_strdup(key),
+					    g_strdup(key));
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int err = PROVMAN_ERR_NONE;
+	GOptionContext *context;
+	GError *error = NULL;
+	microbench_t mb;
+	unsigned int index;
+	const provman_plugin *plugin;
+
+#ifdef MICROBENCH_COUNT_ALLOCS
+	/* Must happen before GLib allocates any memory.  GSlice is asked
+	   to use malloc so that slice allocations are counted too. */
+
+	(void) g_setenv("G_SLICE", "always-malloc", TRUE);
+	g_mem_set_vtable(&g_microbench_vtable);
+#endif
+
+	memset(&mb, 0, sizeof(mb));
+
+	context = g_option_context_new("- benchmark provman's cache, schema, "
+				       "routing and key utilities");
+	g_option_context_add_main_entries(context, g_microbench_options, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	if (g_microbench_contexts < 1 || g_microbench_keys < 1 ||
+	    g_microbench_keys > MICROBENCH_MAX_KEYS ||
+	    g_microbench_iterations < 1) {
+		fprintf(stderr, "Invalid arguments\n");
+		return 1;
+	}
+
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+	g_thread_init(NULL);
+#endif
+	g_type_init();
+
+	err = provman_plugin_find_index(MICROBENCH_ROOT, &index);
+	if (err != PROVMAN_ERR_NONE) {
+		fprintf(stderr, "Test plugin not found\n");
+		return 1;
+	}
+	plugin = provman_plugin_get(index);
+
+	err = provman_schema_new(plugin->schema, strlen(plugin->schema),
+				 &mb.schema);
+	if (err != PROVMAN_ERR_NONE) {
+		fprintf(stderr, "Unable to create test schema: %d\n", err);
+		return 1;
+	}
+
+	prv_make_keys(&mb);
+
+	printf("%d contexts x %d keys, %d iterations\n\n",
+	       g_microbench_contexts, g_microbench_keys,
+	       g_microbench_iterations);
+	printf("%-26s %10s %10s %10s %12s\n", "benchmark", "ops", "ns/op",
+	       "allocs/op", "peak RSS(KB)");
+
+	err = prv_bench_cache(&mb);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	err = prv_bench_schema(&mb);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	err = prv_bench_plugin(&mb);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	err = prv_bench_utils(&mb);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	err = prv_bench_map_file(&mb);
+
+on_error:
+
+	if (err != PROVMAN_ERR_NONE)
+		fprintf(stderr, "Benchmark failed with error %d\n", err);
+
+	g_hash_table_unref(mb.settings);
+	g_ptr_array_free(mb.plugin_ids, TRUE);
+	g_ptr_array_free(mb.contexts, TRUE);
+	g_ptr_array_free(mb.keys, TRUE);
+	provman_schema_delete(mb.schema);
+
+	return err == PROVMAN_ERR_NONE ? 0 : 1;
+}
@@ -0,0 +1,775 @@
+/*
+ * Provman
+ *
+ * Copyright (C) 2011 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+/*!
+ * @file provman-replay.c
+ *
+ * @brief Main file for provman-replay
+ *
+ * provman-replay replays a capture file recorded by provman, see
+ * capture.h, and compares the latency of each call with the latency that
+ * was recorded.  Calls can either be replayed against a running provman
+ * daemon over D-Bus or against an in-process plugin manager that contains
+ * the test plugin.
+ *
+ * In D-Bus mode each client in the capture is given its own connection.
+ * Calls are sent at the times at which they were recorded, divided by
+ * --speed, but a client does not send a call until it has received the
+ * reply to its previous one.  In in-process mode the calls are issued one
+ * at a time, in the order in which the daemon processed them.  Calls that
+ * the daemon rejected because the client did not hold the session are not
+ * replayed in this mode.  In both modes methods that control the daemon
+ * itself, such as SetTracing, are skipped.  A call whose outcome, success
+ * or failure, differs from the recorded outcome is counted as a mismatch.
+ *
+ ******************************************************************************/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "error.h"
+#include "plugin-manager.h"
+#include "capture.h"
+#include "plugin-bench.h"
+
+#define REPLAY_START "Start"
+#define REPLAY_END "End"
+#define REPLAY_ABORT "Abort"
+
+typedef struct replay_call_t_ replay_call_t;
+struct replay_call_t_ {
+	guint32 id;
+	gchar *client;
+	gchar *method;
+	GVariant *params;
+	gint64 called;
+	gint64 replied;
+	gchar *error;
+	gint64 due;
+};
+
+typedef struct replay_stat_t_ replay_stat_t;
+struct replay_stat_t_ {
+	GArray *recorded;
+	GArray *replayed;
+	guint mismatches;
+};
+
+typedef struct replay_t_ replay_t;
+
+typedef struct replay_client_t_ replay_client_t;
+struct replay_client_t_ {
+	replay_t *replay;
+	GDBusConnection *connection;
+	GQueue calls;
+	replay_call_t *current;
+	gint64 sent;
+};
+
+struct replay_t_ {
+	GMainLoop *loop;
+	GPtrArray *calls;
+	GHashTable *stats;
+	GHashTable *clients;
+	plugin_manager_t *manager;
+	guint next;
+	guint outstanding;
+	gint64 t0;
+	gint64 sent;
+	guint timer_id;
+	guint skipped;
+	guint mismatches;
+};
+
+static const gchar *g_replay_control_methods[] = {
+	"GetStatistics",
+	"SetTracing",
+	"SetLogLevel",
+	"SetCapture",
+	NULL
+};
+
+static gchar *g_replay_address;
+static gboolean g_replay_system;
+static gboolean g_replay_in_process;
+static gdouble g_replay_speed = 1.0;
+
+static GOptionEntry g_replay_options[] = {
+	{ "address", 'a', 0, G_OPTION_ARG_STRING, &g_replay_address,
+	  "Address of the bus on which provman is running", "ADDR" },
+	{ "system", 'y', 0, G_OPTION_ARG_NONE, &g_replay_system,
+	  "Replay against provman on the system bus", NULL },
+	{ "in-process", 'i', 0, G_OPTION_ARG_NONE, &g_replay_in_process,
+	  "Replay against an in-process plugin manager", NULL },
+	{ "speed", 's', 0, G_OPTION_ARG_DOUBLE, &g_replay_speed,
+	  "Speed relative to the recording, 0 to replay without delays",
+	  "FACTOR" },
+	{ NULL, 0, 0, 0, NULL, NULL, NULL }
+};
+
+static void prv_call_free(gpointer data)
+{
+	replay_call_t *call = data;
+
+	g_free(call->client);
+	g_free(call->method);
+	g_free(call->error);
+	if (call->params)
+		g_variant_unref(call->params);
+	g_free(call);
+}
+
+static void prv_stat_free(gpointer data)
+{
+	replay_stat_t *stat = data;
+
+	g_array_free(stat->recorded, TRUE);
+	g_array_free(stat->replayed, TRUE);
+	g_free(stat);
+}
+
+static void prv_client_free(gpointer data)
+{
+	replay_client_t *client = data;
+
+	g_queue_clear(&client->calls);
+	if (client->connection)
+		g_object_unref(client->connection);
+	g_free(client);
+}
+
+static bool prv_is_control_method(const gchar *method)
+{
+	unsigned int i;
+
+	for (i = 0; g_replay_control_methods[i]; ++i)
+		if (!strcmp(method, g_replay_control_methods[i]))
+			return true;
+
+	return false;
+}
+
+static gint prv_compare_due(gconstpointer a, gconstpointer b)
+{
+	const replay_call_t *ca = *((replay_call_t * const *) a);
+	const replay_call_t *cb = *((replay_call_t * const *) b);
+
+	if (ca->due != cb->due)
+		return ca->due < cb->due ? -1 : 1;
+
+	return ca->id < cb->id ? -1 : ca->id > cb->id ? 1 : 0;
+}
+
+static void prv_add_record(replay_t *replay, GHashTable *ids,
+			   provman_capture_record_t *record)
+{
+	replay_call_t *call;
+
+	if (record->kind == PROVMAN_CAPTURE_CALL) {
+		if (prv_is_control_method(record->method)) {
+			++replay->skipped;
+			return;
+		}
+
+		call = g_new0(replay_call_t, 1);
+		call->id = record->id;
+		call->client = record->client;
+		record->client = NULL;
+		call->method = record->method;
+		record->method = NULL;
+		call->params = record->variant;
+		record->variant = NULL;
+		call->called = record->timestamp;
+		call->replied = -1;
+		g_ptr_array_add(replay->calls, call);
+		g_hash_table_insert(ids, GUINT_TO_POINTER(call->id), call);
+	} else {
+		call = g_hash_table_lookup(ids, GUINT_TO_POINTER(record->id));
+		if (call) {
+			call->replied = record->timestamp;
+			call->error = record->error;
+			record->error = NULL;
+		}
+	}
+}
+
+static int prv_load_capture(replay_t *replay, const gchar *path)
+{
+	int err;
+	provman_capture_reader_t *reader;
+	provman_capture_record_t *record;
+	GHashTable *ids;
+	replay_call_t *call;
+	unsigned int i;
+	gint64 first = G_MAXINT64;
+
+	err = provman_capture_reader_new(path, &reader);
+	if (err != PROVMAN_ERR_NONE) {
+		fprintf(stderr, "Unable to open capture file %s\n", path);
+		return err;
+	}
+
+	ids = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	for (;;) {
+		err = provman_capture_reader_next(reader, &record);
+		if (err != PROVMAN_ERR_NONE) {
+			fprintf(stderr, "Capture file is truncated or "
+				"corrupt, replaying the calls read so far\n");
+			err = PROVMAN_ERR_NONE;
+			break;
+		}
+		if (!record)
+			break;
+		prv_add_record(replay, ids, record);
+		provman_capture_record_delete(record);
+	}
+
+	g_hash_table_unref(ids);
+	provman_capture_reader_delete(reader);
+
+	/* The daemon only replies to a Start when the client has acquired
+	   the session, so in in-process mode Starts are ordered by the time
+	   of their replies.  Calls the daemon rejected as out of session are
+	   dropped. */
+
+	i = 0;
+	while (i < replay->calls->len) {
+		call = g_ptr_array_index(replay->calls, i);
+		if (g_replay_in_process && call->error &&
+		    !strcmp(call->error, PROVMAN_DBUS_ERR_UNEXPECTED)) {
+			g_ptr_array_remove_index(replay->calls, i);
+			++replay->skipped;
+			continue;
+		}
+
+		call->due = call->called;
+		if (g_replay_in_process && call->replied >= 0 &&
+		    !strcmp(call->method, REPLAY_START))
+			call->due = call->replied;
+		if (call->due < first)
+			first = call->due;
+		++i;
+	}
+
+	for (i = 0; i < replay->calls->len; ++i) {
+		call = g_ptr_array_index(replay->calls, i);
+		call->due -= first;
+		if (g_replay_speed > 0)
+			call->due = (gint64) (call->due / g_replay_speed);
+		else
+			call->due = 0;
+	}
+
+	g_ptr_array_sort(replay->calls, prv_compare_due);
+
+	return err;
+}
+
+static void prv_record(replay_t *replay, replay_call_t *call, gint64 latency,
+		       const gchar *error)
+{
+	replay_stat_t *stat = g_hash_table_lookup(replay->stats, call->method);
+	gint64 recorded;
+
+	if (!stat) {
+		stat = g_new0(replay_stat_t, 1);
+		stat->recorded = g_array_new(FALSE, FALSE, sizeof(gint64));
+		stat->replayed = g_array_new(FALSE, FALSE, sizeof(gint64));
+		g_hash_table_insert(replay->stats, call->method, stat);
+	}
+
+	g_array_append_val(stat->replayed, latency);
+	if (call->replied >= 0) {
+		recorded = call->replied - call->called;
+		g_array_append_val(stat->recorded, recorded);
+	}
+
+	if ((error == NULL) != (call->error == NULL) ||
+	    (g_replay_in_process == FALSE && error &&
+	     strcmp(error, call->error))) {
+		++stat->mismatches;
+		++replay->mismatches;
+	}
+}
+
+static void prv_dbus_pump(replay_t *replay);
+
+static void prv_dbus_cb(GObject *source, GAsyncResult *res,
+			gpointer user_data)
+{
+	replay_client_t *client = user_data;
+	replay_t *replay = client->replay;
+	GVariant *result;
+	GError *error = NULL;
+	gchar *error_name = NULL;
+	gint64 latency;
+
+	result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source),
+					       res, &error);
+	latency = g_get_monotonic_time() - client->sent;
+
+	if (result) {
+		g_variant_unref(result);
+	} else {
+		error_name = g_dbus_error_get_remote_error(error);
+		if (!error_name)
+			error_name = g_strdup(PROVMAN_DBUS_ERR_UNKNOWN);
+		g_error_free(error);
+	}
+
+	prv_record(replay, client->current, latency, error_name);
+	g_free(error_name);
+
+	client->current = NULL;
+	if (--replay->outstanding == 0)
+		g_main_loop_quit(replay->loop);
+	else
+		prv_dbus_pump(replay);
+}
+
+static void prv_dbus_pump(replay_t *replay)
+{
+	GHashTableIter iter;
+	gpointer value;
+	replay_client_t *client;
+	replay_call_t *call;
+	gint64 now = g_get_monotonic_time() - replay->t0;
+
+	g_hash_table_iter_init(&iter, replay->clients);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		client = value;
+		call = g_queue_peek_head(&client->calls);
+		if (client->current || !call || call->due > now)
+			continue;
+
+		client->current = g_queue_pop_head(&client->calls);
+		client->sent = g_get_monotonic_time();
+		g_dbus_connection_call(client->connection,
+				       PROVMAN_SERVER_NAME, PROVMAN_OBJECT,
+				       PROVMAN_INTERFACE, call->method,
+				       call->params, NULL,
+				       G_DBUS_CALL_FLAGS_NONE, G_MAXINT, NULL,
+				       prv_dbus_cb, client);
+	}
+}
+
+static gboolean prv_dbus_timer_cb(gpointer user_data)
+{
+	prv_dbus_pump(user_data);
+
+	return TRUE;
+}
+
+static int prv_dbus_setup(replay_t *replay)
+{
+	int err = PROVMAN_ERR_NONE;
+	gchar *address = NULL;
+	GError *error = NULL;
+	replay_call_t *call;
+	replay_client_t *client;
+	unsigned int i;
+	GDBusConnectionFlags flags =
+		G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+		G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION;
+
+	if (g_replay_address)
+		address = g_strdup(g_replay_address);
+	else
+		address = g_dbus_address_get_for_bus_sync(
+			g_replay_system ? G_BUS_TYPE_SYSTEM :
+			G_BUS_TYPE_SESSION, NULL, &error);
+	if (!address)
+		goto on_error;
+
+	for (i = 0; i < replay->calls->len; ++i) {
+		call = g_ptr_array_index(replay->calls, i);
+		client = g_hash_table_lookup(replay->clients, call->client);
+		if (!client) {
+			client = g_new0(replay_client_t, 1);
+			client->replay = replay;
+			g_queue_init(&client->calls);
+			g_hash_table_insert(replay->clients, call->client,
+					    client);
+			client->connection =
+				g_dbus_connection_new_for_address_sync(
+					address, flags, NULL, NULL, &error);
+			if (!client->connection)
+				goto on_error;
+		}
+		g_queue_push_tail(&client->calls, call);
+	}
+
+	replay->outstanding = replay->calls->len;
+
+on_error:
+
+	if (error) {
+		fprintf(stderr, "Unable to connect to provman: %s\n",
+			error->message);
+		g_error_free(error);
+		err = PROVMAN_ERR_OPEN;
+	}
+
+	g_free(address);
+
+	return err;
+}
+
+static void prv_inproc_next(replay_t *replay);
+
+static void prv_inproc_complete(replay_t *replay, int result)
+{
+	replay_call_t *call = g_ptr_array_index(replay->calls, replay->next);
+	gint64 latency = g_get_monotonic_time() - replay->sent;
+
+	prv_record(replay, call, latency, result == PROVMAN_ERR_NONE ? NULL :
+		   provman_err_to_dbus(result));
+	++replay->next;
+}
+
+static void prv_inproc_void_cb(int result, void *user_data)
+{
+	prv_inproc_complete(user_data, result);
+	prv_inproc_next(user_data);
+}
+
+static void prv_inproc_value_cb(int result, gchar *value, void *user_data)
+{
+	g_free(value);
+	prv_inproc_complete(user_data, result);
+	prv_inproc_next(user_data);
+}
+
+static void prv_inproc_variant_cb(int result, GVariant *variant,
+				  void *user_data)
+{
+	if (variant)
+		g_variant_unref(variant);
+	prv_inproc_complete(user_data, result);
+	prv_inproc_next(user_data);
+}
+
+/* Issues call to the plugin manager.  Returns true if the call completes
+   asynchronously.  Otherwise its result is returned in *result. */
+
+static bool prv_inproc_issue(replay_t *replay, replay_call_t *call,
+			     int *result)
+{
+	plugin_manager_t *manager = replay->manager;
+	const gchar *method = call->method;
+	const gchar *key = NULL;
+	const gchar *prop = NULL;
+	const gchar *value = NULL;
+	GVariant *child = NULL;
+	GVariant *values;
+	gchar *type_info;
+	int err;
+	bool async = true;
+
+	if (g_variant_n_children(call->params) > 0) {
+		child = g_variant_get_child_value(call->params, 0);
+		if (g_variant_is_of_type(child, G_VARIANT_TYPE_STRING))
+			key = g_variant_get_string(child, NULL);
+	}
+
+	if (!strcmp(method, REPLAY_START)) {
+		err = plugin_manager_sync_in(manager, key ? key : "");
+		async = false;
+	} else if (!strcmp(method, REPLAY_END)) {
+		err = plugin_manager_sync_out(manager, prv_inproc_void_cb,
+					      replay);
+	} else if (!strcmp(method, REPLAY_ABORT)) {
+		err = plugin_manager_abort(manager);
+		async = false;
+	} else if (!strcmp(method, "Set") && key) {
+		g_variant_get_child(call->params, 1, "&s", &value);
+		err = plugin_manager_set(manager, key, value,
+					 prv_inproc_void_cb, replay);
+	} else if (!strcmp(method, "SetMeta") && key) {
+		g_variant_get_child(call->params, 1, "&s", &prop);
+		g_variant_get_child(call->params, 2, "&s", &value);
+		err = plugin_manager_set_meta(manager, key, prop, value,
+					      prv_inproc_void_cb, replay);
+	} else if (!strcmp(method, "Get") && key) {
+		err = plugin_manager_get(manager, key, prv_inproc_value_cb,
+					 replay);
+	} else if (!strcmp(method, "GetMeta") && key) {
+		g_variant_get_child(call->params, 1, "&s", &prop);
+		err = plugin_manager_get_meta(manager, key, prop,
+					      prv_inproc_value_cb, replay);
+	} else if (!strcmp(method, "GetAll") && key) {
+		err = plugin_manager_get_all(manager, key,
+					     prv_inproc_variant_cb, replay);
+	} else if (!strcmp(method, "GetAllMeta") && key) {
+		err = plugin_manager_get_all_meta(manager, key,
+						  prv_inproc_variant_cb,
+						  replay);
+	} else if (!strcmp(method, "Delete") && key) {
+		err = plugin_manager_remove(manager, key, prv_inproc_void_cb,
+					    replay);
+	} else if (!strcmp(method, "GetMultiple") && child) {
+		err = plugin_manager_get_multiple(manager, child,
+						  prv_inproc_variant_cb,
+						  replay);
+	} else if (!strcmp(method, "SetMultiple") && child) {
+		err = plugin_manager_set_multiple(manager, child,
+						  prv_inproc_variant_cb,
+						  replay);
+	} else if (!strcmp(method, "SetMultipleMeta") && child) {
+		err = plugin_manager_set_multiple_meta(manager, child,
+						       prv_inproc_variant_cb,
+						       replay);
+	} else if (!strcmp(method, "DeleteMultiple") && child) {
+		err = plugin_manager_remove_multiple(manager, child,
+						     prv_inproc_variant_cb,
+						     replay);
+	} else if (!strcmp(method, "GetTypeInfo") && key) {
+		err = plugin_manager_get_type_info(manager, key, &type_info);
+		if (err == PROVMAN_ERR_NONE)
+			g_free(type_info);
+		async = false;
+	} else if (!strcmp(method, "GetChildrenTypeInfo") && key) {
+		err = plugin_manager_get_children_type_info(manager, key,
+							    &values);
+		if (err == PROVMAN_ERR_NONE)
+			g_variant_unref(values);
+		async = false;
+	} else if (!strcmp(method, "GetVersion")) {
+		err = PROVMAN_ERR_NONE;
+		async = false;
+	} else {
+		err = PROVMAN_ERR_NOT_SUPPORTED;
+		async = false;
+	}
+
+	if (child)
+		g_variant_unref(child);
+
+	if (err != PROVMAN_ERR_NONE)
+		async = false;
+	*result = err;
+
+	return async;
+}
+
+static gboolean prv_inproc_timer_cb(gpointer user_data)
+{
+	replay_t *replay = user_data;
+
+	replay->timer_id = 0;
+	prv_inproc_next(replay);
+
+	return FALSE;
+}
+
+static void prv_inproc_next(replay_t *replay)
+{
+	replay_call_t *call;
+	gint64 delay;
+	int result;
+
+	while (replay->next < replay->calls->len) {
+		call = g_ptr_array_index(replay->calls, replay->next);
+		delay = call->due - (g_get_monotonic_time() - replay->t0);
+		if (delay > 0) {
+			replay->timer_id = g_timeout_add(
+				(guint) ((delay + 999) / 1000),
+				prv_inproc_timer_cb, replay);
+			return;
+		}
+
+		replay->sent = g_get_monotonic_time();
+		if (prv_inproc_issue(replay, call, &result))
+			return;
+
+		prv_inproc_complete(replay, result);
+	}
+
+	g_main_loop_quit(replay->loop);
+}
+
+static gint prv_compare_latency(gconstpointer a, gconstpointer b)
+{
+	gint64 la = *((const gint64 *) a);
+	gint64 lb = *((const gint64 *) b);
+
+	return la < lb ? -1 : la > lb ? 1 : 0;
+}
+
+static gint64 prv_percentile(GArray *latencies, unsigned int percentile)
+{
+	guint index;
+
+	if (latencies->len == 0)
+		return 0;
+
+	g_array_sort(latencies, prv_compare_latency);
+	index = (latencies->len * percentile) / 100;
+	if (index >= latencies->len)
+		index = latencies->len - 1;
+
+	return g_array_index(latencies, gint64, index);
+}
+
+static void prv_report(replay_t *replay, gint64 elapsed)
+{
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	replay_stat_t *stat;
+	replay_call_t *last;
+	gint64 span = 0;
+
+	if (replay->calls->len > 0) {
+		last = g_ptr_array_index(replay->calls,
+					 replay->calls->len - 1);
+		span = last->due;
+	}
+
+	printf("%u calls replayed in %.2f s, scheduled over %.2f s, "
+	       "%u skipped, %u mismatched\n\n", replay->calls->len,
+	       elapsed / 1000000.0, span / 1000000.0, replay->skipped,
+	       replay->mismatches);
+
+	printf("%-20s %8s %12s %12s %12s %12s %10s\n", "method", "count",
+	       "rec p50(us)", "rec p99(us)", "p50(us)", "p99(us)",
+	       "mismatch");
+
+	g_hash_table_iter_init(&iter, replay->stats);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		stat = value;
+		printf("%-20s %8u %12" G_GINT64_FORMAT " %12" G_GINT64_FORMAT
+		       " %12" G_GINT64_FORMAT " %12" G_GINT64_FORMAT " %10u\n",
+		       (const gchar *) key, stat->replayed->len,
+		       prv_percentile(stat->recorded, 50),
+		       prv_percentile(stat->recorded, 99),
+		       prv_percentile(stat->replayed, 50),
+		       prv_percentile(stat->replayed, 99), stat->mismatches);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int err = PROVMAN_ERR_NONE;
+	GOptionContext *context;
+	GError *error = NULL;
+	replay_t replay;
+	gchar *home = NULL;
+
+	memset(&replay, 0, sizeof(replay));
+
+	context = g_option_context_new("CAPTURE - replay a provman capture "
+				       "file");
+	g_option_context_add_main_entries(context, g_replay_options, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	if (argc != 2 || g_replay_speed < 0) {
+		fprintf(stderr, "Invalid arguments\n");
+		return 1;
+	}
+
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+	g_thread_init(NULL);
+#endif
+	g_type_init();
+
+	replay.loop = g_main_loop_new(NULL, FALSE);
+	replay.calls = g_ptr_array_new_with_free_func(prv_call_free);
+	replay.stats = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+					     prv_stat_free);
+	replay.clients = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+					       prv_client_free);
+
+	err = prv_load_capture(&replay, argv[1]);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	if (replay.calls->len == 0) {
+		fprintf(stderr, "No calls to replay\n");
+		err = PROVMAN_ERR_NOT_FOUND;
+		goto on_error;
+	}
+
+	if (g_replay_in_process) {
+		err = provman_bench_home_new(&home);
+		if (err != PROVMAN_ERR_NONE) {
+			fprintf(stderr, "Unable to create home directory: %d\n",
+				err);
+			goto on_error;
+		}
+		err = plugin_manager_new(&replay.manager, false);
+		if (err != PROVMAN_ERR_NONE) {
+			fprintf(stderr, "Unable to create plugin manager: %d\n",
+				err);
+			goto on_error;
+		}
+		replay.t0 = g_get_monotonic_time();
+		replay.timer_id = g_idle_add(prv_inproc_timer_cb, &replay);
+	} else {
+		err = prv_dbus_setup(&replay);
+		if (err != PROVMAN_ERR_NONE)
+			goto on_error;
+		replay.t0 = g_get_monotonic_time();
+		replay.timer_id = g_timeout_add(1, prv_dbus_timer_cb, &replay);
+		prv_dbus_pump(&replay);
+	}
+
+	g_main_loop_run(replay.loop);
+
+	prv_report(&replay, g_get_monotonic_time() - replay.t0);
+
+on_error:
+
+	if (replay.timer_id)
+		(void) g_source_remove(replay.timer_id);
+
+	/* Clients and statistics point to strings owned by the calls and so
+	   must be freed first. */
+
+	g_hash_table_unref(replay.clients);
+	g_hash_table_unref(replay.stats);
+	g_ptr_array_free(replay.calls, TRUE);
+
+	if (replay.manager)
+		plugin_manager_delete(replay.manager);
+
+	provman_bench_home_delete(home);
+
+	g_main_loop_unref(replay.loop);
+
+	return err == PROVMAN_ERR_NONE ? 0 : 1;
+}
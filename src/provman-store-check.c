@@ -0,0 +1,487 @@
+/*
+ * Provman
+ *
+ * Copyright (C) 2011 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+/*!
+ * @file provman-store-check.c
+ *
+ * @brief Main file for provman-store-check
+ *
+ * provman-store-check exercises the recovery paths of the provman store.
+ * It creates a store in a temporary directory, commits modifications to
+ * it, damages the file in the ways a crash or a bad disk would, reopens
+ * the store and verifies the state that is recovered.  The checks cover
+ * log replay, batches that were only partially written, batches whose
+ * checksum does not match, compaction, the renaming of files that are
+ * not stores and provman_store_sync.  The program is run by make check
+ * and exits with a non zero status if any check fails.
+ *
+ ******************************************************************************/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <glib.h>
+
+#include "error.h"
+#include "store.h"
+
+#define STORE_CHECK_NS "check"
+#define STORE_CHECK_OTHER_NS "check.other"
+#define STORE_CHECK_CORRUPT_SUFFIX ".corrupt"
+#define STORE_CHECK_VALUE_SIZE 1024
+#define STORE_CHECK_COMPACT_COMMITS 256
+#define STORE_CHECK_COMPACT_MAX (128 * 1024)
+
+#define STORE_CHECK(cond) do {						\
+		if (!(cond)) {						\
+			fprintf(stderr, "%s:%d: check failed: %s\n",	\
+				__FILE__, __LINE__, #cond);		\
+			goto on_error;					\
+		}							\
+	} while (0)
+
+typedef struct store_check_t_ store_check_t;
+struct store_check_t_ {
+	gchar *dir;
+	gchar *fname;
+	gchar *corrupt_fname;
+	provman_store_t *store;
+};
+
+static void prv_reopen(store_check_t *check)
+{
+	provman_store_close(check->store);
+	provman_store_open_dir(check->dir, &check->store);
+}
+
+static bool prv_store_has_value(provman_store_t *store, const gchar *ns,
+				const gchar *key, const gchar *value)
+{
+	gchar *stored = provman_store_get(store, ns, key);
+	bool retval = !g_strcmp0(stored, value);
+
+	g_free(stored);
+
+	return retval;
+}
+
+static bool prv_has_value(store_check_t *check, const gchar *ns,
+			  const gchar *key, const gchar *value)
+{
+	return prv_store_has_value(check->store, ns, key, value);
+}
+
+static off_t prv_file_size(const gchar *fname)
+{
+	struct stat st;
+
+	return stat(fname, &st) == 0 ? st.st_size : -1;
+}
+
+static bool prv_file_exists(const gchar *fname)
+{
+	return prv_file_size(fname) != -1;
+}
+
+/* Returns the offset of the first occurrence of str in the file that
+   starts at or after from, or -1 if there is none. */
+
+static off_t prv_file_find(const gchar *fname, off_t from, const gchar *str)
+{
+	gchar *contents;
+	gsize length;
+	gsize len = strlen(str);
+	gsize i;
+	off_t offset = -1;
+
+	if (!g_file_get_contents(fname, &contents, &length, NULL))
+		return -1;
+
+	for (i = from; i + len <= length; ++i) {
+		if (!memcmp(contents + i, str, len)) {
+			offset = i;
+			break;
+		}
+	}
+
+	g_free(contents);
+
+	return offset;
+}
+
+static bool prv_flip_byte(const gchar *fname, off_t offset)
+{
+	int fd;
+	guint8 byte;
+	bool retval = false;
+
+	fd = open(fname, O_RDWR);
+	if (fd == -1)
+		return false;
+
+	if (pread(fd, &byte, 1, offset) == 1) {
+		byte ^= 0xff;
+		retval = pwrite(fd, &byte, 1, offset) == 1 && fsync(fd) == 0;
+	}
+
+	(void) close(fd);
+
+	return retval;
+}
+
+static int prv_check_replay(store_check_t *check)
+{
+	STORE_CHECK(prv_has_value(check, STORE_CHECK_NS, "a", NULL));
+
+	/* The first commit writes a snapshot, the second appends a batch
+	   to the log. */
+
+	provman_store_set(check->store, STORE_CHECK_NS, "a", "1");
+	provman_store_set(check->store, STORE_CHECK_OTHER_NS, "a", "other");
+	STORE_CHECK(provman_store_sync(check->store) == PROVMAN_ERR_NONE);
+	prv_reopen(check);
+
+	provman_store_set(check->store, STORE_CHECK_NS, "b", "2");
+	provman_store_set(check->store, STORE_CHECK_NS, "c", "3");
+	STORE_CHECK(provman_store_commit(check->store) == PROVMAN_ERR_NONE);
+	STORE_CHECK(provman_store_remove(check->store, STORE_CHECK_NS, "c") ==
+		    PROVMAN_ERR_NONE);
+	STORE_CHECK(provman_store_commit(check->store) == PROVMAN_ERR_NONE);
+	prv_reopen(check);
+
+	STORE_CHECK(prv_has_value(check, STORE_CHECK_NS, "a", "1"));
+	STORE_CHECK(prv_has_value(check, STORE_CHECK_NS, "b", "2"));
+	STORE_CHECK(prv_has_value(check, STORE_CHECK_NS, "c", NULL));
+	STORE_CHECK(prv_has_value(check, STORE_CHECK_OTHER_NS, "a", "other"));
+
+	return PROVMAN_ERR_NONE;
+
+on_error:
+
+	return PROVMAN_ERR_CORRUPT;
+}
+
+/* Cuts the last batch short, once inside its first record and once
+   inside its commit record. */
+
+static int prv_check_truncated_batch(store_check_t *check)
+{
+	off_t before;
+	off_t after;
+	off_t cuts[2];
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(cuts); ++i) {
+		before = prv_file_size(check->fname);
+		provman_store_set(check->store, STORE_CHECK_NS, "truncated",
+				  "lost");
+		STORE_CHECK(provman_store_sync(check->store) ==
+			    PROVMAN_ERR_NONE);
+		after = prv_file_size(check->fname);
+		STORE_CHECK(before > 0 && after > before);
+
+		cuts[0] = before + 3;
+		cuts[1] = after - 1;
+
+		provman_store_close(check->store);
+		check->store = NULL;
+		STORE_CHECK(truncate(check->fname, cuts[i]) == 0);
+		prv_reopen(check);
+
+		STORE_CHECK(prv_has_value(check, STORE_CHECK_NS, "truncated",
+					  NULL));
+		STORE_CHECK(prv_has_value(check, STORE_CHECK_NS, "a", "1"));
+		STORE_CHECK(prv_has_value(check, STORE_CHECK_NS, "b", "2"));
+
+		/* The next batch overwrites the partial one. */
+
+		provman_store_set(check->store, STORE_CHECK_NS, "after", "4");
+		STORE_CHECK(provman_store_sync(check->store) ==
+			    PROVMAN_ERR_NONE);
+		STORE_CHECK(prv_file_find(check->fname, before, "lost") == -1);
+		prv_reopen(check);
+
+		STORE_CHECK(prv_has_value(check, STORE_CHECK_NS, "after",
+					  "4"));
+		STORE_CHECK(prv_has_value(check, STORE_CHECK_NS, "truncated",
+					  NULL));
+		STORE_CHECK(provman_store_remove(check->store, STORE_CHECK_NS,
+						 "after") == PROVMAN_ERR_NONE);
+		STORE_CHECK(provman_store_sync(check->store) ==
+			    PROVMAN_ERR_NONE);
+	}
+
+	return PROVMAN_ERR_NONE;
+
+on_error:
+
+	return PROVMAN_ERR_CORRUPT;
+}
+
+/* Damages a batch that is followed by a valid one.  Neither batch should
+   be applied, as the log cannot be trusted beyond the damaged batch. */
+
+static int prv_check_bad_checksum(store_check_t *check)
+{
+	off_t before;
+	off_t offset;
+
+	before = prv_file_size(check->fname);
+	provman_store_set(check->store, STORE_CHECK_NS, "damaged",
+			  "damaged-value");
+	STORE_CHECK(provman_store_commit(check->store) == PROVMAN_ERR_NONE);
+	provman_store_set(check->store, STORE_CHECK_NS, "following", "5");
+	STORE_CHECK(provman_store_sync(check->store) == PROVMAN_ERR_NONE);
+	provman_store_close(check->store);
+	check->store = NULL;
+
+	offset = prv_file_find(check->fname, before, "damaged-value");
+	STORE_CHECK(offset != -1);
+	STORE_CHECK(prv_flip_byte(check->fname, offset));
+	prv_reopen(check);
+
+	STORE_CHECK(prv_has_value(check, STORE_CHECK_NS, "damaged", NULL));
+	STORE_CHECK(prv_has_value(check, STORE_CHECK_NS, "following", NULL));
+	STORE_CHECK(prv_has_value(check, STORE_CHECK_NS, "a", "1"));
+	STORE_CHECK(prv_has_value(check, STORE_CHECK_NS, "b", "2"));
+
+	provman_store_set(check->store, STORE_CHECK_NS, "repaired", "6");
+	STORE_CHECK(provman_store_sync(check->store) == PROVMAN_ERR_NONE);
+	prv_reopen(check);
+
+	STORE_CHECK(prv_has_value(check, STORE_CHECK_NS, "repaired", "6"));
+	STORE_CHECK(prv_has_value(check, STORE_CHECK_NS, "damaged", NULL));
+	STORE_CHECK(prv_has_value(check, STORE_CHECK_NS, "following", NULL));
+
+	return PROVMAN_ERR_NONE;
+
+on_error:
+
+	return PROVMAN_ERR_CORRUPT;
+}
+
+/* Commits enough data for the log to be compacted several times and
+   checks that the compacted store contains the latest values, both
+   before and after it is reloaded. */
+
+static int prv_check_compaction(store_check_t *check)
+{
+	gchar value[STORE_CHECK_VALUE_SIZE + 1];
+	gchar key[16];
+	unsigned int i;
+
+	for (i = 0; i < STORE_CHECK_COMPACT_COMMITS; ++i) {
+		memset(value, 'a' + i % 26, STORE_CHECK_VALUE_SIZE);
+		value[STORE_CHECK_VALUE_SIZE] = 0;
+		provman_store_set(check->store, STORE_CHECK_NS, "large", value);
+		snprintf(key, sizeof(key), "key%03u", i);
+		provman_store_set(check->store, STORE_CHECK_OTHER_NS, key, key);
+		if (i % 2)
+			STORE_CHECK(provman_store_remove(check->store,
+							 STORE_CHECK_OTHER_NS,
+							 key) ==
+				    PROVMAN_ERR_NONE);
+		STORE_CHECK(provman_store_commit(check->store) ==
+			    PROVMAN_ERR_NONE);
+	}
+
+	STORE_CHECK(provman_store_sync(check->store) == PROVMAN_ERR_NONE);
+	STORE_CHECK(prv_file_size(check->fname) < STORE_CHECK_COMPACT_MAX);
+
+	for (i = 0; i < 2; ++i) {
+		STORE_CHECK(prv_has_value(check, STORE_CHECK_NS, "large",
+					  value));
+		STORE_CHECK(prv_has_value(check, STORE_CHECK_OTHER_NS,
+					  "key000", "key000"));
+		STORE_CHECK(prv_has_value(check, STORE_CHECK_OTHER_NS,
+					  "key001", NULL));
+		STORE_CHECK(prv_has_value(check, STORE_CHECK_OTHER_NS,
+					  "key254", "key254"));
+		STORE_CHECK(prv_has_value(check, STORE_CHECK_OTHER_NS,
+					  "key255", NULL));
+		STORE_CHECK(prv_has_value(check, STORE_CHECK_OTHER_NS, "a",
+					  "other"));
+		STORE_CHECK(prv_has_value(check, STORE_CHECK_NS, "repaired",
+					  "6"));
+		prv_reopen(check);
+	}
+
+	return PROVMAN_ERR_NONE;
+
+on_error:
+
+	return PROVMAN_ERR_CORRUPT;
+}
+
+static int prv_check_corrupt_file(store_check_t *check)
+{
+	static const gchar garbage[] = "this is not a provman store";
+	gchar *contents = NULL;
+
+	provman_store_close(check->store);
+	check->store = NULL;
+	STORE_CHECK(g_file_set_contents(check->fname, garbage,
+					sizeof(garbage) - 1, NULL));
+	prv_reopen(check);
+
+	STORE_CHECK(prv_has_value(check, STORE_CHECK_NS, "a", NULL));
+	STORE_CHECK(!prv_file_exists(check->fname));
+	STORE_CHECK(g_file_get_contents(check->corrupt_fname, &contents,
+					NULL, NULL));
+	STORE_CHECK(!strcmp(contents, garbage));
+
+	provman_store_set(check->store, STORE_CHECK_NS, "a", "7");
+	STORE_CHECK(provman_store_sync(check->store) == PROVMAN_ERR_NONE);
+	prv_reopen(check);
+
+	STORE_CHECK(prv_has_value(check, STORE_CHECK_NS, "a", "7"));
+
+	g_free(contents);
+
+	return PROVMAN_ERR_NONE;
+
+on_error:
+
+	g_free(contents);
+
+	return PROVMAN_ERR_CORRUPT;
+}
+
+/* Once provman_store_sync has returned, the modifications must be in the
+   file, even though the store is still open.  A copy of the file taken
+   at that point recovers them. */
+
+static int prv_check_sync(store_check_t *check)
+{
+	gchar *contents = NULL;
+	gsize length;
+	gchar *copy_dir;
+	gchar *copy_fname;
+	provman_store_t *copy = NULL;
+
+	copy_dir = g_build_filename(check->dir, "copy", NULL);
+	copy_fname = g_build_filename(copy_dir, PROVMAN_STORE_FILE_NAME,
+				      NULL);
+
+	provman_store_set(check->store, STORE_CHECK_NS, "durable",
+			  "durable-value");
+	STORE_CHECK(provman_store_remove(check->store, STORE_CHECK_NS, "a") ==
+		    PROVMAN_ERR_NONE);
+	STORE_CHECK(provman_store_sync(check->store) == PROVMAN_ERR_NONE);
+
+	STORE_CHECK(mkdir(copy_dir, 0700) == 0);
+	STORE_CHECK(g_file_get_contents(check->fname, &contents, &length,
+					NULL));
+	STORE_CHECK(g_file_set_contents(copy_fname, contents, length, NULL));
+	provman_store_open_dir(copy_dir, &copy);
+
+	STORE_CHECK(prv_store_has_value(copy, STORE_CHECK_NS, "durable",
+					"durable-value"));
+	STORE_CHECK(prv_store_has_value(copy, STORE_CHECK_NS, "a", NULL));
+
+	provman_store_close(copy);
+	(void) unlink(copy_fname);
+	(void) rmdir(copy_dir);
+	g_free(copy_fname);
+	g_free(copy_dir);
+	g_free(contents);
+
+	return PROVMAN_ERR_NONE;
+
+on_error:
+
+	provman_store_close(copy);
+	(void) unlink(copy_fname);
+	(void) rmdir(copy_dir);
+	g_free(copy_fname);
+	g_free(copy_dir);
+	g_free(contents);
+
+	return PROVMAN_ERR_CORRUPT;
+}
+
+int main(void)
+{
+	int err;
+	store_check_t check;
+
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+	g_thread_init(NULL);
+#endif
+
+	memset(&check, 0, sizeof(check));
+	check.dir = g_build_filename(g_get_tmp_dir(),
+				     "provman-store-check-XXXXXX", NULL);
+	if (!mkdtemp(check.dir)) {
+		fprintf(stderr, "Unable to create %s\n", check.dir);
+		g_free(check.dir);
+		return 1;
+	}
+	check.fname = g_build_filename(check.dir, PROVMAN_STORE_FILE_NAME,
+				       NULL);
+	check.corrupt_fname = g_strconcat(check.fname,
+					  STORE_CHECK_CORRUPT_SUFFIX, NULL);
+	provman_store_open_dir(check.dir, &check.store);
+
+	err = prv_check_replay(&check);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	err = prv_check_truncated_batch(&check);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	err = prv_check_bad_checksum(&check);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	err = prv_check_compaction(&check);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	err = prv_check_corrupt_file(&check);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	err = prv_check_sync(&check);
+
+on_error:
+
+	provman_store_close(check.store);
+	(void) unlink(check.corrupt_fname);
+	(void) unlink(check.fname);
+	(void) rmdir(check.dir);
+	g_free(check.corrupt_fname);
+	g_free(check.fname);
+	g_free(check.dir);
+
+	return err == PROVMAN_ERR_NONE ? 0 : 1;
+}
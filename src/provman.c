@@ -39,6 +39,7 @@
 #include <sys/signalfd.h>
 #include <signal.h>
 #include <syslog.h>
+#include <unistd.h>
 
 #include "log.h"
 #include "error.h"
@@ -46,6 +47,9 @@
 #include "tasks.h"
 #include "utils.h"
 #include "plugin-manager.h"
+#include "stats.h"
+#include "trace.h"
+#include "capture.h"
 
 #define PROVMAN_INTERFACE_GET_VERSION "GetVersion"
 #define PROVMAN_INTERFACE_START "Start"
@@ -73,6 +77,16 @@
 #define PROVMAN_INTERFACE_GET_META "GetMeta"
 #define PROVMAN_INTERFACE_GET_ALL_META "GetAllMeta"
 #define PROVMAN_INTERFACE_VERSION "version"
+#define PROVMAN_INTERFACE_GET_STATISTICS "GetStatistics"
+#define PROVMAN_INTERFACE_STATISTICS "statistics"
+#define PROVMAN_INTERFACE_SET_TRACING "SetTracing"
+#define PROVMAN_INTERFACE_ENABLED "enabled"
+#define PROVMAN_INTERFACE_SET_LOG_LEVEL "SetLogLevel"
+#define PROVMAN_INTERFACE_SET_CAPTURE "SetCapture"
+#define PROVMAN_INTERFACE_LEVEL "level"
+
+#define PROVMAN_TRACE_ENV "PROVMAN_TRACE"
+#define PROVMAN_CAPTURE_ENV "PROVMAN_CAPTURE"
 
 #define PROVMAN_TIMEOUT 30*1000
 
@@ -94,6 +108,18 @@ struct provman_context_ {
 	guint holder_watcher;
 	GSList *queued_clients;
 	plugin_manager_t *plugin_manager;
+	gchar *trace_path;
+	gchar *capture_path;
+};
+
+typedef void (*provman_privileged_method)(provman_context *context,
+					  GDBusMethodInvocation *invocation);
+
+typedef struct provman_privileged_call_ provman_privileged_call;
+struct provman_privileged_call_ {
+	provman_context *context;
+	GDBusMethodInvocation *invocation;
+	provman_privileged_method method;
 };
 
 static const gchar g_provman_introspection[] =
@@ -103,6 +129,22 @@ static const gchar g_provman_introspection[] =
 	"      <arg type='s' name='"PROVMAN_INTERFACE_VERSION"'"
 	"           direction='out'/>"
 	"    </method>"
+	"    <method name='"PROVMAN_INTERFACE_GET_STATISTICS"'>"
+	"      <arg type='a{sa{st}}' name='"PROVMAN_INTERFACE_STATISTICS"'"
+	"           direction='out'/>"
+	"    </method>"
+	"    <method name='"PROVMAN_INTERFACE_SET_TRACING"'>"
+	"      <arg type='b' name='"PROVMAN_INTERFACE_ENABLED"'"
+	"           direction='in'/>"
+	"    </method>"
+	"    <method name='"PROVMAN_INTERFACE_SET_CAPTURE"'>"
+	"      <arg type='b' name='"PROVMAN_INTERFACE_ENABLED"'"
+	"           direction='in'/>"
+	"    </method>"
+	"    <method name='"PROVMAN_INTERFACE_SET_LOG_LEVEL"'>"
+	"      <arg type='u' name='"PROVMAN_INTERFACE_LEVEL"'"
+	"           direction='in'/>"
+	"    </method>"
 	"    <method name='"PROVMAN_INTERFACE_START"'>"
 	"      <arg type='s' name='"PROVMAN_INTERFACE_IMSI"'"
 	"           direction='in'/>"
@@ -248,6 +290,10 @@ static gboolean prv_process_task(gpointer user_data)
 
 	if (!context->quitting && context->tasks->len > 0) {
 		task = g_ptr_array_index(context->tasks, 0);
+		task->started = g_get_monotonic_time();
+		task->trace_id = PROVMAN_TRACE_BEGIN(
+			PROVMAN_TRACE_CAT_TASK,
+			provman_task_get_name(task->type), task->imsi);
 
 		switch (task->type) {
 		case PROVMAN_TASK_SYNC_IN:
@@ -434,12 +480,17 @@ static void prv_provman_context_free(provman_context *context)
 	if (context->node_info)
 		g_dbus_node_info_unref(context->node_info);
 
+	g_free(context->trace_path);
+	g_free(context->capture_path);
+
 	plugin_manager_delete(context->plugin_manager);
 }
 
 static void prv_add_task(provman_context *context, provman_task *task)
 {
 	g_ptr_array_add(context->tasks, task);
+	PROVMAN_TRACE_INSTANT(PROVMAN_TRACE_CAT_TASK,
+			      provman_task_get_name(task->type));
 
 	if (!context->idle_id && !prv_async_in_progress(context))
 		context->idle_id = g_idle_add(prv_process_task, context);
@@ -728,7 +779,8 @@ static void prv_session_finished(provman_context *context)
 		parameters =
 			g_dbus_method_invocation_get_parameters(invocation);
 
-		PROVMAN_LOGF("start session with %s", context->holder);
+		PROVMAN_LOGLF(PROVMAN_LOG_LEVEL_INFO, "start session with %s",
+			      context->holder);
 
 		prv_add_sync_in_task(context, parameters);
 
@@ -747,7 +799,8 @@ static void prv_lost_client(GDBusConnection *connection, const gchar *name,
 	provman_task *task;
 	guint i;
 
-	PROVMAN_LOGF("Lost client connection %s", name);
+	PROVMAN_LOGLF(PROVMAN_LOG_LEVEL_INFO, "Lost client connection %s",
+		      name);
 
 	for (i = 0; i < context->tasks->len; ++i) {
 		task = ((provman_task *) g_ptr_array_index(context->tasks,
@@ -792,6 +845,129 @@ static void prv_reset_startup_timer(provman_context *context)
 	}
 }
 
+static void prv_set_tracing(provman_context *context,
+			    GDBusMethodInvocation *invocation)
+{
+	gboolean enabled;
+	int err = PROVMAN_ERR_NONE;
+
+	g_variant_get(g_dbus_method_invocation_get_parameters(invocation),
+		      "(b)", &enabled);
+	if (enabled)
+		err = provman_trace_open(context->trace_path);
+	else
+		provman_trace_close();
+
+	if (err == PROVMAN_ERR_NONE) {
+		syslog(LOG_INFO, "Tracing %s", enabled ?
+		       context->trace_path : "disabled");
+		g_dbus_method_invocation_return_value(invocation, NULL);
+	} else {
+		g_dbus_method_invocation_return_dbus_error(
+			invocation, provman_err_to_dbus(err), "");
+	}
+}
+
+static void prv_set_capture(provman_context *context,
+			    GDBusMethodInvocation *invocation)
+{
+	gboolean enabled;
+	int err = PROVMAN_ERR_NONE;
+
+	g_variant_get(g_dbus_method_invocation_get_parameters(invocation),
+		      "(b)", &enabled);
+	if (enabled)
+		err = provman_capture_open(
+			g_dbus_method_invocation_get_connection(invocation),
+			context->capture_path);
+	else
+		provman_capture_close();
+
+	if (err == PROVMAN_ERR_NONE) {
+		syslog(LOG_INFO, "Capture %s", enabled ?
+		       context->capture_path : "disabled");
+		g_dbus_method_invocation_return_value(invocation, NULL);
+	} else {
+		g_dbus_method_invocation_return_dbus_error(
+			invocation, provman_err_to_dbus(err), "");
+	}
+}
+
+static void prv_set_log_level(provman_context *context,
+			      GDBusMethodInvocation *invocation)
+{
+	guint32 level;
+
+	g_variant_get(g_dbus_method_invocation_get_parameters(invocation),
+		      "(u)", &level);
+	if (level > PROVMAN_LOG_LEVEL_DEBUG) {
+		g_dbus_method_invocation_return_dbus_error(
+			invocation, provman_err_to_dbus(PROVMAN_ERR_BAD_ARGS),
+			"");
+	} else {
+		syslog(LOG_INFO, "Log level set to %u", level);
+		provman_log_set_level(level);
+		g_dbus_method_invocation_return_value(invocation, NULL);
+	}
+}
+
+static void prv_caller_uid_cb(GObject *source, GAsyncResult *result,
+			      gpointer user_data)
+{
+	provman_privileged_call *call = user_data;
+	GVariant *reply;
+	guint32 uid = G_MAXUINT32;
+
+	reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source),
+					      result, NULL);
+	if (reply) {
+		g_variant_get(reply, "(u)", &uid);
+		g_variant_unref(reply);
+	}
+
+	if (uid == 0) {
+		call->method(call->context, call->invocation);
+	} else {
+		syslog(LOG_WARNING, "%s denied to %s",
+		       g_dbus_method_invocation_get_method_name(
+			       call->invocation),
+		       g_dbus_method_invocation_get_sender(call->invocation));
+		g_dbus_method_invocation_return_dbus_error(
+			call->invocation, PROVMAN_DBUS_ERR_DENIED, "");
+	}
+
+	g_free(call);
+}
+
+/* Methods that write files or change what the daemon logs on behalf of
+   the caller are restricted to root on the system bus.  On the session bus
+   every client already runs as the user that owns the daemon. */
+
+static void prv_run_privileged(provman_context *context,
+			       GDBusMethodInvocation *invocation,
+			       provman_privileged_method method)
+{
+	provman_privileged_call *call;
+
+	if (context->bus != G_BUS_TYPE_SYSTEM) {
+		method(context, invocation);
+	} else {
+		call = g_new(provman_privileged_call, 1);
+		call->context = context;
+		call->invocation = invocation;
+		call->method = method;
+		g_dbus_connection_call(
+			g_dbus_method_invocation_get_connection(invocation),
+			"org.freedesktop.DBus", "/org/freedesktop/DBus",
+			"org.freedesktop.DBus", "GetConnectionUnixUser",
+			g_variant_new("(s)",
+				      g_dbus_method_invocation_get_sender(
+					      invocation)),
+			G_VARIANT_TYPE("(u)"), G_DBUS_CALL_FLAGS_NONE, -1,
+			NULL, prv_caller_uid_cb, call);
+	}
+}
+
 static void prv_provman_method_call(GDBusConnection *connection,
 				    const gchar *sender,
 				    const gchar *object_path,
@@ -802,9 +978,13 @@ static void prv_provman_method_call(GDBusConnection *connection,
 				    gpointer user_data)
 {
 	provman_context *context = user_data;
+	GVariant *stats;
 
 	PROVMAN_LOGF("%s called", method_name);
 
+	if (g_provman_capture_enabled)
+		provman_capture_call(invocation);
+
 	if (!g_strcmp0(method_name, PROVMAN_INTERFACE_START)) {
 		if (!context->holder) {
 			prv_reset_startup_timer(context);
@@ -817,7 +997,9 @@ static void prv_provman_method_call(GDBusConnection *connection,
 						 prv_lost_client, context,
 						 NULL);
 
-			PROVMAN_LOGF("start session with %s", context->holder);
+			PROVMAN_LOGLF(PROVMAN_LOG_LEVEL_INFO,
+				      "start session with %s",
+				      context->holder);
 
 			prv_add_sync_in_task(context, parameters);
 			g_dbus_method_invocation_return_value(invocation, NULL);
@@ -842,6 +1024,23 @@ static void prv_provman_method_call(GDBusConnection *connection,
 	} else if (!g_strcmp0(method_name, PROVMAN_INTERFACE_GET_VERSION)) {
 		prv_reset_startup_timer(context);
 		prv_add_get_version_task(context, invocation);
+	} else if (!g_strcmp0(method_name,
+			      PROVMAN_INTERFACE_GET_STATISTICS)) {
+
+		/* Statistics are returned straight away, rather than being
+		   queued, so that they can be retrieved while a long running
+		   task is in progress. */
+
+		stats = provman_stats_get();
+		g_dbus_method_invocation_return_value(
+			invocation, g_variant_new("(@a{sa{st}})", stats));
+		g_variant_unref(stats);
+	} else if (!g_strcmp0(method_name, PROVMAN_INTERFACE_SET_TRACING)) {
+		prv_run_privileged(context, invocation, prv_set_tracing);
+	} else if (!g_strcmp0(method_name, PROVMAN_INTERFACE_SET_CAPTURE)) {
+		prv_run_privileged(context, invocation, prv_set_capture);
+	} else if (!g_strcmp0(method_name, PROVMAN_INTERFACE_SET_LOG_LEVEL)) {
+		prv_run_privileged(context, invocation, prv_set_log_level);
 	} else {
 		if (g_strcmp0(context->holder,
 			      g_dbus_method_invocation_get_sender(
@@ -917,7 +1116,13 @@ static void prv_bus_acquired(GDBusConnection *connection, const gchar *name,
 	if (!context->prov_client_id) {
 		context->error = PROVMAN_ERR_UNKNOWN;
 		g_main_loop_quit(context->main_loop);
-		PROVMAN_LOG("Unable to register "PROVMAN_INTERFACE);
+		PROVMAN_LOGL(PROVMAN_LOG_LEVEL_ERROR,
+			     "Unable to register "PROVMAN_INTERFACE);
+	} else if (g_getenv(PROVMAN_CAPTURE_ENV) &&
+		   provman_capture_open(connection, context->capture_path) !=
+		   PROVMAN_ERR_NONE) {
+		syslog(LOG_ERR, "Unable to open capture file %s",
+		       context->capture_path);
 	}
 }
 
@@ -935,7 +1140,8 @@ static void prv_name_lost(GDBusConnection *connection, const gchar *name,
 {
 	provman_context *context = user_data;
 
-	PROVMAN_LOG("Lost or unable to acquire server name: "
+	PROVMAN_LOGL(PROVMAN_LOG_LEVEL_ERROR,
+		     "Lost or unable to acquire server name: "
 		     PROVMAN_SERVER_NAME);
 
 	context->connection = NULL;
@@ -947,8 +1153,16 @@ static gboolean prv_quit_handler(GIOChannel *source, GIOCondition condition,
 				 gpointer user_data)
 {
 	provman_context *context = user_data;
+	struct signalfd_siginfo info;
+	ssize_t bytes;
 
-	PROVMAN_LOG("SIGTERM or SIGINT received");
+	bytes = read(g_io_channel_unix_get_fd(source), &info, sizeof(info));
+	if (bytes == sizeof(info) && info.ssi_signo == SIGUSR1) {
+		provman_stats_dump();
+		return TRUE;
+	}
+
+	PROVMAN_LOGL(PROVMAN_LOG_LEVEL_INFO, "SIGTERM or SIGINT received");
 	syslog(LOG_INFO, "SIGTERM or SIGINT received");
 
 	prv_quit(context);
@@ -997,11 +1211,42 @@ on_error:
 	if (channel)
 		g_io_channel_unref(channel);
 
-	PROVMAN_LOG("Unable to set up signal handlers");
+	PROVMAN_LOGL(PROVMAN_LOG_LEVEL_ERROR,
+		     "Unable to set up signal handlers");
 
 	return err;
 }
 
+static gchar *prv_make_trace_path(GBusType bus)
+{
+	const gchar *path = g_getenv(PROVMAN_TRACE_ENV);
+	gchar *trace_path = NULL;
+
+	if (path && *path)
+		trace_path = g_strdup(path);
+	else
+		(void) provman_utils_make_file_path(PROVMAN_TRACE_FILE,
+						    bus == G_BUS_TYPE_SYSTEM,
+						    &trace_path);
+
+	return trace_path;
+}
+
+static gchar *prv_make_capture_path(GBusType bus)
+{
+	const gchar *path = g_getenv(PROVMAN_CAPTURE_ENV);
+	gchar *capture_path = NULL;
+
+	if (path && *path)
+		capture_path = g_strdup(path);
+	else
+		(void) provman_utils_make_file_path(PROVMAN_CAPTURE_FILE,
+						    bus == G_BUS_TYPE_SYSTEM,
+						    &capture_path);
+
+	return capture_path;
+}
+
 int provman_run(GBusType bus, const char *log_path)
 {
 	int err = PROVMAN_ERR_NONE;
@@ -1017,12 +1262,19 @@ int provman_run(GBusType bus, const char *log_path)
 	sigemptyset(&mask);
 	sigaddset(&mask, SIGTERM);
 	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGUSR1);
 
 	if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
 		err = PROVMAN_ERR_IO;
 		goto on_error;
 	}
 
+	/* The log writer and the store flusher run in threads of their own,
+	   so threads must be initialised before anything else. */
+
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+	g_thread_init(NULL);
+#endif
 	g_type_init();
 
 #ifdef PROVMAN_LOGGING
@@ -1031,8 +1283,17 @@ int provman_run(GBusType bus, const char *log_path)
 		goto on_error;
 #endif
 
-	PROVMAN_LOGF("============= provman starting (Bus %u)"
-		     "=============", bus);
+	PROVMAN_LOGLF(PROVMAN_LOG_LEVEL_INFO,
+		      "============= provman starting (Bus %u)"
+		      "=============", bus);
+
+	context.trace_path = prv_make_trace_path(bus);
+	if (g_getenv(PROVMAN_TRACE_ENV) &&
+	    provman_trace_open(context.trace_path) != PROVMAN_ERR_NONE)
+		syslog(LOG_ERR, "Unable to open trace file %s",
+		       context.trace_path);
+
+	context.capture_path = prv_make_capture_path(bus);
 
 	err = plugin_manager_new(&context.plugin_manager,
 				 bus == G_BUS_TYPE_SYSTEM);
@@ -1045,7 +1306,8 @@ int provman_run(GBusType bus, const char *log_path)
 		g_dbus_node_info_new_for_xml(g_provman_introspection, NULL);
 
 	if (!context.node_info) {
-		PROVMAN_LOG("Unable to create introspection data!");
+		PROVMAN_LOGL(PROVMAN_LOG_LEVEL_ERROR,
+			     "Unable to create introspection data!");
 		err = PROVMAN_ERR_UNKNOWN;
 		goto on_error;
 	}
@@ -1073,9 +1335,14 @@ int provman_run(GBusType bus, const char *log_path)
 
 on_error:
 
+	provman_capture_close();
+
 	prv_provman_context_free(&context);
 
-	PROVMAN_LOGF("============= provman exitting (%d)"
+	provman_trace_close();
+
+	PROVMAN_LOGLF(PROVMAN_LOG_LEVEL_INFO,
+		      "============= provman exitting (%d)"
 		      " =============", err);
 
 #ifdef PROVMAN_LOGGING
@@ -84,6 +84,26 @@ const gchar g_provman_telephony_schema[] =
 	"        <key name='mmsc' delete='no' type='string'/>"
 	"        <key name='proxy' delete='no' type='string'/>"
 	"    </dir>"
+	"    <dir name='sims' delete='no'>"
+	"        <dir delete='no'>"
+	"            <dir name='contexts' delete='yes'>"
+	"                <dir delete='yes'>"
+	"                    <key name='apn' delete='no' type='string'/>"
+	"                    <key name='name' delete='no' type='string'/>"
+	"                    <key name='password' delete='no' type='string'/>"
+	"                    <key name='username' delete='no' type='string'/>"
+	"                </dir>"
+	"            </dir>"
+	"            <dir name='mms' delete='yes'>"
+	"                <key name='apn' delete='no' type='string'/>"
+	"                <key name='name' delete='no' type='string'/>"
+	"                <key name='password' delete='no' type='string'/>"
+	"                <key name='username' delete='no' type='string'/>"
+	"                <key name='mmsc' delete='no' type='string'/>"
+	"                <key name='proxy' delete='no' type='string'/>"
+	"            </dir>"
+	"        </dir>"
+	"    </dir>"
 	"    <key name='imsis' delete='no' write='no' type='string'/>"
 	"</schema>";
 
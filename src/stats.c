@@ -0,0 +1,238 @@
+/*
+ * Provman
+ *
+ * Copyright (C) 2011 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+
+/*!
+ * @file stats.c
+ *
+ * @brief Contains functions for recording per method statistics
+ *
+ * For each D-Bus method provman records the number of calls, the number
+ * of calls that failed and two latency histograms, one for the time the
+ * task spent in the queue and one for the time taken to service it.
+ *
+ * The histograms use log-linear buckets, 8 buckets per power of two, so
+ * recording a value is a handful of integer operations and the reported
+ * percentiles are accurate to within 12.5%.  All times are recorded in
+ * microseconds.
+ *
+ *****************************************************************************/
+
+#include "config.h"
+
+#include <syslog.h>
+
+#include "error.h"
+#include "stats.h"
+
+#define PROVMAN_STATS_SUB_BUCKET_BITS 3
+#define PROVMAN_STATS_SUB_BUCKETS (1 << PROVMAN_STATS_SUB_BUCKET_BITS)
+#define PROVMAN_STATS_MAX_BITS 40
+#define PROVMAN_STATS_BUCKETS ((PROVMAN_STATS_MAX_BITS - \
+				PROVMAN_STATS_SUB_BUCKET_BITS + 1) * \
+			       PROVMAN_STATS_SUB_BUCKETS)
+
+typedef struct provman_histogram_t_ provman_histogram_t;
+struct provman_histogram_t_ {
+	guint64 count;
+	guint64 max;
+	guint64 buckets[PROVMAN_STATS_BUCKETS];
+};
+
+typedef struct provman_method_stats_t_ provman_method_stats_t;
+struct provman_method_stats_t_ {
+	guint64 calls;
+	guint64 errors;
+	provman_histogram_t wait;
+	provman_histogram_t service;
+};
+
+static provman_method_stats_t g_provman_stats[PROVMAN_TASK_MAX];
+
+static unsigned int prv_bucket_index(guint64 value)
+{
+	unsigned int msb = 0;
+	unsigned int shift;
+	unsigned int index;
+	guint64 tmp = value;
+
+	if (value < PROVMAN_STATS_SUB_BUCKETS)
+		return (unsigned int) value;
+
+	while (tmp >>= 1)
+		++msb;
+
+	shift = msb - PROVMAN_STATS_SUB_BUCKET_BITS;
+	index = (shift + 1) * PROVMAN_STATS_SUB_BUCKETS +
+		((value >> shift) & (PROVMAN_STATS_SUB_BUCKETS - 1));
+
+	return index < PROVMAN_STATS_BUCKETS ? index :
+		PROVMAN_STATS_BUCKETS - 1;
+}
+
+static guint64 prv_bucket_upper_bound(unsigned int index)
+{
+	unsigned int octave = index / PROVMAN_STATS_SUB_BUCKETS;
+	unsigned int sub = index % PROVMAN_STATS_SUB_BUCKETS;
+	unsigned int shift;
+
+	if (octave == 0)
+		return index;
+
+	shift = octave - 1;
+
+	return (((guint64) PROVMAN_STATS_SUB_BUCKETS + sub) << shift) +
+		(((guint64) 1) << shift) - 1;
+}
+
+static void prv_histogram_add(provman_histogram_t *histogram, gint64 value)
+{
+	guint64 uvalue = value > 0 ? (guint64) value : 0;
+
+	++histogram->count;
+	++histogram->buckets[prv_bucket_index(uvalue)];
+	if (uvalue > histogram->max)
+		histogram->max = uvalue;
+}
+
+static guint64 prv_histogram_percentile(provman_histogram_t *histogram,
+					unsigned int percentile)
+{
+	guint64 target;
+	guint64 seen = 0;
+	guint64 value;
+	unsigned int i;
+
+	if (histogram->count == 0)
+		return 0;
+
+	target = (histogram->count * percentile + 99) / 100;
+	if (target == 0)
+		target = 1;
+
+	for (i = 0; i < PROVMAN_STATS_BUCKETS; ++i) {
+		seen += histogram->buckets[i];
+		if (seen >= target)
+			break;
+	}
+
+	/* The max is exact, so never report a percentile above it. */
+
+	value = prv_bucket_upper_bound(i);
+
+	return value < histogram->max ? value : histogram->max;
+}
+
+void provman_stats_record(provman_task_type type, gint64 queued,
+			  gint64 started, int result)
+{
+	provman_method_stats_t *stats;
+	gint64 now;
+
+	if (type >= PROVMAN_TASK_MAX)
+		return;
+
+	now = g_get_monotonic_time();
+	stats = &g_provman_stats[type];
+
+	++stats->calls;
+	if (result != PROVMAN_ERR_NONE)
+		++stats->errors;
+	prv_histogram_add(&stats->wait, started - queued);
+	prv_histogram_add(&stats->service, now - started);
+}
+
+static void prv_add_histogram(GVariantBuilder *vb, const gchar *prefix,
+			      provman_histogram_t *histogram)
+{
+	static const unsigned int percentiles[] = { 50, 90, 99 };
+	gchar *name;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(percentiles) / sizeof(unsigned int); ++i) {
+		name = g_strdup_printf("%s-p%u", prefix, percentiles[i]);
+		g_variant_builder_add(vb, "{st}", name,
+				      prv_histogram_percentile(
+					      histogram, percentiles[i]));
+		g_free(name);
+	}
+
+	name = g_strdup_printf("%s-max", prefix);
+	g_variant_builder_add(vb, "{st}", name, histogram->max);
+	g_free(name);
+}
+
+GVariant *provman_stats_get(void)
+{
+	GVariantBuilder vb;
+	GVariantBuilder method_vb;
+	provman_method_stats_t *stats;
+	unsigned int i;
+
+	g_variant_builder_init(&vb, G_VARIANT_TYPE("a{sa{st}}"));
+
+	for (i = 0; i < PROVMAN_TASK_MAX; ++i) {
+		stats = &g_provman_stats[i];
+		if (stats->calls == 0)
+			continue;
+
+		g_variant_builder_init(&method_vb, G_VARIANT_TYPE("a{st}"));
+		g_variant_builder_add(&method_vb, "{st}", "calls",
+				      stats->calls);
+		g_variant_builder_add(&method_vb, "{st}", "errors",
+				      stats->errors);
+		prv_add_histogram(&method_vb, "wait", &stats->wait);
+		prv_add_histogram(&method_vb, "service", &stats->service);
+		g_variant_builder_add(&vb, "{s@a{st}}",
+				      provman_task_get_name(i),
+				      g_variant_builder_end(&method_vb));
+	}
+
+	return g_variant_ref_sink(g_variant_builder_end(&vb));
+}
+
+void provman_stats_dump(void)
+{
+	provman_method_stats_t *stats;
+	unsigned int i;
+
+	for (i = 0; i < PROVMAN_TASK_MAX; ++i) {
+		stats = &g_provman_stats[i];
+		if (stats->calls == 0)
+			continue;
+
+		syslog(LOG_INFO, "%s: calls %" G_GUINT64_FORMAT " errors %"
+		       G_GUINT64_FORMAT " wait p50/p99/max %" G_GUINT64_FORMAT
+		       "/%" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT
+		       "us service p50/p99/max %" G_GUINT64_FORMAT "/%"
+		       G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT "us",
+		       provman_task_get_name(i), stats->calls, stats->errors,
+		       prv_histogram_percentile(&stats->wait, 50),
+		       prv_histogram_percentile(&stats->wait, 99),
+		       stats->wait.max,
+		       prv_histogram_percentile(&stats->service, 50),
+		       prv_histogram_percentile(&stats->service, 99),
+		       stats->service.max);
+	}
+}
@@ -0,0 +1,45 @@
+/*
+ * Provman
+ *
+ * Copyright (C) 2011 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+
+/*!
+ * @file stats.h
+ *
+ * @brief Contains function declarations for recording per method statistics
+ *
+ *****************************************************************************/
+
+#ifndef PROVMAN_STATS_H
+#define PROVMAN_STATS_H
+
+#include <glib.h>
+
+#include "tasks.h"
+
+void provman_stats_record(provman_task_type type, gint64 queued,
+			  gint64 started, int result);
+GVariant *provman_stats_get(void);
+void provman_stats_dump(void);
+
+#endif
@@ -0,0 +1,1177 @@
+/*
+ * Provman
+ *
+ * Copyright (C) 2011 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+/*!
+ * @file store.c
+ *
+ * @brief contains the implementation of the provman store
+ *
+ * A store file consists of a read only snapshot followed by a log.  The
+ * snapshot is memory mapped when the store is opened.  It contains a table
+ * of namespaces sorted by name, a table of entries sorted by namespace and
+ * key, and a string table.  Each namespace refers to a contiguous range of
+ * entries, so keys can be located, and keys that begin with a given prefix
+ * enumerated, by binary search directly on the mapped file.  All integers
+ * are 32 bit little endian values.
+ *
+ * \code
+ * header      "PMST", version, namespace count, entry count, strings size
+ * namespaces  name, first entry, entry count
+ * entries     key, value
+ * strings     NULL terminated strings referenced by offset
+ * log         batches of records appended by provman_store_commit
+ * \endcode
+ *
+ * Each batch in the log is terminated by a commit record that contains a
+ * checksum of the batch.  When the store is opened, the committed batches
+ * are applied to an in-memory overlay, which is consulted before the
+ * snapshot.  A batch that was only partially written is discarded and
+ * overwritten by the next commit.  Once the log grows larger than the
+ * snapshot, and at least PROVMAN_STORE_COMPACT_MIN bytes, the snapshot is
+ * rewritten and the log is discarded.
+ *
+ * The main thread never touches the disk after the store has been loaded.
+ * provman_store_commit encodes the pending modifications, or a complete
+ * new snapshot, and queues them for a flusher thread owned by the store.
+ * Batches committed while the flusher is busy are coalesced and written
+ * with a single pwrite and fdatasync.  A queued snapshot supersedes any
+ * batches queued before it.  If a write fails, the flusher drops further
+ * batches and the next commit queues a new snapshot, built from the
+ * overlay, which still contains every modification.  The overlay and the
+ * mapped snapshot are only accessed from the main thread, the queue and
+ * the flusher's counters are protected by the store's mutex and the file
+ * descriptor is only used by the flusher.
+ *
+ *****************************************************************************/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "log.h"
+#include "utils.h"
+#include "store.h"
+
+#define PROVMAN_STORE_MAGIC "PMST"
+#define PROVMAN_STORE_MAGIC_LEN 4
+#define PROVMAN_STORE_VERSION 1
+#define PROVMAN_STORE_HEADER_SIZE 20
+#define PROVMAN_STORE_NS_SIZE 12
+#define PROVMAN_STORE_ENTRY_SIZE 8
+#define PROVMAN_STORE_COMPACT_MIN (64 * 1024)
+#define PROVMAN_STORE_CORRUPT_SUFFIX ".corrupt"
+#define PROVMAN_STORE_FNV_OFFSET 2166136261U
+#define PROVMAN_STORE_FNV_PRIME 16777619U
+
+#define PROVMAN_STORE_OP_SET 'S'
+#define PROVMAN_STORE_OP_REMOVE 'R'
+#define PROVMAN_STORE_OP_COMMIT 'C'
+
+enum provman_store_ns_field_t_ {
+	PROVMAN_STORE_NS_NAME,
+	PROVMAN_STORE_NS_FIRST,
+	PROVMAN_STORE_NS_COUNT
+};
+
+enum provman_store_entry_field_t_ {
+	PROVMAN_STORE_ENTRY_KEY,
+	PROVMAN_STORE_ENTRY_VALUE
+};
+
+enum provman_store_record_field_t_ {
+	PROVMAN_STORE_RECORD_NS,
+	PROVMAN_STORE_RECORD_KEY,
+	PROVMAN_STORE_RECORD_VALUE,
+	PROVMAN_STORE_RECORD_FIELDS
+};
+
+struct provman_store_t_ {
+	unsigned int ref_count;
+	gchar *fname;
+	GMappedFile *mapped;
+	const guint8 *data;
+	guint32 ns_count;
+	guint32 entry_count;
+	gsize ns_offset;
+	gsize entries_offset;
+	gsize strings_offset;
+	gsize strings_size;
+	gsize snapshot_size;
+	gsize log_size;
+	GHashTable *overlay;
+	GString *pending;
+	bool reload;
+	GMutex *mutex;
+	GCond *cond;
+	GThread *flusher;
+	GString *queued_log;
+	GString *queued_snapshot;
+	guint64 submitted;
+	guint64 flushed;
+	bool failed;
+	bool quit;
+	int fd;
+	gsize file_size;
+};
+
+static GHashTable *g_stores;
+
+static void prv_hash_table_free(gpointer hash_table)
+{
+	if (hash_table)
+		g_hash_table_unref((GHashTable*) hash_table);
+}
+
+static guint32 prv_read_u32(const guint8 *data)
+{
+	guint32 value;
+
+	memcpy(&value, data, sizeof(value));
+
+	return GUINT32_FROM_LE(value);
+}
+
+static void prv_append_u32(GString *buffer, guint32 value)
+{
+	value = GUINT32_TO_LE(value);
+	g_string_append_len(buffer, (const gchar *) &value, sizeof(value));
+}
+
+static void prv_append_string(GString *buffer, const gchar *str)
+{
+	guint32 len = strlen(str);
+
+	prv_append_u32(buffer, len);
+	g_string_append_len(buffer, str, len);
+}
+
+/* FNV-1a */
+
+static guint32 prv_checksum(const guint8 *data, gsize len)
+{
+	guint32 hash = PROVMAN_STORE_FNV_OFFSET;
+	gsize i;
+
+	for (i = 0; i < len; ++i) {
+		hash ^= data[i];
+		hash *= PROVMAN_STORE_FNV_PRIME;
+	}
+
+	return hash;
+}
+
+static const gchar *prv_string(provman_store_t *store, guint32 offset)
+{
+	return (const gchar *) store->data + store->strings_offset + offset;
+}
+
+static guint32 prv_ns_field(provman_store_t *store, guint32 ns,
+			    unsigned int field)
+{
+	return prv_read_u32(store->data + store->ns_offset +
+			    ns * PROVMAN_STORE_NS_SIZE + field * 4);
+}
+
+static guint32 prv_entry_field(provman_store_t *store, guint32 entry,
+			       unsigned int field)
+{
+	return prv_read_u32(store->data + store->entries_offset +
+			    entry * PROVMAN_STORE_ENTRY_SIZE + field * 4);
+}
+
+static const gchar *prv_entry_key(provman_store_t *store, guint32 entry)
+{
+	return prv_string(store, prv_entry_field(store, entry,
+						 PROVMAN_STORE_ENTRY_KEY));
+}
+
+static const gchar *prv_entry_value(provman_store_t *store, guint32 entry)
+{
+	return prv_string(store, prv_entry_field(store, entry,
+						 PROVMAN_STORE_ENTRY_VALUE));
+}
+
+/* Locates the range of entries that belong to the namespace ns in the
+   snapshot. */
+
+static bool prv_find_ns(provman_store_t *store, const gchar *ns,
+			guint32 *first, guint32 *count)
+{
+	guint32 low = 0;
+	guint32 high = store->ns_count;
+	guint32 mid;
+	int cmp;
+
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		cmp = strcmp(prv_string(store,
+					prv_ns_field(store, mid,
+						     PROVMAN_STORE_NS_NAME)),
+			     ns);
+		if (cmp == 0) {
+			*first = prv_ns_field(store, mid,
+					      PROVMAN_STORE_NS_FIRST);
+			*count = prv_ns_field(store, mid,
+					      PROVMAN_STORE_NS_COUNT);
+			return true;
+		} else if (cmp < 0) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	return false;
+}
+
+/* Returns the first entry in the range [first, first + count) whose key
+   is not less than key. */
+
+static guint32 prv_lower_bound(provman_store_t *store, guint32 first,
+			       guint32 count, const gchar *key)
+{
+	guint32 low = first;
+	guint32 high = first + count;
+	guint32 mid;
+
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (strcmp(prv_entry_key(store, mid), key) < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+static const gchar *prv_snapshot_get(provman_store_t *store, const gchar *ns,
+				     const gchar *key)
+{
+	guint32 first;
+	guint32 count;
+	guint32 entry;
+
+	if (!prv_find_ns(store, ns, &first, &count))
+		return NULL;
+
+	entry = prv_lower_bound(store, first, count, key);
+	if (entry < first + count && !strcmp(prv_entry_key(store, entry), key))
+		return prv_entry_value(store, entry);
+
+	return NULL;
+}
+
+static const gchar *prv_get(provman_store_t *store, const gchar *ns,
+			    const gchar *key)
+{
+	GHashTable *overlay;
+	gpointer value;
+
+	overlay = g_hash_table_lookup(store->overlay, ns);
+	if (overlay && g_hash_table_lookup_extended(overlay, key, NULL,
+						    &value))
+		return value;
+
+	return prv_snapshot_get(store, ns, key);
+}
+
+static GHashTable *prv_get_ns(GHashTable *namespaces, const gchar *ns)
+{
+	GHashTable *map;
+
+	map = g_hash_table_lookup(namespaces, ns);
+	if (!map) {
+		map = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+					    g_free);
+		g_hash_table_insert(namespaces, g_strdup(ns), map);
+	}
+
+	return map;
+}
+
+/* A NULL value records the removal of key */
+
+static void prv_set(provman_store_t *store, const gchar *ns,
+		    const gchar *key, const gchar *value)
+{
+	g_hash_table_insert(prv_get_ns(store->overlay, ns), g_strdup(key),
+			    g_strdup(value));
+}
+
+static bool prv_parse_record(const guint8 **ptr, const guint8 *end,
+			     gchar **fields)
+{
+	const guint8 *pos = *ptr;
+	unsigned int count;
+	unsigned int i;
+	guint32 len;
+
+	if (*pos == PROVMAN_STORE_OP_SET)
+		count = PROVMAN_STORE_RECORD_FIELDS;
+	else if (*pos == PROVMAN_STORE_OP_REMOVE)
+		count = PROVMAN_STORE_RECORD_VALUE;
+	else
+		return false;
+	++pos;
+
+	for (i = 0; i < count; ++i) {
+		if (end - pos < 4)
+			return false;
+		len = prv_read_u32(pos);
+		pos += 4;
+		if ((gsize) (end - pos) < len)
+			return false;
+		if (fields)
+			fields[i] = g_strndup((const gchar *) pos, len);
+		pos += len;
+	}
+
+	*ptr = pos;
+
+	return true;
+}
+
+static void prv_apply_batch(provman_store_t *store, const guint8 *ptr,
+			    const guint8 *end)
+{
+	gchar *fields[PROVMAN_STORE_RECORD_FIELDS];
+	unsigned int i;
+
+	while (ptr < end) {
+		memset(fields, 0, sizeof(fields));
+		if (!prv_parse_record(&ptr, end, fields))
+			break;
+		prv_set(store, fields[PROVMAN_STORE_RECORD_NS],
+			fields[PROVMAN_STORE_RECORD_KEY],
+			fields[PROVMAN_STORE_RECORD_VALUE]);
+		for (i = 0; i < PROVMAN_STORE_RECORD_FIELDS; ++i)
+			g_free(fields[i]);
+	}
+}
+
+/* Applies the committed batches in the log and returns the number of
+   bytes that they occupy. */
+
+static gsize prv_replay_log(provman_store_t *store, const guint8 *log,
+			    gsize length)
+{
+	const guint8 *ptr = log;
+	const guint8 *end = log + length;
+	const guint8 *batch = log;
+	const guint8 *commit;
+
+	while (ptr < end) {
+		if (*ptr == PROVMAN_STORE_OP_COMMIT) {
+			commit = ptr++;
+			if (end - ptr < 4 ||
+			    prv_read_u32(ptr) != prv_checksum(batch,
+							      ptr - batch))
+				break;
+			ptr += 4;
+			prv_apply_batch(store, batch, commit);
+			batch = ptr;
+		} else if (!prv_parse_record(&ptr, end, NULL)) {
+			break;
+		}
+	}
+
+	return batch - log;
+}
+
+static int prv_parse_snapshot(provman_store_t *store, gsize length)
+{
+	const guint8 *data = store->data;
+	guint64 size;
+	guint32 i;
+	guint32 first;
+	guint32 count;
+
+	if (length < PROVMAN_STORE_HEADER_SIZE ||
+	    memcmp(data, PROVMAN_STORE_MAGIC, PROVMAN_STORE_MAGIC_LEN) ||
+	    prv_read_u32(data + 4) != PROVMAN_STORE_VERSION)
+		goto on_error;
+
+	store->ns_count = prv_read_u32(data + 8);
+	store->entry_count = prv_read_u32(data + 12);
+	store->strings_size = prv_read_u32(data + 16);
+
+	size = PROVMAN_STORE_HEADER_SIZE;
+	store->ns_offset = size;
+	size += (guint64) store->ns_count * PROVMAN_STORE_NS_SIZE;
+	store->entries_offset = size;
+	size += (guint64) store->entry_count * PROVMAN_STORE_ENTRY_SIZE;
+	store->strings_offset = size;
+	size += store->strings_size;
+
+	if (size > length)
+		goto on_error;
+
+	if (store->strings_size > 0 &&
+	    data[store->strings_offset + store->strings_size - 1])
+		goto on_error;
+
+	/* Check every offset once, so that lookups do not need to */
+
+	for (i = 0; i < store->ns_count; ++i) {
+		first = prv_ns_field(store, i, PROVMAN_STORE_NS_FIRST);
+		count = prv_ns_field(store, i, PROVMAN_STORE_NS_COUNT);
+		if (prv_ns_field(store, i, PROVMAN_STORE_NS_NAME) >=
+		    store->strings_size || first > store->entry_count ||
+		    count > store->entry_count - first)
+			goto on_error;
+	}
+
+	for (i = 0; i < store->entry_count; ++i)
+		if (prv_entry_field(store, i, PROVMAN_STORE_ENTRY_KEY) >=
+		    store->strings_size ||
+		    prv_entry_field(store, i, PROVMAN_STORE_ENTRY_VALUE) >=
+		    store->strings_size)
+			goto on_error;
+
+	store->snapshot_size = size;
+
+	return PROVMAN_ERR_NONE;
+
+on_error:
+
+	return PROVMAN_ERR_CORRUPT;
+}
+
+static void prv_unload(provman_store_t *store)
+{
+	if (store->mapped) {
+		g_mapped_file_unref(store->mapped);
+		store->mapped = NULL;
+	}
+
+	store->data = NULL;
+	store->ns_count = 0;
+	store->entry_count = 0;
+	store->snapshot_size = 0;
+	store->log_size = 0;
+	g_hash_table_remove_all(store->overlay);
+}
+
+static void prv_load(provman_store_t *store)
+{
+	gsize length;
+	gchar *corrupt_fname;
+
+	store->mapped = g_mapped_file_new(store->fname, FALSE, NULL);
+	if (!store->mapped)
+		return;
+
+	store->data = (const guint8 *)
+		g_mapped_file_get_contents(store->mapped);
+	length = g_mapped_file_get_length(store->mapped);
+
+	if (prv_parse_snapshot(store, length) != PROVMAN_ERR_NONE) {
+		/* Move the file out of the way rather than overwriting it
+		   on the next commit. */
+
+		PROVMAN_LOGF("Store %s is corrupt", store->fname);
+		corrupt_fname = g_strconcat(store->fname,
+					    PROVMAN_STORE_CORRUPT_SUFFIX,
+					    NULL);
+		(void) rename(store->fname, corrupt_fname);
+		g_free(corrupt_fname);
+		prv_unload(store);
+		return;
+	}
+
+	store->log_size = prv_replay_log(store,
+					 store->data + store->snapshot_size,
+					 length - store->snapshot_size);
+}
+
+static GMutex *prv_mutex_new(void)
+{
+	GMutex *mutex;
+
+#if GLIB_CHECK_VERSION(2, 32, 0)
+	mutex = g_new(GMutex, 1);
+	g_mutex_init(mutex);
+#else
+	mutex = g_mutex_new();
+#endif
+
+	return mutex;
+}
+
+static void prv_mutex_free(GMutex *mutex)
+{
+#if GLIB_CHECK_VERSION(2, 32, 0)
+	g_mutex_clear(mutex);
+	g_free(mutex);
+#else
+	g_mutex_free(mutex);
+#endif
+}
+
+static GCond *prv_cond_new(void)
+{
+	GCond *cond;
+
+#if GLIB_CHECK_VERSION(2, 32, 0)
+	cond = g_new(GCond, 1);
+	g_cond_init(cond);
+#else
+	cond = g_cond_new();
+#endif
+
+	return cond;
+}
+
+static void prv_cond_free(GCond *cond)
+{
+#if GLIB_CHECK_VERSION(2, 32, 0)
+	g_cond_clear(cond);
+	g_free(cond);
+#else
+	g_cond_free(cond);
+#endif
+}
+
+static bool prv_write_snapshot(provman_store_t *store, GString *snapshot,
+			       GString *log)
+{
+	g_string_append_len(snapshot, log->str, log->len);
+	if (!g_file_set_contents(store->fname, snapshot->str, snapshot->len,
+				 NULL)) {
+		PROVMAN_LOGF("Unable to write store %s", store->fname);
+		return false;
+	}
+
+	/* The file has been replaced.  The descriptor refers to the old
+	   one. */
+
+	if (store->fd != -1) {
+		(void) close(store->fd);
+		store->fd = -1;
+	}
+	store->file_size = snapshot->len;
+
+	return true;
+}
+
+static bool prv_write_log(provman_store_t *store, GString *log)
+{
+	const gchar *ptr = log->str;
+	gsize left = log->len;
+	off_t offset = store->file_size;
+	ssize_t written;
+
+	/* Discard any partially written batch found when the store was
+	   loaded. */
+
+	if (store->fd == -1) {
+		store->fd = open(store->fname, O_WRONLY);
+		if (store->fd == -1)
+			goto on_error;
+		if (ftruncate(store->fd, offset) != 0) {
+			(void) close(store->fd);
+			store->fd = -1;
+			goto on_error;
+		}
+	}
+
+	while (left > 0) {
+		written = pwrite(store->fd, ptr, left, offset);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			goto on_error;
+		}
+		ptr += written;
+		left -= written;
+		offset += written;
+	}
+
+	if (fdatasync(store->fd) != 0)
+		goto on_error;
+
+	store->file_size += log->len;
+
+	return true;
+
+on_error:
+
+	PROVMAN_LOGF("Unable to append to store %s", store->fname);
+
+	return false;
+}
+
+/* Writes everything that has been queued.  Called with the mutex held.
+   The mutex is released while the file is being written. */
+
+static void prv_flush_queued(provman_store_t *store)
+{
+	GString *snapshot = store->queued_snapshot;
+	GString *log = store->queued_log;
+	guint64 target = store->submitted;
+	bool failed = store->failed;
+	bool written;
+
+	store->queued_snapshot = NULL;
+	store->queued_log = g_string_new("");
+	g_mutex_unlock(store->mutex);
+
+	/* Once a batch has been lost, appending later batches would leave
+	   a hole in the log.  They are dropped until a new snapshot, which
+	   contains all of them, arrives. */
+
+	if (snapshot)
+		written = prv_write_snapshot(store, snapshot, log);
+	else if (failed)
+		written = false;
+	else
+		written = log->len == 0 || prv_write_log(store, log);
+
+	if (snapshot)
+		g_string_free(snapshot, TRUE);
+	g_string_free(log, TRUE);
+
+	g_mutex_lock(store->mutex);
+	store->failed = !written;
+	store->flushed = target;
+	g_cond_broadcast(store->cond);
+}
+
+static gpointer prv_flusher_thread(gpointer data)
+{
+	provman_store_t *store = data;
+
+	g_mutex_lock(store->mutex);
+	for (;;) {
+		if (store->flushed != store->submitted)
+			prv_flush_queued(store);
+		else if (store->quit)
+			break;
+		else
+			g_cond_wait(store->cond, store->mutex);
+	}
+	g_mutex_unlock(store->mutex);
+
+	return NULL;
+}
+
+static void prv_start_flusher(provman_store_t *store)
+{
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+#endif
+
+	store->mutex = prv_mutex_new();
+	store->cond = prv_cond_new();
+	store->queued_log = g_string_new("");
+
+#if GLIB_CHECK_VERSION(2, 32, 0)
+	store->flusher = g_thread_new("provman-store", prv_flusher_thread,
+				      store);
+#else
+	store->flusher = g_thread_create(prv_flusher_thread, store, TRUE,
+					 NULL);
+#endif
+
+	/* Without a flusher, queued modifications are written as soon as
+	   they are committed. */
+
+	if (!store->flusher) {
+		PROVMAN_LOGF("Unable to start flusher for %s", store->fname);
+	}
+}
+
+static void prv_stop_flusher(provman_store_t *store)
+{
+	if (store->flusher) {
+		g_mutex_lock(store->mutex);
+		store->quit = true;
+		g_cond_broadcast(store->cond);
+		g_mutex_unlock(store->mutex);
+		(void) g_thread_join(store->flusher);
+		store->flusher = NULL;
+	}
+
+	if (store->fd != -1) {
+		(void) close(store->fd);
+		store->fd = -1;
+	}
+
+	if (store->queued_snapshot)
+		g_string_free(store->queued_snapshot, TRUE);
+	g_string_free(store->queued_log, TRUE);
+	prv_cond_free(store->cond);
+	prv_mutex_free(store->mutex);
+}
+
+static provman_store_t *prv_open(gchar *fname)
+{
+	provman_store_t *store;
+
+	if (!g_stores)
+		g_stores = g_hash_table_new(g_str_hash, g_str_equal);
+
+	store = g_hash_table_lookup(g_stores, fname);
+	if (store) {
+		++store->ref_count;
+		g_free(fname);
+	} else {
+		store = g_new0(provman_store_t, 1);
+		store->ref_count = 1;
+		store->fname = fname;
+		store->fd = -1;
+		store->overlay = g_hash_table_new_full(g_str_hash, g_str_equal,
+						       g_free,
+						       prv_hash_table_free);
+		store->pending = g_string_new("");
+		prv_load(store);
+		store->file_size = store->snapshot_size + store->log_size;
+		prv_start_flusher(store);
+		g_hash_table_insert(g_stores, store->fname, store);
+	}
+
+	return store;
+}
+
+int provman_store_open(bool system, provman_store_t **store)
+{
+	int err;
+	gchar *fname;
+
+	err = provman_utils_make_file_path(PROVMAN_STORE_FILE_NAME, system,
+					   &fname);
+	if (err != PROVMAN_ERR_NONE)
+		goto on_error;
+
+	*store = prv_open(fname);
+
+on_error:
+
+	return err;
+}
+
+void provman_store_open_dir(const gchar *dir, provman_store_t **store)
+{
+	*store = prv_open(g_build_filename(dir, PROVMAN_STORE_FILE_NAME,
+					   NULL));
+}
+
+void provman_store_close(provman_store_t *store)
+{
+	if (store && --store->ref_count == 0) {
+		(void) provman_store_sync(store);
+		prv_stop_flusher(store);
+		(void) g_hash_table_remove(g_stores, store->fname);
+		if (g_hash_table_size(g_stores) == 0) {
+			g_hash_table_unref(g_stores);
+			g_stores = NULL;
+		}
+		prv_unload(store);
+		g_string_free(store->pending, TRUE);
+		g_hash_table_unref(store->overlay);
+		g_free(store->fname);
+		g_free(store);
+	}
+}
+
+gchar *provman_store_get(provman_store_t *store, const gchar *ns,
+			 const gchar *key)
+{
+	return g_strdup(prv_get(store, ns, key));
+}
+
+void provman_store_set(provman_store_t *store, const gchar *ns,
+		       const gchar *key, const gchar *value)
+{
+	const gchar *old_value = prv_get(store, ns, key);
+
+	if (old_value && !strcmp(old_value, value))
+		return;
+
+	prv_set(store, ns, key, value);
+	g_string_append_c(store->pending, PROVMAN_STORE_OP_SET);
+	prv_append_string(store->pending, ns);
+	prv_append_string(store->pending, key);
+	prv_append_string(store->pending, value);
+}
+
+int provman_store_remove(provman_store_t *store, const gchar *ns,
+			 const gchar *key)
+{
+	int err = PROVMAN_ERR_NONE;
+
+	if (!prv_get(store, ns, key)) {
+		err = PROVMAN_ERR_NOT_FOUND;
+		goto on_error;
+	}
+
+	prv_set(store, ns, key, NULL);
+	g_string_append_c(store->pending, PROVMAN_STORE_OP_REMOVE);
+	prv_append_string(store->pending, ns);
+	prv_append_string(store->pending, key);
+
+on_error:
+
+	return err;
+}
+
+void provman_store_foreach(provman_store_t *store, const gchar *ns,
+			   const gchar *prefix,
+			   provman_store_foreach_cb_t func, void *user_data)
+{
+	GHashTable *overlay;
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	guint32 first;
+	guint32 count;
+	guint32 entry;
+	const gchar *entry_key;
+
+	overlay = g_hash_table_lookup(store->overlay, ns);
+
+	if (prv_find_ns(store, ns, &first, &count)) {
+		for (entry = prv_lower_bound(store, first, count, prefix);
+		     entry < first + count; ++entry) {
+			entry_key = prv_entry_key(store, entry);
+			if (!g_str_has_prefix(entry_key, prefix))
+				break;
+			if (!overlay ||
+			    !g_hash_table_lookup_extended(overlay, entry_key,
+							  NULL, NULL))
+				func(entry_key, prv_entry_value(store, entry),
+				     user_data);
+		}
+	}
+
+	if (overlay) {
+		g_hash_table_iter_init(&iter, overlay);
+		while (g_hash_table_iter_next(&iter, &key, &value))
+			if (value && g_str_has_prefix(key, prefix))
+				func(key, value, user_data);
+	}
+}
+
+static int prv_compare_strings(const void *a, const void *b)
+{
+	return strcmp(*(const gchar * const *) a, *(const gchar * const *) b);
+}
+
+/* Returns the keys of a hash table sorted in ascending order.  The keys
+   are owned by the hash table. */
+
+static const gchar **prv_sorted_keys(GHashTable *hash_table, guint *count)
+{
+	const gchar **keys;
+	GHashTableIter iter;
+	gpointer key;
+	guint i = 0;
+
+	*count = g_hash_table_size(hash_table);
+	keys = g_new(const gchar *, *count);
+	g_hash_table_iter_init(&iter, hash_table);
+	while (g_hash_table_iter_next(&iter, &key, NULL))
+		keys[i++] = key;
+	qsort(keys, *count, sizeof(*keys), prv_compare_strings);
+
+	return keys;
+}
+
+static guint32 prv_add_string(GString *strings, GHashTable *offsets,
+			      const gchar *str)
+{
+	gpointer offset;
+
+	if (!g_hash_table_lookup_extended(offsets, str, NULL, &offset)) {
+		offset = GUINT_TO_POINTER(strings->len);
+		g_string_append_len(strings, str, strlen(str) + 1);
+		g_hash_table_insert(offsets, (gpointer) str, offset);
+	}
+
+	return GPOINTER_TO_UINT(offset);
+}
+
+static GHashTable *prv_collect(provman_store_t *store)
+{
+	GHashTable *all;
+	GHashTable *map;
+	GHashTableIter iter;
+	GHashTableIter ns_iter;
+	gpointer ns;
+	gpointer overlay;
+	gpointer key;
+	gpointer value;
+	guint32 i;
+	guint32 entry;
+	guint32 first;
+	guint32 count;
+
+	all = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+				    prv_hash_table_free);
+
+	for (i = 0; i < store->ns_count; ++i) {
+		map = prv_get_ns(all, prv_string(
+					 store, prv_ns_field(
+						 store, i,
+						 PROVMAN_STORE_NS_NAME)));
+		first = prv_ns_field(store, i, PROVMAN_STORE_NS_FIRST);
+		count = prv_ns_field(store, i, PROVMAN_STORE_NS_COUNT);
+		for (entry = first; entry < first + count; ++entry)
+			g_hash_table_insert(
+				map, g_strdup(prv_entry_key(store, entry)),
+				g_strdup(prv_entry_value(store, entry)));
+	}
+
+	g_hash_table_iter_init(&iter, store->overlay);
+	while (g_hash_table_iter_next(&iter, &ns, &overlay)) {
+		map = prv_get_ns(all, ns);
+		g_hash_table_iter_init(&ns_iter, overlay);
+		while (g_hash_table_iter_next(&ns_iter, &key, &value)) {
+			if (value)
+				g_hash_table_insert(map, g_strdup(key),
+						    g_strdup(value));
+			else
+				(void) g_hash_table_remove(map, key);
+		}
+		if (g_hash_table_size(map) == 0)
+			(void) g_hash_table_remove(all, ns);
+	}
+
+	return all;
+}
+
+static GString *prv_build_snapshot(provman_store_t *store)
+{
+	GHashTable *all = prv_collect(store);
+	GHashTable *offsets = g_hash_table_new(g_str_hash, g_str_equal);
+	GString *strings = g_string_new("");
+	GString *namespaces = g_string_new("");
+	GString *entries = g_string_new("");
+	GString *snapshot;
+	GHashTable *map;
+	const gchar **ns_names;
+	const gchar **keys;
+	guint ns_count;
+	guint count;
+	guint32 entry_count = 0;
+	guint i;
+	guint j;
+
+	ns_names = prv_sorted_keys(all, &ns_count);
+	for (i = 0; i < ns_count; ++i) {
+		map = g_hash_table_lookup(all, ns_names[i]);
+		keys = prv_sorted_keys(map, &count);
+
+		prv_append_u32(namespaces, prv_add_string(strings, offsets,
+							  ns_names[i]));
+		prv_append_u32(namespaces, entry_count);
+		prv_append_u32(namespaces, count);
+
+		for (j = 0; j < count; ++j) {
+			prv_append_u32(entries, prv_add_string(strings, offsets,
+							       keys[j]));
+			prv_append_u32(entries,
+				       prv_add_string(
+					       strings, offsets,
+					       g_hash_table_lookup(map,
+								   keys[j])));
+		}
+		entry_count += count;
+		g_free(keys);
+	}
+
+	snapshot = g_string_sized_new(PROVMAN_STORE_HEADER_SIZE +
+				      namespaces->len + entries->len +
+				      strings->len);
+	g_string_append_len(snapshot, PROVMAN_STORE_MAGIC,
+			    PROVMAN_STORE_MAGIC_LEN);
+	prv_append_u32(snapshot, PROVMAN_STORE_VERSION);
+	prv_append_u32(snapshot, ns_count);
+	prv_append_u32(snapshot, entry_count);
+	prv_append_u32(snapshot, strings->len);
+	g_string_append_len(snapshot, namespaces->str, namespaces->len);
+	g_string_append_len(snapshot, entries->str, entries->len);
+	g_string_append_len(snapshot, strings->str, strings->len);
+
+	g_free(ns_names);
+	g_string_free(entries, TRUE);
+	g_string_free(namespaces, TRUE);
+	g_string_free(strings, TRUE);
+	g_hash_table_unref(offsets);
+	g_hash_table_unref(all);
+
+	return snapshot;
+}
+
+/* Hands the pending batch, or a new snapshot that supersedes everything
+   queued so far, to the flusher. */
+
+static void prv_submit(provman_store_t *store, GString *snapshot)
+{
+	g_mutex_lock(store->mutex);
+	if (snapshot) {
+		if (store->queued_snapshot)
+			g_string_free(store->queued_snapshot, TRUE);
+		store->queued_snapshot = snapshot;
+		g_string_truncate(store->queued_log, 0);
+	} else {
+		g_string_append_len(store->queued_log, store->pending->str,
+				    store->pending->len);
+	}
+	++store->submitted;
+	if (store->flusher)
+		g_cond_broadcast(store->cond);
+	else
+		prv_flush_queued(store);
+	g_mutex_unlock(store->mutex);
+
+	g_string_truncate(store->pending, 0);
+}
+
+static void prv_compact(provman_store_t *store)
+{
+	GString *snapshot;
+
+	snapshot = prv_build_snapshot(store);
+	store->snapshot_size = snapshot->len;
+	store->log_size = 0;
+
+	/* The overlay can only be discarded, and the new snapshot mapped,
+	   once the snapshot is on disk. */
+
+	store->reload = true;
+	prv_submit(store, snapshot);
+}
+
+/* Waits until the flusher has processed everything queued so far and
+   returns true if it was written successfully. */
+
+static bool prv_wait_flushed(provman_store_t *store)
+{
+	guint64 target;
+	bool failed;
+
+	g_mutex_lock(store->mutex);
+	target = store->submitted;
+	while (store->flushed < target)
+		g_cond_wait(store->cond, store->mutex);
+	failed = store->failed;
+	g_mutex_unlock(store->mutex);
+
+	return !failed;
+}
+
+/* Maps the snapshot written by the last compaction and discards the
+   overlay, which would otherwise grow until the store is closed.  Only
+   called when the flusher is idle.  The pending batch has not been
+   queued yet, so it is applied to the new overlay. */
+
+static void prv_reload(provman_store_t *store)
+{
+	store->reload = false;
+	prv_unload(store);
+	prv_load(store);
+	prv_apply_batch(store, (const guint8 *) store->pending->str,
+			(const guint8 *) store->pending->str +
+			store->pending->len);
+	g_mutex_lock(store->mutex);
+	store->file_size = store->snapshot_size + store->log_size;
+	g_mutex_unlock(store->mutex);
+}
+
+int provman_store_commit(provman_store_t *store)
+{
+	int err = PROVMAN_ERR_NONE;
+	gsize compact_size;
+	bool failed;
+	bool idle;
+
+	g_mutex_lock(store->mutex);
+	failed = store->failed;
+	idle = store->flushed == store->submitted;
+	g_mutex_unlock(store->mutex);
+
+	if (store->reload && idle && !failed)
+		prv_reload(store);
+
+	if (failed)
+		err = PROVMAN_ERR_WRITE;
+	else if (store->pending->len == 0)
+		goto on_error;
+
+	g_string_append_c(store->pending, PROVMAN_STORE_OP_COMMIT);
+	prv_append_u32(store->pending,
+		       prv_checksum((const guint8 *) store->pending->str,
+				    store->pending->len));
+
+	/* If an earlier write failed, batches have been lost, so we
+	   rewrite the whole store. */
+
+	compact_size = MAX(PROVMAN_STORE_COMPACT_MIN, store->snapshot_size);
+	if (failed || store->snapshot_size == 0 ||
+	    store->log_size + store->pending->len > compact_size) {
+		prv_compact(store);
+	} else {
+		store->log_size += store->pending->len;
+		prv_submit(store, NULL);
+	}
+
+on_error:
+
+	return err;
+}
+
+int provman_store_sync(provman_store_t *store)
+{
+	int err = PROVMAN_ERR_NONE;
+
+	/* If the first attempt fails the commit queues a new snapshot. */
+
+	(void) provman_store_commit(store);
+	if (!prv_wait_flushed(store)) {
+		(void) provman_store_commit(store);
+		if (!prv_wait_flushed(store)) {
+			err = PROVMAN_ERR_WRITE;
+			goto on_error;
+		}
+	}
+
+	/* The flusher is idle, so we can switch to the snapshot that it
+	   wrote. */
+
+	if (store->reload)
+		prv_reload(store);
+
+on_error:
+
+	return err;
+}
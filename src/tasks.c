@@ -35,6 +35,8 @@
 #include "error.h"
 
 #include "tasks.h"
+#include "stats.h"
+#include "trace.h"
 
 #define PROV_ERROR_NOT_FOUND PROVMAN_SERVICE".Error.NotFound"
 #define PROV_ERROR_BAD_KEY PROVMAN_SERVICE".Error.BadKey"
@@ -46,8 +48,37 @@ struct provman_task_context_t_ {
 	provman_task_sync_cb finished;
 	void *finished_data;
 	GDBusMethodInvocation *invocation;
+	provman_task_type type;
+	gint64 queued;
+	gint64 started;
+	guint trace_id;
 };
 
+static const gchar *g_provman_task_names[PROVMAN_TASK_MAX] = {
+	"Start",
+	"End",
+	"Set",
+	"Get",
+	"GetMultiple",
+	"SetMultiple",
+	"SetMultipleMeta",
+	"GetAll",
+	"GetAllMeta",
+	"Delete",
+	"DeleteMultiple",
+	"Abort",
+	"GetChildrenTypeInfo",
+	"GetTypeInfo",
+	"SetMeta",
+	"GetMeta",
+	"GetVersion"
+};
+
+const gchar *provman_task_get_name(provman_task_type type)
+{
+	return g_provman_task_names[type];
+}
+
 void provman_task_new(provman_task_type type, GDBusMethodInvocation *invocation,
 		      provman_task **task)
 {
@@ -55,6 +86,8 @@ void provman_task_new(provman_task_type type, GDBusMethodInvocation *invocation,
 
 	new_task->type = type;
 	new_task->invocation = invocation;
+	new_task->queued = g_get_monotonic_time();
+	new_task->started = new_task->queued;
 
 	*task = new_task;
 }
@@ -72,6 +105,7 @@ void provman_task_delete(provman_task *task)
 				task->invocation,
 				PROVMAN_DBUS_ERR_DIED, "");
 		g_free(task->imsi);
+		PROVMAN_TRACE_END(task->trace_id, PROVMAN_ERR_CANCELLED);
 		g_free(task);
 	}
 }
@@ -85,6 +119,10 @@ static void prv_task_failed(int result, provman_task_context_t *task_context)
 			task_context->invocation, provman_err_to_dbus(result),
 			"");
 
+	provman_stats_record(task_context->type, task_context->queued,
+			     task_context->started, result);
+	PROVMAN_TRACE_END(task_context->trace_id, result);
+
 	g_free(task_context);
 }
 
@@ -104,6 +142,11 @@ static void prv_task_finished(int result, void *user_data)
 				provman_err_to_dbus(result), "");
 		}
 	}
+
+	provman_stats_record(task_context->type, task_context->queued,
+			     task_context->started, result);
+	PROVMAN_TRACE_END(task_context->trace_id, result);
+
 	task_context->finished(result, task_context->finished_data);
 
 	g_free(task_context);
@@ -128,6 +171,10 @@ static void prv_value_task_finished(int result, gchar *value, void *user_data)
 		}
 	}
 
+	provman_stats_record(task_context->type, task_context->queued,
+			     task_context->started, result);
+	PROVMAN_TRACE_END(task_context->trace_id, result);
+
 	task_context->finished(result, task_context->finished_data);
 
 	g_free(task_context);
@@ -153,6 +200,10 @@ static void prv_variant_task_finished(const char * type, int result,
 		}
 	}
 
+	provman_stats_record(task_context->type, task_context->queued,
+			     task_context->started, result);
+	PROVMAN_TRACE_END(task_context->trace_id, result);
+
 	task_context->finished(result, task_context->finished_data);
 
 	g_free(task_context);
@@ -184,7 +235,12 @@ static void prv_variant_s_task_finished(int result, GVariant *values,
 
 void provman_task_sync_in(plugin_manager_t *plugin_manager, provman_task *task)
 {
-	(void) plugin_manager_sync_in(plugin_manager, task->imsi);
+	int err;
+
+	err = plugin_manager_sync_in(plugin_manager, task->imsi);
+
+	provman_stats_record(task->type, task->queued, task->started, err);
+	PROVMAN_TRACE_END(task->trace_id, err);
 }
 
 bool provman_task_async_cancel(plugin_manager_t *plugin_manager)
@@ -201,6 +257,11 @@ static void prv_provman_task_context_new(provman_task *task,
 	tc->finished = finished;
 	tc->finished_data = finished_data;
 	tc->invocation = task->invocation;
+	tc->type = task->type;
+	tc->queued = task->queued;
+	tc->started = task->started;
+	tc->trace_id = task->trace_id;
+	task->trace_id = 0;
 	*task_context = tc;
 }
 
@@ -501,6 +562,9 @@ void provman_task_abort(plugin_manager_t *plugin_manager, provman_task *task)
 			task->invocation, provman_err_to_dbus(err), "");
 
 	task->invocation = NULL;
+
+	provman_stats_record(task->type, task->queued, task->started, err);
+	PROVMAN_TRACE_END(task->trace_id, err);
 }
 
 void provman_task_get_children_type_info(plugin_manager_t *manager,
@@ -523,6 +587,9 @@ void provman_task_get_children_type_info(plugin_manager_t *manager,
 			task->invocation, provman_err_to_dbus(err), "");
 
 	task->invocation = NULL;
+
+	provman_stats_record(task->type, task->queued, task->started, err);
+	PROVMAN_TRACE_END(task->trace_id, err);
 }
 
 void provman_task_get_type_info(plugin_manager_t *manager,
@@ -546,6 +613,9 @@ void provman_task_get_type_info(plugin_manager_t *manager,
 			task->invocation, provman_err_to_dbus(err), "");
 
 	task->invocation = NULL;
+
+	provman_stats_record(task->type, task->queued, task->started, err);
+	PROVMAN_TRACE_END(task->trace_id, err);
 }
 
 bool provman_task_set_meta(plugin_manager_t *manager, provman_task *task,
@@ -612,5 +682,9 @@ void provman_task_get_version(plugin_manager_t *manager, provman_task *task)
 					      g_variant_new("(s)",
 							    PACKAGE_VERSION));
 	task->invocation = NULL;
+
+	provman_stats_record(task->type, task->queued, task->started,
+			     PROVMAN_ERR_NONE);
+	PROVMAN_TRACE_END(task->trace_id, PROVMAN_ERR_NONE);
 }
 
@@ -54,7 +54,8 @@ enum provman_task_type_ {
 	PROVMAN_TASK_GET_TYPE_INFO,
 	PROVMAN_TASK_SET_META,
 	PROVMAN_TASK_GET_META,
-	PROVMAN_TASK_GET_VERSION
+	PROVMAN_TASK_GET_VERSION,
+	PROVMAN_TASK_MAX
 };
 
 typedef enum provman_task_type_ provman_task_type;
@@ -68,6 +69,9 @@ struct provman_task_ {
 	gchar *value;
 	gchar *prop;
 	GVariant *variant;
+	gint64 queued;
+	gint64 started;
+	guint trace_id;
 };
 
 typedef void (*provman_task_sync_cb)(
@@ -79,6 +83,7 @@ typedef void (*provman_task_sync_out_cb)(
 void provman_task_new(provman_task_type type, GDBusMethodInvocation *invocation,
 		      provman_task **task);
 void provman_task_delete(provman_task *task);
+const gchar *provman_task_get_name(provman_task_type type);
 
 void provman_task_sync_in(plugin_manager_t *plugin_manager, provman_task *task);
 bool provman_task_set(plugin_manager_t *manager, provman_task *task,
@@ -270,3 +270,33 @@ const gchar g_provman_test_schema[] =
 	"  </dir>"
 	"</schema>";
 #endif
+
+#ifdef PROVMAN_SYNTHETIC_PLUGIN
+
+/* Each account in the synthetic plugin's schemas has 100 string properties,
+   p00 to p99. */
+
+#define SYNTHETIC_KEY(n) "<key name='p" n "' delete='yes' type='string'/>"
+#define SYNTHETIC_KEYS(d) SYNTHETIC_KEY(d "0") SYNTHETIC_KEY(d "1") \
+	SYNTHETIC_KEY(d "2") SYNTHETIC_KEY(d "3") SYNTHETIC_KEY(d "4") \
+	SYNTHETIC_KEY(d "5") SYNTHETIC_KEY(d "6") SYNTHETIC_KEY(d "7") \
+	SYNTHETIC_KEY(d "8") SYNTHETIC_KEY(d "9")
+#define SYNTHETIC_SCHEMA(root)						\
+	"<schema root='" root "'>"					\
+	"  <dir delete='yes'>"						\
+	SYNTHETIC_KEYS("0") SYNTHETIC_KEYS("1") SYNTHETIC_KEYS("2")	\
+	SYNTHETIC_KEYS("3") SYNTHETIC_KEYS("4") SYNTHETIC_KEYS("5")	\
+	SYNTHETIC_KEYS("6") SYNTHETIC_KEYS("7") SYNTHETIC_KEYS("8")	\
+	SYNTHETIC_KEYS("9")						\
+	"  </dir>"							\
+	"</schema>"
+
+const gchar g_provman_synthetic_schema0[] =
+	SYNTHETIC_SCHEMA("/applications/synthetic0/");
+const gchar g_provman_synthetic_schema1[] =
+	SYNTHETIC_SCHEMA("/applications/synthetic1/");
+const gchar g_provman_synthetic_schema2[] =
+	SYNTHETIC_SCHEMA("/applications/synthetic2/");
+const gchar g_provman_synthetic_schema3[] =
+	SYNTHETIC_SCHEMA("/applications/synthetic3/");
+#endif
@@ -33,5 +33,9 @@
 #define PROVMAN_TEST_SCHEMAS_H
 
 extern const gchar g_provman_test_schema[];
+extern const gchar g_provman_synthetic_schema0[];
+extern const gchar g_provman_synthetic_schema1[];
+extern const gchar g_provman_synthetic_schema2[];
+extern const gchar g_provman_synthetic_schema3[];
 
 #endif
@@ -0,0 +1,206 @@
+/*
+ * Provman
+ *
+ * Copyright (C) 2011 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+
+/*!
+ * @file trace.c
+ *
+ * @brief contains functions for recording a timeline of provman's activity
+ *
+ *****************************************************************************/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "utils.h"
+#include "trace.h"
+
+typedef struct provman_trace_span_t_ provman_trace_span_t;
+struct provman_trace_span_t_ {
+	const char *category;
+	gchar *name;
+	gchar *detail;
+	gint64 start;
+};
+
+bool g_provman_trace_enabled;
+
+static FILE *g_trace_file;
+static bool g_trace_first_event;
+static GHashTable *g_trace_spans;
+static guint g_trace_next_id = 1;
+
+/* Each category is written to its own track so that overlapping spans in
+   one category do not obscure the spans of the others.  Within a track
+   the viewer nests spans by time. */
+
+static unsigned int prv_category_track(const char *category)
+{
+	if (!strcmp(category, PROVMAN_TRACE_CAT_TASK))
+		return 1;
+	else if (!strcmp(category, PROVMAN_TRACE_CAT_PLUGIN))
+		return 2;
+
+	return 3;
+}
+
+static void prv_free_span(gpointer data)
+{
+	provman_trace_span_t *span = data;
+
+	g_free(span->name);
+	g_free(span->detail);
+	g_slice_free(provman_trace_span_t, span);
+}
+
+static void prv_write_string(const char *str)
+{
+	fputc('"', g_trace_file);
+	for (; *str; ++str) {
+		if (*str == '"' || *str == '\\')
+			fprintf(g_trace_file, "\\%c", *str);
+		else if ((unsigned char) *str < 0x20)
+			fprintf(g_trace_file, "\\u%04x", (unsigned char) *str);
+		else
+			fputc(*str, g_trace_file);
+	}
+	fputc('"', g_trace_file);
+}
+
+static void prv_write_event_start(const char *category, const char *name,
+				  const char *phase, gint64 ts)
+{
+	fputs(g_trace_first_event ? "\n" : ",\n", g_trace_file);
+	g_trace_first_event = false;
+
+	fputs("{\"name\":", g_trace_file);
+	prv_write_string(name);
+	fprintf(g_trace_file, ",\"cat\":\"%s\",\"ph\":\"%s\",\"ts\":%"
+		G_GINT64_FORMAT ",\"pid\":%d,\"tid\":%u", category, phase, ts,
+		(int) getpid(), prv_category_track(category));
+}
+
+int provman_trace_open(const char *trace_file_name)
+{
+	int ret_val = PROVMAN_ERR_NONE;
+
+	if (!g_trace_file) {
+		if (!trace_file_name) {
+			ret_val = PROVMAN_ERR_OPEN;
+			goto on_error;
+		}
+
+		ret_val = provman_utils_create_private_file(trace_file_name,
+							    &g_trace_file);
+		if (ret_val != PROVMAN_ERR_NONE)
+			goto on_error;
+
+		fputs("[", g_trace_file);
+		g_trace_first_event = true;
+		g_trace_spans = g_hash_table_new_full(g_direct_hash,
+						      g_direct_equal, NULL,
+						      prv_free_span);
+		g_provman_trace_enabled = true;
+	}
+
+on_error:
+
+	return ret_val;
+}
+
+void provman_trace_close(void)
+{
+	g_provman_trace_enabled = false;
+
+	if (g_trace_file) {
+		fputs("\n]\n", g_trace_file);
+		fclose(g_trace_file);
+		g_trace_file = NULL;
+		g_hash_table_unref(g_trace_spans);
+		g_trace_spans = NULL;
+	}
+}
+
+guint provman_trace_begin(const char *category, const char *name,
+			  const char *detail)
+{
+	provman_trace_span_t *span;
+	guint id;
+
+	if (!g_trace_file)
+		return 0;
+
+	id = g_trace_next_id++;
+	if (g_trace_next_id == 0)
+		g_trace_next_id = 1;
+
+	span = g_slice_new(provman_trace_span_t);
+	span->category = category;
+	span->name = g_strdup(name);
+	span->detail = g_strdup(detail);
+	span->start = g_get_monotonic_time();
+	g_hash_table_insert(g_trace_spans, GUINT_TO_POINTER(id), span);
+
+	return id;
+}
+
+void provman_trace_end(guint id, int result)
+{
+	provman_trace_span_t *span;
+
+	/* Spans that were opened before tracing was last switched off are
+	   silently dropped. */
+
+	if (!g_trace_file)
+		return;
+
+	span = g_hash_table_lookup(g_trace_spans, GUINT_TO_POINTER(id));
+	if (!span)
+		return;
+
+	prv_write_event_start(span->category, span->name, "X", span->start);
+	fprintf(g_trace_file, ",\"dur\":%" G_GINT64_FORMAT
+		",\"args\":{\"result\":%d",
+		g_get_monotonic_time() - span->start, result);
+	if (span->detail) {
+		fputs(",\"detail\":", g_trace_file);
+		prv_write_string(span->detail);
+	}
+	fputs("}}", g_trace_file);
+
+	(void) g_hash_table_remove(g_trace_spans, GUINT_TO_POINTER(id));
+}
+
+void provman_trace_instant(const char *category, const char *name)
+{
+	if (!g_trace_file)
+		return;
+
+	prv_write_event_start(category, name, "i", g_get_monotonic_time());
+	fputs(",\"s\":\"t\"}", g_trace_file);
+}
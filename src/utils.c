@@ -30,7 +30,10 @@
  *****************************************************************************/
 #include "config.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <glib.h>
 
@@ -80,6 +83,16 @@ on_error:
 	return err;
 }
 
+bool provman_utils_key_in_subtree(const char *key, const char *root)
+{
+	size_t len = strlen(root);
+
+	while (len > 0 && root[len - 1] == '/')
+		--len;
+
+	return !strncmp(key, root, len) && (!key[len] || key[len] == '/');
+}
+
 int provman_utils_make_file_path(const char* fname, bool system, gchar **path)
 {
 	int err = PROVMAN_ERR_NONE;
@@ -112,6 +125,33 @@ on_error:
 	return err;
 }
 
+int provman_utils_create_private_file(const char *path, FILE **file)
+{
+	int err = PROVMAN_ERR_NONE;
+	int fd;
+
+	if (unlink(path) == -1 && errno != ENOENT) {
+		err = PROVMAN_ERR_OPEN;
+		goto on_error;
+	}
+
+	fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+	if (fd == -1) {
+		err = PROVMAN_ERR_OPEN;
+		goto on_error;
+	}
+
+	*file = fdopen(fd, "wb");
+	if (!*file) {
+		(void) close(fd);
+		err = PROVMAN_ERR_OPEN;
+	}
+
+on_error:
+
+	return err;
+}
+
 gchar *provman_utils_get_context_from_key(const gchar *key, const char *root,
 					  unsigned int root_len)
 {